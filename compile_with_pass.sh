@@ -16,9 +16,7 @@ if [ ! -f "$PASS_PATH" ]; then
   exit 1
 fi
 
-# Compile and run pipeline in one go
-clang -O0 -S -emit-llvm "$SRC" -o - | \
-  opt -load-pass-plugin "$PASS_PATH" -passes=zippy -S | \
-  clang -O3 -x ir -o "${SRC%.c}" -
+# Compile with the pass running as part of the default pipeline
+clang -O3 -fpass-plugin="$PASS_PATH" "$SRC" -o "${SRC%.c}"
 
 echo "Compiled ${SRC} with ZippyPass to ${SRC%.c}"
\ No newline at end of file
@@ -0,0 +1,450 @@
+/**
+ * zippy_rt.c
+ *
+ * See `zippy_rt.h` for the overview, this file only contains the plumbing.
+ */
+#include "zippy_rt.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ZIPPY_RT_CACHE_LINE 64
+#define ZIPPY_RT_DEFAULT_OUTPUT "zippy.profile"
+#define ZIPPY_RT_DEFAULT_TRACE_OUTPUT "zippy.trace"
+#define ZIPPY_RT_DEFAULT_TRACE_EVENTS 65536
+#define ZIPPY_RT_DEFAULT_TRACE_PERIOD 16
+
+// Counters per cache line, blocks always grow in whole cache lines
+#define ZIPPY_RT_LINE_COUNTERS (ZIPPY_RT_CACHE_LINE / sizeof(uint64_t))
+
+typedef struct {
+    char *name;
+    uint32_t nameLength;
+    uint32_t numFields;
+    uint32_t base;
+    uint32_t allocSize;
+    zippy_rt_field_layout *fields;
+} zippy_rt_struct;
+
+/**
+ * Per-thread counters, the header is padded to a full cache line so that the counters of two threads never share one.
+ */
+typedef struct zippy_rt_block {
+    struct zippy_rt_block *prev;
+    struct zippy_rt_block *next;
+    uint32_t capacity;
+    _Alignas(ZIPPY_RT_CACHE_LINE) uint64_t counters[];
+} zippy_rt_block;
+
+typedef struct {
+    uint64_t object;
+    uint32_t base;
+    uint32_t field;
+} zippy_rt_window_entry;
+
+/**
+ * Per-thread sampled trace, only the most recent `mask + 1` samples are kept.
+ */
+typedef struct zippy_rt_ring {
+    struct zippy_rt_ring *next;
+    uint32_t thread;
+    uint32_t countdown;
+    uint64_t head;
+    uint64_t mask;
+    zippy_rt_trace_event events[];
+} zippy_rt_ring;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t blockKey;
+
+// Registered structs, guarded by `lock`
+static zippy_rt_struct *structs = NULL;
+static uint32_t numStructs = 0;
+static uint32_t numCounters = 0;
+
+// Live thread blocks and the merged totals of dead ones, guarded by `lock`
+static zippy_rt_block *liveBlocks = NULL;
+static uint64_t *totals = NULL;
+static uint32_t totalsCapacity = 0;
+
+// Trace rings of all threads, dead or alive, guarded by `lock`
+static zippy_rt_ring *rings = NULL;
+static uint32_t numRings = 0;
+static uint32_t tracePeriod = ZIPPY_RT_DEFAULT_TRACE_PERIOD;
+static uint64_t traceEvents = ZIPPY_RT_DEFAULT_TRACE_EVENTS;
+
+static __thread zippy_rt_block *threadBlock = NULL;
+static __thread zippy_rt_ring *threadRing = NULL;
+static __thread zippy_rt_window_entry threadWindow[ZIPPY_RT_COACCESS_WINDOW];
+static __thread uint32_t threadWindowHead = 0;
+
+static void *allocOrDie(const size_t size) {
+    void *ptr = calloc(1, size);
+    if (!ptr) {
+        fputs("zippy_rt: out of memory\n", stderr);
+        abort();
+    }
+    return ptr;
+}
+
+static uint32_t roundToLine(const uint32_t numCounters) {
+    return (numCounters + ZIPPY_RT_LINE_COUNTERS - 1) / ZIPPY_RT_LINE_COUNTERS * ZIPPY_RT_LINE_COUNTERS;
+}
+
+// Must hold `lock`
+static void mergeIntoTotals(const zippy_rt_block *block) {
+    if (block->capacity > totalsCapacity) {
+        uint64_t *newTotals = allocOrDie(block->capacity * sizeof(uint64_t));
+        if (totals) memcpy(newTotals, totals, totalsCapacity * sizeof(uint64_t));
+        free(totals);
+        totals = newTotals;
+        totalsCapacity = block->capacity;
+    }
+    for (uint32_t i = 0; i < block->capacity; i++) {
+        totals[i] += block->counters[i];
+    }
+}
+
+// Must hold `lock`
+static void unlinkBlock(zippy_rt_block *block) {
+    if (block->prev) block->prev->next = block->next;
+    else liveBlocks = block->next;
+    if (block->next) block->next->prev = block->prev;
+}
+
+// Must hold `lock`
+static void linkBlock(zippy_rt_block *block) {
+    block->prev = NULL;
+    block->next = liveBlocks;
+    if (liveBlocks) liveBlocks->prev = block;
+    liveBlocks = block;
+}
+
+static void onThreadExit(void *ptr) {
+    zippy_rt_block *block = ptr;
+    pthread_mutex_lock(&lock);
+    unlinkBlock(block);
+    mergeIntoTotals(block);
+    pthread_mutex_unlock(&lock);
+    threadBlock = NULL;
+    free(block);
+}
+
+static char *resolveOutputPath(const char *envName, const char *defaultPath) {
+    const char *pattern = getenv(envName);
+    if (!pattern || !*pattern) pattern = defaultPath;
+
+    char pid[32];
+    const int pidLength = snprintf(pid, sizeof(pid), "%ld", (long) getpid());
+    char *path = allocOrDie(strlen(pattern) * (size_t) pidLength + 1);
+    char *out = path;
+    for (const char *in = pattern; *in; in++) {
+        if (in[0] == '%' && in[1] == 'p') {
+            memcpy(out, pid, pidLength);
+            out += pidLength;
+            in++;
+            continue;
+        }
+        *out++ = *in;
+    }
+    *out = '\0';
+    return path;
+}
+
+static size_t padTo8(const size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static void writeFile(const char *envName, const char *defaultPath, const char *buffer, const size_t size) {
+    char *path = resolveOutputPath(envName, defaultPath);
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "zippy_rt: failed to open '%s'\n", path);
+    } else {
+        // Only loops on a short write, which regular files practically never do
+        for (size_t written = 0; written < size;) {
+            const ssize_t result = write(fd, buffer + written, size - written);
+            if (result <= 0) {
+                fprintf(stderr, "zippy_rt: failed to write '%s'\n", path);
+                break;
+            }
+            written += (size_t) result;
+        }
+        close(fd);
+    }
+    free(path);
+}
+
+// Must hold `lock`, serializes everything into a single buffer so the file is written with one `write`
+static void writeProfile(void) {
+    size_t size = sizeof(zippy_rt_profile_header);
+    for (uint32_t i = 0; i < numStructs; i++) {
+        size += sizeof(zippy_rt_profile_struct_header);
+        size += padTo8(structs[i].nameLength);
+        size += (structs[i].numFields + structs[i].numFields * structs[i].numFields) * sizeof(uint64_t);
+    }
+
+    char *buffer = allocOrDie(size);
+    char *out = buffer;
+
+    zippy_rt_profile_header header;
+    memcpy(header.magic, ZIPPY_RT_PROFILE_MAGIC, ZIPPY_RT_PROFILE_MAGIC_SIZE);
+    header.version = ZIPPY_RT_PROFILE_VERSION;
+    header.numStructs = numStructs;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    for (uint32_t i = 0; i < numStructs; i++) {
+        const zippy_rt_struct *entry = &structs[i];
+        zippy_rt_profile_struct_header structHeader;
+        structHeader.nameLength = entry->nameLength;
+        structHeader.numFields = entry->numFields;
+        memcpy(out, &structHeader, sizeof(structHeader));
+        out += sizeof(structHeader);
+
+        memcpy(out, entry->name, entry->nameLength);
+        out += padTo8(entry->nameLength);
+
+        // Counts and the co-access matrix are adjacent in the counter space, so they are written in one sweep
+        const uint32_t numEntryCounters = entry->numFields + entry->numFields * entry->numFields;
+        for (uint32_t i = 0; i < numEntryCounters; i++) {
+            const uint32_t index = entry->base + i;
+            const uint64_t count = index < totalsCapacity ? totals[index] : 0;
+            memcpy(out, &count, sizeof(count));
+            out += sizeof(count);
+        }
+    }
+
+    writeFile("ZIPPY_RT_OUTPUT", ZIPPY_RT_DEFAULT_OUTPUT, buffer, size);
+    free(buffer);
+}
+
+static uint64_t numRingEvents(const zippy_rt_ring *ring) {
+    return ring->head <= ring->mask ? ring->head : ring->mask + 1;
+}
+
+// Must hold `lock`, same single buffer approach as the profile
+static void writeTrace(void) {
+    uint64_t numEvents = 0;
+    for (const zippy_rt_ring *ring = rings; ring; ring = ring->next) {
+        numEvents += numRingEvents(ring);
+    }
+
+    size_t size = sizeof(zippy_rt_trace_header);
+    for (uint32_t i = 0; i < numStructs; i++) {
+        size += sizeof(zippy_rt_trace_struct_header);
+        size += padTo8(structs[i].nameLength);
+        size += structs[i].numFields * sizeof(zippy_rt_field_layout);
+    }
+    size = padTo8(size);
+    size += numEvents * sizeof(zippy_rt_trace_event);
+
+    char *buffer = allocOrDie(size);
+    char *out = buffer;
+
+    zippy_rt_trace_header header;
+    memcpy(header.magic, ZIPPY_RT_TRACE_MAGIC, ZIPPY_RT_PROFILE_MAGIC_SIZE);
+    header.version = ZIPPY_RT_TRACE_VERSION;
+    header.numStructs = numStructs;
+    header.numEvents = numEvents;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    for (uint32_t i = 0; i < numStructs; i++) {
+        const zippy_rt_struct *entry = &structs[i];
+        zippy_rt_trace_struct_header structHeader;
+        structHeader.nameLength = entry->nameLength;
+        structHeader.numFields = entry->numFields;
+        structHeader.base = entry->base;
+        structHeader.allocSize = entry->allocSize;
+        memcpy(out, &structHeader, sizeof(structHeader));
+        out += sizeof(structHeader);
+
+        memcpy(out, entry->name, entry->nameLength);
+        out += padTo8(entry->nameLength);
+
+        memcpy(out, entry->fields, entry->numFields * sizeof(zippy_rt_field_layout));
+        out += entry->numFields * sizeof(zippy_rt_field_layout);
+    }
+    out = buffer + padTo8((size_t) (out - buffer));
+
+    for (const zippy_rt_ring *ring = rings; ring; ring = ring->next) {
+        // Once wrapped, the oldest event sits right at the head
+        const uint64_t count = numRingEvents(ring);
+        const uint64_t first = ring->head - count;
+        for (uint64_t i = 0; i < count; i++) {
+            memcpy(out, &ring->events[(first + i) & ring->mask], sizeof(zippy_rt_trace_event));
+            out += sizeof(zippy_rt_trace_event);
+        }
+    }
+
+    writeFile("ZIPPY_RT_TRACE_OUTPUT", ZIPPY_RT_DEFAULT_TRACE_OUTPUT, buffer, size);
+    free(buffer);
+}
+
+static void onProcessExit(void) {
+    pthread_mutex_lock(&lock);
+    // Threads still running at this point (including main) never hit their destructor, so merge them here.
+    // Their counters are read without synchronisation, which can only lose the last few increments.
+    for (zippy_rt_block *block = liveBlocks; block; block = block->next) {
+        mergeIntoTotals(block);
+        memset(block->counters, 0, block->capacity * sizeof(uint64_t));
+    }
+    writeProfile();
+    if (rings) writeTrace();
+    pthread_mutex_unlock(&lock);
+}
+
+static uint64_t readEnvNumber(const char *envName, const uint64_t defaultValue) {
+    const char *value = getenv(envName);
+    if (!value || !*value) return defaultValue;
+    const unsigned long long number = strtoull(value, NULL, 10);
+    return number > 0 ? number : defaultValue;
+}
+
+static void initRuntime(void) {
+    tracePeriod = (uint32_t) readEnvNumber("ZIPPY_RT_TRACE_PERIOD", ZIPPY_RT_DEFAULT_TRACE_PERIOD);
+    // Rounded up to a power of two, so the ring index is a mask instead of a division
+    const uint64_t events = readEnvNumber("ZIPPY_RT_TRACE_EVENTS", ZIPPY_RT_DEFAULT_TRACE_EVENTS);
+    traceEvents = 1;
+    while (traceEvents < events) traceEvents <<= 1;
+
+    pthread_key_create(&blockKey, onThreadExit);
+    atexit(onProcessExit);
+}
+
+/**
+ * Slow path, creates or grows the block of the calling thread so that `index` fits.
+ */
+static zippy_rt_block *acquireBlock(const uint32_t index) {
+    pthread_once(&initOnce, initRuntime);
+
+    pthread_mutex_lock(&lock);
+    uint32_t capacity = roundToLine(numCounters > index ? numCounters : index + 1);
+    zippy_rt_block *block = aligned_alloc(ZIPPY_RT_CACHE_LINE,
+                                          sizeof(zippy_rt_block) + capacity * sizeof(uint64_t));
+    if (!block) {
+        fputs("zippy_rt: out of memory\n", stderr);
+        abort();
+    }
+    memset(block, 0, sizeof(zippy_rt_block) + capacity * sizeof(uint64_t));
+    block->capacity = capacity;
+
+    zippy_rt_block *oldBlock = threadBlock;
+    if (oldBlock) {
+        memcpy(block->counters, oldBlock->counters, oldBlock->capacity * sizeof(uint64_t));
+        unlinkBlock(oldBlock);
+    }
+    linkBlock(block);
+    pthread_mutex_unlock(&lock);
+
+    free(oldBlock);
+    threadBlock = block;
+    pthread_setspecific(blockKey, block);
+    return block;
+}
+
+/**
+ * Slow path, creates the trace ring of the calling thread. Rings outlive their thread, so they are never freed.
+ */
+static zippy_rt_ring *acquireRing(void) {
+    pthread_once(&initOnce, initRuntime);
+
+    zippy_rt_ring *ring = allocOrDie(sizeof(zippy_rt_ring) + traceEvents * sizeof(zippy_rt_trace_event));
+    ring->countdown = tracePeriod;
+    ring->mask = traceEvents - 1;
+
+    pthread_mutex_lock(&lock);
+    ring->thread = numRings++;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&lock);
+
+    threadRing = ring;
+    return ring;
+}
+
+uint32_t __zippy_rt_register_struct(const char *name, const uint32_t numFields, const uint32_t allocSize,
+                                    const zippy_rt_field_layout *fields) {
+    pthread_once(&initOnce, initRuntime);
+
+    pthread_mutex_lock(&lock);
+    const size_t nameLength = strlen(name);
+    for (uint32_t i = 0; i < numStructs; i++) {
+        if (structs[i].nameLength != nameLength || memcmp(structs[i].name, name, nameLength) != 0) continue;
+        if (structs[i].numFields != numFields) {
+            fprintf(stderr, "zippy_rt: struct '%s' registered with [%u] and [%u] fields\n",
+                    name, structs[i].numFields, numFields);
+            abort();
+        }
+        const uint32_t base = structs[i].base;
+        pthread_mutex_unlock(&lock);
+        return base;
+    }
+
+    zippy_rt_struct *newStructs = realloc(structs, (numStructs + 1) * sizeof(zippy_rt_struct));
+    if (!newStructs) {
+        fputs("zippy_rt: out of memory\n", stderr);
+        abort();
+    }
+    structs = newStructs;
+
+    zippy_rt_struct *entry = &structs[numStructs++];
+    entry->name = allocOrDie(nameLength + 1);
+    memcpy(entry->name, name, nameLength);
+    entry->nameLength = (uint32_t) nameLength;
+    entry->numFields = numFields;
+    entry->base = numCounters;
+    entry->allocSize = allocSize;
+    entry->fields = allocOrDie(numFields * sizeof(zippy_rt_field_layout) + 1);
+    memcpy(entry->fields, fields, numFields * sizeof(zippy_rt_field_layout));
+    // Each struct owns its access counters, followed by its co-access matrix
+    numCounters += numFields + numFields * numFields;
+
+    const uint32_t base = entry->base;
+    pthread_mutex_unlock(&lock);
+    return base;
+}
+
+void __zippy_rt_count(const uint32_t base, const uint32_t field, const uint32_t numFields, const void *object) {
+    zippy_rt_block *block = threadBlock;
+    const uint32_t lastIndex = base + numFields + numFields * numFields - 1;
+    if (__builtin_expect(!block || lastIndex >= block->capacity, 0))
+        block = acquireBlock(lastIndex);
+    block->counters[base + field]++;
+
+    // Pair up with recent accesses to other fields of the same object
+    uint64_t *matrix = &block->counters[base + numFields];
+    const uint64_t objectAddress = (uint64_t) (uintptr_t) object;
+    for (uint32_t i = 0; i < ZIPPY_RT_COACCESS_WINDOW; i++) {
+        const zippy_rt_window_entry *entry = &threadWindow[i];
+        if (entry->object != objectAddress || entry->base != base || entry->field == field) continue;
+        matrix[entry->field * numFields + field]++;
+        matrix[field * numFields + entry->field]++;
+    }
+
+    zippy_rt_window_entry *slot = &threadWindow[threadWindowHead++ % ZIPPY_RT_COACCESS_WINDOW];
+    slot->object = objectAddress;
+    slot->base = base;
+    slot->field = field;
+}
+
+void __zippy_rt_trace(const uint32_t base, const uint32_t field, const uint32_t numFields, const void *object) {
+    __zippy_rt_count(base, field, numFields, object);
+
+    zippy_rt_ring *ring = threadRing;
+    if (__builtin_expect(!ring, 0))
+        ring = acquireRing();
+    if (--ring->countdown != 0) return;
+    ring->countdown = tracePeriod;
+
+    zippy_rt_trace_event *event = &ring->events[ring->head++ & ring->mask];
+    event->index = base + field;
+    event->thread = ring->thread;
+    event->object = (uint64_t) (uintptr_t) object;
+}
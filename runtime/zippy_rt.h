@@ -0,0 +1,118 @@
+/**
+ * zippy_rt.h
+ *
+ * Runtime support for builds instrumented with `-passes=zippy-instrument`.
+ *
+ * Every thread counts field accesses into its own cache-line padded counter block, so the hot path is a plain
+ * increment with no atomics and no sharing. Blocks are merged into the process totals when a thread exits, and
+ * once more for any live threads when the process exits, at which point the profile is written in one go.
+ *
+ * Alongside the counts, every thread remembers its last `ZIPPY_RT_COACCESS_WINDOW` accesses. An access to a field of
+ * the same object as one in that window counts as a co-access of the two fields, which is kept per struct type as a
+ * symmetric matrix.
+ *
+ * The output path is taken from `ZIPPY_RT_OUTPUT` (default `zippy.profile`), any `%p` is replaced by the pid.
+ *
+ * Builds instrumented with `-zippy-instrument-mode=trace` also record a sampled address trace, every thread keeps the
+ * last `ZIPPY_RT_TRACE_EVENTS` (default 65536, rounded up to a power of two) of every `ZIPPY_RT_TRACE_PERIOD`-th
+ * (default 16) field access in a ring buffer. The trace is written to `ZIPPY_RT_TRACE_OUTPUT` (default `zippy.trace`),
+ * to be replayed by `zippy-cachesim`.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Profile file layout, all integers are in host byte order:
+ *
+ * - `zippy_rt_profile_header`
+ * - `numStructs` times:
+ *     - `zippy_rt_profile_struct_header`
+ *     - `nameLength` bytes of struct name, zero padded to a multiple of 8
+ *     - `numFields` uint64_t access counters, indexed by the original field index
+ *     - `numFields * numFields` uint64_t co-access counters, row major and symmetric, with a zero diagonal
+ */
+#define ZIPPY_RT_PROFILE_MAGIC "ZIPPYPRF"
+#define ZIPPY_RT_PROFILE_MAGIC_SIZE 8
+#define ZIPPY_RT_PROFILE_VERSION 2
+#define ZIPPY_RT_COACCESS_WINDOW 8
+
+typedef struct {
+    char magic[ZIPPY_RT_PROFILE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t numStructs;
+} zippy_rt_profile_header;
+
+typedef struct {
+    uint32_t nameLength;
+    uint32_t numFields;
+} zippy_rt_profile_struct_header;
+
+/**
+ * Trace file layout, all integers are in host byte order:
+ *
+ * - `zippy_rt_trace_header`
+ * - `numStructs` times:
+ *     - `zippy_rt_trace_struct_header`
+ *     - `nameLength` bytes of struct name, zero padded to a multiple of 8
+ *     - `numFields` `zippy_rt_field_layout` entries, describing the original layout
+ * - `numEvents` `zippy_rt_trace_event` entries, in order per thread
+ */
+#define ZIPPY_RT_TRACE_MAGIC "ZIPPYTRC"
+#define ZIPPY_RT_TRACE_VERSION 1
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t align;
+} zippy_rt_field_layout;
+
+typedef struct {
+    char magic[ZIPPY_RT_PROFILE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t numStructs;
+    uint64_t numEvents;
+} zippy_rt_trace_header;
+
+typedef struct {
+    uint32_t nameLength;
+    uint32_t numFields;
+    uint32_t base;
+    uint32_t allocSize;
+} zippy_rt_trace_struct_header;
+
+typedef struct {
+    // Counter index, which is the struct base plus the field index
+    uint32_t index;
+    // Sequential id of the recording thread
+    uint32_t thread;
+    uint64_t object;
+} zippy_rt_trace_event;
+
+/**
+ * Registers a struct type by its IR name (eg: `struct.Foo`), returning the base index of its counters.
+ *
+ * The `numFields` entries in `fields` describe the original layout, and are copied.
+ *
+ * Registering the same name twice, such as from two translation units, returns the same base.
+ */
+uint32_t __zippy_rt_register_struct(const char *name, uint32_t numFields, uint32_t allocSize,
+                                    const zippy_rt_field_layout *fields);
+
+/**
+ * Counts one access of field `field` of `object`, whose struct of `numFields` fields was registered at `base`.
+ */
+void __zippy_rt_count(uint32_t base, uint32_t field, uint32_t numFields, const void *object);
+
+/**
+ * Counts one access like `__zippy_rt_count`, and samples it into the address trace of the calling thread.
+ */
+void __zippy_rt_trace(uint32_t base, uint32_t field, uint32_t numFields, const void *object);
+
+#ifdef __cplusplus
+}
+#endif
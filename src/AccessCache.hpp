@@ -0,0 +1,282 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "GetElementPtrRef.hpp"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/xxhash.h>
+
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+
+namespace Zippy {
+    /**
+     * What the field weights and affinity take from one function besides its refs: the loop depth of every field use,
+     * the fields used within the same basic block, and the loop depth of every call site. Only these need the loops of
+     * the function, the refs themselves are rescanned on every build.
+     */
+    struct FunctionAccess {
+        struct StructAccess {
+            // Number of uses per field index and loop depth within the function
+            std::map<std::pair<unsigned, unsigned>, unsigned> loopUses;
+            // Number of basic blocks using both fields, lower field index first
+            std::map<std::pair<unsigned, unsigned>, unsigned> coAccesses;
+        };
+
+        struct CallSites {
+            // Deepest loop any of the calls is in
+            unsigned loopDepth = 0;
+            unsigned count = 0;
+        };
+
+        // By struct name, unnamed structs are never laid out
+        std::map<std::string, StructAccess> structAccesses;
+        // By callee name
+        std::map<std::string, CallSites> callSites;
+    };
+
+    /**
+     * Function accesses of a module, cached on disk by a hash of the printed IR of each function, the bodies of the
+     * structs it uses and the data layout, eg:
+     * `0123456789abcdef.zippy-access`. Rebuilds only compute the loops of the functions that changed since, and reuse
+     * the accesses of every other function.
+     *
+     * Without a directory, every function access is computed and nothing is written.
+     */
+    class AccessCache {
+    public:
+        static constexpr const char *MAGIC = "ZIPPY-ACCESS";
+        static constexpr unsigned VERSION = 2;
+        static constexpr const char *EXTENSION = ".zippy-access";
+
+    private:
+        std::string directory;
+        llvm::DenseMap<const llvm::Function*, FunctionAccess> functionAccesses;
+        unsigned numReused = 0;
+
+        static FunctionAccess compute(const llvm::Function &function, const llvm::LoopInfo &loopInfo,
+                                      const llvm::ArrayRef<std::shared_ptr<GetElementPtrRef>> gepRefs) {
+            FunctionAccess functionAccess;
+            // Fields of each struct used per basic block, to pair up afterward
+            std::map<std::string, llvm::DenseMap<const llvm::BasicBlock*, llvm::SmallVector<unsigned, 8>>> blockFields;
+            for (const auto &gepRef: gepRefs) {
+                const auto block = gepRef->getInst()->getParent();
+                const auto loopDepth = loopInfo.getLoopDepth(block);
+                for (const auto &structIndex: gepRef->getStructIndices()) {
+                    if (!structIndex.structType->hasName()) continue;
+                    const auto *fieldIndexOperand = llvm::dyn_cast<llvm::ConstantInt>(
+                        gepRef->getOperand(structIndex.operandIndex));
+                    if (!fieldIndexOperand) continue;
+
+                    const auto name = structIndex.structType->getName().str();
+                    const auto fieldIndex = static_cast<unsigned>(fieldIndexOperand->getZExtValue());
+                    functionAccess.structAccesses[name].loopUses[{fieldIndex, loopDepth}]++;
+                    auto &fields = blockFields[name][block];
+                    if (!llvm::is_contained(fields, fieldIndex)) fields.push_back(fieldIndex);
+                }
+            }
+            for (const auto &[name, blocks]: blockFields) {
+                auto &coAccesses = functionAccess.structAccesses[name].coAccesses;
+                for (const auto &blockEntry: blocks) {
+                    const auto &fields = blockEntry.second;
+                    for (auto i = 0; i < fields.size(); i++) {
+                        for (auto j = i + 1; j < fields.size(); j++) {
+                            coAccesses[std::minmax(fields[i], fields[j])]++;
+                        }
+                    }
+                }
+            }
+
+            for (const auto &inst: llvm::instructions(function)) {
+                const auto callBase = llvm::dyn_cast<llvm::CallBase>(&inst);
+                if (!callBase) continue;
+                const auto callee = callBase->getCalledFunction();
+                // Whether the callee is defined is only checked when the call sites are used, it may change without
+                // this function changing
+                if (!callee || !callee->hasName() || callee->isIntrinsic()) continue;
+                auto &callSites = functionAccess.callSites[callee->getName().str()];
+                callSites.loopDepth = std::max(callSites.loopDepth, loopInfo.getLoopDepth(inst.getParent()));
+                callSites.count++;
+            }
+            return functionAccess;
+        }
+
+        // Splits off the leading number of `text`
+        static bool consumeNumber(llvm::StringRef &text, unsigned &number) {
+            const auto [numberText, rest] = text.split(' ');
+            text = rest;
+            return !numberText.getAsInteger(10, number);
+        }
+
+        /**
+         * Reads `struct <name>` blocks of `use <field> <depth> <count>` and `pair <a> <b> <count>` lines, each closed
+         * by `end`, and `call <depth> <count> <callee>` lines.
+         */
+        static std::optional<FunctionAccess> parse(const llvm::StringRef buffer) {
+            llvm::SmallVector<llvm::StringRef, 64> lines;
+            buffer.split(lines, '\n', -1, false);
+            if (lines.empty()) return std::nullopt;
+            const auto [magic, version] = lines.front().split(' ');
+            unsigned versionNumber;
+            if (magic != MAGIC || version.getAsInteger(10, versionNumber) || versionNumber != VERSION)
+                return std::nullopt;
+
+            FunctionAccess functionAccess;
+            FunctionAccess::StructAccess *current = nullptr;
+            for (const auto line: llvm::drop_begin(lines)) {
+                auto [key, value] = line.split(' ');
+                if (key == "struct") {
+                    if (current || value.empty()) return std::nullopt;
+                    current = &functionAccess.structAccesses[value.str()];
+                } else if (key == "call") {
+                    FunctionAccess::CallSites callSites;
+                    if (current || !consumeNumber(value, callSites.loopDepth) ||
+                        !consumeNumber(value, callSites.count) || value.empty())
+                        return std::nullopt;
+                    functionAccess.callSites[value.str()] = callSites;
+                } else if (!current) {
+                    return std::nullopt;
+                } else if (key == "use" || key == "pair") {
+                    unsigned a, b, count;
+                    if (!consumeNumber(value, a) || !consumeNumber(value, b) || !consumeNumber(value, count) ||
+                        !value.empty())
+                        return std::nullopt;
+                    (key == "use" ? current->loopUses : current->coAccesses)[{a, b}] = count;
+                } else if (key == "end") {
+                    current = nullptr;
+                } else {
+                    return std::nullopt;
+                }
+            }
+            if (current) return std::nullopt;
+            return functionAccess;
+        }
+
+        static void write(llvm::raw_ostream &out, const FunctionAccess &functionAccess) {
+            out << MAGIC << ' ' << VERSION << '\n';
+            for (const auto &[name, structAccess]: functionAccess.structAccesses) {
+                out << "struct " << name << '\n';
+                for (const auto &[use, count]: structAccess.loopUses) {
+                    out << "use " << use.first << ' ' << use.second << ' ' << count << '\n';
+                }
+                for (const auto &[pair, count]: structAccess.coAccesses) {
+                    out << "pair " << pair.first << ' ' << pair.second << ' ' << count << '\n';
+                }
+                out << "end\n";
+            }
+            for (const auto &[callee, callSites]: functionAccess.callSites) {
+                out << "call " << callSites.loopDepth << ' ' << callSites.count << ' ' << callee << '\n';
+            }
+        }
+
+        /**
+         * The printed IR only names the structs it uses, so the bodies of the structs its refs touch and the data
+         * layout are hashed along. A struct gaining a field then changes the key of every function using it. Printed through
+         * a slot tracker shared by the whole module, which would otherwise be rebuilt per function.
+         */
+        static uint64_t hashFunction(const llvm::Function &function, llvm::ModuleSlotTracker &slotTracker,
+                                     const llvm::StringRef dataLayout,
+                                     const llvm::ArrayRef<std::shared_ptr<GetElementPtrRef>> gepRefs) {
+            std::string key;
+            llvm::raw_string_ostream keyStream(key);
+            keyStream << dataLayout << '\n';
+            std::set<llvm::StructType*> structTypes;
+            for (const auto &gepRef: gepRefs) {
+                for (const auto &structIndex: gepRef->getStructIndices()) structTypes.insert(structIndex.structType);
+            }
+            // Sorted by name, not by pointer, for the key to be the same across compiles
+            std::map<std::string, std::string> signatures;
+            for (auto *structType: structTypes) {
+                if (!structType->hasName()) continue;
+                signatures[structType->getName().str()] = StructType{structType}.getSignature();
+            }
+            for (const auto &[name, signature]: signatures) keyStream << name << " = " << signature << '\n';
+            static_cast<const llvm::Value&>(function).print(keyStream, slotTracker);
+            return llvm::xxHash64(keyStream.str());
+        }
+
+        std::string getPath(const uint64_t hash) const {
+            std::string fileName;
+            llvm::raw_string_ostream fileNameStream(fileName);
+            fileNameStream << llvm::format_hex_no_prefix(hash, 16) << EXTENSION;
+            llvm::SmallString<256> path(directory);
+            llvm::sys::path::append(path, fileNameStream.str());
+            return std::string(path);
+        }
+
+        /**
+         * Written under a unique name first and then renamed, so concurrent compiles never read a partial entry.
+         */
+        void store(const uint64_t hash, const FunctionAccess &functionAccess) {
+            const auto path = getPath(hash);
+            int fd;
+            llvm::SmallString<256> tempPath;
+            if (const auto errorCode = llvm::sys::fs::createUniqueFile(path + ".%%%%%%", fd, tempPath)) {
+                llvm::errs() << "Failed to write access cache: " << directory << " - " << errorCode.message()
+                             << ", no longer cached\n";
+                directory.clear();
+                return;
+            }
+            {
+                llvm::raw_fd_ostream out(fd, true);
+                write(out, functionAccess);
+            }
+            if (llvm::sys::fs::rename(tempPath, path)) llvm::sys::fs::remove(tempPath);
+        }
+
+    public:
+        explicit AccessCache(std::string directory): directory(std::move(directory)) {}
+
+        /**
+         * Reuses the cached accesses of every defined function whose IR is unchanged and computes the rest, `gepRefs`
+         * are the refs found in each function.
+         */
+        void collect(llvm::Module &M, llvm::FunctionAnalysisManager &FAM,
+                     const llvm::DenseMap<const llvm::Function*, llvm::ArrayRef<std::shared_ptr<GetElementPtrRef>>>
+                         &gepRefs) {
+            log() << "Collecting Function Accesses\n";
+            if (!directory.empty()) {
+                if (const auto errorCode = llvm::sys::fs::create_directories(directory)) {
+                    llvm::errs() << "Failed to create access cache: " << directory << " - " << errorCode.message()
+                                 << ", not cached\n";
+                    directory.clear();
+                }
+            }
+            std::optional<llvm::ModuleSlotTracker> slotTracker;
+            if (!directory.empty()) slotTracker.emplace(&M);
+
+            for (auto &function: M.functions()) {
+                if (function.isDeclaration()) continue;
+                std::optional<uint64_t> hash;
+                if (!directory.empty()) {
+                    hash = hashFunction(function, *slotTracker, M.getDataLayout().getStringRepresentation(),
+                                        gepRefs.lookup(&function));
+                    if (auto bufferOrErr = llvm::MemoryBuffer::getFile(getPath(*hash))) {
+                        if (auto functionAccess = parse((*bufferOrErr)->getBuffer())) {
+                            functionAccesses[&function] = std::move(*functionAccess);
+                            numReused++;
+                            continue;
+                        }
+                    }
+                }
+                const auto &loopInfo = FAM.getResult<llvm::LoopAnalysis>(function);
+                auto functionAccess = compute(function, loopInfo, gepRefs.lookup(&function));
+                if (hash && !directory.empty()) store(*hash, functionAccess);
+                functionAccesses[&function] = std::move(functionAccess);
+            }
+            log() << llvm::format("Collected [%d] Function Accesses, [%d] from the cache\n\n",
+                                  functionAccesses.size(), numReused);
+        }
+
+        const FunctionAccess *lookup(const llvm::Function *function) const {
+            const auto found = functionAccesses.find(function);
+            return found == functionAccesses.end() ? nullptr : &found->second;
+        }
+    };
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/DebugProgramInstruction.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <optional>
+
+namespace Zippy {
+    /**
+     * Keeps the debug info of reordered structs in sync with their new layout, so debuggers and profilers attribute
+     * accesses to the right fields.
+     *
+     * Each struct is matched to its `DICompositeType` by name, and only if every member sits at the offset of a field
+     * in the initial layout. A new composite type is built with the members at their new offsets and the new size, and
+     * every reference to the old one in the module is pointed at it. Variables split into fragments, eg: by SROA, have
+     * each fragment moved along with the member it describes.
+     */
+    class DebugTypeInfo {
+        llvm::Module &M;
+        const llvm::DataLayout &DL;
+        // Composite types by their name, or the name of a typedef of them
+        llvm::StringMap<llvm::SmallVector<llvm::DICompositeType*, 1>> composites;
+        // Old composite types to their replacements, not movable itself
+        std::unique_ptr<llvm::ValueToValueMapTy> valueMap = std::make_unique<llvm::ValueToValueMapTy>();
+        std::vector<llvm::DICompositeType*> newComposites;
+        // Members of the old composite types to their new offset
+        llvm::DenseMap<const llvm::DIDerivedType*, uint64_t> memberOffsets;
+
+        explicit DebugTypeInfo(llvm::Module &M): M(M), DL(M.getDataLayout()) {}
+
+        static bool isFieldMember(const llvm::DINode *element) {
+            const auto member = llvm::dyn_cast<llvm::DIDerivedType>(element);
+            return member && member->getTag() == llvm::dwarf::DW_TAG_member && !member->isStaticMember();
+        }
+
+        /**
+         * Maps each member of the composite type to the initial index of the field at its offset.
+         */
+        bool matchMembers(const llvm::DICompositeType *composite, const llvm::StructType *structTy,
+                          const llvm::StructLayout *initialLayout,
+                          llvm::DenseMap<const llvm::DINode*, unsigned> &memberFields) const {
+            if (composite->isForwardDecl()) return false;
+            if (composite->getSizeInBits() != initialLayout->getSizeInBits()) return false;
+            for (const auto element: composite->getElements()) {
+                // Base classes are laid out as fields too, which isn't handled
+                if (element->getTag() == llvm::dwarf::DW_TAG_inheritance) return false;
+                if (!isFieldMember(element)) continue;
+                const auto member = llvm::cast<llvm::DIDerivedType>(element);
+                // Bitfields share a single field
+                if (member->isBitField() || member->getOffsetInBits() % 8 != 0) return false;
+
+                // Zero sized fields share their offset with the next one, so the size has to match too
+                std::optional<unsigned> fieldIndex;
+                for (unsigned i = 0; i < structTy->getNumElements(); i++) {
+                    if (initialLayout->getElementOffsetInBits(i).getKnownMinValue() != member->getOffsetInBits())
+                        continue;
+                    if (!fieldIndex) fieldIndex = i;
+                    if (DL.getTypeSizeInBits(structTy->getElementType(i)).getKnownMinValue() ==
+                        member->getSizeInBits()) {
+                        fieldIndex = i;
+                        break;
+                    }
+                }
+                if (!fieldIndex) return false;
+                memberFields[member] = *fieldIndex;
+            }
+            return !memberFields.empty();
+        }
+
+        /**
+         * Offset a fragment of a variable of the type moves to, following the members it lies in down through nested
+         * types. Nothing if it spans several members of a reordered struct, eg: two fields SROA kept as one `i64`.
+         */
+        std::optional<uint64_t> remapFragment(const llvm::DIType *type, const uint64_t offsetInBits,
+                                              const uint64_t sizeInBits) const {
+            // Typedefs and qualifiers share the layout of the type they name
+            while (const auto derived = llvm::dyn_cast_or_null<llvm::DIDerivedType>(type)) {
+                const auto tag = derived->getTag();
+                if (tag != llvm::dwarf::DW_TAG_typedef && tag != llvm::dwarf::DW_TAG_const_type &&
+                    tag != llvm::dwarf::DW_TAG_volatile_type)
+                    break;
+                type = derived->getBaseType();
+            }
+            const auto composite = llvm::dyn_cast_or_null<llvm::DICompositeType>(type);
+            if (!composite || (offsetInBits == 0 && sizeInBits >= composite->getSizeInBits())) return offsetInBits;
+
+            if (composite->getTag() == llvm::dwarf::DW_TAG_array_type) {
+                const auto elementSize = getSizeInBits(composite->getBaseType(), false);
+                if (elementSize == 0) return offsetInBits;
+                const auto offsetInElement = remapFragment(composite->getBaseType(), offsetInBits % elementSize,
+                                                           sizeInBits);
+                if (!offsetInElement) return std::nullopt;
+                return offsetInBits / elementSize * getSizeInBits(composite->getBaseType(), true) + *offsetInElement;
+            }
+            if (composite->getTag() != llvm::dwarf::DW_TAG_structure_type &&
+                composite->getTag() != llvm::dwarf::DW_TAG_class_type)
+                return offsetInBits;
+
+            const auto isReordered = valueMap->MD().count(composite) != 0;
+            for (const auto element: composite->getElements()) {
+                if (!isFieldMember(element)) continue;
+                const auto member = llvm::cast<llvm::DIDerivedType>(element);
+                const auto memberOffset = member->getOffsetInBits();
+                if (offsetInBits < memberOffset || offsetInBits + sizeInBits > memberOffset + member->getSizeInBits())
+                    continue;
+                const auto offsetInMember = remapFragment(member->getBaseType(), offsetInBits - memberOffset,
+                                                          sizeInBits);
+                if (!offsetInMember) return std::nullopt;
+                const auto found = memberOffsets.find(member);
+                return (found == memberOffsets.end() ? memberOffset : found->second) + *offsetInMember;
+            }
+            // Padding, or several members of a struct which kept its layout
+            if (!isReordered) return offsetInBits;
+            return std::nullopt;
+        }
+
+        // Size of the type, as it was or once the composite types it is made of are replaced
+        uint64_t getSizeInBits(const llvm::DIType *type, const bool isNew) const {
+            if (!type) return 0;
+            if (isNew) {
+                if (const auto found = valueMap->MD().find(type); found != valueMap->MD().end())
+                    return llvm::cast<llvm::DIType>(found->second.get())->getSizeInBits();
+            }
+            const auto derived = llvm::dyn_cast<llvm::DIDerivedType>(type);
+            if (derived && derived->getSizeInBits() == 0) return getSizeInBits(derived->getBaseType(), isNew);
+            return type->getSizeInBits();
+        }
+
+        /**
+         * Points a `dbg.value`, `dbg.declare` or debug record at the new variable, moving its fragment along with the
+         * member it describes. A fragment that can no longer be described is dropped, so the debugger shows it as
+         * optimized out rather than as the wrong field.
+         */
+        template<typename DbgVariable>
+        void remapVariable(llvm::ValueMapper &mapper, DbgVariable &dbgVariable) const {
+            const auto variable = dbgVariable.getVariable();
+            const auto expression = dbgVariable.getExpression();
+            if (const auto fragment = expression->getFragmentInfo()) {
+                const auto newOffset = remapFragment(variable->getType(), fragment->OffsetInBits,
+                                                     fragment->SizeInBits);
+                if (!newOffset) {
+                    dbgVariable.setKillLocation();
+                } else if (*newOffset != fragment->OffsetInBits) {
+                    // The fragment is replaced, rather than narrowed by another one
+                    llvm::SmallVector<uint64_t, 8> ops;
+                    for (const auto &op: expression->expr_ops()) {
+                        if (op.getOp() != llvm::dwarf::DW_OP_LLVM_fragment) op.appendToVector(ops);
+                    }
+                    const auto newExpression = llvm::DIExpression::createFragmentExpression(
+                        llvm::DIExpression::get(M.getContext(), ops), *newOffset, fragment->SizeInBits);
+                    if (newExpression) dbgVariable.setExpression(*newExpression);
+                    else dbgVariable.setKillLocation();
+                }
+            }
+            dbgVariable.setVariable(llvm::cast<llvm::DILocalVariable>(mapper.mapMDNode(*variable)));
+        }
+
+    public:
+        // `struct.Point.1` is described as `Point`, and `class.ns::Point` as `Point` within `ns`
+        static llvm::StringRef getSourceName(llvm::StringRef name) {
+            name = name.drop_until([](const char c) { return c == '.'; }).drop_front();
+            while (!name.empty() && llvm::isDigit(name.back())) {
+                const auto trimmed = name.rtrim("0123456789");
+                if (trimmed.empty() || trimmed.back() != '.') break;
+                name = trimmed.drop_back();
+            }
+            const auto scopeEnd = name.rfind("::");
+            return scopeEnd == llvm::StringRef::npos ? name : name.drop_front(scopeEnd + 2);
+        }
+
+        static DebugTypeInfo collect(llvm::Module &M) {
+            DebugTypeInfo debugTypeInfo(M);
+            llvm::DebugInfoFinder finder;
+            finder.processModule(M);
+            for (const auto type: finder.types()) {
+                if (const auto composite = llvm::dyn_cast<llvm::DICompositeType>(type)) {
+                    if (!composite->getName().empty()) debugTypeInfo.composites[composite->getName()].push_back(composite);
+                } else if (const auto typedefType = llvm::dyn_cast<llvm::DIDerivedType>(type)) {
+                    // Anonymous structs are only named through their typedef, eg: `typedef struct {...} Point`
+                    if (typedefType->getTag() != llvm::dwarf::DW_TAG_typedef) continue;
+                    const auto composite = llvm::dyn_cast_or_null<llvm::DICompositeType>(typedefType->getBaseType());
+                    if (composite && composite->getName().empty())
+                        debugTypeInfo.composites[typedefType->getName()].push_back(composite);
+                }
+            }
+            return debugTypeInfo;
+        }
+
+        bool isEmpty() const {
+            return composites.empty();
+        }
+
+        /**
+         * Composite type describing the struct under its initial layout, along with the member of each initial field
+         * index, null for fields without one, eg: explicit padding.
+         */
+        const llvm::DICompositeType *findComposite(const llvm::StructType *structTy,
+                                                   const llvm::StructLayout *initialLayout,
+                                                   std::vector<const llvm::DIDerivedType*> &fieldMembers) const {
+            const auto found = composites.find(getSourceName(structTy->getName()));
+            if (found == composites.end()) return nullptr;
+            for (const auto composite: found->second) {
+                llvm::DenseMap<const llvm::DINode*, unsigned> memberFields;
+                if (!matchMembers(composite, structTy, initialLayout, memberFields)) continue;
+                fieldMembers.assign(structTy->getNumElements(), nullptr);
+                for (const auto &[member, index]: memberFields) {
+                    fieldMembers[index] = llvm::cast<llvm::DIDerivedType>(member);
+                }
+                return composite;
+            }
+            return nullptr;
+        }
+
+        /**
+         * Describes the new layout of a struct, `positions` maps each initial field index to its new index. Returns
+         * whether any matching composite type was found.
+         */
+        bool remapStruct(llvm::StructType *structTy, const llvm::StructLayout *initialLayout,
+                         const llvm::StructLayout *currentLayout, const std::vector<unsigned> &positions) {
+            const auto found = composites.find(getSourceName(structTy->getName()));
+            if (found == composites.end()) return false;
+
+            auto didWork = false;
+            for (const auto composite: found->second) {
+                llvm::DenseMap<const llvm::DINode*, unsigned> memberFields;
+                if (valueMap->MD().count(composite)) continue;
+                if (!matchMembers(composite, structTy, initialLayout, memberFields)) continue;
+
+                // Members are placed where they now are, everything else keeps its place
+                auto &context = M.getContext();
+                const auto newComposite = llvm::DICompositeType::getDistinct(
+                    context, composite->getTag(), composite->getRawName(), composite->getRawFile(),
+                    composite->getLine(), composite->getRawScope(), composite->getRawBaseType(),
+                    currentLayout->getSizeInBits(), composite->getAlignInBits(), composite->getOffsetInBits(),
+                    composite->getFlags(), nullptr, composite->getRuntimeLang(), composite->getRawVTableHolder(),
+                    composite->getRawTemplateParams(), composite->getRawIdentifier(),
+                    composite->getRawDiscriminator(), composite->getRawDataLocation(), composite->getRawAssociated(),
+                    composite->getRawAllocated(), composite->getRawRank(), composite->getRawAnnotations());
+
+                llvm::DIBuilder builder(M);
+                std::vector<llvm::Metadata*> elements;
+                std::vector<std::pair<uint64_t, llvm::Metadata*>> members;
+                for (const auto element: composite->getElements()) {
+                    if (!isFieldMember(element)) {
+                        elements.push_back(element);
+                        continue;
+                    }
+                    const auto member = llvm::cast<llvm::DIDerivedType>(element);
+                    const auto position = positions[memberFields.lookup(member)];
+                    const auto offsetInBits = currentLayout->getElementOffsetInBits(position).getKnownMinValue();
+                    const auto newMember = builder.createMemberType(
+                        newComposite, member->getName(), member->getFile(), member->getLine(),
+                        member->getSizeInBits(), member->getAlignInBits(), offsetInBits, member->getFlags(),
+                        member->getBaseType(), member->getAnnotations());
+                    memberOffsets[member] = offsetInBits;
+                    // Slot kept for a member, filled in offset order below
+                    elements.push_back(nullptr);
+                    members.emplace_back(offsetInBits, newMember);
+                }
+                std::stable_sort(members.begin(), members.end(), [](const auto &a, const auto &b) {
+                    return a.first < b.first;
+                });
+                auto nextMember = members.begin();
+                for (auto &element: elements) {
+                    if (!element) element = (nextMember++)->second;
+                }
+                newComposite->replaceElements(llvm::MDTuple::get(context, elements));
+
+                valueMap->MD()[composite].reset(newComposite);
+                newComposites.push_back(newComposite);
+                didWork = true;
+            }
+            return didWork;
+        }
+
+        /**
+         * Points every reference to the old composite types at the new ones, across the whole module.
+         */
+        unsigned apply() {
+            if (newComposites.empty()) return 0;
+            llvm::ValueMapper mapper(*valueMap, llvm::RF_ReuseAndMutateDistinctMDs | llvm::RF_IgnoreMissingLocals);
+
+            // Members of the new types may themselves be of a reordered struct
+            for (const auto newComposite: newComposites) {
+                mapper.mapMDNode(*newComposite);
+            }
+            for (auto &namedMetadata: M.named_metadata()) {
+                for (unsigned i = 0; i < namedMetadata.getNumOperands(); i++) {
+                    namedMetadata.setOperand(i, mapper.mapMDNode(*namedMetadata.getOperand(i)));
+                }
+            }
+            // Not cleared by `getAllMetadata` when there is nothing attached
+            llvm::SmallVector<std::pair<unsigned, llvm::MDNode*>, 4> attachments;
+            for (auto &globalVar: M.globals()) {
+                attachments.clear();
+                globalVar.getAllMetadata(attachments);
+                for (const auto &[kind, node]: attachments) {
+                    globalVar.setMetadata(kind, mapper.mapMDNode(*node));
+                }
+            }
+            for (auto &function: M.functions()) {
+                attachments.clear();
+                function.getAllMetadata(attachments);
+                for (const auto &[kind, node]: attachments) {
+                    function.setMetadata(kind, mapper.mapMDNode(*node));
+                }
+                for (auto &inst: llvm::instructions(function)) {
+                    attachments.clear();
+                    inst.getAllMetadata(attachments);
+                    for (const auto &[kind, node]: attachments) {
+                        inst.setMetadata(kind, mapper.mapMDNode(*node));
+                    }
+                    if (const auto dbgVariable = llvm::dyn_cast<llvm::DbgVariableIntrinsic>(&inst))
+                        remapVariable(mapper, *dbgVariable);
+#if LLVM_VERSION_MAJOR >= 19
+                    // Debug records are attached to the instruction they precede, in place of the intrinsics. LLVM 18
+                    // still emits the intrinsics, so only has them to remap.
+                    for (auto &dbgRecord: llvm::filterDbgVars(inst.getDbgRecordRange())) {
+                        remapVariable(mapper, dbgRecord);
+                    }
+#endif
+                }
+            }
+            return newComposites.size();
+        }
+    };
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "FunctionInfo.hpp"
+#include "LayoutDatabase.hpp"
+#include "StructInfo.hpp"
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/IR/PassManager.h>
+
+namespace Zippy {
+    /**
+     * Field access statistics of one module: the hotness of every field, the affinity between fields, which structs
+     * are unsafe to reorder and why, and the target layout of each safe struct.
+     *
+     * Result of `ZippyFieldAccessAnalysis`, so the transform, printers and other passes share a single collection for
+     * as long as the module is left alone. Computing it changes neither the module nor the layout database, layouts
+     * are only recorded by the transform.
+     */
+    class FieldAccessInfo {
+    public:
+        struct UnsafeStruct {
+            std::string reason;
+            // Where the struct was found unsafe, null if nowhere in particular, eg: when unsafe in another module
+            const llvm::Value *value;
+        };
+
+    private:
+        // Safe structs with uses, fields in their target order
+        std::vector<StructInfo> structInfos;
+        std::vector<FunctionInfo> functionInfos;
+        llvm::MapVector<llvm::StructType*, UnsafeStruct> unsafeStructs;
+        // Safe structs that still aren't laid out, eg: with no field used
+        RejectedStructs rejectedStructs;
+        // Database the layouts were looked up in, when laying out against one
+        std::optional<LayoutDatabase> layoutDatabase;
+
+    public:
+        FieldAccessInfo(std::vector<StructInfo> structInfos, std::vector<FunctionInfo> functionInfos,
+                        llvm::MapVector<llvm::StructType*, UnsafeStruct> unsafeStructs, RejectedStructs rejectedStructs,
+                        std::optional<LayoutDatabase> layoutDatabase):
+            structInfos(std::move(structInfos)),
+            functionInfos(std::move(functionInfos)),
+            unsafeStructs(std::move(unsafeStructs)),
+            rejectedStructs(std::move(rejectedStructs)),
+            layoutDatabase(std::move(layoutDatabase)) {}
+
+        bool isEmpty() const {
+            return structInfos.empty();
+        }
+
+        std::vector<StructInfo> &getStructInfos() {
+            return structInfos;
+        }
+
+        const std::vector<StructInfo> &getStructInfos() const {
+            return structInfos;
+        }
+
+        const std::vector<FunctionInfo> &getFunctionInfos() const {
+            return functionInfos;
+        }
+
+        const StructInfo *lookup(const llvm::StructType *structTy) const {
+            for (const auto &structInfo: structInfos) {
+                if (structInfo.getStructType().ptr == structTy) return &structInfo;
+            }
+            return nullptr;
+        }
+
+        const llvm::MapVector<llvm::StructType*, UnsafeStruct> &getUnsafeStructs() const {
+            return unsafeStructs;
+        }
+
+        const RejectedStructs &getRejectedStructs() const {
+            return rejectedStructs;
+        }
+
+        std::optional<LayoutDatabase> &getLayoutDatabase() {
+            return layoutDatabase;
+        }
+
+        /**
+         * Why the struct can't be reordered, or empty if it can.
+         */
+        llvm::StringRef getUnsafeReason(llvm::StructType *structTy) const {
+            const auto found = unsafeStructs.find(structTy);
+            return found == unsafeStructs.end() ? "" : llvm::StringRef(found->second.reason);
+        }
+
+        void print(llvm::raw_ostream &OS) const {
+            for (const auto &structInfo: structInfos) {
+                const auto targetLayout = structInfo.getTargetLayout();
+                OS << structInfo.getStructType() << llvm::format(" - Size: [%llu] -> [%llu]\n",
+                                                                 structInfo.getInitialSize().getKnownMinValue(),
+                                                                 targetLayout->getSizeInBytes().getKnownMinValue());
+                // Printed by initial index, the field infos themselves are in their target order
+                const auto &fieldInfos = structInfo.getFieldInfos();
+                for (unsigned index = 0; index < fieldInfos.size(); index++) {
+                    const auto position = structInfo.findPosition(index);
+                    const auto &fieldInfo = fieldInfos[position];
+                    OS << TAB_STR << llvm::format(
+                        "Index: [%02d] - Loads: [%02d] - Stores: [%02d] - Loop Weight: [%06.2f] - "
+                        "Total Weight: [%06.2f] - Position: [%02d]\n",
+                        index, fieldInfo.getNumLoads(), fieldInfo.getNumStores(), fieldInfo.getLoopWeight(),
+                        fieldInfo.getTotalWeight(), position);
+                }
+                for (unsigned a = 0; a < fieldInfos.size(); a++) {
+                    for (auto b = a + 1; b < fieldInfos.size(); b++) {
+                        const auto affinity = structInfo.getAffinity(a, b);
+                        if (affinity == 0.0F) continue;
+                        OS << TAB_STR << llvm::format("Affinity: [%02d] [%02d] - [%06.2f]\n", a, b, affinity);
+                    }
+                }
+            }
+            for (const auto &[structTy, unsafeStruct]: unsafeStructs) {
+                OS << StructType{structTy} << " - Unsafe: " << unsafeStruct.reason << "\n";
+            }
+        }
+
+        /**
+         * Kept until a pass changes the module, or any function analysis the field uses point into.
+         */
+        bool invalidate(llvm::Module &M, const llvm::PreservedAnalyses &PA,
+                        llvm::ModuleAnalysisManager::Invalidator &Inv);
+    };
+
+    /**
+     * Collects the field access statistics of a module, see `FieldAccessInfo`.
+     */
+    class ZippyFieldAccessAnalysis : public llvm::AnalysisInfoMixin<ZippyFieldAccessAnalysis> {
+        friend AnalysisInfoMixin;
+        static inline llvm::AnalysisKey Key;
+        // Nothing outside the module sees its structs, eg: on the merged module of a full LTO link
+        bool wholeProgram;
+
+    public:
+        using Result = FieldAccessInfo;
+
+        explicit ZippyFieldAccessAnalysis(const bool wholeProgram = false): wholeProgram(wholeProgram) {}
+
+        // Defined along with the collection itself, in ZippyPass.hpp
+        FieldAccessInfo run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) const;
+    };
+
+    inline bool FieldAccessInfo::invalidate(llvm::Module &M, const llvm::PreservedAnalyses &PA,
+                                            llvm::ModuleAnalysisManager::Invalidator &Inv) {
+        auto checker = PA.getChecker<ZippyFieldAccessAnalysis>();
+        if (!checker.preserved() && !checker.preservedSet<llvm::AllAnalysesOn<llvm::Module>>()) return true;
+        // The proxy is only cached once functions were collected
+        return !functionInfos.empty() && Inv.invalidate<llvm::FunctionAnalysisManagerModuleProxy>(M, PA);
+    }
+}
@@ -4,16 +4,17 @@
 #include "cmath"
 #include "GetElementPtrRef.hpp"
 
+#include <map>
+
 namespace Zippy {
     class FieldUse {
-        std::shared_ptr<llvm::LoopInfo> loopInfo;
         std::shared_ptr<GetElementPtrRef> gepRef;
-        // Operator index is separate from the field index, as GEPs may reference a nested field (not implemented atm)
+        // Operator index is separate from the field index, as GEPs may reference a nested field, eg: `a.b.c`
         unsigned operandIndex;
 
     public:
-        FieldUse(const std::shared_ptr<llvm::LoopInfo> &loopInfo, const std::shared_ptr<GetElementPtrRef> &gepRef,
-                 const unsigned operandIndex): loopInfo(loopInfo), gepRef(gepRef), operandIndex(operandIndex) {}
+        FieldUse(const std::shared_ptr<GetElementPtrRef> &gepRef, const unsigned operandIndex): gepRef(gepRef),
+            operandIndex(operandIndex) {}
 
         void setFieldIndex(const uint64_t index) const {
             const auto oldOperand = gepRef->getOperand(operandIndex);
@@ -28,23 +29,19 @@ namespace Zippy {
         }
 
         void setAlignment(const llvm::Align alignment) {
+            // Accesses of something nested within the field are aligned by whatever is innermost
+            if (!gepRef->addressesField(operandIndex)) return;
             gepRef->setAlignment(alignment);
         }
 
+        unsigned getOperandIndex() const {
+            return operandIndex;
+        }
+
         // New method to access the GEP reference
         std::shared_ptr<GetElementPtrRef> getGepRef() const {
             return gepRef;
         }
-
-        unsigned computeLoopDepth() const {
-            // The parent should always be present, but rather throw a clear error than segfault
-            const auto parent = gepRef->getInst()->getParent();
-            if (!parent)
-                llvm_unreachable("FieldUse parent cannot be null");
-            // Find a loop if exists, and get its depth. Otherwise, assume not in a loop.
-            const auto loop = loopInfo->getLoopFor(parent);
-            return loop ? loop->getLoopDepth() : 0;
-        }
     };
 
     class FieldInfo {
@@ -54,14 +51,19 @@ namespace Zippy {
         llvm::TypeSize storeSize;
         llvm::TypeSize allocSize;
         std::vector<FieldUse> uses;
+        // Number of uses per loop depth, counting the loops the function is called from
+        std::map<unsigned, unsigned> loopUses;
 
         unsigned numLoads = 0;
         unsigned numStores = 0;
+        // Measured access count, when a profile is present
+        uint64_t profileCount = 0;
 
         float sizeWeight = 1.0F;
         float loadWeight = 1.0F;
         float storeWeight = 1.0F;
         float loopWeight = 1.0F;
+        float profileWeight = 0.0F;
         float totalWeight = 1.0F;
 
         unsigned initialIndex;
@@ -128,22 +130,28 @@ namespace Zippy {
             targetIndex = idx;
         }
 
-        void addUse(const std::shared_ptr<llvm::LoopInfo> &loopInfo,
-                    const std::shared_ptr<GetElementPtrRef> &gepRef,
-                    const unsigned operandIndex) {
-            uses.emplace_back(loopInfo, gepRef, operandIndex);
-            GetElementPtrRef::RefType type = gepRef->getType();
-            if (type == GetElementPtrRef::LOAD) {
-                numLoads++;
-            } else if (type == GetElementPtrRef::STORE) {
-                numStores++;
-            }
+        void addUse(const std::shared_ptr<GetElementPtrRef> &gepRef,
+                    const unsigned operandIndex,
+                    const unsigned callCount = 1) {
+            uses.emplace_back(gepRef, operandIndex);
+            // Each call site of the function runs its accesses once more
+            const auto &summary = gepRef->getAccessSummary();
+            numLoads += summary.numLoads * callCount;
+            numStores += summary.numStores * callCount;
         }
 
         const std::vector<FieldUse> &getUses() const {
             return uses;
         }
 
+        void addLoopUses(const unsigned loopDepth, const unsigned count) {
+            loopUses[loopDepth] += count;
+        }
+
+        const std::map<unsigned, unsigned> &getLoopUses() const {
+            return loopUses;
+        }
+
         void setSizeWeight(const float weight) {
             sizeWeight = weight;
         }
@@ -176,6 +184,22 @@ namespace Zippy {
             return loopWeight;
         }
 
+        void setProfileCount(const uint64_t count) {
+            profileCount = count;
+        }
+
+        uint64_t getProfileCount() const {
+            return profileCount;
+        }
+
+        void setProfileWeight(const float weight) {
+            profileWeight = weight;
+        }
+
+        float getProfileWeight() const {
+            return profileWeight;
+        }
+
         void setTotalWeight(const float weight) {
             totalWeight = weight;
         }
@@ -197,6 +221,11 @@ namespace Zippy {
             return true;
         }
 
+        void applyLayout(const llvm::StructLayout *layout) {
+            for (auto &use: uses)
+                use.getGepRef()->applyLayout(layout);
+        }
+
         void applyAlign(const llvm::Align align) {
             if (currentAlign == align) return;
             for (auto &use: uses)
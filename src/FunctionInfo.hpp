@@ -4,6 +4,9 @@
 #include "ZippyCommon.hpp"
 #include "GetElementPtrRef.hpp"
 #include "IntrinsicInstRef.hpp"
+#include "PointerFlow.hpp"
+#include "SizeRef.hpp"
+#include "Statistics.hpp"
 
 namespace Zippy {
     // Only here to reduce verbosity
@@ -16,153 +19,216 @@ namespace Zippy {
         std::vector<std::shared_ptr<GetElementPtrRef>> gepRefs;
         // Intrinsic instructions such as memcpy or memset
         std::vector<std::shared_ptr<IntrinsicInstRef>> intrinsicInsts;
+        // Allocation sizes and strides derived from the size of a struct
+        std::vector<std::shared_ptr<SizeRef>> sizeRefs;
 
-        std::shared_ptr<llvm::LoopInfo> loopInfo;
+        // Loops are only computed once something asks for them, eg: a report, as the function accesses may be cached
+        llvm::FunctionAnalysisManager *FAM;
 
         // Tracking for found refs
         unsigned numGEPInst;
         unsigned numGEPOps;
         unsigned numDirectRefs;
+        unsigned numByteOffsets;
 
         // Tracks the number of gepRefs that we are actually using.
         unsigned numUsedGepRefs;
 
-        explicit FunctionInfo(const Function function): function(function), numGEPInst(0), numGEPOps(0),
-                                                        numDirectRefs(0), numUsedGepRefs(0) {
+        // Deepest loop nest this function is called from, and how many call sites reach it, across the call graph
+        unsigned callerLoopDepth = 0;
+        unsigned callCount = 1;
+
+        explicit FunctionInfo(const Function function, PointerFlow &pointerFlow,
+                              llvm::FunctionAnalysisManager &FAM): function(function), FAM(&FAM), numGEPInst(0),
+            numGEPOps(0), numDirectRefs(0), numByteOffsets(0), numUsedGepRefs(0) {
             GEPInstSet foundGEPs;
 
             const auto ptr = function.ptr;
+            const auto &DL = ptr->getParent()->getDataLayout();
             // Scan all instructions in the function, we do it like it's done in the spec
             for (llvm::inst_iterator I = inst_begin(ptr), E = inst_end(ptr); I != E; ++I) {
                 llvm::Instruction *inst = &*I;
 
                 if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(inst)) {
                     // Handles: `load`
-                    processLoadOrStore(foundGEPs, inst, loadInst->getPointerOperand(), GetElementPtrRef::LOAD);
+                    processLoadOrStore(foundGEPs, pointerFlow, inst, loadInst->getPointerOperand(),
+                                       GetElementPtrRef::LOAD);
                 } else if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
                     // Handles: `store`
-                    processLoadOrStore(foundGEPs, inst, storeInst->getPointerOperand(), GetElementPtrRef::STORE);
+                    processLoadOrStore(foundGEPs, pointerFlow, inst, storeInst->getPointerOperand(),
+                                       GetElementPtrRef::STORE);
                 } else if (auto *gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(inst)) {
                     // Handles: `getelementptr`
-                    processGEPInst(foundGEPs, gepInst, GetElementPtrRef::UNKNOWN);
+                    processGEPInst(foundGEPs, pointerFlow, gepInst);
                 } else if (auto *memCpyInst = llvm::dyn_cast<llvm::MemCpyInst>(inst)) {
                     // Handles: `@llvm.memcpy.p0.*`
-                    intrinsicInsts.push_back(std::make_shared<MemCpyInstRef>(memCpyInst));
+                    processIntrinsic(std::make_shared<MemCpyInstRef>(memCpyInst, DL), inst);
                 } else if (auto *memSetInst = llvm::dyn_cast<llvm::MemSetInst>(inst)) {
                     // Handles: `@llvm.memset.p0.*`
-                    intrinsicInsts.push_back(std::make_shared<MemSetInstRef>(memSetInst));
+                    processIntrinsic(std::make_shared<MemSetInstRef>(memSetInst, DL), inst);
+                } else if (auto *callBase = llvm::dyn_cast<llvm::CallBase>(inst)) {
+                    // Handles: `malloc`, `calloc`, `realloc` and `aligned_alloc`
+                    processAllocation(callBase);
                 }
             }
-            if (gepRefs.empty() && intrinsicInsts.empty()) return;
-
-            const auto domTree = std::make_unique<llvm::DominatorTree>(*function.ptr);
-            // LoopInfo Takes ownership of the dominator tree here
-            loopInfo = std::make_shared<llvm::LoopInfo>(*domTree);
-
-            // Print debug info about loops found
-            unsigned loopCount = 0;
-            for (const auto &loopRef: *loopInfo) {
-                loopCount += 1 + loopRef->getSubLoops().size();
-            }
-
-            if (loopCount > 0) {
-                llvm::errs() << "\n" << TAB_STR_2 << llvm::format("Found: [%d] Loops", loopCount);
-            }
         }
 
-        void processLoadOrStore(GEPInstSet &foundGEPs, llvm::Instruction *inst, llvm::Value *ptrOperand,
-                                const GetElementPtrRef::RefType type) {
+        void processLoadOrStore(GEPInstSet &foundGEPs, PointerFlow &pointerFlow, llvm::Instruction *inst,
+                                llvm::Value *ptrOperand, const GetElementPtrRef::RefType type) {
             // Branching based on known ways the actual field reference could be used
             if (auto *gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(ptrOperand)) {
                 // As a GEP Instruction
-                processGEPInst(foundGEPs, gepInst, type);
+                processGEPInst(foundGEPs, pointerFlow, gepInst);
+                // As a pointer to a whole struct element, eg: `&data[i]`
+                if (!GetElementPtrRef::hasStructIndex(llvm::cast<llvm::GEPOperator>(gepInst)))
+                    processDirectRef(inst, ptrOperand, type);
             } else if (auto *gepOp = llvm::dyn_cast<llvm::GEPOperator>(ptrOperand)) {
                 // As a GEP Operator
                 processGEPOperator(inst, gepOp, type);
-            } else if (const auto *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(ptrOperand)) {
-                // As a Direct Reference (only handling global variables for now)
-                processDirectRef(inst, globalVar, type);
+            } else {
+                // As a Direct Reference, through a global variable or an alloca
+                processDirectRef(inst, ptrOperand, type);
             }
         }
 
-        void processGEPInst(GEPInstSet &foundGEPs, llvm::GetElementPtrInst *gepInst, GetElementPtrRef::RefType type) {
+        void processGEPInst(GEPInstSet &foundGEPs, PointerFlow &pointerFlow, llvm::GetElementPtrInst *gepInst) {
             // Avoid duplicates
             if (!foundGEPs.insert(gepInst).second) return;
-            // Skip if fewer than three operands (array indexing only)
-            if (gepInst->getNumOperands() < 3) return;
-            // This would be true if we used nested anonymous structs, but that is unsupported
-            if (gepInst->getNumOperands() != 3)
-                llvm_unreachable("Expected three or fewer GEP operands");
-            // Our source element needs to be a struct type
-            if (!llvm::isa<llvm::StructType>(gepInst->getSourceElementType())) return;
-            // Attempt to resolve type if unknown
-            if (type == GetElementPtrRef::UNKNOWN)
-                type = resolveRefType(gepInst);
+            // Byte offsets are resolved against the pointee struct instead
+            if (ByteOffsetGEPRef::isByteOffsetGEP(llvm::cast<llvm::GEPOperator>(gepInst))) {
+                const auto gepRef = processByteOffsetGEP(gepInst, llvm::cast<llvm::GEPOperator>(gepInst),
+                                                         GetElementPtrRef::UNKNOWN);
+                if (gepRef) gepRef->setAccessSummary(pointerFlow.summarize(gepInst));
+                return;
+            }
+            // Skip unless a struct is indexed somewhere along the way, eg: `s.x`, `data[i].x` or `a.b.c`
+            if (!GetElementPtrRef::hasStructIndex(llvm::cast<llvm::GEPOperator>(gepInst))) return;
+            // Classify by every access the field pointer reaches
+            const auto gepRef = std::make_shared<GetElementPtrInstRef>(gepInst, GetElementPtrRef::UNKNOWN);
+            gepRef->setAccessSummary(pointerFlow.summarize(gepInst));
             // Add it to the collection
-            gepRefs.push_back(std::make_shared<GetElementPtrInstRef>(gepInst, type));
+            gepRefs.push_back(gepRef);
             numGEPInst++;
-        }
-
-        static GetElementPtrRef::RefType resolveRefType(llvm::GetElementPtrInst *gepInst) {
-            for (const auto gepUser: gepInst->users()) {
-                if (llvm::isa<llvm::LoadInst>(gepUser)) return GetElementPtrRef::LOAD;
-                if (llvm::isa<llvm::StoreInst>(gepUser)) return GetElementPtrRef::STORE;
-                if (llvm::isa<llvm::CallInst>(gepUser)) return GetElementPtrRef::CALL;
-                if (auto *next = llvm::dyn_cast<llvm::GetElementPtrInst>(gepUser)) {
-                    auto type = resolveRefType(next);
-                    if (type != GetElementPtrRef::UNKNOWN) return type;
-                }
-            }
-            return GetElementPtrRef::UNKNOWN;
+            ++NumGEPInsts;
         }
 
         void processGEPOperator(llvm::Instruction *inst, llvm::GEPOperator *gepOp,
                                 const GetElementPtrRef::RefType type) {
-            // Skip if fewer than three operands (array indexing only)
-            if (gepOp->getNumOperands() < 3) return;
-            // Our source element needs to be a struct type
-            if (!llvm::isa<llvm::StructType>(gepOp->getSourceElementType())) return;
+            // Byte offsets are resolved against the pointee struct instead
+            if (ByteOffsetGEPRef::isByteOffsetGEP(gepOp)) {
+                processByteOffsetGEP(inst, gepOp, type);
+                return;
+            }
+            // Skip unless a struct is indexed somewhere along the way, eg: `s.x`, `data[i].x` or `a.b.c`
+            if (!GetElementPtrRef::hasStructIndex(gepOp)) return;
             // Add it to the collection
             gepRefs.push_back(std::make_shared<GetElementPtrOpRef>(inst, gepOp, type));
             numGEPOps++;
+            ++NumGEPOperators;
         }
 
-        void processDirectRef(llvm::Instruction *inst, const llvm::GlobalVariable *globalVar,
+        std::shared_ptr<GetElementPtrRef> processByteOffsetGEP(llvm::Instruction *inst, llvm::GEPOperator *gepOp,
+                                                               const GetElementPtrRef::RefType type) {
+            // Offsets from a pointer of unknown pointee, eg: a parameter, are left as is. `LegalityInfo` keeps the
+            // struct such a pointer was derived from in its layout, as the offset would go stale otherwise.
+            auto *structTy = ByteOffsetGEPRef::inferPointeeStructType(gepOp->getPointerOperand());
+            if (!structTy || structTy->isOpaque()) return nullptr;
+            if (!llvm::isa<llvm::ConstantInt>(gepOp->getOperand(1))) {
+                // Variable offsets can still be a stride over an array of structs, eg: `p + i * sizeof(S)`
+                const auto gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(gepOp);
+                if (!gepInst || !processSizeRef(gepInst, 1, structTy)) ++NumRejectedGEPs;
+                return nullptr;
+            }
+
+            // Negative offsets and offsets into padding don't belong to any field
+            const auto &DL = function.ptr->getParent()->getDataLayout();
+            const auto target = ByteOffsetGEPRef::resolve(DL, gepOp);
+            if (!target) {
+                ++NumRejectedGEPs;
+                return nullptr;
+            }
+
+            const auto gepRef = std::make_shared<ByteOffsetGEPRef>(inst, gepOp, target->structType, target->fieldIndex,
+                                                                   target->offsetInField, target->elementIndex, type);
+            gepRefs.push_back(gepRef);
+            numByteOffsets++;
+            ++NumByteOffsetRefs;
+            return gepRef;
+        }
+
+        void processIntrinsic(const std::shared_ptr<IntrinsicInstRef> &intrinsicRef, llvm::Instruction *inst) {
+            if (intrinsicRef->getStructType()) {
+                intrinsicInsts.push_back(intrinsicRef);
+                return;
+            }
+            // Variable lengths can still be a whole number of structs
+            if (auto *structTy = intrinsicRef->getArrayStructType()) processSizeRef(inst, 2, structTy);
+        }
+
+        void processAllocation(llvm::CallBase *callBase) {
+            const auto sizeOperands = SizeRef::getAllocationSizeOperands(callBase);
+            if (sizeOperands.empty()) return;
+
+            auto *structTy = SizeRef::inferIndexedStructType(callBase);
+            if (!structTy || structTy->isOpaque()) return;
+            for (const auto operandIndex: sizeOperands) {
+                if (processSizeRef(callBase, operandIndex, structTy)) return;
+            }
+        }
+
+        bool processSizeRef(llvm::Instruction *user, const unsigned operandIndex, llvm::StructType *structTy) {
+            const auto &DL = function.ptr->getParent()->getDataLayout();
+            const auto sizeRef = SizeRef::match(user, operandIndex, structTy,
+                                                DL.getTypeAllocSize(structTy).getKnownMinValue());
+            if (!sizeRef) return false;
+            sizeRefs.push_back(sizeRef);
+            return true;
+        }
+
+        void processDirectRef(llvm::Instruction *inst, const llvm::Value *ptrOperand,
                               const GetElementPtrRef::RefType type) {
             // Check for Struct Type
-            auto *structTy = llvm::dyn_cast<llvm::StructType>(globalVar->getValueType());
+            auto *structTy = ByteOffsetGEPRef::inferPointeeStructType(ptrOperand);
             if (!structTy) return;
+            // Loading or storing the struct as a whole isn't a field access
+            if (llvm::getLoadStoreType(inst) == structTy) return;
             // Add Direct Reference
             gepRefs.push_back(std::make_shared<DirectStructRef>(inst, structTy, type));
             numDirectRefs++;
+            ++NumDirectRefs;
         }
 
     public:
-        static std::vector<FunctionInfo> collect(llvm::Module &M) {
-            llvm::errs() << "Collecting Functions\n";
+        static std::vector<FunctionInfo> collect(llvm::Module &M, llvm::ModuleAnalysisManager &AM) {
+            log() << "Collecting Functions\n";
+            auto &FAM = AM.getResult<llvm::FunctionAnalysisManagerModuleProxy>(M).getManager();
             std::vector<FunctionInfo> functionInfos;
+            // Shared across functions, as field pointers are followed into the callees they are passed to
+            PointerFlow pointerFlow;
             for (auto &functionRaw: M.functions()) {
                 Function function{&functionRaw};
                 // Don't mention undefined functions at all
                 if (!function.isDefined()) continue;
-                llvm::errs() << TAB_STR << function;
-                FunctionInfo functionInfo(function);
+                log() << TAB_STR << function;
+                FunctionInfo functionInfo(function, pointerFlow, FAM);
                 if (functionInfo.getGepRefs().empty()) {
-                    if (functionInfo.intrinsicInsts.empty()) {
-                        llvm::errs() << " - No struct references, skipped\n";
+                    if (functionInfo.intrinsicInsts.empty() && functionInfo.sizeRefs.empty()) {
+                        log() << " - No struct references, skipped\n";
                         continue;
                     }
                 }
                 functionInfos.push_back(functionInfo);
-                llvm::errs() << "\n" << TAB_STR_2 << llvm::format("Found Refs: I:[%d] O:[%d] D:[%d] C[%d]\n",
-                                                                 functionInfo.numGEPInst,
-                                                                 functionInfo.numGEPOps, functionInfo.numDirectRefs,
-                                                                 functionInfo.intrinsicInsts.size());
+                log() << "\n" << TAB_STR_2 << llvm::format("Found Refs: I:[%d] O:[%d] D:[%d] B:[%d] C[%d] S[%d]\n",
+                                                           functionInfo.numGEPInst,
+                                                           functionInfo.numGEPOps, functionInfo.numDirectRefs,
+                                                           functionInfo.numByteOffsets,
+                                                           functionInfo.intrinsicInsts.size(),
+                                                           functionInfo.sizeRefs.size());
             }
             if (functionInfos.empty()) {
-                llvm::errs() << "No Functions collected\n\n";
+                log() << "No Functions collected\n\n";
             } else {
-                llvm::errs() << llvm::format("Collected [%d] Functions\n\n", functionInfos.size());
+                log() << llvm::format("Collected [%d] Functions\n\n", functionInfos.size());
             }
             return std::move(functionInfos);
         }
@@ -187,8 +253,28 @@ namespace Zippy {
             return intrinsicInsts;
         }
 
-        std::shared_ptr<llvm::LoopInfo> getLoopInfo() const {
-            return loopInfo;
+        const std::vector<std::shared_ptr<SizeRef>> &getSizeRefs() const {
+            return sizeRefs;
+        }
+
+        /**
+         * Computed on first use, and reused from the function analysis manager after that.
+         */
+        const llvm::LoopInfo *getLoopInfo() const {
+            return &FAM->getResult<llvm::LoopAnalysis>(*function.ptr);
+        }
+
+        unsigned getCallerLoopDepth() const {
+            return callerLoopDepth;
+        }
+
+        unsigned getCallCount() const {
+            return callCount;
+        }
+
+        void setCallContext(const unsigned loopDepth, const unsigned count) {
+            callerLoopDepth = loopDepth;
+            callCount = count;
         }
     };
 }
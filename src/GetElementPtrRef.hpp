@@ -2,6 +2,10 @@
 
 #include "ZippyCommon.hpp"
 
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+
+#include <optional>
+
 namespace Zippy {
     class GetElementPtrRef {
     public:
@@ -12,8 +16,47 @@ namespace Zippy {
             CALL
         };
 
+        // A struct indexed into along the GEP, and the operand holding the field index
+        struct StructIndex {
+            llvm::StructType *structType;
+            unsigned operandIndex;
+        };
+
+        // Every access reached from the reference, following the pointer through phis, selects and casts
+        struct AccessSummary {
+            unsigned numLoads = 0;
+            unsigned numStores = 0;
+            unsigned numCalls = 0;
+
+            static AccessSummary of(const RefType type) {
+                AccessSummary summary;
+                if (type == LOAD) summary.numLoads = 1;
+                if (type == STORE) summary.numStores = 1;
+                if (type == CALL) summary.numCalls = 1;
+                return summary;
+            }
+
+            AccessSummary &operator+=(const AccessSummary &other) {
+                numLoads += other.numLoads;
+                numStores += other.numStores;
+                numCalls += other.numCalls;
+                return *this;
+            }
+
+            // Reads are preferred when classifying, as they are what stall on a cache miss
+            RefType getRefType() const {
+                if (numLoads > 0) return LOAD;
+                if (numStores > 0) return STORE;
+                if (numCalls > 0) return CALL;
+                return UNKNOWN;
+            }
+        };
+
     protected:
         RefType type;
+        AccessSummary accessSummary;
+        // Every struct indexed along the type path, outermost first, eg: both `A` and `B` for `a.b.c`
+        llvm::SmallVector<StructIndex, 2> structIndices;
 
     public:
         virtual ~GetElementPtrRef() = default;
@@ -23,11 +66,35 @@ namespace Zippy {
         virtual void setAlignment(llvm::Align alignment) = 0;
         virtual llvm::Type *getSourceType() const = 0;
         virtual llvm::Instruction *getInst() const = 0;
+        // Pointer to the struct object the field is part of
+        virtual llvm::Value *getBasePointer() const = 0;
+
+        // Pointer to the struct object indexed at `operandIndex`, inserting the address computation if needed
+        virtual llvm::Value *createObjectPointer(llvm::IRBuilderBase &builder, unsigned operandIndex) const {
+            return getBasePointer();
+        }
+
+        // Whether the field indexed at `operandIndex` is what gets accessed, rather than something nested within it
+        virtual bool addressesField(unsigned operandIndex) const {
+            return true;
+        }
+
+        // Called with the layout of the new struct body, for references addressing fields by byte offset
+        virtual void applyLayout(const llvm::StructLayout *layout) {}
 
         virtual RefType getType() const {
             return type;
         }
 
+        const AccessSummary &getAccessSummary() const {
+            return accessSummary;
+        }
+
+        void setAccessSummary(const AccessSummary &summary) {
+            accessSummary = summary;
+            type = summary.getRefType();
+        }
+
         virtual bool isWrite() const {
             return type == STORE;
         }
@@ -48,8 +115,54 @@ namespace Zippy {
             return structType.ptr == getSourceType();
         }
 
+        const llvm::SmallVector<StructIndex, 2> &getStructIndices() const {
+            return structIndices;
+        }
+
+        static bool hasStructIndex(const llvm::GEPOperator *gepOp) {
+            for (auto it = llvm::gep_type_begin(gepOp); it != llvm::gep_type_end(gepOp); ++it) {
+                if (it.getStructTypeOrNull()) return true;
+            }
+            return false;
+        }
+
+        // Pointer to the struct object indexed at `operandIndex` of the GEP
+        static llvm::Value *createPrefixGEP(llvm::IRBuilderBase &builder, llvm::GEPOperator *gepOp,
+                                            const unsigned operandIndex) {
+            // The struct is addressed by every index before its own, skipped when that is only the leading zero
+            const auto numIndices = operandIndex - 1;
+            const auto *first = llvm::dyn_cast<llvm::ConstantInt>(gepOp->getOperand(1));
+            if (numIndices == 1 && first && first->isZero()) return gepOp->getPointerOperand();
+            const llvm::SmallVector<llvm::Value*, 4> indices(gepOp->idx_begin(), gepOp->idx_begin() + numIndices);
+            return builder.CreateGEP(gepOp->getSourceElementType(), gepOp->getPointerOperand(), indices);
+        }
+
     protected:
-        explicit GetElementPtrRef(const RefType type): type(type) {}
+        explicit GetElementPtrRef(const RefType type): type(type), accessSummary(AccessSummary::of(type)) {}
+
+        void collectStructIndices(const llvm::GEPOperator *gepOp) {
+            unsigned operandIndex = 1;
+            for (auto it = llvm::gep_type_begin(gepOp); it != llvm::gep_type_end(gepOp); ++it, ++operandIndex) {
+                if (auto *structTy = it.getStructTypeOrNull()) structIndices.push_back({structTy, operandIndex});
+            }
+        }
+
+        static void setUserAlignment(const llvm::Align alignment, llvm::GetElementPtrInst *gepInst) {
+            // We need to find **any** references we can reach and update the alignment
+            for (const auto gepUser: gepInst->users()) {
+                if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(gepUser)) {
+                    loadInst->setAlignment(alignment);
+                    continue;
+                }
+                if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(gepUser)) {
+                    storeInst->setAlignment(alignment);
+                    continue;
+                }
+                if (auto *next = llvm::dyn_cast<llvm::GetElementPtrInst>(gepUser)) {
+                    setUserAlignment(alignment, next);
+                }
+            }
+        }
     };
 
     /**
@@ -60,7 +173,9 @@ namespace Zippy {
 
     public:
         GetElementPtrInstRef(llvm::GetElementPtrInst *ptr, const RefType type)
-            : GetElementPtrRef(type), ptr(ptr) {}
+            : GetElementPtrRef(type), ptr(ptr) {
+            collectStructIndices(llvm::cast<llvm::GEPOperator>(ptr));
+        }
 
         llvm::ConstantInt *getOperand(const unsigned operandIndex) const override {
             return llvm::cast<llvm::ConstantInt>(ptr->getOperand(operandIndex));
@@ -71,7 +186,7 @@ namespace Zippy {
         }
 
         void setAlignment(const llvm::Align alignment) override {
-            setAlignment(alignment, ptr);
+            setUserAlignment(alignment, ptr);
         }
 
         llvm::Type *getSourceType() const override {
@@ -82,22 +197,16 @@ namespace Zippy {
             return ptr;
         }
 
-    private:
-        static void setAlignment(const llvm::Align alignment, llvm::GetElementPtrInst *gepInst) {
-            // We need to find **any** references we can reach and update the alignment
-            for (const auto gepUser: gepInst->users()) {
-                if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(gepUser)) {
-                    loadInst->setAlignment(alignment);
-                    continue;
-                }
-                if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(gepUser)) {
-                    storeInst->setAlignment(alignment);
-                    continue;
-                }
-                if (auto *next = llvm::dyn_cast<llvm::GetElementPtrInst>(gepUser)) {
-                    setAlignment(alignment, next);
-                }
-            }
+        llvm::Value *getBasePointer() const override {
+            return ptr->getPointerOperand();
+        }
+
+        llvm::Value *createObjectPointer(llvm::IRBuilderBase &builder, const unsigned operandIndex) const override {
+            return createPrefixGEP(builder, llvm::cast<llvm::GEPOperator>(ptr), operandIndex);
+        }
+
+        bool addressesField(const unsigned operandIndex) const override {
+            return operandIndex == ptr->getNumOperands() - 1;
         }
     };
 
@@ -110,7 +219,9 @@ namespace Zippy {
 
     public:
         GetElementPtrOpRef(llvm::Instruction *instPtr, llvm::GEPOperator *ptr, const RefType type)
-            : GetElementPtrRef(type), instPtr(instPtr), ptr(ptr) {}
+            : GetElementPtrRef(type), instPtr(instPtr), ptr(ptr) {
+            collectStructIndices(ptr);
+        }
 
         bool isOperator() const override {
             return true;
@@ -121,7 +232,30 @@ namespace Zippy {
         }
 
         void setOperand(const unsigned operandIndex, llvm::ConstantInt *operand) override {
-            ptr->setOperand(operandIndex, operand);
+            if (auto *gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(ptr)) {
+                gepInst->setOperand(operandIndex, operand);
+                return;
+            }
+            // Constants are uniqued, so the using instruction is pointed at a new GEP instead of changing this one,
+            // which may also be used elsewhere, eg: in a global initializer
+            const auto constantExpr = llvm::cast<llvm::ConstantExpr>(ptr);
+            llvm::SmallVector<llvm::Constant*, 4> operands;
+            for (const auto &oldOperand: constantExpr->operands()) {
+                operands.push_back(llvm::cast<llvm::Constant>(oldOperand));
+            }
+            operands[operandIndex] = operand;
+            llvm::Value *newGep = constantExpr->getWithOperands(operands);
+            if (!llvm::isa<llvm::GEPOperator>(newGep)) {
+                // Folded away, eg: all zero indices fold into the base pointer, so it is kept as an instruction
+                const llvm::SmallVector<llvm::Value*, 4> indices(ptr->idx_begin(), ptr->idx_end());
+                auto *gepInst = llvm::GetElementPtrInst::Create(ptr->getSourceElementType(), ptr->getPointerOperand(),
+                                                                indices, "", instPtr);
+                gepInst->setIsInBounds(ptr->isInBounds());
+                gepInst->setOperand(operandIndex, operand);
+                newGep = gepInst;
+            }
+            instPtr->replaceUsesOfWith(ptr, newGep);
+            ptr = llvm::cast<llvm::GEPOperator>(newGep);
         }
 
         void setAlignment(const llvm::Align alignment) override {
@@ -139,38 +273,36 @@ namespace Zippy {
         llvm::Instruction *getInst() const override {
             return instPtr;
         }
+
+        llvm::Value *getBasePointer() const override {
+            return ptr->getPointerOperand();
+        }
+
+        llvm::Value *createObjectPointer(llvm::IRBuilderBase &builder, const unsigned operandIndex) const override {
+            return createPrefixGEP(builder, ptr, operandIndex);
+        }
+
+        bool addressesField(const unsigned operandIndex) const override {
+            return operandIndex == ptr->getNumOperands() - 1;
+        }
     };
 
     /**
-     * Handles direct struct access (field 0) without GEP instructions
+     * Handles direct struct access (field 0) without GEP instructions, through a global, an alloca or an element pointer
+     *
+     * The IR is left alone until the field index actually changes, at which point a GEP is inserted in front of the
+     * load or store.
      */
     class DirectStructRef final : public GetElementPtrRef {
         llvm::Instruction *ptr;
         llvm::StructType *structType;
-        llvm::GEPOperator *gepInst;
+        llvm::GetElementPtrInst *gepInst = nullptr;
         llvm::ConstantInt *operand;
     public:
         DirectStructRef(llvm::Instruction *ptr, llvm::StructType *structType, const RefType type)
-            : GetElementPtrRef(type), ptr(ptr), structType(structType) {
-
-            // Creates an IR Builder
-            llvm::IRBuilder irBuilder(ptr);
-            // Creates a GEP, note that '12345' is an evil random number to *avoid* over-eager constant folding
-            auto gep = irBuilder.CreateConstInBoundsGEP2_32(structType, getPointerOperand(), 12345, 0);
-
-            // Actually apply the operand into the instruction unconditionally
-            if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(ptr)) {
-                loadInst->setOperand(loadInst->getPointerOperandIndex(), gep);
-            } else if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(ptr)) {
-                storeInst->setOperand(storeInst->getPointerOperandIndex(), gep);
-            } else {
-                llvm_unreachable("Expected LoadInst or StoreInst");
-            }
-            gepInst = llvm::cast<llvm::GEPOperator>(gep);
-            operand = llvm::cast<llvm::ConstantInt>(gepInst->getOperand(2));
-
-            // This completes the evil hack, which sets the 'array index' of the value back to zero.
-            gepInst->setOperand(1, irBuilder.getInt32(0));
+            : GetElementPtrRef(type), ptr(ptr), structType(structType),
+              operand(llvm::ConstantInt::get(llvm::Type::getInt32Ty(structType->getContext()), 0)) {
+            structIndices.push_back({structType, 2});
         }
 
         bool isInstruction() const override {
@@ -188,8 +320,15 @@ namespace Zippy {
             // Avoid changing the IR if no change is needed
             if (fieldIndex == this->operand->getZExtValue()) return;
 
-            // Apply Operand
-            gepInst->setOperand(2, operand);
+            if (!gepInst) {
+                // Created as an instruction, as constant folding would turn `gep %S, @global, 0, 0` back into `@global`
+                const auto zero = llvm::ConstantInt::get(operand->getType(), 0);
+                gepInst = llvm::GetElementPtrInst::CreateInBounds(structType, getPointerOperand(), {zero, operand}, "",
+                                                                  ptr);
+                setPointerOperand(gepInst);
+            } else {
+                gepInst->setOperand(2, operand);
+            }
 
             // Update the operand
             this->operand = operand;
@@ -198,8 +337,11 @@ namespace Zippy {
         void setAlignment(const llvm::Align alignment) override {
             if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(ptr)) {
                 loadInst->setAlignment(alignment);
-            } else if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(ptr)) {
+                return;
+            }
+            if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(ptr)) {
                 storeInst->setAlignment(alignment);
+                return;
             }
             llvm_unreachable("Expected LoadInst or StoreInst");
         }
@@ -212,6 +354,10 @@ namespace Zippy {
             return ptr;
         }
 
+        llvm::Value *getBasePointer() const override {
+            return gepInst ? gepInst->getPointerOperand() : getPointerOperand();
+        }
+
     private:
         llvm::Value *getPointerOperand() const {
             if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(ptr)) {
@@ -222,5 +368,160 @@ namespace Zippy {
             }
             llvm_unreachable("Expected LoadInst or StoreInst");
         }
+
+        void setPointerOperand(llvm::Value *pointer) const {
+            if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(ptr)) {
+                loadInst->setOperand(loadInst->getPointerOperandIndex(), pointer);
+            } else if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(ptr)) {
+                storeInst->setOperand(storeInst->getPointerOperandIndex(), pointer);
+            } else {
+                llvm_unreachable("Expected LoadInst or StoreInst");
+            }
+        }
+    };
+
+    /**
+     * Contains `getelementptr i8` byte offset accesses, the shape field accesses take once InstCombine has run.
+     *
+     * The field is resolved from the offset into the known pointee struct, and the offset is rewritten from the new
+     * layout once the body has been replaced.
+     */
+    class ByteOffsetGEPRef final : public GetElementPtrRef {
+        // The GEP itself as an instruction, otherwise the load or store using the constant GEP
+        llvm::Instruction *instPtr;
+        llvm::GEPOperator *ptr;
+        llvm::StructType *structType;
+        llvm::ConstantInt *operand;
+        // Accesses may point inside a field, eg: an element of an array field
+        uint64_t offsetInField;
+        // Offsets past the struct step into a neighbouring element of an array of structs
+        uint64_t elementIndex;
+
+    public:
+        // The field a constant byte offset points into, under the current layout of the pointee struct
+        struct Target {
+            llvm::StructType *structType;
+            unsigned fieldIndex;
+            uint64_t offsetInField;
+            uint64_t elementIndex;
+        };
+
+        static bool isByteOffsetGEP(const llvm::GEPOperator *gepOp) {
+            return gepOp->getNumIndices() == 1 && gepOp->getSourceElementType()->isIntegerTy(8);
+        }
+
+        /**
+         * The struct a pointer is known to point at, from where it was allocated or how it was indexed. Globals and
+         * allocas of arrays point at their first element.
+         */
+        static llvm::StructType *inferPointeeStructType(const llvm::Value *ptrOperand) {
+            llvm::Type *type = nullptr;
+            if (const auto *globalVar = llvm::dyn_cast<llvm::GlobalVariable>(ptrOperand)) {
+                type = globalVar->getValueType();
+            } else if (const auto *allocaInst = llvm::dyn_cast<llvm::AllocaInst>(ptrOperand)) {
+                type = allocaInst->getAllocatedType();
+            } else if (const auto *gepOp = llvm::dyn_cast<llvm::GEPOperator>(ptrOperand)) {
+                return llvm::dyn_cast<llvm::StructType>(gepOp->getResultElementType());
+            } else {
+                return nullptr;
+            }
+            while (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type)) {
+                type = arrayTy->getElementType();
+            }
+            return llvm::dyn_cast<llvm::StructType>(type);
+        }
+
+        /**
+         * Resolves a constant byte offset GEP against the struct its base points at. Offsets which are negative, into
+         * padding, or from a base of unknown type don't resolve.
+         */
+        static std::optional<Target> resolve(const llvm::DataLayout &DL, const llvm::GEPOperator *gepOp) {
+            const auto *offsetOperand = llvm::dyn_cast<llvm::ConstantInt>(gepOp->getOperand(1));
+            auto *structTy = inferPointeeStructType(gepOp->getPointerOperand());
+            if (!offsetOperand || !structTy || structTy->isOpaque() || offsetOperand->isNegative()) return std::nullopt;
+
+            const auto *layout = DL.getStructLayout(structTy);
+            // Offsets past the struct step into a neighbouring element of an array of structs
+            const uint64_t structSize = layout->getSizeInBytes();
+            const auto elementIndex = offsetOperand->getZExtValue() / structSize;
+            const auto offset = offsetOperand->getZExtValue() % structSize;
+            const auto fieldIndex = layout->getElementContainingOffset(offset);
+            const auto offsetInField = offset - layout->getElementOffset(fieldIndex).getKnownMinValue();
+            // Offsets into padding don't belong to any field
+            if (offsetInField >= DL.getTypeStoreSize(structTy->getElementType(fieldIndex)).getKnownMinValue())
+                return std::nullopt;
+            return Target{structTy, fieldIndex, offsetInField, elementIndex};
+        }
+
+        ByteOffsetGEPRef(llvm::Instruction *instPtr, llvm::GEPOperator *ptr, llvm::StructType *structType,
+                         const unsigned fieldIndex, const uint64_t offsetInField, const uint64_t elementIndex,
+                         const RefType type)
+            : GetElementPtrRef(type), instPtr(instPtr), ptr(ptr), structType(structType),
+              operand(llvm::ConstantInt::get(llvm::Type::getInt32Ty(structType->getContext()), fieldIndex)),
+              offsetInField(offsetInField), elementIndex(elementIndex) {
+            structIndices.push_back({structType, 2});
+        }
+
+        bool isOperator() const override {
+            return !llvm::isa<llvm::GetElementPtrInst>(ptr);
+        }
+
+        bool isInstruction() const override {
+            return llvm::isa<llvm::GetElementPtrInst>(ptr);
+        }
+
+        llvm::ConstantInt *getOperand(const unsigned operandIndex) const override {
+            assert(operandIndex == 2); // Same magic constant as the direct references
+            return operand;
+        }
+
+        void setOperand(const unsigned operandIndex, llvm::ConstantInt *operand) override {
+            assert(operandIndex == 2); // Same magic constant as the direct references
+            // The offset itself can only be computed once the new body is in place, see `applyLayout`
+            this->operand = operand;
+        }
+
+        void setAlignment(const llvm::Align alignment) override {
+            const auto accessAlignment = llvm::commonAlignment(alignment, offsetInField);
+            if (auto *gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(ptr)) {
+                setUserAlignment(accessAlignment, gepInst);
+            } else if (auto *loadInst = llvm::dyn_cast<llvm::LoadInst>(instPtr)) {
+                loadInst->setAlignment(accessAlignment);
+            } else if (auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(instPtr)) {
+                storeInst->setAlignment(accessAlignment);
+            }
+        }
+
+        void applyLayout(const llvm::StructLayout *layout) override {
+            const auto offset = elementIndex * layout->getSizeInBytes().getKnownMinValue() +
+                                layout->getElementOffset(operand->getZExtValue()).getKnownMinValue() + offsetInField;
+            const auto oldOffset = llvm::cast<llvm::ConstantInt>(ptr->getOperand(1));
+            if (oldOffset->getZExtValue() == offset) return;
+            const auto newOffset = llvm::ConstantInt::get(oldOffset->getIntegerType(), offset);
+
+            if (auto *gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(ptr)) {
+                gepInst->setOperand(1, newOffset);
+                return;
+            }
+            // Constants are uniqued, so the using instruction is pointed at a new GEP instead
+            const auto newGep = llvm::ConstantExpr::getGetElementPtr(
+                ptr->getSourceElementType(), llvm::cast<llvm::Constant>(ptr->getPointerOperand()), newOffset,
+                ptr->isInBounds());
+            instPtr->replaceUsesOfWith(ptr, newGep);
+            // A zero offset folds down to the base pointer itself
+            if (auto *newGepOp = llvm::dyn_cast<llvm::GEPOperator>(newGep)) ptr = newGepOp;
+        }
+
+        llvm::Type *getSourceType() const override {
+            return structType;
+        }
+
+        llvm::Instruction *getInst() const override {
+            return instPtr;
+        }
+
+        llvm::Value *getBasePointer() const override {
+            return ptr->getPointerOperand();
+        }
     };
 }
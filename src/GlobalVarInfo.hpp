@@ -2,34 +2,229 @@
 
 #include "ZippyCommon.hpp"
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+
+#include <algorithm>
+
 namespace Zippy {
+    /**
+     * A global whose initializer has to follow a struct being reordered, either because the struct is laid out
+     * somewhere within its value type, eg: `[N x %S]` or nested in another struct, or because the initializer holds
+     * constant GEPs pointing into the fields of one, eg: a table of field pointers. Byte offsets into a global are
+     * followed down to the struct wherever it is nested, eg: `&table.entry.field`.
+     */
     class GlobalVarInfo {
         GlobalVariable globalVar;
 
         explicit GlobalVarInfo(const GlobalVariable globalVar): globalVar(globalVar) {}
 
+        static bool containsStruct(llvm::Type *type, const llvm::StructType *structTy) {
+            if (type == structTy) return true;
+            if (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type))
+                return containsStruct(arrayTy->getElementType(), structTy);
+            if (const auto outerTy = llvm::dyn_cast<llvm::StructType>(type)) {
+                for (const auto element: outerTy->elements()) {
+                    if (containsStruct(element, structTy)) return true;
+                }
+            }
+            return false;
+        }
+
+        static bool isByteOffsetGEP(const llvm::GEPOperator *gepOp) {
+            return gepOp->getNumIndices() == 1 && gepOp->getSourceElementType()->isIntegerTy(8);
+        }
+
+        // The global a byte offset GEP steps through, the struct may be anywhere within it, eg: nested in another
+        static const llvm::GlobalVariable *getByteOffsetBase(const llvm::GEPOperator *gepOp) {
+            return llvm::dyn_cast<llvm::GlobalVariable>(gepOp->getPointerOperand());
+        }
+
+        static bool referencesStruct(const llvm::Constant *constant, const llvm::StructType *structTy,
+                                     llvm::SmallPtrSetImpl<const llvm::Constant*> &visited) {
+            if (!visited.insert(constant).second) return false;
+            if (const auto gepOp = llvm::dyn_cast<llvm::GEPOperator>(constant)) {
+                const auto base = isByteOffsetGEP(gepOp) ? getByteOffsetBase(gepOp) : nullptr;
+                if (base ? containsStruct(base->getValueType(), structTy)
+                         : containsStruct(gepOp->getSourceElementType(), structTy))
+                    return true;
+            }
+            // Only aggregates and expressions can hold anything further, plain data such as strings can't
+            if (!llvm::isa<llvm::ConstantAggregate, llvm::ConstantExpr>(constant)) return false;
+            for (const auto &operand: constant->operands()) {
+                if (referencesStruct(llvm::cast<llvm::Constant>(operand), structTy, visited)) return true;
+            }
+            return false;
+        }
+
+        /**
+         * Rebuilds a constant for the reordered struct, `positions` maps each initial field index to its new index.
+         */
+        class Remapper {
+            const llvm::DataLayout &DL;
+            llvm::StructType *structTy;
+            const std::vector<unsigned> &positions;
+            const llvm::StructLayout *initialLayout;
+            const llvm::StructLayout *currentLayout;
+            // Initializers are DAGs, each constant is only rebuilt once
+            llvm::DenseMap<llvm::Constant*, llvm::Constant*> remapped;
+
+        public:
+            Remapper(const llvm::DataLayout &DL, llvm::StructType *structTy, const std::vector<unsigned> &positions,
+                     const llvm::StructLayout *initialLayout, const llvm::StructLayout *currentLayout)
+                : DL(DL), structTy(structTy), positions(positions), initialLayout(initialLayout),
+                  currentLayout(currentLayout) {}
+
+            llvm::Constant *remap(llvm::Constant *constant) {
+                if (!llvm::isa<llvm::ConstantAggregate, llvm::ConstantExpr>(constant)) return constant;
+                const auto found = remapped.find(constant);
+                if (found != remapped.end()) return found->second;
+
+                std::vector<llvm::Constant*> operands;
+                operands.reserve(constant->getNumOperands());
+                for (const auto &operand: constant->operands()) {
+                    operands.push_back(remap(llvm::cast<llvm::Constant>(operand)));
+                }
+
+                llvm::Constant *result;
+                if (const auto constantStruct = llvm::dyn_cast<llvm::ConstantStruct>(constant)) {
+                    if (constantStruct->getType() == structTy) {
+                        std::vector<llvm::Constant*> reordered(operands.size());
+                        for (auto i = 0; i < operands.size(); i++) {
+                            reordered[positions[i]] = operands[i];
+                        }
+                        operands = std::move(reordered);
+                    }
+                    result = llvm::ConstantStruct::get(constantStruct->getType(), operands);
+                } else if (const auto constantArray = llvm::dyn_cast<llvm::ConstantArray>(constant)) {
+                    result = llvm::ConstantArray::get(constantArray->getType(), operands);
+                } else if (const auto constantExpr = llvm::dyn_cast<llvm::ConstantExpr>(constant)) {
+                    if (const auto gepOp = llvm::dyn_cast<llvm::GEPOperator>(constantExpr)) remapGEP(gepOp, operands);
+                    result = constantExpr->getWithOperands(operands);
+                } else {
+                    result = constant;
+                }
+                remapped[constant] = result;
+                return result;
+            }
+
+        private:
+            void remapGEP(const llvm::GEPOperator *gepOp, std::vector<llvm::Constant*> &operands) const {
+                if (isByteOffsetGEP(gepOp)) {
+                    const auto base = getByteOffsetBase(gepOp);
+                    const auto offsetOperand = llvm::dyn_cast<llvm::ConstantInt>(operands[1]);
+                    if (!base || !containsStruct(base->getValueType(), structTy) || !offsetOperand ||
+                        offsetOperand->isNegative())
+                        return;
+                    const auto newOffset = remapOffset(base->getValueType(), offsetOperand->getZExtValue());
+                    operands[1] = llvm::ConstantInt::get(offsetOperand->getType(), newOffset);
+                    return;
+                }
+                // The type path is walked by hand, as the struct already has its new body and only the remapped
+                // indices lead through it. The operands are the pointer followed by the indices.
+                auto *type = gepOp->getSourceElementType();
+                for (unsigned operandIndex = 2; operandIndex < operands.size(); operandIndex++) {
+                    if (type == structTy) {
+                        const auto fieldIndex = llvm::cast<llvm::ConstantInt>(operands[operandIndex]);
+                        operands[operandIndex] = llvm::ConstantInt::get(fieldIndex->getType(),
+                                                                        positions[fieldIndex->getZExtValue()]);
+                    }
+                    type = llvm::GetElementPtrInst::getTypeAtIndex(type, operands[operandIndex]);
+                    if (!type) return;
+                }
+            }
+
+            /**
+             * Moves a byte offset into a type holding the struct from the initial layout of the struct to its current
+             * one, eg: `&table.entry.field` with the struct nested in `table`, or an element of an array of them.
+             */
+            uint64_t remapOffset(llvm::Type *type, const uint64_t offset) const {
+                if (!containsStruct(type, structTy)) return offset;
+                // Past the end, eg: a one past the end pointer
+                const auto initialSize = getSize(type, true);
+                if (offset >= initialSize) return getSize(type, false) + offset - initialSize;
+
+                if (type == structTy) {
+                    // The struct already has its new body, the field is found again at its new position
+                    const auto fieldIndex = initialLayout->getElementContainingOffset(offset);
+                    const auto offsetInField = offset - initialLayout->getElementOffset(fieldIndex).getKnownMinValue();
+                    const auto position = positions[fieldIndex];
+                    return currentLayout->getElementOffset(position).getKnownMinValue() +
+                           remapOffset(structTy->getElementType(position), offsetInField);
+                }
+                if (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type)) {
+                    const auto elementTy = arrayTy->getElementType();
+                    const auto initialElementSize = getSize(elementTy, true);
+                    return offset / initialElementSize * getSize(elementTy, false) +
+                           remapOffset(elementTy, offset % initialElementSize);
+                }
+                const auto outerTy = llvm::cast<llvm::StructType>(type);
+                const auto initialOffsets = getFieldOffsets(outerTy, true);
+                const auto currentOffsets = getFieldOffsets(outerTy, false);
+                // The last offset is the size of the outer struct, which the offset is known to be within
+                const auto fieldIndex = std::upper_bound(initialOffsets.begin(), initialOffsets.end() - 1, offset) -
+                                        initialOffsets.begin() - 1;
+                return currentOffsets[fieldIndex] +
+                       remapOffset(outerTy->getElementType(fieldIndex), offset - initialOffsets[fieldIndex]);
+            }
+
+            // Size of a type holding the struct, under the initial or the current layout of the struct
+            uint64_t getSize(llvm::Type *type, const bool initial) const {
+                if (type == structTy)
+                    return (initial ? initialLayout : currentLayout)->getSizeInBytes().getKnownMinValue();
+                if (!containsStruct(type, structTy)) return DL.getTypeAllocSize(type).getKnownMinValue();
+                if (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type))
+                    return arrayTy->getNumElements() * getSize(arrayTy->getElementType(), initial);
+                return getFieldOffsets(llvm::cast<llvm::StructType>(type), initial).back();
+            }
+
+            /**
+             * Offsets of the fields of a struct holding the struct, followed by its size. They are worked out by hand,
+             * as the data layout caches the layout of the outer struct from before the struct was reordered.
+             */
+            std::vector<uint64_t> getFieldOffsets(llvm::StructType *outerTy, const bool initial) const {
+                std::vector<uint64_t> offsets;
+                offsets.reserve(outerTy->getNumElements() + 1);
+                uint64_t offset = 0;
+                llvm::Align maxAlign;
+                for (const auto element: outerTy->elements()) {
+                    const auto align = outerTy->isPacked() ? llvm::Align() : DL.getABITypeAlign(element);
+                    offset = llvm::alignTo(offset, align);
+                    offsets.push_back(offset);
+                    offset += getSize(element, initial);
+                    maxAlign = std::max(maxAlign, align);
+                }
+                offsets.push_back(llvm::alignTo(offset, maxAlign));
+                return offsets;
+            }
+        };
+
     public:
         static std::vector<GlobalVarInfo> collect(llvm::Module &M) {
-            llvm::errs() << "Collecting Global Variables\n";
+            log() << "Collecting Global Variables\n";
             std::vector<GlobalVarInfo> globalVarInfos;
             for (auto &globalVarRaw: M.globals()) {
                 const GlobalVariable globalVar = {&globalVarRaw};
-                // Non-struct globals are fully ignored
-                if (!globalVar.isStructType()) continue;
+                // Declarations have nothing to remap
+                if (!globalVar.ptr->hasInitializer()) continue;
+                // Only aggregates and expressions can hold struct fields, eg: a plain `int` is fully ignored
+                const auto initializer = globalVar.ptr->getInitializer();
+                if (!llvm::isa<llvm::ConstantAggregate, llvm::ConstantExpr, llvm::ConstantAggregateZero>(initializer))
+                    continue;
                 // Log variable name
-                llvm::errs() << TAB_STR << globalVar;
-                // Check for initializer
+                log() << TAB_STR << globalVar;
+                // Zeroes stay zeroes in any order
                 if (!globalVar.isZeroInit()) {
                     globalVarInfos.push_back(GlobalVarInfo(globalVar));
                 } else {
-                    llvm::errs() << " - Zero init, skipped";
+                    log() << " - Zero init, skipped";
                 }
-                llvm::errs() << "\n";
+                log() << "\n";
             }
             if (globalVarInfos.empty()) {
-                llvm::errs() << "No Global Variables collected\n\n";
+                log() << "No Global Variables collected\n\n";
             } else {
-                llvm::errs() << llvm::format("Collected [%d] Global Variables\n\n", globalVarInfos.size());
+                log() << llvm::format("Collected [%d] Global Variables\n\n", globalVarInfos.size());
             }
             return std::move(globalVarInfos);
         }
@@ -42,24 +237,20 @@ namespace Zippy {
             return {globalVar.ptr->getValueType()};
         }
 
-        void remap(const std::vector<unsigned> &remapTable) {
-            // Get old initializer
-            const auto oldInitializer = llvm::dyn_cast<llvm::ConstantStruct>(globalVar.ptr->getInitializer());
-            if (!oldInitializer) llvm_unreachable("Old Initializer for Global Variable absent.");
-            // Validate Operand count in remap table AND initializer
-            const auto numOperands = oldInitializer->getNumOperands();
-            if (numOperands != remapTable.size()) llvm_unreachable("Global Variable Operands don't match Remap Table");
-            // Compute new Operands
-            std::vector<llvm::Constant*> newOperands(numOperands);
-            for (auto i = 0; i < numOperands; ++i) {
-                newOperands[i] = oldInitializer->getOperand(remapTable[i]);
-            }
-            // Create new Initializer
-            const auto structType = llvm::dyn_cast<llvm::StructType>(getValueType().ptr);
-            if (!structType) llvm_unreachable("Global Variable Type is not a Struct");
-            const auto newInitializer = llvm::ConstantStruct::get(structType, newOperands);
-            // Apply new initializer
-            globalVar.ptr->setInitializer(newInitializer);
+        /**
+         * Whether the initializer has to be remapped when the struct is reordered.
+         */
+        bool references(const llvm::StructType *structTy) const {
+            if (containsStruct(globalVar.ptr->getValueType(), structTy)) return true;
+            llvm::SmallPtrSet<const llvm::Constant*, 32> visited;
+            return referencesStruct(globalVar.ptr->getInitializer(), structTy, visited);
+        }
+
+        void remap(llvm::StructType *structTy, const std::vector<unsigned> &positions,
+                   const llvm::StructLayout *initialLayout, const llvm::StructLayout *currentLayout) {
+            Remapper remapper(globalVar.ptr->getParent()->getDataLayout(), structTy, positions, initialLayout,
+                              currentLayout);
+            globalVar.ptr->setInitializer(remapper.remap(globalVar.ptr->getInitializer()));
         }
     };
 }
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "FunctionInfo.hpp"
+#include "StructInfo.hpp"
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+namespace Zippy {
+    enum class InstrumentMode {
+        COUNTS,
+        TRACE
+    };
+
+    static llvm::cl::opt<InstrumentMode> InstrumentModeOpt(
+        "zippy-instrument-mode",
+        llvm::cl::desc("What zippy-instrument records at runtime"),
+        llvm::cl::values(
+            clEnumValN(InstrumentMode::COUNTS, "counts", "Per-field access counts only"),
+            clEnumValN(InstrumentMode::TRACE, "trace", "Access counts plus a sampled address trace")),
+        llvm::cl::init(InstrumentMode::COUNTS));
+
+    /**
+     * Counts every field use at runtime through `libzippy_rt`, which writes the counts out as a profile on exit.
+     * The address of the struct object is passed along for co-access tracking, and in trace mode to be sampled.
+     *
+     * Fields are counted by their original index, the struct types themselves are left untouched.
+     */
+    class Instrumentation {
+        static constexpr auto REGISTER_FUNC_NAME = "__zippy_rt_register_struct";
+        static constexpr auto COUNT_FUNC_NAME = "__zippy_rt_count";
+        static constexpr auto TRACE_FUNC_NAME = "__zippy_rt_trace";
+        static constexpr auto CTOR_FUNC_NAME = "__zippy_rt_module_ctor";
+        static constexpr auto BASE_VAR_PREFIX = "__zippy_rt_base.";
+        static constexpr auto LAYOUT_VAR_PREFIX = "__zippy_rt_layout.";
+
+        llvm::Module &M;
+        llvm::ModuleAnalysisManager &AM;
+        const llvm::DataLayout &DL;
+
+        std::vector<StructInfo> structInfos;
+        std::vector<FunctionInfo> functionInfos;
+
+        bool collect() {
+            structInfos = StructInfo::collect(M, DL);
+            if (structInfos.empty()) return false;
+            functionInfos = FunctionInfo::collect(M, AM);
+            if (functionInfos.empty()) return false;
+
+            unsigned sumUses = 0;
+            for (auto &structInfo: structInfos) {
+                for (auto &functionInfo: functionInfos) {
+                    sumUses += structInfo.collectFieldUses(functionInfo);
+                }
+            }
+            return sumUses != 0;
+        }
+
+        /**
+         * Creates the `zippy_rt_field_layout` table describing the original layout.
+         */
+        llvm::GlobalVariable *createLayoutTable(StructInfo &structInfo) {
+            auto &ctx = M.getContext();
+            const auto i32Type = llvm::Type::getInt32Ty(ctx);
+            const auto entryType = llvm::StructType::get(ctx, {i32Type, i32Type, i32Type});
+            const auto structType = structInfo.getStructType();
+
+            std::vector<llvm::Constant*> entries;
+            for (const auto &fieldInfo: structInfo.getFieldInfos()) {
+                const auto index = fieldInfo.getInitialIndex();
+                entries.push_back(llvm::ConstantStruct::get(entryType, {
+                                                                llvm::ConstantInt::get(
+                                                                    i32Type, structType.getElementOffset(DL, index).getKnownMinValue()),
+                                                                llvm::ConstantInt::get(
+                                                                    i32Type, fieldInfo.getStoreSize().getKnownMinValue()),
+                                                                llvm::ConstantInt::get(
+                                                                    i32Type, fieldInfo.getInitialAlign().value())
+                                                            }));
+            }
+            const auto tableType = llvm::ArrayType::get(entryType, entries.size());
+            return new llvm::GlobalVariable(M, tableType, true, llvm::GlobalValue::PrivateLinkage,
+                                            llvm::ConstantArray::get(tableType, entries),
+                                            LAYOUT_VAR_PREFIX + structType.ptr->getName());
+        }
+
+        void instrument() {
+            auto &ctx = M.getContext();
+            const auto i32Type = llvm::Type::getInt32Ty(ctx);
+            const auto voidType = llvm::Type::getVoidTy(ctx);
+            const auto ptrType = llvm::PointerType::getUnqual(ctx);
+
+            const auto isTrace = InstrumentModeOpt == InstrumentMode::TRACE;
+
+            const auto registerFunc = M.getOrInsertFunction(REGISTER_FUNC_NAME, i32Type, ptrType, i32Type, i32Type,
+                                                            ptrType);
+            const auto countFunc = M.getOrInsertFunction(isTrace ? TRACE_FUNC_NAME : COUNT_FUNC_NAME, voidType,
+                                                         i32Type, i32Type, i32Type, ptrType);
+
+            // The constructor registers each struct once, and stores the base index of its counters
+            const auto ctor = llvm::Function::Create(llvm::FunctionType::get(voidType, false),
+                                                     llvm::GlobalValue::InternalLinkage, CTOR_FUNC_NAME, M);
+            llvm::IRBuilder ctorBuilder(llvm::BasicBlock::Create(ctx, "entry", ctor));
+
+            log() << "Instrumenting Structs\n";
+            unsigned numInstrumented = 0;
+            for (auto &structInfo: structInfos) {
+                if (structInfo.getSumFieldUses() == 0) continue;
+                const auto structTy = structInfo.getStructType().ptr;
+
+                const auto baseVar = new llvm::GlobalVariable(M, i32Type, false, llvm::GlobalValue::InternalLinkage,
+                                                              llvm::ConstantInt::get(i32Type, 0),
+                                                              BASE_VAR_PREFIX + structTy->getName());
+                const auto nameStr = ctorBuilder.CreateGlobalStringPtr(structTy->getName());
+                const auto base = ctorBuilder.CreateCall(registerFunc, {
+                                                             nameStr,
+                                                             ctorBuilder.getInt32(structTy->getNumElements()),
+                                                             ctorBuilder.getInt32(
+                                                                 structInfo.getInitialSize().getKnownMinValue()),
+                                                             createLayoutTable(structInfo)
+                                                         });
+                ctorBuilder.CreateStore(base, baseVar);
+
+                unsigned numCounted = 0;
+                for (const auto &fieldInfo: structInfo.getFieldInfos()) {
+                    for (const auto &use: fieldInfo.getUses()) {
+                        const auto gepRef = use.getGepRef();
+                        llvm::IRBuilder builder(gepRef->getInst());
+                        const auto useBase = builder.CreateLoad(i32Type, baseVar);
+                        builder.CreateCall(countFunc, {
+                                               useBase,
+                                               builder.getInt32(fieldInfo.getInitialIndex()),
+                                               builder.getInt32(structTy->getNumElements()),
+                                               gepRef->createObjectPointer(builder, use.getOperandIndex())
+                                           });
+                        numCounted++;
+                    }
+                }
+                log() << TAB_STR << structInfo.getStructType();
+                log() << llvm::format(" - Counting [%d] uses\n", numCounted);
+                numInstrumented++;
+            }
+            ctorBuilder.CreateRetVoid();
+            llvm::appendToGlobalCtors(M, ctor, 0);
+            log() << llvm::format("Instrumented [%d] Structs\n\n", numInstrumented);
+        }
+
+    public:
+        Instrumentation(llvm::Module &M, llvm::ModuleAnalysisManager &AM): M(M), AM(AM), DL(M.getDataLayout()) {}
+
+        llvm::PreservedAnalyses run() {
+            if (!collect()) {
+                log() << "Nothing to instrument\n";
+                return llvm::PreservedAnalyses::all();
+            }
+            instrument();
+            return llvm::PreservedAnalyses::none();
+        }
+    };
+}
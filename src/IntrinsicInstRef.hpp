@@ -1,66 +1,362 @@
 #pragma once
 
 #include "ZippyCommon.hpp"
+#include "GetElementPtrRef.hpp"
+#include "SizeRef.hpp"
 
 namespace Zippy {
+    /**
+     * A `memcpy` or `memset` over some or all of the bytes of a struct.
+     *
+     * The byte range it covers is resolved into the fields it touches under the initial layout. Once the struct is
+     * reordered, those fields are covered again at their new positions, by as few intrinsics as possible. Whole
+     * structs, or arrays of them, simply get their length scaled to the new size.
+     *
+     * The other side of a `memcpy` copying whole structs may be untyped, it is then assumed to hold the same struct.
+     */
     class IntrinsicInstRef {
+    public:
+        // Part of a field covered by the intrinsic, by initial field index
+        struct FieldRange {
+            unsigned fieldIndex;
+            uint64_t offsetInField;
+            uint64_t length;
+        };
+
     protected:
-        llvm::Type *dstType;
+        // Where a pointer operand points within a struct, and how to get back to the start of that struct
+        struct Location {
+            llvm::StructType *structType = nullptr;
+            // Offset into the struct under the initial layout
+            uint64_t offset = 0;
+            llvm::Value *ptr = nullptr;
+            // Operand of the GEP indexing the first field, zero when `ptr` points at the struct itself
+            unsigned fieldOperand = 0;
+            // Byte offset GEPs step over whole elements of an array of structs
+            bool isByteOffset = false;
+            uint64_t elementIndex = 0;
+        };
+
+        llvm::MemIntrinsic *ptr;
+        // The pointer operand resolved into the struct, and the other one of a `memcpy`
+        Location dst;
+        Location src;
+        llvm::StructType *structType = nullptr;
+        // Number of whole structs covered, zero for a partial range
+        uint64_t multiple = 0;
+        std::vector<FieldRange> fieldRanges;
 
     public:
         virtual ~IntrinsicInstRef() = default;
 
-        // TODO: No implementations of this method don't account for current size
-        virtual void setTypeSize(llvm::TypeSize typeSize) = 0;
+        llvm::StructType *getStructType() const {
+            return structType;
+        }
+
+        const std::vector<FieldRange> &getFieldRanges() const {
+            return fieldRanges;
+        }
+
+        // Struct the intrinsic starts at, when it covers a variable number of them, eg: `memset(p, 0, n * sizeof(S))`
+        llvm::StructType *getArrayStructType() const {
+            if (llvm::isa<llvm::ConstantInt>(ptr->getLength()) || dst.offset != 0) return nullptr;
+            return dst.structType;
+        }
+
+        /**
+         * Rewrites the intrinsic against the new layout, `positions` maps each initial field index to its new index.
+         */
+        void applyLayout(const llvm::DataLayout &DL, const llvm::StructLayout *layout,
+                         const std::vector<unsigned> &positions) {
+            const auto newSize = layout->getSizeInBytes().getKnownMinValue();
+            llvm::IRBuilder builder(ptr);
+
+            // Whole structs keep covering whole structs
+            if (multiple > 0) {
+                const auto base = createBase(builder, dst, newSize);
+                rewrite(builder, base, createOtherBase(builder, newSize), 0, multiple * newSize, true);
+                return;
+            }
+
+            // Place each covered range at the new position of its field, in address order
+            std::vector<std::pair<uint64_t, uint64_t>> segments;
+            for (const auto &fieldRange: fieldRanges) {
+                const auto start = layout->getElementOffset(positions[fieldRange.fieldIndex]).getKnownMinValue() +
+                                   fieldRange.offsetInField;
+                segments.emplace_back(start, start + fieldRange.length);
+            }
+            std::sort(segments.begin(), segments.end());
+
+            // Neighbouring ranges are coalesced, as long as only padding lies between them
+            std::vector<std::pair<uint64_t, uint64_t>> coalesced;
+            for (const auto &segment: segments) {
+                if (!coalesced.empty() && isPadding(DL, layout, coalesced.back().second, segment.first)) {
+                    coalesced.back().second = std::max(coalesced.back().second, segment.second);
+                } else {
+                    coalesced.push_back(segment);
+                }
+            }
+
+            // Only padding was covered
+            if (coalesced.empty()) {
+                ptr->eraseFromParent();
+                return;
+            }
 
-        llvm::Type *getDstType() {
-            return dstType;
+            const auto base = createBase(builder, dst, newSize);
+            const auto otherBase = createOtherBase(builder, newSize);
+            for (auto i = 0; i < coalesced.size(); i++) {
+                rewrite(builder, base, otherBase, coalesced[i].first, coalesced[i].second - coalesced[i].first,
+                        i == 0);
+            }
         }
 
     protected:
-        explicit IntrinsicInstRef(const llvm::CallBase *callBase, const unsigned dstArgIndex) {
-            dstType = nullptr;
-            for (auto &use: callBase->getArgOperand(dstArgIndex)->uses()) {
-                if (const auto allocInst = llvm::dyn_cast<llvm::AllocaInst>(use)) {
-                    dstType = allocInst->getAllocatedType();
-                    return;
+        /**
+         * Resolves the struct a pointer operand points into, leaving the struct type null when it can't be known.
+         */
+        static Location locate(llvm::Value *pointer, const llvm::DataLayout &DL, const unsigned depth = 4) {
+            Location location;
+            location.ptr = pointer;
+            Location unresolved = location;
+            if (const auto allocaInst = llvm::dyn_cast<llvm::AllocaInst>(pointer)) {
+                location.structType = getStructOrArrayElement(allocaInst->getAllocatedType());
+                return location;
+            }
+            if (const auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(pointer)) {
+                location.structType = getStructOrArrayElement(globalVar->getValueType());
+                return location;
+            }
+            auto *gepOp = llvm::dyn_cast<llvm::GEPOperator>(pointer);
+            if (!gepOp) {
+                location.structType = inferPointee(pointer, DL, depth);
+                return location;
+            }
+
+            // Byte offsets are resolved against the struct the base points at
+            if (gepOp->getNumIndices() == 1 && gepOp->getSourceElementType()->isIntegerTy(8)) {
+                const auto base = locate(gepOp->getPointerOperand(), DL, depth);
+                const auto offset = llvm::dyn_cast<llvm::ConstantInt>(gepOp->getOperand(1));
+                if (!base.structType || base.offset != 0 || base.fieldOperand != 0 || base.isByteOffset) return unresolved;
+                if (!offset || offset->isNegative() || base.structType->isOpaque()) return unresolved;
+                const uint64_t size = DL.getTypeAllocSize(base.structType).getKnownMinValue();
+                location.structType = base.structType;
+                location.isByteOffset = true;
+                location.elementIndex = offset->getZExtValue() / size;
+                location.offset = offset->getZExtValue() % size;
+                return location;
+            }
+
+            // Everything from the first field index onward addresses into that struct
+            unsigned operandIndex = 1;
+            for (auto it = llvm::gep_type_begin(gepOp); it != llvm::gep_type_end(gepOp); ++it, ++operandIndex) {
+                auto *structTy = it.getStructTypeOrNull();
+                if (!structTy) continue;
+                llvm::SmallVector<llvm::Value*, 4> indices{llvm::ConstantInt::get(DL.getIndexType(pointer->getType()), 0)};
+                for (auto i = operandIndex; i < gepOp->getNumOperands(); i++) {
+                    if (!llvm::isa<llvm::ConstantInt>(gepOp->getOperand(i))) return unresolved;
+                    indices.push_back(gepOp->getOperand(i));
                 }
-                if (const auto gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(use)) {
-                    dstType = gepInst->getSourceElementType();
-                    return;
+                location.structType = structTy;
+                location.fieldOperand = operandIndex;
+                location.offset = DL.getIndexedOffsetInType(structTy, indices);
+                return location;
+            }
+            // No field indexed, the result is a whole struct, eg: `&data[i]`
+            location.structType = llvm::dyn_cast<llvm::StructType>(gepOp->getResultElementType());
+            return location;
+        }
+
+        /**
+         * The struct an untyped pointer points at the start of, from how it is indexed elsewhere or, for arguments,
+         * what every caller passes in. Pointers spilled at `-O0` are traced back to the value stored.
+         */
+        static llvm::StructType *inferPointee(llvm::Value *pointer, const llvm::DataLayout &DL, const unsigned depth) {
+            if (const auto loadInst = llvm::dyn_cast<llvm::LoadInst>(pointer)) {
+                const auto allocaInst = llvm::dyn_cast<llvm::AllocaInst>(loadInst->getPointerOperand());
+                if (!allocaInst) return nullptr;
+                llvm::StoreInst *spill = nullptr;
+                for (const auto user: allocaInst->users()) {
+                    const auto storeInst = llvm::dyn_cast<llvm::StoreInst>(user);
+                    if (!storeInst || storeInst->getPointerOperand() != allocaInst) continue;
+                    // Only a single store says what the pointer is
+                    if (spill) return nullptr;
+                    spill = storeInst;
                 }
-                if (const auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(use)) {
-                    dstType = globalVar->getValueType();
-                    return;
+                if (!spill) return nullptr;
+                pointer = spill->getValueOperand();
+            }
+            if (const auto structTy = SizeRef::inferIndexedStructType(pointer)) return structTy;
+
+            const auto argument = llvm::dyn_cast<llvm::Argument>(pointer);
+            if (!argument || depth == 0) return nullptr;
+            const auto function = argument->getParent();
+            llvm::StructType *found = nullptr;
+            for (const auto user: function->users()) {
+                const auto callBase = llvm::dyn_cast<llvm::CallBase>(user);
+                if (!callBase || callBase->getCalledFunction() != function) return nullptr;
+                const auto caller = locate(callBase->getArgOperand(argument->getArgNo()), DL, depth - 1);
+                // Field pointers are rewritten themselves, so only pointers to the struct start are trusted
+                if (!caller.structType || caller.offset != 0 || caller.fieldOperand != 0 || caller.isByteOffset)
+                    return nullptr;
+                if (found && found != caller.structType) return nullptr;
+                found = caller.structType;
+            }
+            return found;
+        }
+
+        static llvm::StructType *getStructOrArrayElement(llvm::Type *type) {
+            while (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type)) {
+                type = arrayTy->getElementType();
+            }
+            return llvm::dyn_cast<llvm::StructType>(type);
+        }
+
+        // Pointer to the start of the struct a location points into, as laid out with the new size
+        static llvm::Value *createBase(llvm::IRBuilderBase &builder, const Location &location, const uint64_t newSize) {
+            if (!location.isByteOffset && location.fieldOperand == 0) return location.ptr;
+            auto *gepOp = llvm::cast<llvm::GEPOperator>(location.ptr);
+            if (!location.isByteOffset) return GetElementPtrRef::createPrefixGEP(builder, gepOp, location.fieldOperand);
+            if (location.elementIndex == 0) return gepOp->getPointerOperand();
+            return builder.CreateConstGEP1_64(builder.getInt8Ty(), gepOp->getPointerOperand(),
+                                              location.elementIndex * newSize);
+        }
+
+        // Start of the struct the other pointer of a `memcpy` points into, assumed to be at the same offset if unknown
+        llvm::Value *createOtherBase(llvm::IRBuilderBase &builder, const uint64_t newSize) const {
+            if (!src.ptr) return nullptr;
+            if (src.structType) return createBase(builder, src, newSize);
+            return createOffset(builder, src.ptr, -static_cast<int64_t>(dst.offset));
+        }
+
+        static llvm::Value *createOffset(llvm::IRBuilderBase &builder, llvm::Value *pointer, const int64_t offset) {
+            if (offset == 0) return pointer;
+            return builder.CreateGEP(builder.getInt8Ty(), pointer, builder.getInt64(offset));
+        }
+
+        /**
+         * Resolves the range covered into fields, leaving the struct type null when it isn't supported.
+         */
+        void resolveRange(const llvm::DataLayout &DL) {
+            const auto length = llvm::dyn_cast<llvm::ConstantInt>(ptr->getLength());
+            if (!length || !dst.structType || dst.structType->isOpaque()) return;
+            const auto *layout = DL.getStructLayout(dst.structType);
+            const uint64_t size = layout->getSizeInBytes();
+            const auto start = dst.offset;
+            const auto end = start + length->getZExtValue();
+
+            if (start == 0 && length->getZExtValue() % size == 0) {
+                multiple = length->getZExtValue() / size;
+            } else if (end <= size) {
+                for (unsigned i = 0; i < dst.structType->getNumElements(); i++) {
+                    const uint64_t fieldStart = layout->getElementOffset(i).getKnownMinValue();
+                    const uint64_t fieldEnd = fieldStart +
+                                          DL.getTypeStoreSize(dst.structType->getElementType(i)).getKnownMinValue();
+                    const auto rangeStart = std::max(start, fieldStart);
+                    const auto rangeEnd = std::min(end, fieldEnd);
+                    if (rangeStart < rangeEnd)
+                        fieldRanges.push_back({i, rangeStart - fieldStart, rangeEnd - rangeStart});
                 }
+            } else {
+                // Partially covering more than one struct isn't supported
+                return;
             }
-            llvm_unreachable("Destination type is null, failed to implicitly find");
+            structType = dst.structType;
         }
+
+        // Whether no field of the new layout has any byte in the range
+        bool isPadding(const llvm::DataLayout &DL, const llvm::StructLayout *layout, const uint64_t start,
+                       const uint64_t end) const {
+            for (unsigned i = 0; i < structType->getNumElements(); i++) {
+                const uint64_t fieldStart = layout->getElementOffset(i).getKnownMinValue();
+                const uint64_t fieldEnd = fieldStart +
+                                      DL.getTypeStoreSize(structType->getElementType(i)).getKnownMinValue();
+                if (fieldStart < end && start < fieldEnd) return false;
+            }
+            return true;
+        }
+
+        static llvm::Align getAlignmentAt(const llvm::MaybeAlign alignment, const uint64_t oldOffset,
+                                          const uint64_t newOffset) {
+            // The alignment known for the struct start, from the one at the original offset
+            const auto baseAlign = llvm::commonAlignment(alignment.valueOrOne(), oldOffset);
+            return llvm::commonAlignment(baseAlign, newOffset);
+        }
+
+        /**
+         * Covers `length` bytes at `offset` from the struct start, reusing the intrinsic itself for the first range.
+         */
+        virtual void rewrite(llvm::IRBuilderBase &builder, llvm::Value *base, llvm::Value *otherBase, uint64_t offset,
+                             uint64_t length, bool isFirst) = 0;
+
+        explicit IntrinsicInstRef(llvm::MemIntrinsic *ptr, const llvm::DataLayout &DL)
+            : ptr(ptr), dst(locate(ptr->getRawDest(), DL)) {}
     };
 
     class MemCpyInstRef final : public IntrinsicInstRef {
-        llvm::MemCpyInst *ptr;
+        // The source was resolved rather than the destination
+        bool isSwapped = false;
 
     public:
-        explicit MemCpyInstRef(llvm::MemCpyInst *ptr)
-            : IntrinsicInstRef(ptr, 0), ptr(ptr) {}
+        explicit MemCpyInstRef(llvm::MemCpyInst *ptr, const llvm::DataLayout &DL)
+            : IntrinsicInstRef(ptr, DL) {
+            src = locate(ptr->getRawSource(), DL);
+            // Copies out of a struct into memory of unknown type are resolved through the source instead
+            if (!dst.structType) {
+                std::swap(dst, src);
+                isSwapped = true;
+            }
+            // Both sides must agree on what is being copied, when both are known
+            if (src.structType && (src.structType != dst.structType || src.offset != dst.offset)) return;
+            resolveRange(DL);
+            // Part of a struct copied to or from untyped memory, eg: a byte buffer, can't be placed
+            if (!src.structType && multiple == 0) structType = nullptr;
+        }
 
-        void setTypeSize(const llvm::TypeSize typeSize) override {
-            const auto baseLen = llvm::cast<llvm::ConstantInt>(ptr->getArgOperand(2));
-            ptr->setOperand(2, llvm::ConstantInt::get(baseLen->getIntegerType(), typeSize));
+    protected:
+        void rewrite(llvm::IRBuilderBase &builder, llvm::Value *base, llvm::Value *otherBase, const uint64_t offset,
+                     const uint64_t length, const bool isFirst) override {
+            auto *memCpyInst = llvm::cast<llvm::MemCpyInst>(ptr);
+            auto *dstPtr = createOffset(builder, base, static_cast<int64_t>(offset));
+            auto *srcPtr = createOffset(builder, otherBase, static_cast<int64_t>(offset));
+            if (isSwapped) std::swap(dstPtr, srcPtr);
+
+            const auto dstAlign = getAlignmentAt(memCpyInst->getDestAlign(), dst.offset, offset);
+            const auto srcAlign = getAlignmentAt(memCpyInst->getSourceAlign(), dst.offset, offset);
+            const auto lengthValue = llvm::ConstantInt::get(memCpyInst->getLength()->getType(), length);
+            if (!isFirst) {
+                builder.CreateMemCpy(dstPtr, dstAlign, srcPtr, srcAlign, lengthValue, memCpyInst->isVolatile());
+                return;
+            }
+            memCpyInst->setDest(dstPtr);
+            memCpyInst->setSource(srcPtr);
+            memCpyInst->setDestAlignment(dstAlign);
+            memCpyInst->setSourceAlignment(srcAlign);
+            memCpyInst->setLength(lengthValue);
         }
     };
 
     class MemSetInstRef final : public IntrinsicInstRef {
-        llvm::MemSetInst *ptr;
-
     public:
-        explicit MemSetInstRef(llvm::MemSetInst *ptr)
-            : IntrinsicInstRef(ptr, 0), ptr(ptr) {}
+        explicit MemSetInstRef(llvm::MemSetInst *ptr, const llvm::DataLayout &DL)
+            : IntrinsicInstRef(ptr, DL) {
+            resolveRange(DL);
+        }
 
-        void setTypeSize(const llvm::TypeSize typeSize) override {
-            const auto baseLen = llvm::cast<llvm::ConstantInt>(ptr->getArgOperand(2));
-            ptr->setOperand(2, llvm::ConstantInt::get(baseLen->getIntegerType(), typeSize));
+    protected:
+        void rewrite(llvm::IRBuilderBase &builder, llvm::Value *base, llvm::Value *otherBase, const uint64_t offset,
+                     const uint64_t length, const bool isFirst) override {
+            auto *memSetInst = llvm::cast<llvm::MemSetInst>(ptr);
+            auto *dstPtr = createOffset(builder, base, static_cast<int64_t>(offset));
+            const auto dstAlign = getAlignmentAt(memSetInst->getDestAlign(), dst.offset, offset);
+            const auto lengthValue = llvm::ConstantInt::get(memSetInst->getLength()->getType(), length);
+            if (!isFirst) {
+                builder.CreateMemSet(dstPtr, memSetInst->getValue(), lengthValue, dstAlign, memSetInst->isVolatile());
+                return;
+            }
+            memSetInst->setDest(dstPtr);
+            memSetInst->setDestAlignment(dstAlign);
+            memSetInst->setLength(lengthValue);
         }
     };
 }
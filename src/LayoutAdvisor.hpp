@@ -0,0 +1,195 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "DebugTypeInfo.hpp"
+#include "FieldAccessInfo.hpp"
+#include "LoopLayoutInfo.hpp"
+
+#include <llvm/BinaryFormat/Dwarf.h>
+
+namespace Zippy {
+    /**
+     * Writes the computed layouts out as C struct definitions, for structs which can't be reordered by the compiler,
+     * eg: as part of a public ABI, but can be by hand.
+     *
+     * Fields are named and typed after the debug info describing the struct, or after their IR type without it. Each
+     * definition comes with its predicted size and padding, and the cache lines each loop touches per element.
+     */
+    class LayoutAdvisor {
+        const llvm::DataLayout &DL;
+        const FieldAccessInfo &fieldAccessInfo;
+        DebugTypeInfo debugTypeInfo;
+        std::vector<LoopLayoutInfo> loopLayoutInfos;
+
+        static std::string join(const std::string &typeName, const std::string &declarator) {
+            return declarator.empty() ? typeName : typeName + " " + declarator;
+        }
+
+        // Pointers to arrays and functions need parentheses, as the suffix binds tighter than `*`
+        static bool hasSuffix(const llvm::DIType *type) {
+            if (const auto composite = llvm::dyn_cast_or_null<llvm::DICompositeType>(type))
+                return composite->getTag() == llvm::dwarf::DW_TAG_array_type;
+            return llvm::isa_and_nonnull<llvm::DISubroutineType>(type);
+        }
+
+        /**
+         * C declaration of `declarator` as the given debug info type, eg: `const char *name` or `int (*fn)(int)`.
+         */
+        static std::string declare(const llvm::DIType *type, const std::string &declarator) {
+            // `void` has no type of its own
+            if (!type) return join("void", declarator);
+
+            if (const auto derived = llvm::dyn_cast<llvm::DIDerivedType>(type)) {
+                const auto baseType = derived->getBaseType();
+                switch (derived->getTag()) {
+                    case llvm::dwarf::DW_TAG_pointer_type:
+                        return declare(baseType, hasSuffix(baseType) ? "(*" + declarator + ")" : "*" + declarator);
+                    case llvm::dwarf::DW_TAG_reference_type:
+                        return declare(baseType, hasSuffix(baseType) ? "(&" + declarator + ")" : "&" + declarator);
+                    case llvm::dwarf::DW_TAG_const_type:
+                    case llvm::dwarf::DW_TAG_volatile_type:
+                    case llvm::dwarf::DW_TAG_restrict_type:
+                    case llvm::dwarf::DW_TAG_atomic_type: {
+                        const auto qualifier = derived->getTag() == llvm::dwarf::DW_TAG_const_type
+                                                   ? "const"
+                                                   : derived->getTag() == llvm::dwarf::DW_TAG_volatile_type
+                                                   ? "volatile"
+                                                   : derived->getTag() == llvm::dwarf::DW_TAG_restrict_type
+                                                   ? "restrict"
+                                                   : "_Atomic";
+                        // Qualifies the pointer itself, eg: `char *const name`
+                        const auto baseDerived = llvm::dyn_cast_or_null<llvm::DIDerivedType>(baseType);
+                        if (baseDerived && baseDerived->getTag() == llvm::dwarf::DW_TAG_pointer_type)
+                            return declare(baseType, std::string(qualifier) + " " + declarator);
+                        return std::string(qualifier) + " " + declare(baseType, declarator);
+                    }
+                    default:
+                        return join(derived->getName().str(), declarator);
+                }
+            }
+
+            if (const auto composite = llvm::dyn_cast<llvm::DICompositeType>(type)) {
+                switch (composite->getTag()) {
+                    case llvm::dwarf::DW_TAG_array_type: {
+                        std::string dimensions;
+                        for (const auto element: composite->getElements()) {
+                            const auto subrange = llvm::dyn_cast<llvm::DISubrange>(element);
+                            const auto count = subrange
+                                                   ? llvm::dyn_cast_if_present<llvm::ConstantInt*>(subrange->getCount())
+                                                   : nullptr;
+                            dimensions += count && !count->isMinusOne()
+                                              ? "[" + std::to_string(count->getSExtValue()) + "]"
+                                              : "[]";
+                        }
+                        return declare(composite->getBaseType(), declarator + dimensions);
+                    }
+                    case llvm::dwarf::DW_TAG_union_type:
+                        return join("union " + composite->getName().str(), declarator);
+                    case llvm::dwarf::DW_TAG_enumeration_type:
+                        return join("enum " + composite->getName().str(), declarator);
+                    default:
+                        return join("struct " + composite->getName().str(), declarator);
+                }
+            }
+
+            if (const auto subroutine = llvm::dyn_cast<llvm::DISubroutineType>(type)) {
+                const auto types = subroutine->getTypeArray();
+                std::string parameters;
+                for (unsigned i = 1; i < types.size(); i++) {
+                    if (i > 1) parameters += ", ";
+                    // Variadic functions end on a null type
+                    parameters += types[i] ? declare(types[i], "") : "...";
+                }
+                const auto returnType = types.size() > 0 ? types[0] : nullptr;
+                return declare(returnType, declarator + "(" + (parameters.empty() ? "void" : parameters) + ")");
+            }
+
+            return join(type->getName().str(), declarator);
+        }
+
+        /**
+         * C declaration of `declarator` as the given IR type, for structs without debug info.
+         */
+        static std::string declare(llvm::Type *type, const std::string &declarator) {
+            if (type->isIntegerTy(1)) return join("bool", declarator);
+            if (type->isIntegerTy(8) || type->isIntegerTy(16) || type->isIntegerTy(32) || type->isIntegerTy(64))
+                return join("int" + std::to_string(type->getIntegerBitWidth()) + "_t", declarator);
+            if (type->isFloatTy()) return join("float", declarator);
+            if (type->isDoubleTy()) return join("double", declarator);
+            if (type->isX86_FP80Ty()) return join("long double", declarator);
+            if (type->isPointerTy()) return join("void", "*" + declarator);
+            if (const auto arrayType = llvm::dyn_cast<llvm::ArrayType>(type))
+                return declare(arrayType->getElementType(),
+                               declarator + "[" + std::to_string(arrayType->getNumElements()) + "]");
+            if (const auto structType = llvm::dyn_cast<llvm::StructType>(type); structType && structType->hasName())
+                return join("struct " + DebugTypeInfo::getSourceName(structType->getName()).str(), declarator);
+
+            // Anything else is left for the reader, eg: vectors and literal structs
+            std::string typeName;
+            llvm::raw_string_ostream typeNameStream(typeName);
+            typeNameStream << "/* ";
+            type->print(typeNameStream);
+            typeNameStream << " */";
+            return join(typeNameStream.str(), declarator);
+        }
+
+        void printDefinition(llvm::raw_ostream &OS, const StructInfo &structInfo) const {
+            const auto structTy = structInfo.getStructType().ptr;
+            std::vector<const llvm::DIDerivedType*> fieldMembers;
+            const auto composite = debugTypeInfo.findComposite(structTy, structInfo.getInitialLayout(), fieldMembers);
+
+            // Summary of the predicted layout, and of every loop it changes the footprint of
+            const auto initialSize = structInfo.getInitialSize().getKnownMinValue();
+            const auto targetSize = structInfo.getTargetLayout()->getSizeInBytes().getKnownMinValue();
+            const auto sumFieldSizes = structInfo.getSumFieldSizes();
+            OS << "/*\n * " << structInfo.getStructType();
+            OS << llvm::format("\n * Size: [%llu] -> [%llu] - Padding: [%llu] -> [%llu]\n", initialSize, targetSize,
+                               initialSize - sumFieldSizes, targetSize - sumFieldSizes);
+            for (const auto &loopLayoutInfo: loopLayoutInfos) {
+                for (const auto &footprint: loopLayoutInfo.getFootprints()) {
+                    if (footprint.structInfo != &structInfo) continue;
+                    OS << " * Loop: ";
+                    loopLayoutInfo.getFunction().printName(OS);
+                    OS << " - Header: ";
+                    loopLayoutInfo.getLoop()->getHeader()->printAsOperand(OS, false);
+                    OS << llvm::format(" - Lines Per Element: [%d] -> [%d]\n", footprint.currentLines,
+                                       footprint.targetLines);
+                }
+            }
+            OS << " */\n";
+
+            // Anonymous structs are only named through their typedef
+            const auto sourceName = DebugTypeInfo::getSourceName(structTy->getName());
+            const auto isTypedef = composite && composite->getName().empty();
+            OS << (isTypedef ? "typedef struct" : "struct " + (composite ? composite->getName() : sourceName).str());
+            OS << (structTy->isPacked() ? " __attribute__((packed)) {\n" : " {\n");
+            for (const auto &fieldInfo: structInfo.getFieldInfos()) {
+                const auto index = fieldInfo.getInitialIndex();
+                const auto member = composite ? fieldMembers[index] : nullptr;
+                const auto fieldName = member && !member->getName().empty()
+                                           ? member->getName().str()
+                                           : "field_" + std::to_string(index);
+                OS << TAB_STR << (member
+                                      ? declare(member->getBaseType(), fieldName)
+                                      : declare(fieldInfo.getType().ptr, fieldName));
+                OS << llvm::format("; /* Index: [%02d] - Total Weight: [%06.2f] */\n", index,
+                                   fieldInfo.getTotalWeight());
+            }
+            OS << "}" << (isTypedef ? " " + sourceName.str() : "") << ";\n\n";
+        }
+
+    public:
+        LayoutAdvisor(llvm::Module &M, const FieldAccessInfo &fieldAccessInfo): DL(M.getDataLayout()),
+            fieldAccessInfo(fieldAccessInfo),
+            debugTypeInfo(DebugTypeInfo::collect(M)),
+            loopLayoutInfos(LoopLayoutInfo::collect(fieldAccessInfo.getStructInfos(),
+                                                    fieldAccessInfo.getFunctionInfos(), DL)) {}
+
+        void print(llvm::raw_ostream &OS) const {
+            OS << "/* Zippy Layout Advice */\n\n";
+            for (const auto &structInfo: fieldAccessInfo.getStructInfos()) {
+                printDefinition(OS, structInfo);
+            }
+        }
+    };
+}
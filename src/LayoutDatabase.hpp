@@ -0,0 +1,185 @@
+#pragma once
+
+#include "ZippyLog.hpp"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Zippy {
+    /**
+     * Layouts decided so far, shared on disk by every compile of a project so separately compiled translation units
+     * agree on the layout of each struct.
+     *
+     * Layouts are keyed by the struct name and a hash of its original body. The first decision for a key wins: a
+     * compile reuses any layout already recorded and only appends the ones it had to compute. The file is read
+     * through a memory mapping without locking, and only locked while appending, where it is read again to pick up
+     * decisions other compiles made in the meantime.
+     *
+     * Only depends on LLVM Support, so the standalone tools can read and write databases too.
+     */
+    class LayoutDatabase {
+    public:
+        static constexpr const char *MAGIC = "ZIPPY-LAYOUTS";
+        static constexpr unsigned VERSION = 1;
+
+        // Struct name and the hash of its original body
+        using Key = std::pair<std::string, uint64_t>;
+
+        static uint64_t hashSignature(const llvm::StringRef signature) {
+            return llvm::xxHash64(signature);
+        }
+
+    private:
+        std::string path;
+        // Initial field indices in their new order
+        std::map<Key, std::vector<unsigned>> layouts;
+        // Recorded by this compile, not yet in the file
+        std::map<Key, std::vector<unsigned>> pending;
+
+        explicit LayoutDatabase(std::string path): path(std::move(path)) {}
+
+        /**
+         * Reads `<hash> <order> <name>` lines, eg: `0123456789abcdef 2,0,1 struct.Foo`, keeping the first of each key.
+         */
+        bool parse(const llvm::StringRef buffer) {
+            llvm::SmallVector<llvm::StringRef, 64> lines;
+            buffer.split(lines, '\n', -1, false);
+            // Empty until the first layout is appended
+            if (lines.empty()) return true;
+            const auto [magic, version] = lines.front().split(' ');
+            unsigned versionNumber;
+            if (magic != MAGIC || version.getAsInteger(10, versionNumber) || versionNumber != VERSION) return false;
+
+            for (const auto line: llvm::drop_begin(lines)) {
+                const auto [hashText, rest] = line.split(' ');
+                const auto [orderText, name] = rest.split(' ');
+                uint64_t hash;
+                if (hashText.getAsInteger(16, hash) || name.empty()) return false;
+                std::vector<unsigned> order;
+                llvm::SmallVector<llvm::StringRef, 16> indices;
+                orderText.split(indices, ',');
+                for (const auto indexText: indices) {
+                    unsigned index;
+                    if (indexText.getAsInteger(10, index)) return false;
+                    order.push_back(index);
+                }
+                layouts.try_emplace({name.str(), hash}, std::move(order));
+            }
+            return true;
+        }
+
+        static void writeLayout(llvm::raw_ostream &out, const Key &key, const std::vector<unsigned> &order) {
+            out << llvm::format_hex_no_prefix(key.second, 16) << ' ';
+            llvm::interleave(order, out, ",");
+            out << ' ' << key.first << '\n';
+        }
+
+    public:
+        /**
+         * Maps in the database at `path`, a missing file is an empty database which is created on commit.
+         */
+        static std::optional<LayoutDatabase> load(const llvm::StringRef path) {
+            log() << "Loading Layout Database: " << path << "\n";
+            LayoutDatabase layoutDatabase(path.str());
+            if (!llvm::sys::fs::exists(path)) {
+                log() << "No layouts recorded yet\n\n";
+                return layoutDatabase;
+            }
+            auto bufferOrErr = llvm::MemoryBuffer::getFile(path, false, false);
+            if (!bufferOrErr) {
+                llvm::errs() << "Failed to read layout database, ignored\n\n";
+                return std::nullopt;
+            }
+            if (!layoutDatabase.parse((*bufferOrErr)->getBuffer())) {
+                llvm::errs() << "Malformed or outdated layout database, ignored\n\n";
+                return std::nullopt;
+            }
+            log() << llvm::format("Loaded [%d] Layouts\n\n", layoutDatabase.layouts.size());
+            return layoutDatabase;
+        }
+
+        const std::vector<unsigned> *lookup(const Key &key) const {
+            auto found = layouts.find(key);
+            if (found != layouts.end()) return &found->second;
+            found = pending.find(key);
+            return found == pending.end() ? nullptr : &found->second;
+        }
+
+        void record(const Key &key, std::vector<unsigned> order) {
+            if (layouts.count(key)) return;
+            pending.try_emplace(key, std::move(order));
+        }
+
+        const std::map<Key, std::vector<unsigned>> &getLayouts() const {
+            return layouts;
+        }
+
+        /**
+         * Appends the layouts recorded since loading, unless another compile recorded the same key first, in which
+         * case its layout replaces the recorded one. Returns whether the database could be written.
+         */
+        bool commit() {
+            if (pending.empty()) return true;
+            int fd;
+            if (const auto errorCode = llvm::sys::fs::openFileForReadWrite(path, fd, llvm::sys::fs::CD_OpenAlways,
+                                                                          llvm::sys::fs::OF_Append)) {
+                llvm::errs() << "Failed to open layout database: " << errorCode.message() << "\n";
+                return false;
+            }
+            if (const auto errorCode = llvm::sys::fs::lockFile(fd)) {
+                llvm::errs() << "Failed to lock layout database: " << errorCode.message() << "\n";
+                llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+                return false;
+            }
+
+            // Decisions committed since loading win over the pending ones
+            llvm::sys::fs::file_status status;
+            auto isValid = !llvm::sys::fs::status(fd, status);
+            if (isValid && status.getSize() > 0) {
+                auto bufferOrErr = llvm::MemoryBuffer::getOpenFile(llvm::sys::fs::convertFDToNativeFile(fd), path,
+                                                                   status.getSize(), false);
+                isValid = bufferOrErr && parse((*bufferOrErr)->getBuffer());
+            }
+            if (isValid) {
+                llvm::raw_fd_ostream out(fd, false);
+                if (status.getSize() == 0) out << MAGIC << ' ' << VERSION << '\n';
+                for (auto &[key, order]: pending) {
+                    if (layouts.try_emplace(key, std::move(order)).second) writeLayout(out, key, layouts[key]);
+                }
+                out.flush();
+            } else {
+                llvm::errs() << "Malformed or outdated layout database, left as is\n";
+            }
+            pending.clear();
+
+            llvm::sys::fs::unlockFile(fd);
+            llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+            return isValid;
+        }
+
+        /**
+         * Writes every layout, pending ones included, as a complete database.
+         */
+        void write(llvm::raw_ostream &out) const {
+            out << MAGIC << ' ' << VERSION << '\n';
+            for (const auto &[key, order]: layouts) {
+                writeLayout(out, key, order);
+            }
+            for (const auto &[key, order]: pending) {
+                if (!layouts.count(key)) writeLayout(out, key, order);
+            }
+        }
+    };
+}
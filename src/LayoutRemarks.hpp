@@ -0,0 +1,152 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "FieldAccessInfo.hpp"
+#include "LoopLayoutInfo.hpp"
+
+#include <llvm/Analysis/OptimizationRemarkEmitter.h>
+#include <llvm/IR/DiagnosticInfo.h>
+
+namespace Zippy {
+    /**
+     * Optimization remarks for every layout decision, for `-Rpass=zippy`, `-Rpass-missed=zippy` and
+     * `-fsave-optimization-record`.
+     *
+     * Reordered structs are reported where their hottest field is used, with the change in size and in cache lines
+     * touched per loop iteration. Unsafe structs are reported as missed where they were found unsafe, eg: at the call
+     * they escape through, otherwise at the first use found. Every other struct that isn't laid out is reported as missed
+     * at the start of the module, with the reason it was given up on.
+     */
+    class LayoutRemarks {
+        llvm::Module &M;
+        llvm::FunctionAnalysisManager &FAM;
+        bool isEnabled;
+        // Cache lines touched per element over every loop using the struct, under the current and target layout
+        llvm::DenseMap<const StructInfo*, std::pair<unsigned, unsigned>> loopLines;
+        llvm::DenseMap<const StructInfo*, unsigned> numLoops;
+
+        static const llvm::Instruction *findInstruction(const llvm::Value *value) {
+            if (!value) return nullptr;
+            llvm::SmallPtrSet<const llvm::Value*, 16> visited;
+            std::vector<const llvm::Value*> worklist{value};
+            while (!worklist.empty()) {
+                const auto current = worklist.back();
+                worklist.pop_back();
+                if (!visited.insert(current).second) continue;
+                if (const auto inst = llvm::dyn_cast<llvm::Instruction>(current)) return inst;
+                // Globals and arguments are located at their first use, through any constant expressions
+                for (const auto user: current->users()) {
+                    worklist.push_back(user);
+                }
+            }
+            return nullptr;
+        }
+
+        llvm::Function *findFirstDefinedFunction() const {
+            for (auto &function: M.functions()) {
+                if (!function.isDeclaration()) return &function;
+            }
+            return nullptr;
+        }
+
+        /**
+         * Emits a remark at `value`, or at the start of the module for anything without a location.
+         */
+        template<typename RemarkT, typename BuildFn>
+        void emit(const llvm::Value *value, const llvm::StringRef remarkName, BuildFn build) {
+            const auto inst = findInstruction(value);
+            // Only non const to look up its analyses
+            const auto function = inst ? const_cast<llvm::Function*>(inst->getFunction()) : findFirstDefinedFunction();
+            if (!function) return;
+            auto &ORE = FAM.getResult<llvm::OptimizationRemarkEmitterAnalysis>(*function);
+            ORE.emit([&] {
+                auto remark = inst
+                                  ? RemarkT(PASS_NAME, remarkName, inst)
+                                  : RemarkT(PASS_NAME, remarkName, function->getSubprogram(),
+                                            &function->getEntryBlock());
+                build(remark);
+                return remark;
+            });
+        }
+
+        // Anchors a struct at the first use of its hottest field
+        static const llvm::Value *findHottestUse(const StructInfo &structInfo) {
+            for (const auto &fieldInfo: structInfo.getFieldInfos()) {
+                if (!fieldInfo.getUses().empty()) return fieldInfo.getUses().front().getGepRef()->getInst();
+            }
+            return nullptr;
+        }
+
+    public:
+        static constexpr const char *PASS_NAME = "zippy";
+
+        /**
+         * Takes the loop footprints of the target layouts, so has to be created before transforming.
+         */
+        LayoutRemarks(llvm::Module &M, llvm::ModuleAnalysisManager &AM, const FieldAccessInfo &fieldAccessInfo): M(M),
+            FAM(AM.getResult<llvm::FunctionAnalysisManagerModuleProxy>(M).getManager()) {
+            auto &context = M.getContext();
+            isEnabled = context.getLLVMRemarkStreamer() || context.getDiagHandlerPtr()->isAnyRemarkEnabled(PASS_NAME);
+            if (!isEnabled) return;
+            for (const auto &loopLayoutInfo: LoopLayoutInfo::collect(fieldAccessInfo.getStructInfos(),
+                                                                     fieldAccessInfo.getFunctionInfos(),
+                                                                     M.getDataLayout())) {
+                for (const auto &footprint: loopLayoutInfo.getFootprints()) {
+                    auto &[currentLines, targetLines] = loopLines[footprint.structInfo];
+                    currentLines += footprint.currentLines;
+                    targetLines += footprint.targetLines;
+                    numLoops[footprint.structInfo]++;
+                }
+            }
+        }
+
+        void emitUnsafe(const FieldAccessInfo &fieldAccessInfo) {
+            if (!isEnabled) return;
+            for (const auto &[structTy, unsafeStruct]: fieldAccessInfo.getUnsafeStructs()) {
+                const auto name = structTy->getName();
+                const auto &reason = unsafeStruct.reason;
+                emit<llvm::OptimizationRemarkMissed>(unsafeStruct.value, "UnsafeStruct", [&](auto &remark) {
+                    remark << "not reordering " << llvm::ore::NV("Struct", name) << ": "
+                           << llvm::ore::NV("Reason", reason);
+                });
+            }
+        }
+
+        void emitRejected(const FieldAccessInfo &fieldAccessInfo) {
+            if (!isEnabled) return;
+            for (const auto &[structTy, reason]: fieldAccessInfo.getRejectedStructs()) {
+                // Unnamed structs go by their body instead
+                const auto name = structTy->hasName() ? structTy->getName().str() : StructType{structTy}.getSignature();
+                emit<llvm::OptimizationRemarkMissed>(nullptr, "RejectedStruct", [&](auto &remark) {
+                    remark << "not reordering " << llvm::ore::NV("Struct", name) << ": "
+                           << llvm::ore::NV("Reason", reason);
+                });
+            }
+        }
+
+        void emitTransformed(const StructInfo &structInfo) {
+            if (!isEnabled) return;
+            const auto name = structInfo.getStructType().ptr->getName();
+            const auto initialSize = structInfo.getInitialSize().getKnownMinValue();
+            const auto currentSize = structInfo.getCurrentSize().getKnownMinValue();
+            const auto lines = loopLines.lookup(&structInfo);
+            const auto loops = numLoops.lookup(&structInfo);
+            emit<llvm::OptimizationRemark>(findHottestUse(structInfo), "Reordered", [&](auto &remark) {
+                remark << "reordered " << llvm::ore::NV("Struct", name) << ": "
+                       << llvm::ore::NV("InitialSize", initialSize) << " -> "
+                       << llvm::ore::NV("TargetSize", currentSize) << " bytes, "
+                       << llvm::ore::NV("InitialLines", lines.first) << " -> "
+                       << llvm::ore::NV("TargetLines", lines.second) << " cache lines per iteration over "
+                       << llvm::ore::NV("NumLoops", loops) << " loops";
+            });
+        }
+
+        void emitUnchanged(const StructInfo &structInfo) {
+            if (!isEnabled) return;
+            const auto name = structInfo.getStructType().ptr->getName();
+            emit<llvm::OptimizationRemarkAnalysis>(findHottestUse(structInfo), "Unchanged", [&](auto &remark) {
+                remark << llvm::ore::NV("Struct", name) << " is already in its target layout";
+            });
+        }
+    };
+}
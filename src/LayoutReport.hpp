@@ -0,0 +1,179 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "FieldAccessInfo.hpp"
+#include "LoopLayoutInfo.hpp"
+
+#include <llvm/Support/JSON.h>
+
+namespace Zippy {
+    /**
+     * Machine readable report of every layout decision within a module, for tracking layouts and their predicted
+     * effect across builds.
+     *
+     * Each safe struct is reported with its initial and target order, the offset, size and alignment of its fields
+     * under both layouts, the weights behind the order and the cache lines each loop touches per element. Unsafe
+     * structs are reported with the reason they were skipped, and the same sizes, order and fields, with their target
+     * layout being the initial one.
+     */
+    class LayoutReport {
+        const llvm::Module &M;
+        const llvm::DataLayout &DL;
+        const FieldAccessInfo &fieldAccessInfo;
+        std::vector<LoopLayoutInfo> loopLayoutInfos;
+
+        template<typename T>
+        static void writePair(llvm::json::OStream &J, const llvm::StringRef key, const T initial, const T target) {
+            J.attributeObject(key, [&] {
+                J.attribute("initial", initial);
+                J.attribute("target", target);
+            });
+        }
+
+        /**
+         * Writes the sizes and the order of a struct, with `order` listing the initial field indices in target order.
+         */
+        static void writeSizes(llvm::json::OStream &J, const uint64_t initialSize, const uint64_t targetSize,
+                               const uint64_t sumFieldSizes, const llvm::ArrayRef<unsigned> order) {
+            writePair(J, "size", initialSize, targetSize);
+            writePair(J, "padding", initialSize - sumFieldSizes, targetSize - sumFieldSizes);
+            J.attributeObject("order", [&] {
+                J.attributeArray("initial", [&] {
+                    for (unsigned i = 0; i < order.size(); i++) J.value(i);
+                });
+                J.attributeArray("target", [&] {
+                    for (const auto index: order) J.value(index);
+                });
+            });
+        }
+
+        /**
+         * Writes where the field at `index` is placed, the attributes every reported field starts with.
+         */
+        void writeFieldLayout(llvm::json::OStream &J, const Type type, const unsigned index, const unsigned position,
+                              const uint64_t initialOffset, const uint64_t targetOffset) const {
+            std::string typeName;
+            llvm::raw_string_ostream typeNameStream(typeName);
+            type.ptr->print(typeNameStream);
+
+            J.attribute("index", index);
+            J.attribute("position", position);
+            J.attribute("type", typeNameStream.str());
+            J.attribute("size", type.getAllocSize(DL).getKnownMinValue());
+            J.attribute("align", type.getABIAlign(DL).value());
+            writePair(J, "offset", initialOffset, targetOffset);
+        }
+
+        void writeField(llvm::json::OStream &J, const StructInfo &structInfo, const llvm::StructLayout *targetLayout,
+                        const unsigned index) const {
+            const auto position = structInfo.findPosition(index);
+            const auto &fieldInfo = structInfo.getFieldInfos()[position];
+
+            J.object([&] {
+                writeFieldLayout(J, fieldInfo.getType(), index, position,
+                                 structInfo.getInitialLayout()->getElementOffset(index).getKnownMinValue(),
+                                 targetLayout->getElementOffset(position).getKnownMinValue());
+                J.attribute("loads", fieldInfo.getNumLoads());
+                J.attribute("stores", fieldInfo.getNumStores());
+                J.attributeObject("weights", [&] {
+                    J.attribute("size", fieldInfo.getSizeWeight());
+                    J.attribute("load", fieldInfo.getLoadWeight());
+                    J.attribute("store", fieldInfo.getStoreWeight());
+                    J.attribute("loop", fieldInfo.getLoopWeight());
+                    J.attribute("profile", fieldInfo.getProfileWeight());
+                    J.attribute("total", fieldInfo.getTotalWeight());
+                });
+            });
+        }
+
+        void writeStruct(llvm::json::OStream &J, const StructInfo &structInfo) const {
+            const auto targetLayout = structInfo.getTargetLayout();
+            const auto initialSize = structInfo.getInitialSize().getKnownMinValue();
+            const auto targetSize = targetLayout->getSizeInBytes().getKnownMinValue();
+            const auto sumFieldSizes = structInfo.getSumFieldSizes();
+            const auto numFields = structInfo.getFieldInfos().size();
+
+            J.object([&] {
+                J.attribute("name", structInfo.getStructType().ptr->getName());
+                J.attribute("safe", true);
+                J.attribute("profiled", structInfo.getHasProfile());
+                writeSizes(J, initialSize, targetSize, sumFieldSizes, structInfo.getOrder());
+                J.attributeArray("fields", [&] {
+                    for (unsigned i = 0; i < numFields; i++) {
+                        writeField(J, structInfo, targetLayout, i);
+                    }
+                });
+                J.attributeArray("loops", [&] {
+                    for (const auto &loopLayoutInfo: loopLayoutInfos) {
+                        for (const auto &footprint: loopLayoutInfo.getFootprints()) {
+                            if (footprint.structInfo != &structInfo) continue;
+                            J.object([&] {
+                                J.attribute("function", loopLayoutInfo.getFunction().ptr->getName());
+                                J.attribute("header", loopLayoutInfo.getLoop()->getHeader()->getName());
+                                J.attribute("depth", loopLayoutInfo.getLoop()->getLoopDepth());
+                                J.attributeArray("fields", [&] {
+                                    for (const auto index: footprint.fieldIndices) J.value(index);
+                                });
+                                writePair(J, "lines", footprint.currentLines, footprint.targetLines);
+                            });
+                        }
+                    }
+                });
+            });
+        }
+
+        /**
+         * Unsafe structs keep their layout, so their target is their initial layout.
+         */
+        void writeUnsafeStruct(llvm::json::OStream &J, llvm::StructType *structTy,
+                               const FieldAccessInfo::UnsafeStruct &unsafeStruct) const {
+            const auto layout = DL.getStructLayout(structTy);
+            const auto size = DL.getTypeAllocSize(structTy).getKnownMinValue();
+            const auto numFields = structTy->getNumElements();
+            uint64_t sumFieldSizes = 0;
+            std::vector<unsigned> order(numFields);
+            for (unsigned i = 0; i < numFields; i++) {
+                sumFieldSizes += Type{structTy->getElementType(i)}.getAllocSize(DL).getKnownMinValue();
+                order[i] = i;
+            }
+
+            J.object([&] {
+                J.attribute("name", structTy->getName());
+                J.attribute("safe", false);
+                J.attribute("reason", unsafeStruct.reason);
+                writeSizes(J, size, size, sumFieldSizes, order);
+                J.attributeArray("fields", [&] {
+                    for (unsigned i = 0; i < numFields; i++) {
+                        const auto offset = layout->getElementOffset(i).getKnownMinValue();
+                        J.object([&] {
+                            writeFieldLayout(J, Type{structTy->getElementType(i)}, i, i, offset, offset);
+                        });
+                    }
+                });
+            });
+        }
+
+    public:
+        LayoutReport(const llvm::Module &M, const FieldAccessInfo &fieldAccessInfo): M(M),
+            DL(M.getDataLayout()),
+            fieldAccessInfo(fieldAccessInfo),
+            loopLayoutInfos(LoopLayoutInfo::collect(fieldAccessInfo.getStructInfos(),
+                                                    fieldAccessInfo.getFunctionInfos(), DL)) {}
+
+        void write(llvm::raw_ostream &out) const {
+            llvm::json::OStream J(out, 2);
+            J.object([&] {
+                J.attribute("module", M.getModuleIdentifier());
+                J.attributeArray("structs", [&] {
+                    for (const auto &structInfo: fieldAccessInfo.getStructInfos()) {
+                        writeStruct(J, structInfo);
+                    }
+                    for (const auto &[structTy, unsafeStruct]: fieldAccessInfo.getUnsafeStructs()) {
+                        writeUnsafeStruct(J, structTy, unsafeStruct);
+                    }
+                });
+            });
+            out << "\n";
+        }
+    };
+}
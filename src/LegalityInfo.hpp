@@ -0,0 +1,432 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "GetElementPtrRef.hpp"
+#include "IntrinsicInstRef.hpp"
+#include "SizeRef.hpp"
+#include "SummaryInfo.hpp"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/Support/CommandLine.h>
+
+namespace Zippy {
+    static llvm::cl::opt<bool> WholeProgram(
+        "zippy-whole-program",
+        llvm::cl::desc("Assume nothing outside the module sees the structs, eg: a single source executable. Implied "
+                       "under full LTO, and with summaries or a layout database"),
+        llvm::cl::init(false));
+
+    /**
+     * Finds the struct types whose layout can be observed from outside the module, which must keep their layout.
+     *
+     * Pointers to each struct are followed from everywhere they are known to originate (globals, allocas and typed
+     * GEPs) through phis, selects, casts, spills to allocas, defined callees and returns. A struct is unsafe once such
+     * a pointer reaches an external declaration, `ptrtoint`, a `memcpy` or `memset` of unknown size or not resolved
+     * into fields, `memmove`, inline asm, varargs, an indirect call, a byte offset that isn't resolved to a field or a
+     * stride over an array of the struct, or a load or store reaching across fields, eg: a struct passed by value as an
+     * `i64`. Structs nested within an unsafe struct are unsafe too, as are nested structs a partial `memcpy` or a
+     * constant byte offset into the outer struct reaches, unless that offset is only held by global initializers.
+     *
+     * Pointers stored anywhere but an alloca are not followed, they are caught again wherever they are used typed.
+     */
+    class LegalityInfo {
+        const llvm::DataLayout &DL;
+        llvm::DenseMap<const llvm::StructType*, std::string> unsafeReasons;
+        // Where each struct was found unsafe, if anywhere in particular
+        llvm::DenseMap<const llvm::StructType*, const llvm::Value*> unsafeValues;
+        llvm::DenseMap<const llvm::StructType*, llvm::SmallPtrSet<const llvm::Value*, 32>> visitedValues;
+        // Escapes to external functions are only recorded, for summaries where another module may define them
+        bool deferExternalCalls;
+        // Whether exported functions and globals are only used by modules laid out the same way
+        bool wholeProgram;
+        llvm::DenseMap<const llvm::StructType*, std::vector<SummaryInfo::ExternalArg>> externalCallees;
+
+        // External functions that only ever see the struct as opaque memory
+        static bool isAllowedExternal(const llvm::Function *callee) {
+            if (callee->isIntrinsic()) return true;
+            const auto name = callee->getName();
+            return name == "free" || name == "realloc";
+        }
+
+        static llvm::StructType *getStructOrArrayElement(llvm::Type *type) {
+            while (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type)) {
+                type = arrayTy->getElementType();
+            }
+            return llvm::dyn_cast<llvm::StructType>(type);
+        }
+
+        static bool containsStruct(llvm::Type *type, const llvm::StructType *structTy) {
+            if (type == structTy) return true;
+            if (const auto arrayTy = llvm::dyn_cast<llvm::ArrayType>(type))
+                return containsStruct(arrayTy->getElementType(), structTy);
+            if (const auto outerTy = llvm::dyn_cast<llvm::StructType>(type))
+                return llvm::any_of(outerTy->elements(), [&](auto *element) { return containsStruct(element, structTy); });
+            return false;
+        }
+
+        void markUnsafe(const llvm::StructType *structTy, const std::string &reason, const llvm::Value *value) {
+            if (!unsafeReasons.try_emplace(structTy, reason).second) return;
+            unsafeValues[structTy] = value;
+            // Nested structs are laid out as part of the outer one
+            for (const auto element: structTy->elements()) {
+                if (const auto nestedTy = getStructOrArrayElement(element)) {
+                    markUnsafe(nestedTy, "nested in " + structTy->getName().str(), value);
+                }
+            }
+        }
+
+        void addExternalCallee(const llvm::StructType *structTy, const SummaryInfo::ExternalArg &callee) {
+            auto &callees = externalCallees[structTy];
+            if (llvm::is_contained(callees, callee)) return;
+            callees.push_back(callee);
+            // Nested structs escape along with the outer one
+            for (const auto element: structTy->elements()) {
+                if (const auto nestedTy = getStructOrArrayElement(element)) addExternalCallee(nestedTy, callee);
+            }
+        }
+
+        /**
+         * Checks a `memcpy` or `memset` the struct pointer is passed to, which is only rewritten once it has been
+         * resolved into the fields it covers, see `IntrinsicInstRef`.
+         */
+        void checkMemIntrinsic(llvm::StructType *structTy, llvm::MemIntrinsic *memIntrinsic) {
+            const auto memCpy = llvm::dyn_cast<llvm::MemCpyInst>(memIntrinsic);
+            const auto memSet = llvm::dyn_cast<llvm::MemSetInst>(memIntrinsic);
+            if (!memCpy && !memSet) {
+                markUnsafe(structTy, "copied by '" + memIntrinsic->getCalledFunction()->getName().str() + "'",
+                           memIntrinsic);
+                return;
+            }
+            const std::string verb = memCpy ? "copied" : "set";
+            std::unique_ptr<IntrinsicInstRef> intrinsicRef;
+            if (memCpy) intrinsicRef = std::make_unique<MemCpyInstRef>(memCpy, DL);
+            else intrinsicRef = std::make_unique<MemSetInstRef>(memSet, DL);
+
+            // Lengths must be known, or a whole number of structs from the start of one, eg: `n * sizeof(S)`
+            if (!llvm::isa<llvm::ConstantInt>(memIntrinsic->getLength())) {
+                const auto allocSize = DL.getTypeAllocSize(structTy).getKnownMinValue();
+                if (!SizeRef::isSize(memIntrinsic->getLength(), allocSize) ||
+                    intrinsicRef->getArrayStructType() != structTy)
+                    markUnsafe(structTy, verb + " with an unknown size", memIntrinsic);
+                return;
+            }
+            if (intrinsicRef->getStructType() != structTy) {
+                markUnsafe(structTy, verb + " without being resolved into fields", memIntrinsic);
+                return;
+            }
+            // Ranges are only placed by the field they start in, so a struct nested within one has to stay as is
+            for (const auto &fieldRange: intrinsicRef->getFieldRanges()) {
+                if (const auto nestedTy = getStructOrArrayElement(structTy->getElementType(fieldRange.fieldIndex)))
+                    markUnsafe(nestedTy, "partially " + verb + " through " + structTy->getName().str(), memIntrinsic);
+            }
+        }
+
+        /**
+         * Checks a call the struct pointer is passed to, returning the callee argument to follow if there is one.
+         */
+        const llvm::Value *checkCall(llvm::StructType *structTy, const llvm::CallBase *callBase,
+                                     const llvm::Use &use) {
+            if (callBase->isInlineAsm()) {
+                markUnsafe(structTy, "passed to inline asm", callBase);
+                return nullptr;
+            }
+            if (const auto memIntrinsic = llvm::dyn_cast<llvm::MemIntrinsic>(callBase)) {
+                checkMemIntrinsic(structTy, const_cast<llvm::MemIntrinsic*>(memIntrinsic));
+                return nullptr;
+            }
+            if (!callBase->isArgOperand(&use)) return nullptr;
+
+            const auto argNo = callBase->getArgOperandNo(&use);
+            if (argNo >= callBase->getFunctionType()->getNumParams()) {
+                markUnsafe(structTy, "passed through varargs", callBase);
+                return nullptr;
+            }
+            const auto callee = callBase->getCalledFunction();
+            if (!callee) {
+                markUnsafe(structTy, "escapes through an indirect call", callBase);
+                return nullptr;
+            }
+            if (callee->isDeclaration()) {
+                if (!isAllowedExternal(callee)) {
+                    const auto name = callee->getName().str();
+                    if (deferExternalCalls) addExternalCallee(structTy, {name, argNo});
+                    else markUnsafe(structTy, "escapes to external function '" + name + "'", callBase);
+                }
+                // The result of `realloc` is the same object
+                return callee->getName() == "realloc" ? callBase : nullptr;
+            }
+            return callee->getArg(argNo);
+        }
+
+        /**
+         * Checks a constant byte offset into the struct. The offset is only rewritten for the field of the struct it
+         * points into, so a struct nested within that field has to keep its layout, unless the offset is part of a
+         * global initializer.
+         */
+        void checkConstantOffset(const llvm::StructType *structTy, const llvm::GEPOperator *gepOp) {
+            // Only offsets collected as a field reference get rewritten, see `FunctionInfo`
+            const auto target = ByteOffsetGEPRef::resolve(DL, gepOp);
+            if (!target || target->structType != structTy || !isCollected(gepOp)) {
+                markUnsafe(structTy, "accessed by a byte offset not resolved to a field", gepOp);
+                return;
+            }
+            // Offsets held by global initializers are followed down into nested structs instead, see `GlobalVarInfo`
+            const auto nestedTy = getStructOrArrayElement(structTy->getElementType(target->fieldIndex));
+            if (nestedTy && !isInitializerOffset(gepOp))
+                markUnsafe(nestedTy, "accessed by a byte offset into " + structTy->getName().str(), gepOp);
+            for (const auto user: gepOp->users()) {
+                checkAccess(structTy, user, gepOp, target->fieldIndex, target->offsetInField);
+            }
+        }
+
+        // Constant expressions are only collected as the pointer of a load or store, or in a global initializer
+        static bool isCollected(const llvm::GEPOperator *gepOp) {
+            if (llvm::isa<llvm::GetElementPtrInst>(gepOp)) return true;
+            return llvm::all_of(gepOp->users(), [gepOp](const llvm::User *user) {
+                return llvm::isa<llvm::Constant>(user) || llvm::getLoadStorePointerOperand(user) == gepOp;
+            });
+        }
+
+        static bool isInitializerOffset(const llvm::GEPOperator *gepOp) {
+            return llvm::isa<llvm::Constant>(gepOp) && llvm::isa<llvm::GlobalVariable>(gepOp->getPointerOperand()) &&
+                   isOnlyInInitializers(llvm::cast<llvm::Constant>(gepOp));
+        }
+
+        static bool isOnlyInInitializers(const llvm::Constant *constant) {
+            return llvm::all_of(constant->users(), [](const llvm::User *user) {
+                if (llvm::isa<llvm::GlobalVariable>(user)) return true;
+                return llvm::isa<llvm::ConstantAggregate, llvm::ConstantExpr>(user) &&
+                       isOnlyInInitializers(llvm::cast<llvm::Constant>(user));
+            });
+        }
+
+        /**
+         * Checks a load or store through a pointer into the struct, which must stay within the field it starts in,
+         * eg: a struct passed by value is loaded as an `i64` covering several fields.
+         */
+        void checkAccess(const llvm::StructType *structTy, const llvm::User *user, const llvm::Value *pointer,
+                         const unsigned fieldIndex, const uint64_t offsetInField) {
+            if (llvm::getLoadStorePointerOperand(user) != pointer || structTy->getNumElements() == 0) return;
+            const auto accessTy = llvm::getLoadStoreType(const_cast<llvm::User*>(user));
+            // Whole structs are loaded and stored typed
+            if (accessTy == structTy) return;
+            const auto fieldSize = DL.getTypeStoreSize(structTy->getElementType(fieldIndex)).getKnownMinValue();
+            if (offsetInField + DL.getTypeStoreSize(accessTy).getKnownMinValue() > fieldSize)
+                markUnsafe(structTy, "accessed across fields as " + getTypeName(accessTy), user);
+        }
+
+        static std::string getTypeName(const llvm::Type *type) {
+            std::string name;
+            llvm::raw_string_ostream OS(name);
+            type->print(OS);
+            return name;
+        }
+
+        void walk(llvm::StructType *structTy, const llvm::Value *root) {
+            auto &visited = visitedValues[structTy];
+            std::vector<const llvm::Value*> worklist{root};
+            while (!worklist.empty()) {
+                // Nothing more to find once unsafe
+                if (unsafeReasons.count(structTy)) return;
+                const auto value = worklist.back();
+                worklist.pop_back();
+                if (!visited.insert(value).second) continue;
+
+                if (const auto argument = llvm::dyn_cast<llvm::Argument>(value)) {
+                    const auto function = argument->getParent();
+                    if (!wholeProgram && !function->hasLocalLinkage() && function->getName() != "main")
+                        markUnsafe(structTy, "passed in from outside the module", argument);
+                }
+
+                for (const auto &use: value->uses()) {
+                    const auto user = use.getUser();
+                    if (const auto storeInst = llvm::dyn_cast<llvm::StoreInst>(user)) {
+                        if (storeInst->getPointerOperand() == value) {
+                            checkAccess(structTy, storeInst, value, 0, 0);
+                            continue;
+                        }
+                        // Spilled pointers are followed through the loads of the alloca they are spilled to
+                        const auto allocaInst = llvm::dyn_cast<llvm::AllocaInst>(storeInst->getPointerOperand());
+                        if (!allocaInst) continue;
+                        for (const auto allocaUser: allocaInst->users()) {
+                            if (llvm::isa<llvm::LoadInst>(allocaUser)) worklist.push_back(allocaUser);
+                        }
+                    } else if (llvm::isa<llvm::LoadInst>(user)) {
+                        checkAccess(structTy, user, value, 0, 0);
+                    } else if (const auto gepOp = llvm::dyn_cast<llvm::GEPOperator>(user)) {
+                        if (gepOp->getPointerOperand() != value) continue;
+                        if (ByteOffsetGEPRef::isByteOffsetGEP(gepOp)) {
+                            const auto offset = gepOp->getOperand(1);
+                            const auto allocSize = DL.getTypeAllocSize(structTy).getKnownMinValue();
+                            // Whole elements of an array are stepped over, eg: `p + i * sizeof(S)`
+                            if (SizeRef::isSize(offset, allocSize)) {
+                                worklist.push_back(gepOp);
+                            } else if (!llvm::isa<llvm::ConstantInt>(offset)) {
+                                markUnsafe(structTy, "indexed by an unresolved byte offset", gepOp);
+                            } else {
+                                checkConstantOffset(structTy, gepOp);
+                            }
+                            continue;
+                        }
+                        // Stepping over an array of the struct, field pointers are no longer struct pointers
+                        if (gepOp->getResultElementType() == structTy) worklist.push_back(gepOp);
+                    } else if (llvm::isa<llvm::PHINode, llvm::SelectInst, llvm::BitCastOperator,
+                        llvm::AddrSpaceCastOperator>(user)) {
+                        worklist.push_back(user);
+                    } else if (llvm::isa<llvm::PtrToIntOperator>(user)) {
+                        markUnsafe(structTy, "cast to an integer", user);
+                    } else if (const auto callBase = llvm::dyn_cast<llvm::CallBase>(user)) {
+                        if (const auto next = checkCall(structTy, callBase, use)) worklist.push_back(next);
+                    } else if (const auto returnInst = llvm::dyn_cast<llvm::ReturnInst>(user)) {
+                        // Returned pointers are followed from every call site
+                        for (const auto functionUser: returnInst->getFunction()->users()) {
+                            const auto callBase = llvm::dyn_cast<llvm::CallBase>(functionUser);
+                            if (callBase && callBase->getCalledFunction() == returnInst->getFunction())
+                                worklist.push_back(callBase);
+                        }
+                    }
+                }
+            }
+        }
+
+        LegalityInfo(const llvm::DataLayout &DL, const bool deferExternalCalls, const bool wholeProgram): DL(DL),
+            deferExternalCalls(deferExternalCalls),
+            wholeProgram(wholeProgram) {}
+
+    public:
+        /**
+         * With `deferExternalCalls`, escapes to external functions are left to the caller, see `getExternalCallees`.
+         * Without `wholeProgram`, structs reachable through exported functions and globals are unsafe.
+         */
+        static LegalityInfo compute(llvm::Module &M, const bool deferExternalCalls, const bool wholeProgram) {
+            LegalityInfo legalityInfo(M.getDataLayout(), deferExternalCalls, wholeProgram);
+            for (auto &globalVar: M.globals()) {
+                const auto structTy = getStructOrArrayElement(globalVar.getValueType());
+                if (!structTy) continue;
+                if (!wholeProgram && !globalVar.hasLocalLinkage())
+                    legalityInfo.markUnsafe(structTy, "global visible outside the module", &globalVar);
+                legalityInfo.walk(structTy, &globalVar);
+            }
+            for (auto &globalVar: M.globals()) {
+                // Initializers which don't fit the struct, eg: literal types clang emits for padded arrays, are laid
+                // out by their own type and wouldn't follow a reordering
+                for (const auto user: globalVar.users()) {
+                    const auto gepOp = llvm::dyn_cast<llvm::GEPOperator>(user);
+                    if (!gepOp || gepOp->getPointerOperand() != &globalVar) continue;
+                    const auto structTy = getStructOrArrayElement(gepOp->getSourceElementType());
+                    if (structTy && !containsStruct(globalVar.getValueType(), structTy))
+                        legalityInfo.markUnsafe(structTy, "global initialized as a different type", gepOp);
+                }
+            }
+            for (auto &function: M.functions()) {
+                if (function.isDeclaration()) continue;
+                for (auto &inst: llvm::instructions(function)) {
+                    if (const auto allocaInst = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
+                        if (const auto structTy = getStructOrArrayElement(allocaInst->getAllocatedType()))
+                            legalityInfo.walk(structTy, allocaInst);
+                    } else if (const auto gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst)) {
+                        // Typed GEPs tell what both their base and their result point at
+                        if (const auto structTy = getStructOrArrayElement(gepInst->getSourceElementType()))
+                            legalityInfo.walk(structTy, gepInst->getPointerOperand());
+                        if (const auto structTy = llvm::dyn_cast<llvm::StructType>(gepInst->getResultElementType()))
+                            legalityInfo.walk(structTy, gepInst);
+                    }
+                }
+            }
+            return legalityInfo;
+        }
+
+        bool isSafe(const llvm::StructType *structTy) const {
+            return !unsafeReasons.count(structTy);
+        }
+
+        llvm::StringRef getReason(const llvm::StructType *structTy) const {
+            const auto found = unsafeReasons.find(structTy);
+            return found == unsafeReasons.end() ? llvm::StringRef() : llvm::StringRef(found->second);
+        }
+
+        /**
+         * Where the struct was found unsafe, eg: the call it escapes through, or null if nowhere in particular.
+         */
+        const llvm::Value *getUnsafeValue(const llvm::StructType *structTy) const {
+            return unsafeValues.lookup(structTy);
+        }
+
+        /**
+         * External functions a pointer to the struct reaches, only recorded when deferred.
+         */
+        llvm::ArrayRef<SummaryInfo::ExternalArg> getExternalCallees(const llvm::StructType *structTy) const {
+            const auto found = externalCallees.find(structTy);
+            if (found == externalCallees.end()) return {};
+            return found->second;
+        }
+
+        /**
+         * Why a pointer argument of a function other modules may call can't be passed a struct of theirs, or empty if
+         * it can, along with the external functions it is passed on to.
+         *
+         * The pointer could be to any struct, so only what keeps any struct intact is allowed: typed GEPs, which the
+         * legality of this module covers for the struct they name, and passing it on through calls. Loads, stores and
+         * byte offsets straight off the pointer would be left pointing at the old fields.
+         */
+        static std::string checkArgument(const llvm::Argument *argument,
+                                         std::vector<SummaryInfo::ExternalArg> &forwards) {
+            llvm::SmallPtrSet<const llvm::Value*, 32> visited;
+            std::vector<const llvm::Value*> worklist{argument};
+            while (!worklist.empty()) {
+                const auto value = worklist.back();
+                worklist.pop_back();
+                if (!visited.insert(value).second) continue;
+
+                for (const auto &use: value->uses()) {
+                    const auto user = use.getUser();
+                    if (const auto storeInst = llvm::dyn_cast<llvm::StoreInst>(user)) {
+                        if (storeInst->getPointerOperand() == value) return "stored to without a type";
+                        // Spilled pointers are followed through the loads of the alloca they are spilled to
+                        const auto allocaInst = llvm::dyn_cast<llvm::AllocaInst>(storeInst->getPointerOperand());
+                        if (!allocaInst) continue;
+                        for (const auto allocaUser: allocaInst->users()) {
+                            if (llvm::isa<llvm::LoadInst>(allocaUser)) worklist.push_back(allocaUser);
+                        }
+                    } else if (llvm::isa<llvm::LoadInst>(user)) {
+                        return "loaded from without a type";
+                    } else if (const auto gepOp = llvm::dyn_cast<llvm::GEPOperator>(user)) {
+                        if (gepOp->getPointerOperand() != value) continue;
+                        if (!getStructOrArrayElement(gepOp->getSourceElementType()))
+                            return "indexed as " + getTypeName(gepOp->getSourceElementType());
+                    } else if (llvm::isa<llvm::PHINode, llvm::SelectInst, llvm::BitCastOperator,
+                        llvm::AddrSpaceCastOperator>(user)) {
+                        worklist.push_back(user);
+                    } else if (llvm::isa<llvm::PtrToIntOperator>(user)) {
+                        return "cast to an integer";
+                    } else if (const auto callBase = llvm::dyn_cast<llvm::CallBase>(user)) {
+                        if (callBase->isInlineAsm()) return "passed to inline asm";
+                        if (llvm::isa<llvm::MemIntrinsic>(callBase)) return "copied or set without a type";
+                        if (!callBase->isArgOperand(&use)) continue;
+                        const auto argNo = callBase->getArgOperandNo(&use);
+                        if (argNo >= callBase->getFunctionType()->getNumParams()) return "passed through varargs";
+                        const auto callee = callBase->getCalledFunction();
+                        if (!callee) return "escapes through an indirect call";
+                        if (!callee->isDeclaration()) {
+                            worklist.push_back(callee->getArg(argNo));
+                        } else if (!isAllowedExternal(callee)) {
+                            const SummaryInfo::ExternalArg forward{callee->getName().str(), argNo};
+                            if (!llvm::is_contained(forwards, forward)) forwards.push_back(forward);
+                        } else if (callee->getName() == "realloc") {
+                            worklist.push_back(callBase);
+                        }
+                    } else if (const auto returnInst = llvm::dyn_cast<llvm::ReturnInst>(user)) {
+                        for (const auto functionUser: returnInst->getFunction()->users()) {
+                            const auto callBase = llvm::dyn_cast<llvm::CallBase>(functionUser);
+                            if (callBase && callBase->getCalledFunction() == returnInst->getFunction())
+                                worklist.push_back(callBase);
+                        }
+                    }
+                }
+            }
+            return "";
+        }
+    };
+}
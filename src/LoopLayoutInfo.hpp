@@ -0,0 +1,129 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "FunctionInfo.hpp"
+#include "StructInfo.hpp"
+
+namespace Zippy {
+    /**
+     * Fields of one struct touched inside a loop, and the cache lines one element of it costs per iteration under the
+     * current layout and under the computed target layout.
+     *
+     * Each element is assumed to start on a cache line, so this is a lower bound for elements straddling lines.
+     */
+    struct LoopStructFootprint {
+        const StructInfo *structInfo;
+        // Touched fields by initial index
+        std::vector<unsigned> fieldIndices;
+        unsigned currentLines = 0;
+        unsigned targetLines = 0;
+    };
+
+    class LoopLayoutInfo {
+        Function function;
+        const llvm::Loop *loop;
+        std::vector<LoopStructFootprint> footprints;
+
+        LoopLayoutInfo(const Function &function, const llvm::Loop *loop): function(function), loop(loop) {}
+
+        static bool isUsedInLoop(const FieldInfo &fieldInfo, const llvm::Loop *loop) {
+            for (const auto &use: fieldInfo.getUses()) {
+                if (loop->contains(use.getGepRef()->getInst())) return true;
+            }
+            return false;
+        }
+
+        void collectFootprint(const StructInfo &structInfo, const llvm::DataLayout &DL) {
+            LoopStructFootprint footprint{&structInfo};
+            std::vector<std::pair<uint64_t, uint64_t>> currentRanges;
+            std::vector<std::pair<uint64_t, uint64_t>> targetRanges;
+
+            const auto structType = structInfo.getStructType();
+            for (const auto &fieldInfo: structInfo.getFieldInfos()) {
+                if (!isUsedInLoop(fieldInfo, loop)) continue;
+                const auto index = fieldInfo.getInitialIndex();
+                const auto size = fieldInfo.getStoreSize().getKnownMinValue();
+                footprint.fieldIndices.push_back(index);
+                currentRanges.emplace_back(structType.getElementOffset(DL, index).getKnownMinValue(), size);
+                targetRanges.emplace_back(
+                    structInfo.getTargetLayout()->getElementOffset(structInfo.findPosition(index)).getKnownMinValue(),
+                    size);
+            }
+            if (footprint.fieldIndices.empty()) return;
+
+            std::sort(footprint.fieldIndices.begin(), footprint.fieldIndices.end());
+            footprint.currentLines = countCacheLines(currentRanges);
+            footprint.targetLines = countCacheLines(targetRanges);
+            footprints.push_back(std::move(footprint));
+        }
+
+    public:
+        /**
+         * Collects the footprint of every loop touching struct fields, the struct infos must already have their
+         * fields in the target order.
+         */
+        static std::vector<LoopLayoutInfo> collect(const std::vector<StructInfo> &structInfos,
+                                                   const std::vector<FunctionInfo> &functionInfos,
+                                                   const llvm::DataLayout &DL) {
+            std::vector<LoopLayoutInfo> loopLayoutInfos;
+            for (const auto &functionInfo: functionInfos) {
+                const auto loopInfo = functionInfo.getLoopInfo();
+                if (!loopInfo) continue;
+                for (const auto loop: loopInfo->getLoopsInPreorder()) {
+                    LoopLayoutInfo loopLayoutInfo(functionInfo.getFunction(), loop);
+                    for (const auto &structInfo: structInfos) {
+                        loopLayoutInfo.collectFootprint(structInfo, DL);
+                    }
+                    if (loopLayoutInfo.footprints.empty()) continue;
+                    loopLayoutInfos.push_back(std::move(loopLayoutInfo));
+                }
+            }
+            return loopLayoutInfos;
+        }
+
+        const Function &getFunction() const {
+            return function;
+        }
+
+        const llvm::Loop *getLoop() const {
+            return loop;
+        }
+
+        const std::vector<LoopStructFootprint> &getFootprints() const {
+            return footprints;
+        }
+
+        uint64_t getCurrentBytes() const {
+            uint64_t lines = 0;
+            for (const auto &footprint: footprints) lines += footprint.currentLines;
+            return lines * CACHE_LINE_SIZE;
+        }
+
+        uint64_t getTargetBytes() const {
+            uint64_t lines = 0;
+            for (const auto &footprint: footprints) lines += footprint.targetLines;
+            return lines * CACHE_LINE_SIZE;
+        }
+
+        void print(llvm::raw_ostream &OS) const {
+            OS << "Loop: ";
+            function.printName(OS);
+            OS << " - Header: ";
+            loop->getHeader()->printAsOperand(OS, false);
+            OS << llvm::format(" - Depth: [%d]\n", loop->getLoopDepth());
+
+            for (const auto &footprint: footprints) {
+                OS << TAB_STR << footprint.structInfo->getStructType() << "\n";
+                OS << TAB_STR_2 << "Fields:";
+                for (const auto index: footprint.fieldIndices) {
+                    OS << llvm::format(" [%02d]", index);
+                }
+                OS << "\n";
+                OS << TAB_STR_2 << llvm::format("Lines Per Element: [%d] -> [%d]\n",
+                                                footprint.currentLines, footprint.targetLines);
+            }
+            OS << TAB_STR << llvm::format("Bytes Per Iteration: [%llu] -> [%llu]\n", getCurrentBytes(),
+                                          getTargetBytes());
+        }
+    };
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "GetElementPtrRef.hpp"
+
+#include <llvm/ADT/DenseMap.h>
+
+namespace Zippy {
+    /**
+     * Walks the def-use chains of pointers, through GEPs, phis, selects, casts and `ptrtoint`/`inttoptr` round trips,
+     * and summarizes the loads, stores and calls they reach. Pointers passed to a defined function are followed into
+     * the matching argument, so the accesses made by the callee count too.
+     *
+     * Summaries are memoized per value, and every value in a cycle (eg: a pointer bumped through a loop phi, or passed
+     * along by recursion) shares the summary of the whole cycle, so each value is only walked once per module.
+     */
+    class PointerFlow {
+        typedef GetElementPtrRef::AccessSummary AccessSummary;
+
+        struct Node {
+            unsigned index;
+            unsigned lowLink;
+            bool onStack;
+            // Accesses made directly through this value
+            AccessSummary direct;
+            llvm::SmallVector<const llvm::Value*, 4> successors;
+        };
+
+        llvm::DenseMap<const llvm::Value*, AccessSummary> summaries;
+        // Identifies the cycle each summarized value belongs to, so shared successors are only counted once
+        llvm::DenseMap<const llvm::Value*, unsigned> cycleIds;
+        llvm::DenseMap<const llvm::Value*, Node> nodes;
+        std::vector<const llvm::Value*> stack;
+        unsigned nextIndex = 0;
+        unsigned nextCycleId = 0;
+
+        static bool isFlowUser(const llvm::User *user, const llvm::Value *value) {
+            if (const auto *gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(user))
+                return gepInst->getPointerOperand() == value;
+            return llvm::isa<llvm::PHINode, llvm::SelectInst, llvm::BitCastInst, llvm::AddrSpaceCastInst,
+                llvm::PtrToIntInst, llvm::IntToPtrInst>(user);
+        }
+
+        // The callee argument a pointer is passed as, when the callee is defined in this module
+        static const llvm::Argument *findArgument(const llvm::CallBase *callBase, const llvm::Use &use) {
+            if (!callBase->isArgOperand(&use)) return nullptr;
+            const auto *callee = callBase->getCalledFunction();
+            if (!callee || callee->isDeclaration()) return nullptr;
+            const auto argNo = callBase->getArgOperandNo(&use);
+            // Variadic arguments have no matching parameter
+            if (argNo >= callee->arg_size()) return nullptr;
+            return callee->getArg(argNo);
+        }
+
+        // Tarjan's strongly connected components, summaries are assigned as each component is closed
+        void visit(const llvm::Value *value) {
+            Node node{nextIndex, nextIndex, true};
+            nextIndex++;
+            for (const auto &use: value->uses()) {
+                const auto *user = use.getUser();
+                if (llvm::isa<llvm::LoadInst>(user)) {
+                    node.direct.numLoads++;
+                } else if (const auto *storeInst = llvm::dyn_cast<llvm::StoreInst>(user)) {
+                    // Storing the pointer itself somewhere isn't an access through it
+                    if (storeInst->getPointerOperand() == value) node.direct.numStores++;
+                } else if (const auto *callBase = llvm::dyn_cast<llvm::CallBase>(user)) {
+                    node.direct.numCalls++;
+                    if (const auto *argument = findArgument(callBase, use)) node.successors.push_back(argument);
+                } else if (isFlowUser(user, value)) {
+                    node.successors.push_back(user);
+                }
+            }
+            nodes[value] = node;
+            stack.push_back(value);
+
+            // Nodes are looked up again after each visit, as visiting may grow the map
+            for (const auto *successor: node.successors) {
+                if (summaries.count(successor)) continue;
+                const auto found = nodes.find(successor);
+                if (found == nodes.end()) {
+                    visit(successor);
+                    nodes[value].lowLink = std::min(nodes[value].lowLink, nodes[successor].lowLink);
+                } else if (found->second.onStack) {
+                    nodes[value].lowLink = std::min(nodes[value].lowLink, found->second.index);
+                }
+            }
+
+            if (nodes[value].lowLink != nodes[value].index) return;
+
+            // Close the cycle rooted at this value
+            const auto cycleId = nextCycleId++;
+            llvm::SmallVector<const llvm::Value*, 4> members;
+            const llvm::Value *member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                nodes[member].onStack = false;
+                cycleIds[member] = cycleId;
+                members.push_back(member);
+            } while (member != value);
+
+            AccessSummary summary;
+            llvm::SmallDenseSet<unsigned, 4> countedCycles{cycleId};
+            for (const auto *cycleMember: members) {
+                const auto &memberNode = nodes[cycleMember];
+                summary += memberNode.direct;
+                for (const auto *successor: memberNode.successors) {
+                    if (!countedCycles.insert(cycleIds[successor]).second) continue;
+                    summary += summaries[successor];
+                }
+            }
+            for (const auto *cycleMember: members) {
+                summaries[cycleMember] = summary;
+                nodes.erase(cycleMember);
+            }
+        }
+
+    public:
+        AccessSummary summarize(const llvm::Value *value) {
+            if (!summaries.count(value)) visit(value);
+            return summaries[value];
+        }
+    };
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "ZippyLog.hpp"
+#include "zippy_rt.h"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstring>
+#include <optional>
+#include <vector>
+
+namespace Zippy {
+    /**
+     * Field access profile, as written by `libzippy_rt`, keyed by the IR struct name (eg: `struct.Foo`).
+     *
+     * Only depends on LLVM Support, so the standalone tools can read and write profiles too.
+     */
+    class ProfileInfo {
+    public:
+        struct StructProfile {
+            unsigned numFields = 0;
+            // Access count per original field index
+            std::vector<uint64_t> counts;
+            // Symmetric co-access matrix, indexed by `[a * numFields + b]`
+            std::vector<uint64_t> coAccess;
+
+            explicit StructProfile(const unsigned numFields = 0): numFields(numFields), counts(numFields),
+                                                                  coAccess(numFields * numFields) {}
+
+            uint64_t getCoAccess(const unsigned a, const unsigned b) const {
+                return coAccess[a * numFields + b];
+            }
+
+            void addCoAccess(const unsigned a, const unsigned b, const uint64_t count) {
+                if (a == b) return;
+                coAccess[a * numFields + b] += count;
+                coAccess[b * numFields + a] += count;
+            }
+        };
+
+    private:
+        llvm::StringMap<StructProfile> structProfiles;
+
+        template<typename T>
+        static bool readValue(const char *&cursor, const char *end, T &value) {
+            if (end - cursor < static_cast<ptrdiff_t>(sizeof(T))) return false;
+            std::memcpy(&value, cursor, sizeof(T));
+            cursor += sizeof(T);
+            return true;
+        }
+
+        static size_t padTo8(const size_t size) {
+            return (size + 7) & ~static_cast<size_t>(7);
+        }
+
+        bool parse(const llvm::MemoryBuffer &buffer) {
+            const char *cursor = buffer.getBufferStart();
+            const char *end = buffer.getBufferEnd();
+
+            zippy_rt_profile_header header;
+            if (!readValue(cursor, end, header)) return false;
+            if (std::memcmp(header.magic, ZIPPY_RT_PROFILE_MAGIC, ZIPPY_RT_PROFILE_MAGIC_SIZE) != 0) return false;
+            if (header.version != ZIPPY_RT_PROFILE_VERSION) return false;
+
+            for (uint32_t i = 0; i < header.numStructs; i++) {
+                zippy_rt_profile_struct_header structHeader;
+                if (!readValue(cursor, end, structHeader)) return false;
+                if (end - cursor < static_cast<ptrdiff_t>(padTo8(structHeader.nameLength))) return false;
+                const llvm::StringRef name(cursor, structHeader.nameLength);
+                cursor += padTo8(structHeader.nameLength);
+
+                StructProfile structProfile(structHeader.numFields);
+                for (auto &count: structProfile.counts) {
+                    if (!readValue(cursor, end, count)) return false;
+                }
+                for (auto &count: structProfile.coAccess) {
+                    if (!readValue(cursor, end, count)) return false;
+                }
+                merge(name, structProfile);
+            }
+            return true;
+        }
+
+    public:
+        static std::optional<ProfileInfo> load(const llvm::StringRef path) {
+            log() << "Loading Profile: " << path << "\n";
+            auto bufferOrErr = llvm::MemoryBuffer::getFile(path);
+            if (!bufferOrErr) {
+                llvm::errs() << "Failed to read profile, ignored\n\n";
+                return std::nullopt;
+            }
+            ProfileInfo profileInfo;
+            if (!profileInfo.parse(**bufferOrErr)) {
+                llvm::errs() << "Malformed or outdated profile, ignored\n\n";
+                return std::nullopt;
+            }
+            log() << llvm::format("Loaded [%d] Struct Profiles\n\n", profileInfo.structProfiles.size());
+            return profileInfo;
+        }
+
+        const StructProfile *lookup(const llvm::StringRef name, const unsigned numFields) const {
+            const auto found = structProfiles.find(name);
+            if (found == structProfiles.end() || found->second.numFields != numFields) return nullptr;
+            return &found->second;
+        }
+
+        /**
+         * Adds the counts onto any existing profile of the same struct, a field count mismatch replaces it.
+         */
+        void merge(const llvm::StringRef name, const StructProfile &structProfile) {
+            auto [found, inserted] = structProfiles.try_emplace(name, structProfile);
+            if (inserted) return;
+            auto &existing = found->second;
+            if (existing.numFields != structProfile.numFields) {
+                existing = structProfile;
+                return;
+            }
+            for (unsigned i = 0; i < existing.counts.size(); i++) {
+                existing.counts[i] += structProfile.counts[i];
+            }
+            for (unsigned i = 0; i < existing.coAccess.size(); i++) {
+                existing.coAccess[i] += structProfile.coAccess[i];
+            }
+        }
+
+        void write(llvm::raw_ostream &out) const {
+            zippy_rt_profile_header header;
+            std::memcpy(header.magic, ZIPPY_RT_PROFILE_MAGIC, ZIPPY_RT_PROFILE_MAGIC_SIZE);
+            header.version = ZIPPY_RT_PROFILE_VERSION;
+            header.numStructs = structProfiles.size();
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            for (const auto &entry: structProfiles) {
+                const auto &structProfile = entry.second;
+                zippy_rt_profile_struct_header structHeader;
+                structHeader.nameLength = entry.first().size();
+                structHeader.numFields = structProfile.numFields;
+                out.write(reinterpret_cast<const char*>(&structHeader), sizeof(structHeader));
+
+                out << entry.first();
+                out.write_zeros(padTo8(structHeader.nameLength) - structHeader.nameLength);
+
+                out.write(reinterpret_cast<const char*>(structProfile.counts.data()),
+                          structProfile.counts.size() * sizeof(uint64_t));
+                out.write(reinterpret_cast<const char*>(structProfile.coAccess.data()),
+                          structProfile.coAccess.size() * sizeof(uint64_t));
+            }
+        }
+    };
+}
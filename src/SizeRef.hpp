@@ -0,0 +1,186 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+
+#include <llvm/ADT/SmallPtrSet.h>
+
+namespace Zippy {
+    /**
+     * A constant derived from the alloc size of a struct, such as the size in `malloc(n * sizeof(S))` or the stride of
+     * byte offset arithmetic over an array of structs, which has to follow the struct when its size changes.
+     */
+    class SizeRef {
+        // The instruction holding the constant, either the user itself or a `mul`/`shl` feeding it
+        llvm::Instruction *inst;
+        unsigned operandIndex;
+        // Where the size flows into, eg: the `malloc` call and its size argument
+        llvm::Instruction *user;
+        unsigned userOperandIndex;
+        llvm::StructType *structType;
+        // How many structs the constant covers
+        uint64_t multiple;
+
+        SizeRef(llvm::Instruction *inst, const unsigned operandIndex, llvm::Instruction *user,
+                const unsigned userOperandIndex, llvm::StructType *structType, const uint64_t multiple): inst(inst),
+            operandIndex(operandIndex), user(user), userOperandIndex(userOperandIndex), structType(structType),
+            multiple(multiple) {}
+
+        static uint64_t getMultiple(const llvm::Value *value, const uint64_t allocSize) {
+            const auto constant = llvm::dyn_cast<llvm::ConstantInt>(value);
+            if (!constant || constant->isZero() || constant->getValue().getActiveBits() > 64) return 0;
+            const auto size = constant->getZExtValue();
+            return size % allocSize == 0 ? size / allocSize : 0;
+        }
+
+        // Power of two sizes get strength reduced into a shift
+        static uint64_t getShiftMultiple(const llvm::Value *value, const uint64_t allocSize) {
+            const auto shift = llvm::dyn_cast<llvm::ConstantInt>(value);
+            if (!shift || shift->getZExtValue() >= 64) return 0;
+            const auto size = 1ULL << shift->getZExtValue();
+            return size % allocSize == 0 ? size / allocSize : 0;
+        }
+
+        // Whether the operand is the size of an allocation, the length of a `memcpy`/`memset` or a byte offset
+        static bool isSizeOperand(const llvm::Instruction *user, const unsigned operandIndex) {
+            if (llvm::isa<llvm::MemIntrinsic>(user)) return operandIndex == 2;
+            if (const auto gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(user))
+                return gepInst->getNumIndices() == 1 && operandIndex == 1;
+            const auto callBase = llvm::dyn_cast<llvm::CallBase>(user);
+            return callBase && llvm::is_contained(getAllocationSizeOperands(callBase), operandIndex);
+        }
+
+    public:
+        /**
+         * Operands of an allocation call which may hold the size, `calloc` takes it as either one of its two.
+         */
+        static llvm::SmallVector<unsigned, 2> getAllocationSizeOperands(const llvm::CallBase *callBase) {
+            const auto *callee = callBase->getCalledFunction();
+            if (!callee || !callee->isDeclaration()) return {};
+            llvm::SmallVector<unsigned, 2> sizeOperands;
+            const auto name = callee->getName();
+            if (name == "malloc") {
+                sizeOperands = {0};
+            } else if (name == "calloc") {
+                sizeOperands = {1, 0};
+            } else if (name == "realloc" || name == "aligned_alloc") {
+                sizeOperands = {1};
+            }
+            if (!sizeOperands.empty() && callBase->arg_size() <= sizeOperands.front()) return {};
+            return sizeOperands;
+        }
+
+        /**
+         * Matches the size operand of `user`, when it is a multiple of the alloc size itself, or a `mul`/`shl` by one.
+         *
+         * Only allocation sizes, `memcpy`/`memset` lengths and byte offsets are matched. A plain constant is only
+         * matched as an allocation size, as constant lengths and offsets are resolved into fields instead.
+         */
+        static std::shared_ptr<SizeRef> match(llvm::Instruction *user, const unsigned operandIndex,
+                                              llvm::StructType *structType, const uint64_t allocSize) {
+            if (!isSizeOperand(user, operandIndex)) return nullptr;
+            auto *value = user->getOperand(operandIndex);
+            if (llvm::isa<llvm::CallBase>(user) && !llvm::isa<llvm::MemIntrinsic>(user)) {
+                if (const auto multiple = getMultiple(value, allocSize))
+                    return std::shared_ptr<SizeRef>(new SizeRef(user, operandIndex, user, operandIndex, structType,
+                                                                multiple));
+            }
+
+            auto *binaryOp = llvm::dyn_cast<llvm::BinaryOperator>(value);
+            if (!binaryOp) return nullptr;
+            if (binaryOp->getOpcode() == llvm::Instruction::Mul) {
+                for (unsigned i = 0; i < 2; i++) {
+                    if (const auto multiple = getMultiple(binaryOp->getOperand(i), allocSize))
+                        return std::shared_ptr<SizeRef>(new SizeRef(binaryOp, i, user, operandIndex, structType,
+                                                                    multiple));
+                }
+            } else if (binaryOp->getOpcode() == llvm::Instruction::Shl) {
+                if (const auto multiple = getShiftMultiple(binaryOp->getOperand(1), allocSize))
+                    return std::shared_ptr<SizeRef>(new SizeRef(binaryOp, 1, user, operandIndex, structType,
+                                                                multiple));
+            }
+            return nullptr;
+        }
+
+        /**
+         * Whether `value` would be matched as a size, without holding on to it.
+         */
+        static bool isSize(const llvm::Value *value, const uint64_t allocSize) {
+            if (getMultiple(value, allocSize)) return true;
+            const auto binaryOp = llvm::dyn_cast<llvm::BinaryOperator>(value);
+            if (!binaryOp) return false;
+            if (binaryOp->getOpcode() == llvm::Instruction::Mul)
+                return getMultiple(binaryOp->getOperand(0), allocSize) || getMultiple(binaryOp->getOperand(1), allocSize);
+            if (binaryOp->getOpcode() == llvm::Instruction::Shl)
+                return getShiftMultiple(binaryOp->getOperand(1), allocSize);
+            return false;
+        }
+
+        /**
+         * The struct an untyped pointer, such as a heap allocation, is used as, found from the first typed GEP
+         * indexing into it.
+         *
+         * The pointer is followed through phis, selects, casts and spills to allocas or globals.
+         */
+        static llvm::StructType *inferIndexedStructType(llvm::Value *pointer) {
+            llvm::SmallPtrSet<const llvm::Value*, 16> visited;
+            std::vector<const llvm::Value*> worklist{pointer};
+            while (!worklist.empty()) {
+                const auto value = worklist.back();
+                worklist.pop_back();
+                if (!visited.insert(value).second) continue;
+                for (const auto user: value->users()) {
+                    if (const auto gepInst = llvm::dyn_cast<llvm::GetElementPtrInst>(user)) {
+                        if (gepInst->getPointerOperand() != value) continue;
+                        if (auto *structTy = llvm::dyn_cast<llvm::StructType>(gepInst->getSourceElementType()))
+                            return structTy;
+                    } else if (const auto storeInst = llvm::dyn_cast<llvm::StoreInst>(user)) {
+                        if (storeInst->getValueOperand() != value) continue;
+                        const auto slot = storeInst->getPointerOperand();
+                        if (!llvm::isa<llvm::AllocaInst, llvm::GlobalVariable>(slot)) continue;
+                        for (const auto slotUser: slot->users()) {
+                            if (llvm::isa<llvm::LoadInst>(slotUser)) worklist.push_back(slotUser);
+                        }
+                    } else if (llvm::isa<llvm::PHINode, llvm::SelectInst, llvm::BitCastInst>(user)) {
+                        worklist.push_back(user);
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+        llvm::StructType *getStructType() const {
+            return structType;
+        }
+
+        llvm::Instruction *getInst() const {
+            return inst;
+        }
+
+        void setTypeSize(const llvm::TypeSize typeSize) {
+            const auto oldOperand = llvm::cast<llvm::ConstantInt>(inst->getOperand(operandIndex));
+            const auto size = multiple * typeSize.getKnownMinValue();
+            if (inst->getOpcode() != llvm::Instruction::Shl && oldOperand->getZExtValue() == size) return;
+
+            // A `mul` may be shared with uses that aren't sizes, or sizes of another struct, so each use gets its own
+            if (inst != user && !inst->hasOneUse()) {
+                auto *clone = inst->clone();
+                clone->insertBefore(user);
+                user->setOperand(userOperandIndex, clone);
+                inst = clone;
+            }
+
+            // A shift only fits power of two sizes, so it is turned back into a multiplication
+            if (inst->getOpcode() == llvm::Instruction::Shl) {
+                llvm::IRBuilder builder(inst);
+                const auto mul = builder.CreateMul(inst->getOperand(0),
+                                                   llvm::ConstantInt::get(oldOperand->getType(), size));
+                inst->replaceAllUsesWith(mul);
+                inst->eraseFromParent();
+                inst = llvm::cast<llvm::Instruction>(mul);
+                operandIndex = 1;
+                return;
+            }
+            inst->setOperand(operandIndex, llvm::ConstantInt::get(oldOperand->getType(), size));
+        }
+    };
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Timer.h>
+
+// Counters for `-stats`, which only counts in LLVM builds with assertions or `LLVM_FORCE_ENABLE_STATS`
+#define DEBUG_TYPE "zippy"
+
+namespace Zippy {
+    STATISTIC(NumStructsConsidered, "Number of struct types considered for reordering");
+    STATISTIC(NumStructsUnsafe, "Number of struct types unsafe to reorder");
+    STATISTIC(NumStructsTransformed, "Number of struct types reordered");
+    STATISTIC(NumGEPInsts, "Number of field references through GEP instructions");
+    STATISTIC(NumGEPOperators, "Number of field references through GEP constant expressions");
+    STATISTIC(NumDirectRefs, "Number of direct references to the first field");
+    STATISTIC(NumByteOffsetRefs, "Number of field references through byte offset GEPs");
+    STATISTIC(NumRejectedGEPs, "Number of GEPs into structs not resolved to a field");
+    STATISTIC(NumBytesSaved, "Number of bytes saved over all reordered struct types");
+
+    /**
+     * Times a phase of the pass for `-time-passes`, and as a scope of `-ftime-trace`.
+     */
+    class PhaseTimer {
+        llvm::TimeTraceScope timeTraceScope;
+        llvm::NamedRegionTimer namedRegionTimer;
+
+    public:
+        PhaseTimer(const llvm::StringRef name, const llvm::StringRef description): timeTraceScope(description),
+            namedRegionTimer(name, description, "zippy", "Zippy Phases", llvm::TimePassesIsEnabled) {}
+    };
+}
+
+#undef DEBUG_TYPE
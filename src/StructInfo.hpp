@@ -1,31 +1,52 @@
 #pragma once
 
 #include "ZippyCommon.hpp"
+#include "AccessCache.hpp"
+#include "DebugTypeInfo.hpp"
 #include "FieldInfo.hpp"
 #include "FunctionInfo.hpp"
 #include "GlobalVarInfo.hpp"
+#include "ProfileInfo.hpp"
+#include "Statistics.hpp"
+#include "SummaryInfo.hpp"
+
+#include <llvm/ADT/MapVector.h>
 
 namespace Zippy {
-    class StructInfo {
-        // TODO: This is a guess and will "generally" be correct, it's wrong when geps are generated in a chained way.
-        static constexpr unsigned FIELD_IDX = 2;
+    // Structs that are never laid out, and why, eg: with fewer than two fields
+    typedef llvm::MapVector<llvm::StructType*, std::string> RejectedStructs;
 
+    class StructInfo {
         StructType structType;
         std::vector<FieldInfo> fieldInfos;
         unsigned numFieldInfos;
         bool isPacked;
         std::vector<GlobalVarInfo> globalVarInfos;
         std::vector<std::shared_ptr<IntrinsicInstRef>> intrinsicRefs;
+        std::vector<std::shared_ptr<SizeRef>> sizeRefs;
 
         std::vector<unsigned> remapTable;
         unsigned sumFieldUses = 0;
 
+        // Pairwise affinity between fields by initial index, used as the edge weights when clustering
+        std::vector<float> affinity;
+        bool hasProfile = false;
+        // Laid out from the merged summaries, which every module has to follow even without uses of its own
+        bool hasSummary = false;
+
         llvm::TypeSize initialSize = llvm::TypeSize::getZero();
         llvm::TypeSize currentSize = llvm::TypeSize::getZero();
+        // The DataLayout keeps the layout of the original body cached, so the current one is tracked separately
+        const llvm::StructLayout *initialLayout;
+        const llvm::StructLayout *currentLayout;
+        // Layout of the fields in their target order, before the struct itself is transformed
+        const llvm::StructLayout *targetLayout = nullptr;
 
         explicit StructInfo(const StructType structType, const llvm::DataLayout &DL): structType(structType),
             initialSize(DL.getTypeAllocSize(structType.ptr)),
-            currentSize(initialSize) {
+            currentSize(initialSize),
+            initialLayout(DL.getStructLayout(structType.ptr)),
+            currentLayout(initialLayout) {
             numFieldInfos = structType.ptr->getNumElements();
             isPacked = structType.ptr->isPacked();
 
@@ -40,29 +61,61 @@ namespace Zippy {
             for (auto i = 0; i < numFieldInfos; ++i) {
                 remapTable.emplace_back(i);
             }
+
+            affinity.resize(numFieldInfos * numFieldInfos, 0.0F);
+        }
+
+        void addAffinity(const unsigned a, const unsigned b, const float weight) {
+            if (a == b) return;
+            affinity[a * numFieldInfos + b] += weight;
+            affinity[b * numFieldInfos + a] += weight;
+        }
+
+        /**
+         * Adds the loop depths of the field uses, deepened by the loops the function is called from, and the static
+         * guess at which fields are accessed together: any two fields used in the same basic block.
+         */
+        void collectFunctionAccess(const FunctionInfo &functionInfo, const FunctionAccess &functionAccess) {
+            const auto found = functionAccess.structAccesses.find(structType.ptr->getName().str());
+            if (found == functionAccess.structAccesses.end()) return;
+            // Cached accesses may predate a change to the struct body, fields it no longer has are left out
+            for (const auto &[use, count]: found->second.loopUses) {
+                if (use.first >= numFieldInfos) continue;
+                fieldInfos[use.first].addLoopUses(use.second + functionInfo.getCallerLoopDepth(), count);
+            }
+            for (const auto &[pair, count]: found->second.coAccesses) {
+                if (pair.second >= numFieldInfos) continue;
+                addAffinity(pair.first, pair.second, static_cast<float>(count));
+            }
         }
 
     public:
-        static std::vector<StructInfo> collect(const llvm::Module &M, const llvm::DataLayout &DL) {
-            llvm::errs() << "Collecting Structs\n";
+        /**
+         * Collects every struct that could be laid out, along with why the rest can't into `rejectedStructs`, if given.
+         */
+        static std::vector<StructInfo> collect(const llvm::Module &M, const llvm::DataLayout &DL,
+                                               RejectedStructs *rejectedStructs = nullptr) {
+            log() << "Collecting Structs\n";
             std::vector<StructInfo> structInfos;
             for (const auto structTy: M.getIdentifiedStructTypes()) {
                 const StructType structType{structTy};
-                // Skip unnamed structs
-                if (!structType.ptr->hasName()) continue;
-                // Skip structs with less than two elements
-                if (structType.ptr->getNumElements() < 2) continue;
-                // TODO: Currently skipping 'timespec' structs, but should have a more robust marking system
-                if (structType.ptr->getName() == "struct.timespec") continue;
+                std::string rejectedReason;
+                if (!structType.ptr->hasName()) rejectedReason = "unnamed";
+                else if (structType.ptr->isOpaque()) rejectedReason = "opaque, its body is not known here";
+                else if (structType.ptr->getNumElements() < 2) rejectedReason = "fewer than two fields";
+                if (!rejectedReason.empty()) {
+                    if (rejectedStructs) (*rejectedStructs)[structTy] = std::move(rejectedReason);
+                    continue;
+                }
 
                 auto structInfo = StructInfo(structType, DL);
-                llvm::errs() << TAB_STR << structInfo.getStructType() << "\n";
+                log() << TAB_STR << structInfo.getStructType() << "\n";
                 structInfos.push_back(structInfo);
             }
             if (structInfos.empty()) {
-                llvm::errs() << "No Structs collected\n\n";
+                log() << "No Structs collected\n\n";
             } else {
-                llvm::errs() << llvm::format("Collected [%d] Structs\n\n", structInfos.size());
+                log() << llvm::format("Collected [%d] Structs\n\n", structInfos.size());
             }
             return std::move(structInfos);
         }
@@ -82,59 +135,255 @@ namespace Zippy {
             return fieldInfos;
         }
 
-        llvm::TypeSize getInitialSize() {
+        const std::vector<FieldInfo> &getFieldInfos() const {
+            return fieldInfos;
+        }
+
+        llvm::TypeSize getInitialSize() const {
             return initialSize;
         }
 
-        llvm::TypeSize getCurrentSize() {
+        const llvm::StructLayout *getInitialLayout() const {
+            return initialLayout;
+        }
+
+        /**
+         * Sum of the field sizes, whatever the struct size exceeds it by is padding.
+         */
+        uint64_t getSumFieldSizes() const {
+            uint64_t sumFieldSizes = 0;
+            for (const auto &fieldInfo: fieldInfos) {
+                sumFieldSizes += fieldInfo.getAllocSize().getKnownMinValue();
+            }
+            return sumFieldSizes;
+        }
+
+        llvm::TypeSize getCurrentSize() const {
             return currentSize;
         }
 
-        unsigned collectFieldUses(FunctionInfo &functionInfo) {
+        /**
+         * Collects the uses of each field within the function, along with their loop depth and which fields are used
+         * together from its function access, if any.
+         */
+        unsigned collectFieldUses(FunctionInfo &functionInfo, const FunctionAccess *functionAccess = nullptr) {
             unsigned foundUses = 0;
             for (const auto &gepRef: functionInfo.getGepRefs()) {
-                // Check if the source element is this struct
-                if (!gepRef->isSameSourceStructType(structType)) continue;
-                // Get the operand and validate that it is indeed, a `ConstantInt`
-                const auto *fieldIndexOperand = llvm::dyn_cast<llvm::ConstantInt>(gepRef->getOperand(FIELD_IDX));
-                if (!fieldIndexOperand) continue;
+                for (const auto &structIndex: gepRef->getStructIndices()) {
+                    // Check if the indexed struct is this struct
+                    if (structIndex.structType != structType.ptr) continue;
+                    // Get the operand and validate that it is indeed, a `ConstantInt`
+                    const auto *fieldIndexOperand = llvm::dyn_cast<llvm::ConstantInt>(
+                        gepRef->getOperand(structIndex.operandIndex));
+                    if (!fieldIndexOperand) {
+                        ++NumRejectedGEPs;
+                        continue;
+                    }
 
-                // Get the field index and add the usage
-                const auto fieldIndex = fieldIndexOperand->getZExtValue();
-                fieldInfos[fieldIndex].addUse(functionInfo.getLoopInfo(), gepRef, FIELD_IDX);
+                    // Get the field index and add the usage
+                    const auto fieldIndex = fieldIndexOperand->getZExtValue();
+                    fieldInfos[fieldIndex].addUse(gepRef, structIndex.operandIndex, functionInfo.getCallCount());
 
-                // Track uses
-                foundUses++;
+                    // Track uses
+                    foundUses++;
+                }
             }
             sumFieldUses += foundUses;
             functionInfo.incrementUsedGepRefs(foundUses);
 
-            // TODO: This is a quick fix for finding relevant mem copies, tidy later
-            for (auto intrinsicRef: functionInfo.getIntrinsicInsts()) {
-                if (intrinsicRef->getDstType() == structType.ptr)
+            for (const auto &intrinsicRef: functionInfo.getIntrinsicInsts()) {
+                if (intrinsicRef->getStructType() == structType.ptr)
                     intrinsicRefs.push_back(intrinsicRef);
             }
+            for (const auto &sizeRef: functionInfo.getSizeRefs()) {
+                if (sizeRef->getStructType() == structType.ptr) sizeRefs.push_back(sizeRef);
+            }
+
+            if (functionAccess) collectFunctionAccess(functionInfo, *functionAccess);
 
             return foundUses;
         }
 
+        /**
+         * Replaces the static affinity with the measured co-access counts, and records the measured field hotness.
+         */
+        void applyProfile(const ProfileInfo::StructProfile &structProfile) {
+            hasProfile = true;
+            for (auto &fieldInfo: fieldInfos) {
+                fieldInfo.setProfileCount(structProfile.counts[fieldInfo.getInitialIndex()]);
+            }
+            for (auto a = 0; a < numFieldInfos; a++) {
+                for (auto b = 0; b < numFieldInfos; b++) {
+                    affinity[a * numFieldInfos + b] = static_cast<float>(structProfile.getCoAccess(a, b));
+                }
+            }
+        }
+
+        /**
+         * Affinity between two fields, by their initial indices.
+         */
+        float getAffinity(const unsigned a, const unsigned b) const {
+            return affinity[a * numFieldInfos + b];
+        }
+
+        bool getHasProfile() const {
+            return hasProfile;
+        }
+
+        std::string getSignature() const {
+            return structType.getSignature();
+        }
+
+        /**
+         * What the module knows about the struct, for the summaries merged across modules.
+         */
+        SummaryInfo::StructSummary summarize(const std::string &unsafeReason,
+                                             const llvm::ArrayRef<SummaryInfo::ExternalArg> externalCallees) const {
+            SummaryInfo::StructSummary structSummary;
+            structSummary.signature = getSignature();
+            structSummary.unsafeReason = unsafeReason;
+            structSummary.externalCallees = externalCallees.vec();
+            structSummary.weights.resize(numFieldInfos);
+            for (const auto &fieldInfo: fieldInfos) {
+                structSummary.weights[fieldInfo.getInitialIndex()] = fieldInfo.getTotalWeight();
+            }
+            structSummary.affinity = affinity;
+            return structSummary;
+        }
+
+        /**
+         * Replaces the local weights and affinity with the ones merged across modules, so every module computes the
+         * same layout.
+         */
+        void applySummary(const SummaryInfo::StructSummary &structSummary) {
+            hasSummary = true;
+            for (auto &fieldInfo: fieldInfos) {
+                fieldInfo.setTotalWeight(structSummary.weights[fieldInfo.getInitialIndex()]);
+            }
+            affinity = structSummary.affinity;
+        }
+
+        /**
+         * Initial field indices in their current order.
+         */
+        std::vector<unsigned> getOrder() const {
+            std::vector<unsigned> order;
+            order.reserve(numFieldInfos);
+            for (const auto &fieldInfo: fieldInfos) {
+                order.push_back(fieldInfo.getInitialIndex());
+            }
+            return order;
+        }
+
+        /**
+         * Puts the fields in the order of their initial indices, as decided elsewhere. Returns false, leaving the order
+         * untouched, when it doesn't fit the struct.
+         */
+        bool applyOrder(const std::vector<unsigned> &order) {
+            if (order.size() != numFieldInfos) return false;
+            std::vector<FieldInfo> reordered;
+            reordered.reserve(numFieldInfos);
+            std::vector<bool> isPlaced(numFieldInfos, false);
+            for (const auto initialIndex: order) {
+                if (initialIndex >= numFieldInfos || isPlaced[initialIndex]) return false;
+                isPlaced[initialIndex] = true;
+                reordered.push_back(fieldInfos[findPosition(initialIndex)]);
+            }
+            fieldInfos = std::move(reordered);
+            return true;
+        }
+
+        /**
+         * Greedily groups the fields with the strongest affinity into cache line sized clusters.
+         *
+         * Each cluster is seeded with the heaviest remaining field, so without any affinity the weight order is kept.
+         */
+        void clusterFields() {
+            std::vector<FieldInfo> remaining = std::move(fieldInfos);
+            fieldInfos.clear();
+            fieldInfos.reserve(numFieldInfos);
+
+            while (!remaining.empty()) {
+                const auto clusterStart = fieldInfos.size();
+                fieldInfos.push_back(remaining.front());
+                remaining.erase(remaining.begin());
+                auto clusterSize = fieldInfos.back().getAllocSize().getKnownMinValue();
+
+                while (clusterSize < CACHE_LINE_SIZE && !remaining.empty()) {
+                    auto best = remaining.end();
+                    auto bestAffinity = 0.0F;
+                    for (auto it = remaining.begin(); it != remaining.end(); ++it) {
+                        auto sumAffinity = 0.0F;
+                        for (auto i = clusterStart; i < fieldInfos.size(); i++) {
+                            sumAffinity += getAffinity(fieldInfos[i].getInitialIndex(), it->getInitialIndex());
+                        }
+                        if (sumAffinity <= bestAffinity) continue;
+                        best = it;
+                        bestAffinity = sumAffinity;
+                    }
+                    // Nothing left that is accessed together with this cluster
+                    if (best == remaining.end()) break;
+                    clusterSize += best->getAllocSize().getKnownMinValue();
+                    fieldInfos.push_back(*best);
+                    remaining.erase(best);
+                }
+
+                log() << TAB_STR << "Cluster:";
+                for (auto i = clusterStart; i < fieldInfos.size(); i++) {
+                    log() << llvm::format(" [%02d]", fieldInfos[i].getInitialIndex());
+                }
+                log() << "\n";
+            }
+        }
+
+        /**
+         * Layout the struct would have with the fields in their current order, leaving the struct itself untouched.
+         * Computed once the fields are in their target order, see `getTargetLayout`.
+         */
+        void computeTargetLayout(const llvm::DataLayout &DL) {
+            std::vector<llvm::Type*> body;
+            body.reserve(numFieldInfos);
+            for (const auto &fieldInfo: fieldInfos) {
+                body.push_back(fieldInfo.getType().ptr);
+            }
+            // Same dummy type trick as `updateCurrentSize`, as the layout of the real type is cached
+            const auto dummyStructType = llvm::StructType::create(structType.ptr->getContext());
+            dummyStructType->setBody(body, isPacked);
+            targetLayout = DL.getStructLayout(dummyStructType);
+        }
+
+        const llvm::StructLayout *getTargetLayout() const {
+            assert(targetLayout && "Target layout not computed yet");
+            return targetLayout;
+        }
+
+        /**
+         * Position of a field in the current order, by its initial index.
+         */
+        unsigned findPosition(const unsigned initialIndex) const {
+            for (auto i = 0; i < numFieldInfos; i++) {
+                if (fieldInfos[i].getInitialIndex() == initialIndex) return i;
+            }
+            llvm_unreachable("Field index out of range");
+        }
+
         unsigned collectGlobalVars(std::vector<GlobalVarInfo> &allGlobalVarInfos) {
-            llvm::errs() << TAB_STR << "For Struct: ";
-            structType.printName(llvm::errs());
-            llvm::errs() << "\n";
+            log() << TAB_STR << "For Struct: ";
+            structType.printName(log());
+            log() << "\n";
             auto varsCollected = 0;
             for (auto &globalVarInfo: allGlobalVarInfos) {
-                if (globalVarInfo.getValueType().ptr != structType.ptr) continue;
+                if (!globalVarInfo.references(structType.ptr)) continue;
                 globalVarInfos.push_back(globalVarInfo);
-                llvm::errs() << TAB_STR_2 << "Collected: ";
-                globalVarInfo.getGlobalVar().printName(llvm::errs());
-                llvm::errs() << "\n";
+                log() << TAB_STR_2 << "Collected: ";
+                globalVarInfo.getGlobalVar().printName(log());
+                log() << "\n";
                 varsCollected++;
             }
             if (varsCollected == 0) {
-                llvm::errs() << TAB_STR << "None collected\n";
+                log() << TAB_STR << "None collected\n";
             } else {
-                llvm::errs() << TAB_STR << llvm::format("Collected [%d] Global Variables\n", varsCollected);
+                log() << TAB_STR << llvm::format("Collected [%d] Global Variables\n", varsCollected);
             }
             return varsCollected;
         }
@@ -144,12 +393,14 @@ namespace Zippy {
             auto maxLoadWeight = 1.0F;
             auto maxStoreWeight = 1.0F;
             auto maxLoopWeight = 1.0F;
+            auto maxProfileWeight = 1.0F;
             // Find maximum weights
             for (const auto &fieldInfo: fieldInfos) {
                 maxSizeWeight = std::max(maxSizeWeight, fieldInfo.getSizeWeight());
                 maxLoadWeight = std::max(maxLoadWeight, fieldInfo.getLoadWeight());
                 maxStoreWeight = std::max(maxStoreWeight, fieldInfo.getStoreWeight());
                 maxLoopWeight = std::max(maxLoopWeight, fieldInfo.getLoopWeight());
+                maxProfileWeight = std::max(maxProfileWeight, fieldInfo.getProfileWeight());
             }
             // Normalized weights (0, 1)
             for (auto &fieldInfo: fieldInfos) {
@@ -157,10 +408,12 @@ namespace Zippy {
                 fieldInfo.setLoadWeight(fieldInfo.getLoadWeight() / maxLoadWeight);
                 fieldInfo.setStoreWeight(fieldInfo.getStoreWeight() / maxStoreWeight);
                 fieldInfo.setLoopWeight(fieldInfo.getLoopWeight() / maxLoopWeight);
+                fieldInfo.setProfileWeight(fieldInfo.getProfileWeight() / maxProfileWeight);
             }
         }
 
         bool applyTransform(const llvm::DataLayout &DL) {
+            PhaseTimer timer("apply-transform", "Zippy Apply Transform");
             updateTargetIndices();
             // Early return if no work was done
             if (!remapFields()) return false;
@@ -169,27 +422,53 @@ namespace Zippy {
             updateCurrentSize(DL);
             // Apply alignment
             for (auto i = 0; i < numFieldInfos; i++) {
-                fieldInfos[i].applyAlign(calculateFieldAlignment(DL, structType.ptr, i));
+                const auto typeAlign = fieldInfos[i].getType().getABIAlign(DL);
+                fieldInfos[i].applyAlign(llvm::commonAlignment(typeAlign, currentLayout->getElementOffset(i)));
+            }
+            // Rewrite byte offset references against the new layout
+            for (auto &fieldInfo: fieldInfos) {
+                fieldInfo.applyLayout(currentLayout);
             }
-            // Remap global variables
+            const auto positions = getPositions();
+            // Remap global variable initializers
             for (auto &globalVarInfo: globalVarInfos) {
-                globalVarInfo.remap(remapTable);
+                globalVarInfo.remap(structType.ptr, positions, initialLayout, currentLayout);
             }
-            // Update intrinsic references
-            for (const auto intrinsicRef: intrinsicRefs) {
-                intrinsicRef->setTypeSize(currentSize);
+            // Cover the same fields again with the intrinsics, at their new positions
+            for (const auto &intrinsicRef: intrinsicRefs) {
+                intrinsicRef->applyLayout(DL, currentLayout, positions);
+            }
+            // Update allocation sizes and strides
+            for (const auto &sizeRef: sizeRefs) {
+                sizeRef->setTypeSize(currentSize);
             }
             // Print debug info
-            llvm::errs() << TAB_STR << "Transformation Result:\n";
-            llvm::errs() << TAB_STR_2 << llvm::format("Initial size: [%d] Current Size: [%d]\n",
-                                                      initialSize.getKnownMinValue(), currentSize.getKnownMinValue());
+            log() << TAB_STR << "Transformation Result:\n";
+            log() << TAB_STR_2 << llvm::format("Initial size: [%d] Current Size: [%d]\n",
+                                               initialSize.getKnownMinValue(), currentSize.getKnownMinValue());
             for (const auto &fieldInfo: fieldInfos) {
-                llvm::errs() << TAB_STR_2 << fieldInfo << "\n";
+                log() << TAB_STR_2 << fieldInfo << "\n";
             }
             return true;
         }
 
+        /**
+         * Points the debug info of the struct at its new layout, once transformed.
+         */
+        bool updateDebugInfo(DebugTypeInfo &debugTypeInfo) const {
+            return debugTypeInfo.remapStruct(structType.ptr, initialLayout, currentLayout, getPositions());
+        }
+
     private:
+        // New index of each field by its initial index
+        std::vector<unsigned> getPositions() const {
+            std::vector<unsigned> positions(numFieldInfos);
+            for (auto i = 0; i < numFieldInfos; i++) {
+                positions[fieldInfos[i].getInitialIndex()] = i;
+            }
+            return positions;
+        }
+
         void updateTargetIndices() {
             for (auto i = 0; i < numFieldInfos; i++) {
                 auto &fieldInfo = fieldInfos[i];
@@ -200,11 +479,14 @@ namespace Zippy {
 
         bool remapFields() {
             auto didWork = false;
+            auto didMove = false;
             // Apply the remap to each field
             for (auto i = 0; i < numFieldInfos; i++) {
+                didMove |= fieldInfos[i].getCurrentIndex() != i;
                 didWork |= fieldInfos[i].applyRemap();
             }
-            return didWork;
+            // A layout shared with other modules is applied even where none of the fields are used
+            return didWork || (hasSummary && didMove);
         }
 
         void updateBody() {
@@ -225,6 +507,7 @@ namespace Zippy {
             const auto dummyStructType = llvm::StructType::create(structType.ptr->getContext());
             dummyStructType->setBody(structType.ptr->elements(), isPacked);
             currentSize = DL.getTypeAllocSize(dummyStructType);
+            currentLayout = DL.getStructLayout(dummyStructType);
         }
     };
 }
@@ -0,0 +1,383 @@
+#pragma once
+
+#include "ZippyLog.hpp"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace Zippy {
+    /**
+     * Struct access summary of one or more modules, for ThinLTO style builds where no single module sees the whole
+     * program.
+     *
+     * Each module writes its own summary while compiling, with the weight of every field, the affinity between fields
+     * and whether the struct is safe to reorder. Merging every summary of the program gives the same inputs to each
+     * backend, so they all pick the same layout per struct without ever seeing each other's IR.
+     *
+     * Escapes to external functions are recorded rather than treated as unsafe, along with the argument the struct is
+     * passed as. Each module records in turn what its own functions do with their pointer arguments, so the escape only
+     * counts once the merged summaries don't define the function, or the function lets the pointer escape further.
+     *
+     * Only depends on LLVM Support, so the standalone tools can read summaries too.
+     */
+    class SummaryInfo {
+    public:
+        static constexpr const char *MAGIC = "ZIPPY-SUMMARY";
+        static constexpr unsigned VERSION = 2;
+        static constexpr const char *EXTENSION = ".zippy-summary";
+
+        // A pointer passed to a function defined elsewhere, as its argument `argNo`
+        struct ExternalArg {
+            std::string function;
+            unsigned argNo;
+
+            bool operator==(const ExternalArg &other) const {
+                return function == other.function && argNo == other.argNo;
+            }
+
+            bool operator<(const ExternalArg &other) const {
+                return std::tie(function, argNo) < std::tie(other.function, other.argNo);
+            }
+        };
+
+        // What a function defined in a summarized module does with one of its pointer arguments
+        struct ArgumentSummary {
+            // Empty while any struct passed as the argument stays safe
+            std::string unsafeReason;
+            // Functions defined elsewhere the argument is passed on to
+            std::vector<ExternalArg> forwards;
+        };
+
+        struct StructSummary {
+            // Printed body of the struct, summaries of differing bodies under the same name are never merged
+            std::string signature;
+            // Empty while the struct is safe to reorder
+            std::string unsafeReason;
+            std::vector<ExternalArg> externalCallees;
+            // Total weight per initial field index
+            std::vector<float> weights;
+            // Symmetric affinity matrix, indexed by `[a * numFields + b]`
+            std::vector<float> affinity;
+
+            unsigned getNumFields() const {
+                return weights.size();
+            }
+
+            bool isSafe() const {
+                return unsafeReason.empty();
+            }
+
+            // Whether the affinity matrix covers exactly the fields there are weights for
+            bool isConsistent() const {
+                return affinity.size() == weights.size() * weights.size();
+            }
+        };
+
+    private:
+        llvm::StringMap<StructSummary> structSummaries;
+        // Functions defined, and so visible to the pass, in any of the summarized modules
+        llvm::StringSet<> definedFunctions;
+        // Pointer arguments of those functions which don't keep every struct safe, ordered so writes are stable
+        std::map<ExternalArg, ArgumentSummary> argumentSummaries;
+
+        // Splits `<argNo> <function>`, function names may contain spaces so they run to the end
+        static std::optional<ExternalArg> parseExternalArg(const llvm::StringRef text) {
+            const auto [argNoText, function] = text.split(' ');
+            unsigned argNo;
+            if (argNoText.getAsInteger(10, argNo) || function.empty()) return std::nullopt;
+            return ExternalArg{function.str(), argNo};
+        }
+
+        static bool parseFloats(llvm::StringRef text, std::vector<float> &values) {
+            llvm::SmallVector<llvm::StringRef, 16> tokens;
+            text.split(tokens, ' ', -1, false);
+            for (const auto token: tokens) {
+                double value;
+                if (token.getAsDouble(value)) return false;
+                values.push_back(static_cast<float>(value));
+            }
+            return true;
+        }
+
+        bool parse(const llvm::MemoryBuffer &buffer) {
+            llvm::SmallVector<llvm::StringRef, 64> lines;
+            buffer.getBuffer().split(lines, '\n', -1, false);
+            if (lines.empty()) return false;
+            const auto [magic, version] = lines.front().split(' ');
+            unsigned versionNumber;
+            if (magic != MAGIC || version.getAsInteger(10, versionNumber) || versionNumber != VERSION) return false;
+
+            // Each line is a key followed by its value, struct names may contain spaces so values run to the end
+            std::optional<std::pair<std::string, StructSummary>> current;
+            std::optional<std::pair<ExternalArg, ArgumentSummary>> currentArgument;
+            for (const auto line: llvm::drop_begin(lines)) {
+                const auto [key, value] = line.split(' ');
+                if (key == "define") {
+                    definedFunctions.insert(value);
+                } else if (key == "struct") {
+                    if (current || currentArgument) return false;
+                    current.emplace(value.str(), StructSummary());
+                } else if (key == "argument") {
+                    if (current || currentArgument) return false;
+                    const auto externalArg = parseExternalArg(value);
+                    if (!externalArg) return false;
+                    currentArgument.emplace(*externalArg, ArgumentSummary());
+                } else if (currentArgument) {
+                    if (key == "unsafe") {
+                        currentArgument->second.unsafeReason = value.str();
+                    } else if (key == "forward") {
+                        const auto externalArg = parseExternalArg(value);
+                        if (!externalArg) return false;
+                        currentArgument->second.forwards.push_back(*externalArg);
+                    } else if (key == "end") {
+                        mergeArgument(currentArgument->first, currentArgument->second);
+                        currentArgument.reset();
+                    } else {
+                        return false;
+                    }
+                } else if (!current) {
+                    return false;
+                } else if (key == "signature") {
+                    current->second.signature = value.str();
+                } else if (key == "unsafe") {
+                    current->second.unsafeReason = value.str();
+                } else if (key == "external") {
+                    const auto externalArg = parseExternalArg(value);
+                    if (!externalArg) return false;
+                    current->second.externalCallees.push_back(*externalArg);
+                } else if (key == "weights") {
+                    if (!parseFloats(value, current->second.weights)) return false;
+                } else if (key == "affinity") {
+                    if (!parseFloats(value, current->second.affinity)) return false;
+                } else if (key == "end") {
+                    if (!current->second.isConsistent()) return false;
+                    merge(current->first, current->second);
+                    current.reset();
+                } else {
+                    return false;
+                }
+            }
+            return !current && !currentArgument;
+        }
+
+        static void writeFloats(llvm::raw_ostream &out, const std::vector<float> &values) {
+            for (const auto value: values) {
+                out << ' ' << llvm::format("%g", value);
+            }
+        }
+
+    public:
+        /**
+         * Merges every summary within `directory`, in name order so each backend adds them up the same way.
+         */
+        static std::optional<SummaryInfo> loadDirectory(const llvm::StringRef directory) {
+            log() << "Loading Summaries: " << directory << "\n";
+            std::error_code errorCode;
+            std::vector<std::string> paths;
+            for (llvm::sys::fs::directory_iterator it(directory, errorCode), end; it != end && !errorCode;
+                 it.increment(errorCode)) {
+                if (llvm::sys::path::extension(it->path()) == EXTENSION) paths.push_back(it->path());
+            }
+            if (errorCode) {
+                llvm::errs() << "Failed to read summary directory, ignored\n\n";
+                return std::nullopt;
+            }
+            llvm::sort(paths);
+
+            SummaryInfo summaryInfo;
+            for (const auto &path: paths) {
+                auto bufferOrErr = llvm::MemoryBuffer::getFile(path);
+                if (!bufferOrErr || !summaryInfo.parse(**bufferOrErr)) {
+                    llvm::errs() << "Malformed or outdated summary, ignored: " << path << "\n";
+                }
+            }
+            summaryInfo.resolveExternalCallees();
+            log() << llvm::format("Loaded [%d] Struct Summaries from [%d] Modules\n\n",
+                                  summaryInfo.structSummaries.size(), paths.size());
+            return summaryInfo;
+        }
+
+        /**
+         * Summary file of a module within `directory`, named after the module so concurrent compiles never collide.
+         */
+        static std::string getPath(const llvm::StringRef directory, const llvm::StringRef moduleIdentifier) {
+            std::string fileName;
+            llvm::raw_string_ostream fileNameStream(fileName);
+            fileNameStream << llvm::sys::path::filename(moduleIdentifier) << '.'
+                           << llvm::format_hex_no_prefix(llvm::xxHash64(moduleIdentifier), 16) << EXTENSION;
+            llvm::SmallString<256> path(directory);
+            llvm::sys::path::append(path, fileNameStream.str());
+            return std::string(path);
+        }
+
+        void addDefinedFunction(const llvm::StringRef name) {
+            definedFunctions.insert(name);
+        }
+
+        bool isDefined(const llvm::StringRef name) const {
+            return definedFunctions.contains(name);
+        }
+
+        const StructSummary *lookup(const llvm::StringRef name) const {
+            const auto found = structSummaries.find(name);
+            return found == structSummaries.end() ? nullptr : &found->second;
+        }
+
+        /**
+         * Adds the weights and affinity onto any existing summary of the same struct, unsafe if either one is.
+         */
+        void merge(const llvm::StringRef name, const StructSummary &structSummary) {
+            auto [found, inserted] = structSummaries.try_emplace(name, structSummary);
+            auto &existing = found->second;
+            if (!structSummary.isConsistent()) {
+                if (existing.isSafe()) existing.unsafeReason = "summarized inconsistently";
+                return;
+            }
+            if (inserted) return;
+            if (existing.signature != structSummary.signature) {
+                if (existing.isSafe()) existing.unsafeReason = "defined differently across modules";
+                return;
+            }
+            // The same body always has as many fields, anything else is a summary of some other build
+            if (existing.weights.size() != structSummary.weights.size() ||
+                existing.affinity.size() != structSummary.affinity.size()) {
+                if (existing.isSafe()) existing.unsafeReason = "summarized with differing fields across modules";
+                return;
+            }
+            if (existing.isSafe()) existing.unsafeReason = structSummary.unsafeReason;
+            for (const auto &callee: structSummary.externalCallees) {
+                if (!llvm::is_contained(existing.externalCallees, callee)) existing.externalCallees.push_back(callee);
+            }
+            for (unsigned i = 0; i < existing.weights.size(); i++) {
+                existing.weights[i] += structSummary.weights[i];
+            }
+            for (unsigned i = 0; i < existing.affinity.size(); i++) {
+                existing.affinity[i] += structSummary.affinity[i];
+            }
+        }
+
+        /**
+         * Records what a defined function does with a pointer argument, merged with any other module defining it too,
+         * eg: an inline function.
+         */
+        void mergeArgument(const ExternalArg &argument, const ArgumentSummary &argumentSummary) {
+            auto [found, inserted] = argumentSummaries.try_emplace(argument, argumentSummary);
+            if (inserted) return;
+            auto &existing = found->second;
+            if (existing.unsafeReason.empty()) existing.unsafeReason = argumentSummary.unsafeReason;
+            for (const auto &forward: argumentSummary.forwards) {
+                if (!llvm::is_contained(existing.forwards, forward)) existing.forwards.push_back(forward);
+            }
+        }
+
+        /**
+         * Why a struct passed to a function defined elsewhere is unsafe, or empty if every summarized module keeps it
+         * safe, following the pointer on through every function it is passed to.
+         */
+        std::string getEscapeReason(const ExternalArg &externalArg) const {
+            std::vector<ExternalArg> worklist{externalArg};
+            std::vector<ExternalArg> visited;
+            while (!worklist.empty()) {
+                const auto current = worklist.back();
+                worklist.pop_back();
+                if (llvm::is_contained(visited, current)) continue;
+                visited.push_back(current);
+
+                if (!isDefined(current.function)) return "escapes to external function '" + current.function + "'";
+                const auto found = argumentSummaries.find(current);
+                if (found == argumentSummaries.end()) continue;
+                if (!found->second.unsafeReason.empty())
+                    return found->second.unsafeReason + " in '" + current.function + "'";
+                worklist.insert(worklist.end(), found->second.forwards.begin(), found->second.forwards.end());
+            }
+            return "";
+        }
+
+        /**
+         * Merges every struct, defined function and argument of another summary into this one.
+         */
+        void mergeAll(const SummaryInfo &other) {
+            for (const auto &entry: other.definedFunctions) {
+                definedFunctions.insert(entry.getKey());
+            }
+            for (const auto &[argument, argumentSummary]: other.argumentSummaries) {
+                mergeArgument(argument, argumentSummary);
+            }
+            for (const auto &entry: other.structSummaries) {
+                merge(entry.getKey(), entry.getValue());
+            }
+        }
+
+        const llvm::StringMap<StructSummary> &getStructSummaries() const {
+            return structSummaries;
+        }
+
+        /**
+         * Marks structs escaping to functions none of the summaries define, or which let them escape further, as
+         * unsafe.
+         */
+        void resolveExternalCallees() {
+            for (auto &entry: structSummaries) {
+                auto &structSummary = entry.second;
+                for (const auto &callee: structSummary.externalCallees) {
+                    if (!structSummary.isSafe()) break;
+                    structSummary.unsafeReason = getEscapeReason(callee);
+                }
+            }
+        }
+
+        void write(llvm::raw_ostream &out) const {
+            out << MAGIC << ' ' << VERSION << '\n';
+            // Sorted, so the same module always gives the same summary
+            std::vector<llvm::StringRef> functionNames;
+            for (const auto &entry: definedFunctions) {
+                functionNames.push_back(entry.getKey());
+            }
+            llvm::sort(functionNames);
+            for (const auto name: functionNames) {
+                out << "define " << name << '\n';
+            }
+            for (const auto &[argument, argumentSummary]: argumentSummaries) {
+                out << "argument " << argument.argNo << ' ' << argument.function << '\n';
+                if (!argumentSummary.unsafeReason.empty()) out << "unsafe " << argumentSummary.unsafeReason << '\n';
+                for (const auto &forward: argumentSummary.forwards) {
+                    out << "forward " << forward.argNo << ' ' << forward.function << '\n';
+                }
+                out << "end\n";
+            }
+
+            std::vector<llvm::StringRef> structNames;
+            for (const auto &entry: structSummaries) {
+                structNames.push_back(entry.getKey());
+            }
+            llvm::sort(structNames);
+            for (const auto name: structNames) {
+                const auto &structSummary = structSummaries.find(name)->second;
+                out << "struct " << name << '\n';
+                out << "signature " << structSummary.signature << '\n';
+                if (!structSummary.isSafe()) out << "unsafe " << structSummary.unsafeReason << '\n';
+                for (const auto &callee: structSummary.externalCallees) {
+                    out << "external " << callee.argNo << ' ' << callee.function << '\n';
+                }
+                out << "weights";
+                writeFloats(out, structSummary.weights);
+                out << "\naffinity";
+                writeFloats(out, structSummary.affinity);
+                out << "\nend\n";
+            }
+        }
+    };
+}
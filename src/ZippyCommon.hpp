@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ZippyLog.hpp"
+
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
@@ -15,12 +17,17 @@
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/LoopInfo.h>
 
+#include <set>
+
 namespace Zippy {
     const std::string NO_VAL_NAME_STR = "???";
     const std::string SKIPPED_STR = "[SKIPPED]";
     const std::string TAB_STR = "    ";
     const std::string TAB_STR_2 = TAB_STR + TAB_STR;
 
+    // Assumed cache line size when grouping fields
+    constexpr unsigned CACHE_LINE_SIZE = 64;
+
     struct Type {
         llvm::Type *ptr;
 
@@ -58,6 +65,19 @@ namespace Zippy {
             const auto typeAlignment = fieldType.getABIAlign(DL);
             return commonAlignment(typeAlignment, fieldOffset);
         }
+
+        /**
+         * The body as it would print, eg: `{ i32, ptr }`, telling apart different structs of the same name.
+         */
+        std::string getSignature() const {
+            std::string signature;
+            llvm::raw_string_ostream signatureStream(signature);
+            signatureStream << (ptr->isPacked() ? "<{ " : "{ ");
+            llvm::interleaveComma(ptr->elements(), signatureStream,
+                                  [&signatureStream](const llvm::Type *element) { signatureStream << *element; });
+            signatureStream << (ptr->isPacked() ? " }>" : " }");
+            return signatureStream.str();
+        }
     };
 
     struct Function {
@@ -88,6 +108,20 @@ namespace Zippy {
         }
     };
 
+    /**
+     * Counts the distinct cache lines touched by the given `[offset, offset + size)` byte ranges.
+     */
+    inline unsigned countCacheLines(const std::vector<std::pair<uint64_t, uint64_t>> &ranges) {
+        std::set<uint64_t> lines;
+        for (const auto &[offset, size]: ranges) {
+            const auto last = offset + std::max<uint64_t>(size, 1) - 1;
+            for (auto line = offset / CACHE_LINE_SIZE; line <= last / CACHE_LINE_SIZE; line++) {
+                lines.insert(line);
+            }
+        }
+        return lines.size();
+    }
+
     llvm::Align calculateFieldAlignment(const llvm::DataLayout &DL,
                                         llvm::StructType *structType,
                                         unsigned fieldIndex) {
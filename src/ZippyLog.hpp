@@ -0,0 +1,21 @@
+#pragma once
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace Zippy {
+    static llvm::cl::opt<bool> Verbose(
+        "zippy-verbose",
+        llvm::cl::desc("Log the progress of zippy to stderr, eg: the field weights and why each struct is skipped"),
+        llvm::cl::init(false));
+
+    /**
+     * Stream for progress logs, which are dropped unless `-zippy-verbose` is given. Failures are still reported on
+     * `llvm::errs()`.
+     *
+     * Only depends on LLVM Support, so the headers the standalone tools share can log too.
+     */
+    inline llvm::raw_ostream &log() {
+        return Verbose ? llvm::errs() : llvm::nulls();
+    }
+}
@@ -1,269 +1,28 @@
-#include "ZippyCommon.hpp"
-#include "FunctionInfo.hpp"
-#include "FieldInfo.hpp"
-#include "GlobalVarInfo.hpp"
-#include "StructInfo.hpp"
+#include "ZippyPass.hpp"
 
-#include <llvm/Pass.h>
-#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Passes/PassPlugin.h>
 
-
 namespace Zippy {
-    class Pass {
-        llvm::Module &M;
-        llvm::ModuleAnalysisManager &AM;
-        const llvm::DataLayout &DL;
-
-        // Using lists instead of vectors, because using vectors didn't let me remove elements?
-        std::vector<StructInfo> structInfos;
-        std::vector<FunctionInfo> functionInfos;
-
-        bool collectStructTypes() {
-            structInfos = StructInfo::collect(M, DL);
-            return !structInfos.empty();
-        }
-
-        bool collectFunctions() {
-            functionInfos = FunctionInfo::collect(M);
-            return !functionInfos.empty();
-        }
-
-        bool collectFieldUses() {
-            llvm::errs() << "Collecting Field Uses\n";
-            unsigned sumUses = 0;
-            for (auto &structInfo: structInfos) {
-                llvm::errs() << TAB_STR << structInfo.getStructType() << "\n";
-                for (auto &functionInfo: functionInfos) {
-                    const auto uses = structInfo.collectFieldUses(functionInfo);
-                    if (uses == 0) continue;
-                    llvm::errs() << TAB_STR_2 << functionInfo.getFunction();
-                    llvm::errs() << llvm::format(" [%d] uses\n", uses);
-                    sumUses += uses;
-                }
-            }
-            if (sumUses == 0) {
-                llvm::errs() << "No Field Uses collected\n";
-                return false;
-            }
-            llvm::errs() << llvm::format("Collected [%d] Field Uses\n\n", sumUses);
-            return true;
-        }
-
-        void collectGlobalVars() {
-            auto globalVarInfos = GlobalVarInfo::collect(M);
-            if (globalVarInfos.empty()) return;
-            unsigned varsCollected = 0;
-            llvm::errs() << "Collecting Global Variables into Structs\n";
-            for (auto &structInfo: structInfos) {
-                varsCollected += structInfo.collectGlobalVars(globalVarInfos);
-            }
-            if (varsCollected == 0) {
-                llvm::errs() << "None collected\n";
-            } else {
-                llvm::errs() << llvm::format("Collected [%d] Total Global Variables\n", varsCollected);
-            }
-        }
-
-        // Inner loop multipliers, scaled by a non-linear curve
-        const float outerLoopMult = std::pow(100, 1.3F);  // ~631.0
-        const float middleLoopMult = std::pow(20, 1.3F);  // ~56.2
-        const float innerLoopMult = std::pow(10, 1.3F);   // ~20.0
-
-        void computeFieldWeights() {
-            for (auto &structInfo: structInfos) {
-                llvm::errs() << "Computing Field Weights For: " << structInfo.getStructType() << "\n";
-                auto &fieldInfos = structInfo.getFieldInfos();
-
-                llvm::errs() << TAB_STR << "Size Weights:\n";
-                for (auto &fieldInfo: fieldInfos) {
-                    const auto size = fieldInfo.getAllocSize().getKnownMinValue();
-                    const float sizeWeight = size;
-                    fieldInfo.setSizeWeight(sizeWeight);
-                    llvm::errs() << TAB_STR_2 << llvm::format(
-                        "Index: [%02d] - Alloc Size: [%02d] - Size Weight: [%06.2f]\n",
-                        fieldInfo.getInitialIndex(), size, sizeWeight);
-                }
-
-                llvm::errs() << TAB_STR << "Load/Store Weights:\n";
-                for (auto &fieldInfo: fieldInfos) {
-                    llvm::errs() << TAB_STR_2 << llvm::format("Index: [%02d] - ", fieldInfo.getInitialIndex());
-                    if (fieldInfo.getSumLoadStores() == 0) {
-                        fieldInfo.setLoadWeight(0.0F);
-                        fieldInfo.setStoreWeight(0.0F);
-                        llvm::errs() << "No Load/Stores\n";
-                        continue;
-                    }
-
-                    const auto loads = fieldInfo.getNumLoads();
-                    const auto stores = fieldInfo.getNumStores();
-
-                    const float loadWeight = loads;
-                    const float storeWeight = stores;
-
-                    fieldInfo.setLoadWeight(loadWeight);
-                    fieldInfo.setStoreWeight(storeWeight);
-
-                    llvm::errs() << llvm::format(
-                        "Loads: [%02d] - Load Weight: [%06.2f] - Stores: [%02d] - Store Weight: [%06.2f]\n",
-                        loads, loadWeight, stores, storeWeight);
-                }
-
-                llvm::errs() << TAB_STR << "Loop Weights:\n";
-                for (auto &fieldInfo: fieldInfos) {
-                    float loopAccessWeight = 1.0F;
-                    unsigned loopAccessCount = 0;
-                    unsigned deepestLoopFound = 0;
-
-                    const auto &uses = fieldInfo.getUses();
-                    for (const auto &use: uses) {
-                        const unsigned depth = use.computeLoopDepth();
-                        // No work to do if depth is zero
-                        if (depth == 0) continue;
-
-                        // TODO: In concept, values present in an outer loop would run more frequently than
-                        //       inside an inner loop. Consider iterating over x-y-z, but doing intermediate work
-                        //       at each stage. As far as frequency of access goes this is weird, might change it as
-                        //       benchmarks and tests roll along.
-                        float loopMult;
-                        switch (depth) {
-                            case 1:
-                                loopMult = outerLoopMult;
-                                break;
-                            case 2:
-                                loopMult = middleLoopMult;
-                                break;
-                            default:
-                                loopMult = innerLoopMult;
-                                break;
-                        }
-
-                        // Compute new use weight and apply iy
-                        const float useWeight = loopMult * depth;
-                        loopAccessWeight = std::max(loopAccessWeight, useWeight);
-
-                        // Increment debug counters
-                        ++loopAccessCount;
-                        deepestLoopFound = std::max(deepestLoopFound, depth);
-                    }
-
-                    llvm::errs() << TAB_STR_2;
-                    if (loopAccessCount > 0) {
-                        llvm::errs() << llvm::format(
-                            "Index: [%02d] - Loop Accesses: [%02d] - Deepest Loop: [%02d] - Loop Weight: [%06.2f]\n",
-                            fieldInfo.getInitialIndex(), loopAccessCount, deepestLoopFound, loopAccessWeight);
-                    } else {
-                        llvm::errs() << llvm::format("Index: [%02d] - Not used in loops.\n",
-                                                     fieldInfo.getInitialIndex());
-                    }
-
-                    fieldInfo.setLoopWeight(loopAccessWeight);
-                }
-
-                structInfo.normalizeWeights();
-
-                auto maxSizeWeight = 1.0F;
-                auto maxLoadWeight = 1.0F;
-                auto maxStoreWeight = 1.0F;
-                auto maxLoopWeight = 1.0F;
-
-                llvm::errs() << TAB_STR << "Normalized Weights:\n";
-
-                // Find maximum weights
-                for (const auto &fieldInfo: fieldInfos) {
-                    maxSizeWeight = std::max(maxSizeWeight, fieldInfo.getSizeWeight());
-                    maxLoadWeight = std::max(maxLoadWeight, fieldInfo.getLoadWeight());
-                    maxStoreWeight = std::max(maxStoreWeight, fieldInfo.getStoreWeight());
-                    maxLoopWeight = std::max(maxLoopWeight, fieldInfo.getLoopWeight());
-                }
-                // Normalized weights (0, 1)
-                for (auto &fieldInfo: fieldInfos) {
-                    const auto sizeWeight = fieldInfo.getSizeWeight() / maxSizeWeight;
-                    const auto loadWeight = fieldInfo.getLoadWeight() / maxLoadWeight;
-                    const auto storeWeight = fieldInfo.getStoreWeight() / maxStoreWeight;
-                    const auto loopWeight = fieldInfo.getLoopWeight() / maxLoopWeight;
-
-                    fieldInfo.setSizeWeight(sizeWeight);
-                    fieldInfo.setLoadWeight(loadWeight);
-                    fieldInfo.setStoreWeight(storeWeight);
-                    fieldInfo.setLoopWeight(loopWeight);
-
-                    llvm::errs() << TAB_STR_2 << llvm::format(
-                        "Index: [%02d] - Size Weight: [%06.2f] - Load Weight: [%06.2f] - Store Weight: [%06.2f] - Loop Weight: [%06.2f]\n",
-                        sizeWeight, loadWeight, storeWeight, loopWeight);
-                }
-
-                llvm::errs() << TAB_STR << "Total Weights:\n";
-                for (auto &fieldInfo: fieldInfos) {
-                    auto totalWeight = 0.0F;
-
-                    if (fieldInfo.getSumLoadStores() != 0) {
-                        // For used fields, prioritize:
-                        // 1. Fields accessed in loops (highest priority)
-                        // 2. Fields frequently accessed (load/store frequency)
-                        // 3. With a slight bias toward larger fields to reduce padding
-
-                        totalWeight = fieldInfo.getLoopWeight() * 0.6F + // Loop access is most important
-                                      fieldInfo.getLoadWeight() * 0.3F + // Read operations
-                                      fieldInfo.getStoreWeight() * 0.2F + // Write operations
-                                      fieldInfo.getSizeWeight() * 0.1F; // Small bias for larger fields
-                    } else {
-                        // For unused fields, still give a slight preference to larger types
-                        // to help reduce padding when grouped together
-                        totalWeight = 0.1F + fieldInfo.getSizeWeight() * 0.05F;
-                    }
-
-                    fieldInfo.setTotalWeight(totalWeight);
-                    llvm::errs() << TAB_STR_2 << llvm::format("Index: [%02d] - Total Weight: [%06.2f]\n",
-                                                              fieldInfo.getCurrentIndex(), totalWeight);
-                }
-            }
-            llvm::errs() << "\n";
-        }
-
-    public:
-        explicit Pass(llvm::Module &M,
-                      llvm::ModuleAnalysisManager &AM): M(M), AM(AM), DL(M.getDataLayout()) {}
-
-        llvm::PreservedAnalyses run() {
-            auto didWork = false;
-
-            if (!collectStructTypes()) goto no_work;
-            if (!collectFunctions()) goto no_work;
-            if (!collectFieldUses()) goto no_work;
-            collectGlobalVars();
-            computeFieldWeights();
-
-            for (auto &structInfo: structInfos) {
-                llvm::errs() << "Transforming: " << structInfo.getStructType() << "\n";
-
-                auto &fieldInfos = structInfo.getFieldInfos();
-                std::sort(fieldInfos.begin(), fieldInfos.end(),
-                          [](const FieldInfo &a, const FieldInfo &b) {
-                              return a.getTotalWeight() > b.getTotalWeight();
-                          });
-
-                didWork |= structInfo.applyTransform(DL);
-            }
-
-            if (didWork) {
-                llvm::errs() << "Did work\n";
-                return llvm::PreservedAnalyses::none();
-            }
-            llvm::errs() << "Did no work\n";
-            return llvm::PreservedAnalyses::all();
-            // No work skip
-        no_work:
-            llvm::errs() << "No work found\n";
-            return llvm::PreservedAnalyses::all();
-        }
+    enum class ExtensionPoint {
+        NONE,
+        PIPELINE_START,
+        OPTIMIZER_EARLY,
+        OPTIMIZER_LAST,
+        FULL_LTO
     };
 
-    struct ZippyPass : llvm::PassInfoMixin<ZippyPass> {
-        static llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) {
-            return Pass(M, AM).run();
-        }
-    };
+    static llvm::cl::opt<ExtensionPoint> ExtensionPointOpt(
+        "zippy-ep",
+        llvm::cl::desc("Where zippy runs within the default pipelines, eg: clang -O2 -fpass-plugin=ZippyPass.so"),
+        llvm::cl::values(
+            clEnumValN(ExtensionPoint::NONE, "none", "Only when named explicitly, eg: opt -passes=zippy"),
+            clEnumValN(ExtensionPoint::PIPELINE_START, "pipeline-start", "Before any simplification, on -O0 like IR"),
+            clEnumValN(ExtensionPoint::OPTIMIZER_EARLY, "optimizer-early",
+                       "After simplification and inlining, before vectorization and unrolling"),
+            clEnumValN(ExtensionPoint::OPTIMIZER_LAST, "optimizer-last", "At the very end of the pipeline"),
+            clEnumValN(ExtensionPoint::FULL_LTO, "full-lto", "On the merged module of a full LTO link")),
+        // Reordering one translation unit at a time breaks the ABI between them, so it is never on by default
+        llvm::cl::init(ExtensionPoint::NONE));
 }
 
 using namespace llvm;
@@ -275,6 +34,15 @@ llvmGetPassPluginInfo() {
         .PluginName = "ZippyPass",
         .PluginVersion = "v0.1",
         .RegisterPassBuilderCallbacks = [](PassBuilder &PB) {
+            // Field access statistics, cached until the module changes. The merged module of a full LTO link is the
+            // whole program, so exported functions and globals don't make its structs unsafe there.
+            PB.registerAnalysisRegistrationCallback(
+                [](ModuleAnalysisManager &MAM) {
+                    MAM.registerPass([] {
+                        return Zippy::ZippyFieldAccessAnalysis(
+                            Zippy::ExtensionPointOpt == Zippy::ExtensionPoint::FULL_LTO);
+                    });
+                });
             PB.registerPipelineParsingCallback(
                 [](const StringRef Name, ModulePassManager &MPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -286,8 +54,69 @@ llvmGetPassPluginInfo() {
                         MPM.addPass(Zippy::ZippyPass());
                         return true;
                     }
+                    // Summarizes struct accesses for ThinLTO, the backends then run 'zippy' with the same directory
+                    //
+                    // eg: opt -load-pass-plugin ZippyPass.so -passes=zippy-summarize -zippy-summary-dir=summaries input.ll -o input.bc
+                    if (Name == "zippy-summarize") {
+                        MPM.addPass(Zippy::ZippySummarizePass());
+                        return true;
+                    }
+                    // Writes the computed layouts as C struct definitions to apply by hand, eg: to structs of a public ABI
+                    //
+                    // eg: opt -load-pass-plugin ZippyPass.so -passes=zippy-advise -zippy-advice=advice.h input.ll -disable-output
+                    if (Name == "zippy-advise") {
+                        MPM.addPass(Zippy::ZippyAdvisePass());
+                        return true;
+                    }
+                    // Instruments field uses for profiling, link the result against `libzippy_rt`
+                    //
+                    // eg: opt -load-pass-plugin ZippyPass.so -passes=zippy-instrument input.ll -o instrumented.ll -S
+                    if (Name == "zippy-instrument") {
+                        MPM.addPass(Zippy::ZippyInstrumentPass());
+                        return true;
+                    }
+                    // Prints per loop cache line footprints without transforming anything
+                    //
+                    // eg: opt -load-pass-plugin ZippyPass.so -passes='print<zippy-layout>' input.ll -disable-output
+                    if (Name == "print<zippy-layout>") {
+                        MPM.addPass(Zippy::ZippyLayoutPrinterPass(llvm::errs()));
+                        return true;
+                    }
+                    // Prints the field access statistics the layouts are computed from
+                    //
+                    // eg: opt -load-pass-plugin ZippyPass.so -passes='print<zippy-field-access>' input.ll -disable-output
+                    if (Name == "print<zippy-field-access>") {
+                        MPM.addPass(Zippy::ZippyFieldAccessPrinterPass(llvm::errs()));
+                        return true;
+                    }
+                    if (Name == "require<zippy-field-access>") {
+                        MPM.addPass(RequireAnalysisPass<Zippy::ZippyFieldAccessAnalysis, Module>());
+                        return true;
+                    }
+                    if (Name == "invalidate<zippy-field-access>") {
+                        MPM.addPass(InvalidateAnalysisPass<Zippy::ZippyFieldAccessAnalysis>());
+                        return true;
+                    }
                     return false;
                 });
+            // Runs as part of the default pipelines, at the extension point picked by `-zippy-ep`. Unoptimized
+            // builds are left alone.
+            //
+            // eg: clang -O2 -fpass-plugin=ZippyPass.so -mllvm -zippy-ep=optimizer-last input.c
+            const auto addAt = [](const Zippy::ExtensionPoint extensionPoint) {
+                return [extensionPoint](ModulePassManager &MPM, const OptimizationLevel Level) {
+                    if (Zippy::ExtensionPointOpt != extensionPoint || Level == OptimizationLevel::O0) return;
+                    MPM.addPass(Zippy::ZippyPass());
+                };
+            };
+            PB.registerPipelineStartEPCallback(addAt(Zippy::ExtensionPoint::PIPELINE_START));
+            PB.registerOptimizerEarlyEPCallback(addAt(Zippy::ExtensionPoint::OPTIMIZER_EARLY));
+            PB.registerOptimizerLastEPCallback(addAt(Zippy::ExtensionPoint::OPTIMIZER_LAST));
+            // Runs on the merged module of a full LTO link, where every translation unit is visible. Only picked by
+            // `-zippy-ep=full-lto`, so the compile steps leave each translation unit alone even with the plugin loaded.
+            //
+            // eg: clang -flto -fuse-ld=lld -Wl,--load-pass-plugin=ZippyPass.so -Wl,-mllvm,-zippy-ep=full-lto a.c b.c
+            PB.registerFullLinkTimeOptimizationEarlyEPCallback(addAt(Zippy::ExtensionPoint::FULL_LTO));
         }
     };
 }
@@ -0,0 +1,811 @@
+#pragma once
+
+#include "ZippyCommon.hpp"
+#include "AccessCache.hpp"
+#include "FieldAccessInfo.hpp"
+#include "FunctionInfo.hpp"
+#include "FieldInfo.hpp"
+#include "GlobalVarInfo.hpp"
+#include "StructInfo.hpp"
+#include "Instrumentation.hpp"
+#include "LayoutAdvisor.hpp"
+#include "LayoutDatabase.hpp"
+#include "LayoutRemarks.hpp"
+#include "LayoutReport.hpp"
+#include "LegalityInfo.hpp"
+#include "LoopLayoutInfo.hpp"
+#include "ProfileInfo.hpp"
+#include "Statistics.hpp"
+#include "SummaryInfo.hpp"
+
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Pass.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include <numeric>
+
+
+namespace Zippy {
+    static llvm::cl::opt<std::string> ProfilePath(
+        "zippy-profile",
+        llvm::cl::desc("Field access profile written by libzippy_rt, replaces static hotness and affinity guesses"),
+        llvm::cl::value_desc("file"));
+
+    static llvm::cl::opt<std::string> SummaryDir(
+        "zippy-summary-dir",
+        llvm::cl::desc("Directory of per module summaries, written by zippy-summarize and merged by zippy so every "
+                       "module of a ThinLTO build picks the same layout"),
+        llvm::cl::value_desc("directory"));
+
+    static llvm::cl::opt<std::string> LayoutDatabasePath(
+        "zippy-layout-db",
+        llvm::cl::desc("Layouts shared by every compile of a project, the first layout decided for a struct is reused "
+                       "by all later ones"),
+        llvm::cl::value_desc("file"));
+
+    static llvm::cl::opt<std::string> AdvicePath(
+        "zippy-advice",
+        llvm::cl::desc("Where zippy-advise writes the reordered struct definitions, '-' for stdout"),
+        llvm::cl::value_desc("file"),
+        llvm::cl::init("-"));
+
+    static llvm::cl::opt<std::string> AccessCacheDir(
+        "zippy-cache-dir",
+        llvm::cl::desc("Directory caching the loop depths and co-accesses of each function by a hash of its IR, so "
+                       "rebuilds only compute the loops of the functions that changed"),
+        llvm::cl::value_desc("directory"));
+
+    static llvm::cl::opt<std::string> ReportPath(
+        "zippy-report",
+        llvm::cl::desc("JSON report of every layout decision, written by zippy before transforming"),
+        llvm::cl::value_desc("file"));
+
+    class Pass {
+        llvm::Module &M;
+        llvm::ModuleAnalysisManager &AM;
+        const llvm::DataLayout &DL;
+        // The module is the whole program, eg: under full LTO
+        bool wholeProgram;
+
+        // Using lists instead of vectors, because using vectors didn't let me remove elements?
+        std::vector<StructInfo> structInfos;
+        std::vector<FunctionInfo> functionInfos;
+        AccessCache accessCache;
+        // Merged summaries of every module, when laying out for ThinLTO
+        std::optional<SummaryInfo> summaryInfo;
+        std::optional<LayoutDatabase> layoutDatabase;
+        llvm::MapVector<llvm::StructType*, FieldAccessInfo::UnsafeStruct> unsafeStructs;
+        RejectedStructs rejectedStructs;
+
+        bool collectStructTypes() {
+            PhaseTimer timer("collect-struct-types", "Zippy Collect Struct Types");
+            structInfos = StructInfo::collect(M, DL, &rejectedStructs);
+            NumStructsConsidered += structInfos.size();
+            return !structInfos.empty();
+        }
+
+        void loadSummaries() {
+            if (summaryInfo || SummaryDir.empty()) return;
+            summaryInfo = SummaryInfo::loadDirectory(SummaryDir);
+        }
+
+        /**
+         * Why the struct can't be reordered, or empty if it can. With summaries, escapes to functions another module
+         * defines are fine, but the struct has to be safe in every module.
+         */
+        std::string getUnsafeReason(const LegalityInfo &legalityInfo, const StructInfo &structInfo) const {
+            const auto structTy = structInfo.getStructType().ptr;
+            if (!legalityInfo.isSafe(structTy)) return legalityInfo.getReason(structTy).str();
+            if (!summaryInfo) return "";
+            for (const auto &callee: legalityInfo.getExternalCallees(structTy)) {
+                const auto reason = summaryInfo->getEscapeReason(callee);
+                if (!reason.empty()) return reason;
+            }
+            const auto structSummary = summaryInfo->lookup(structTy->getName());
+            if (!structSummary) return "";
+            if (structSummary->signature != structInfo.getSignature()) return "defined differently across modules";
+            if (structSummary->getNumFields() != structTy->getNumElements()) return "summarized with differing fields";
+            return structSummary->unsafeReason;
+        }
+
+        /**
+         * Whether every module seeing the structs lays them out the same way: under full LTO this module is the whole
+         * program, and otherwise every module follows the same summaries or layout database.
+         */
+        bool isWholeProgram() const {
+            return WholeProgram || wholeProgram || summaryInfo.has_value() || layoutDatabase.has_value();
+        }
+
+        void loadLayoutDatabase() {
+            if (LayoutDatabasePath.empty()) return;
+            layoutDatabase = LayoutDatabase::load(LayoutDatabasePath);
+        }
+
+        bool checkLegality() {
+            log() << "Checking Struct Legality\n";
+            const auto legalityInfo = LegalityInfo::compute(M, summaryInfo.has_value(), isWholeProgram());
+            const auto numStructs = structInfos.size();
+            structInfos.erase(std::remove_if(structInfos.begin(), structInfos.end(),
+                                             [this, &legalityInfo](const StructInfo &structInfo) {
+                                                 const auto reason = getUnsafeReason(legalityInfo, structInfo);
+                                                 if (reason.empty()) return false;
+                                                 ++NumStructsUnsafe;
+                                                 const auto structTy = structInfo.getStructType().ptr;
+                                                 unsafeStructs[structTy] = {reason,
+                                                                            legalityInfo.getUnsafeValue(structTy)};
+                                                 log() << TAB_STR;
+                                                 structInfo.getStructType().printName(log());
+                                                 log() << " - Unsafe: " << reason << "\n";
+                                                 return true;
+                                             }), structInfos.end());
+            log() << llvm::format("Skipped [%d] Unsafe Structs\n\n", numStructs - structInfos.size());
+            return !structInfos.empty();
+        }
+
+        bool collectFunctions() {
+            PhaseTimer timer("collect-functions", "Zippy Collect Functions");
+            functionInfos = FunctionInfo::collect(M, AM);
+            return !functionInfos.empty();
+        }
+
+        /**
+         * Loop depths of the field uses and call sites of every defined function, and the fields used together.
+         */
+        void collectFunctionAccesses() {
+            PhaseTimer timer("collect-function-accesses", "Zippy Collect Function Accesses");
+            auto &FAM = AM.getResult<llvm::FunctionAnalysisManagerModuleProxy>(M).getManager();
+            llvm::DenseMap<const llvm::Function*, llvm::ArrayRef<std::shared_ptr<GetElementPtrRef>>> gepRefs;
+            for (const auto &functionInfo: functionInfos) {
+                gepRefs[functionInfo.getFunction().ptr] = functionInfo.getGepRefs();
+            }
+            accessCache.collect(M, FAM, gepRefs);
+        }
+
+        // Keeps propagated call counts from overflowing the load and store counters
+        static constexpr unsigned MAX_CALL_COUNT = 1 << 10;
+
+        /**
+         * Propagates the loop depth and number of call sites of each caller into its callees, so accesses in small
+         * helpers called from hot loops elsewhere are weighed as being in those loops.
+         */
+        void collectCallContexts() {
+            struct CallContext {
+                unsigned loopDepth = 0;
+                unsigned callCount = 0;
+            };
+
+            auto &callGraph = AM.getResult<llvm::CallGraphAnalysis>(M);
+
+            // SCCs are visited callees first, so they are walked in reverse to settle callers before their callees
+            std::vector<std::vector<llvm::CallGraphNode*>> sccs;
+            for (auto sccIt = llvm::scc_begin(&callGraph); !sccIt.isAtEnd(); ++sccIt) {
+                sccs.push_back(*sccIt);
+            }
+
+            llvm::DenseMap<const llvm::Function*, CallContext> callContexts;
+            for (auto sccIt = sccs.rbegin(); sccIt != sccs.rend(); ++sccIt) {
+                llvm::SmallPtrSet<const llvm::Function*, 4> sccFunctions;
+                for (const auto node: *sccIt) {
+                    sccFunctions.insert(node->getFunction());
+                }
+
+                for (const auto node: *sccIt) {
+                    auto *caller = node->getFunction();
+                    if (!caller || caller->isDeclaration()) continue;
+                    // Functions nothing in the module calls run at least once from outside
+                    auto callerContext = callContexts[caller];
+                    callerContext.callCount = std::max(callerContext.callCount, 1U);
+                    callContexts[caller] = callerContext;
+
+                    // The loop depth of each call site comes from the function access, which may be cached
+                    const auto functionAccess = accessCache.lookup(caller);
+                    if (!functionAccess) continue;
+                    for (const auto &[calleeName, callSites]: functionAccess->callSites) {
+                        const auto *callee = M.getFunction(calleeName);
+                        // Recursion within the SCC would only feed back into itself
+                        if (!callee || callee->isDeclaration() || sccFunctions.contains(callee)) continue;
+
+                        auto &calleeContext = callContexts[callee];
+                        calleeContext.loopDepth = std::max(calleeContext.loopDepth,
+                                                           callerContext.loopDepth + callSites.loopDepth);
+                        calleeContext.callCount = std::min(calleeContext.callCount +
+                                                           callSites.count * callerContext.callCount,
+                                                           MAX_CALL_COUNT);
+                    }
+                }
+            }
+
+            log() << "Propagating Call Contexts\n";
+            for (auto &functionInfo: functionInfos) {
+                const auto callContext = callContexts.lookup(functionInfo.getFunction().ptr);
+                functionInfo.setCallContext(callContext.loopDepth, std::max(callContext.callCount, 1U));
+                if (functionInfo.getCallerLoopDepth() == 0 && functionInfo.getCallCount() == 1) continue;
+                log() << TAB_STR << functionInfo.getFunction();
+                log() << llvm::format(" - Caller Loop Depth: [%d] - Call Count: [%d]\n",
+                                      functionInfo.getCallerLoopDepth(), functionInfo.getCallCount());
+            }
+            log() << "\n";
+        }
+
+        bool collectFieldUses() {
+            PhaseTimer timer("collect-field-uses", "Zippy Collect Field Uses");
+            log() << "Collecting Field Uses\n";
+            unsigned sumUses = 0;
+            for (auto &structInfo: structInfos) {
+                log() << TAB_STR << structInfo.getStructType() << "\n";
+                for (auto &functionInfo: functionInfos) {
+                    const auto uses = structInfo.collectFieldUses(functionInfo,
+                                                                  accessCache.lookup(functionInfo.getFunction().ptr));
+                    if (uses == 0) continue;
+                    log() << TAB_STR_2 << functionInfo.getFunction();
+                    log() << llvm::format(" [%d] uses\n", uses);
+                    sumUses += uses;
+                }
+            }
+            if (sumUses == 0) {
+                log() << "No Field Uses collected\n";
+                return false;
+            }
+            log() << llvm::format("Collected [%d] Field Uses\n\n", sumUses);
+            return true;
+        }
+
+        void collectGlobalVars() {
+            auto globalVarInfos = GlobalVarInfo::collect(M);
+            if (globalVarInfos.empty()) return;
+            unsigned varsCollected = 0;
+            log() << "Collecting Global Variables into Structs\n";
+            for (auto &structInfo: structInfos) {
+                varsCollected += structInfo.collectGlobalVars(globalVarInfos);
+            }
+            if (varsCollected == 0) {
+                log() << "None collected\n";
+            } else {
+                log() << llvm::format("Collected [%d] Total Global Variables\n", varsCollected);
+            }
+        }
+
+        void collectAffinity() {
+            if (ProfilePath.empty()) return;
+            const auto profileInfo = ProfileInfo::load(ProfilePath);
+            if (!profileInfo) return;
+
+            log() << "Applying Profile\n";
+            for (auto &structInfo: structInfos) {
+                const auto structTy = structInfo.getStructType().ptr;
+                log() << TAB_STR << structInfo.getStructType();
+                const auto structProfile = profileInfo->lookup(structTy->getName(), structTy->getNumElements());
+                if (!structProfile) {
+                    log() << " - No profile\n";
+                    continue;
+                }
+                structInfo.applyProfile(*structProfile);
+                log() << " - Applied\n";
+            }
+            log() << "\n";
+        }
+
+        /**
+         * Takes the weights and affinity merged across every module over the local ones. Structs without a summary are
+         * left as is, the modules that were summarized never saw them and lay them out as they are.
+         */
+        void applySummaries() {
+            if (!summaryInfo) return;
+            log() << "Applying Summaries\n";
+            for (auto &structInfo: structInfos) {
+                log() << TAB_STR << structInfo.getStructType();
+                const auto structSummary = summaryInfo->lookup(structInfo.getStructType().ptr->getName());
+                if (!structSummary) {
+                    log() << " - No summary, left as is\n";
+                    rejectedStructs[structInfo.getStructType().ptr] = "not in any summary";
+                    continue;
+                }
+                structInfo.applySummary(*structSummary);
+                log() << " - Applied\n";
+            }
+            structInfos.erase(std::remove_if(structInfos.begin(), structInfos.end(),
+                                             [this](const StructInfo &structInfo) {
+                                                 return !summaryInfo->lookup(structInfo.getStructType().ptr->getName());
+                                             }), structInfos.end());
+            log() << "\n";
+        }
+
+        // Inner loop multipliers, scaled by a non-linear curve
+        const float outerLoopMult = std::pow(100, 1.3F);  // ~631.0
+        const float middleLoopMult = std::pow(20, 1.3F);  // ~56.2
+        const float innerLoopMult = std::pow(10, 1.3F);   // ~20.0
+
+        void computeFieldWeights() {
+            PhaseTimer timer("compute-field-weights", "Zippy Compute Field Weights");
+            for (auto &structInfo: structInfos) {
+                log() << "Computing Field Weights For: " << structInfo.getStructType() << "\n";
+                auto &fieldInfos = structInfo.getFieldInfos();
+
+                log() << TAB_STR << "Size Weights:\n";
+                for (auto &fieldInfo: fieldInfos) {
+                    const auto size = fieldInfo.getAllocSize().getKnownMinValue();
+                    const float sizeWeight = size;
+                    fieldInfo.setSizeWeight(sizeWeight);
+                    log() << TAB_STR_2 << llvm::format(
+                        "Index: [%02d] - Alloc Size: [%02d] - Size Weight: [%06.2f]\n",
+                        fieldInfo.getInitialIndex(), size, sizeWeight);
+                }
+
+                log() << TAB_STR << "Load/Store Weights:\n";
+                for (auto &fieldInfo: fieldInfos) {
+                    log() << TAB_STR_2 << llvm::format("Index: [%02d] - ", fieldInfo.getInitialIndex());
+                    if (fieldInfo.getSumLoadStores() == 0) {
+                        fieldInfo.setLoadWeight(0.0F);
+                        fieldInfo.setStoreWeight(0.0F);
+                        log() << "No Load/Stores\n";
+                        continue;
+                    }
+
+                    const auto loads = fieldInfo.getNumLoads();
+                    const auto stores = fieldInfo.getNumStores();
+
+                    const float loadWeight = loads;
+                    const float storeWeight = stores;
+
+                    fieldInfo.setLoadWeight(loadWeight);
+                    fieldInfo.setStoreWeight(storeWeight);
+
+                    log() << llvm::format(
+                        "Loads: [%02d] - Load Weight: [%06.2f] - Stores: [%02d] - Store Weight: [%06.2f]\n",
+                        loads, loadWeight, stores, storeWeight);
+                }
+
+                log() << TAB_STR << "Loop Weights:\n";
+                for (auto &fieldInfo: fieldInfos) {
+                    float loopAccessWeight = 1.0F;
+                    unsigned loopAccessCount = 0;
+                    unsigned deepestLoopFound = 0;
+
+                    for (const auto &[depth, numUses]: fieldInfo.getLoopUses()) {
+                        // No work to do if depth is zero
+                        if (depth == 0) continue;
+
+                        // TODO: In concept, values present in an outer loop would run more frequently than
+                        //       inside an inner loop. Consider iterating over x-y-z, but doing intermediate work
+                        //       at each stage. As far as frequency of access goes this is weird, might change it as
+                        //       benchmarks and tests roll along.
+                        float loopMult;
+                        switch (depth) {
+                            case 1:
+                                loopMult = outerLoopMult;
+                                break;
+                            case 2:
+                                loopMult = middleLoopMult;
+                                break;
+                            default:
+                                loopMult = innerLoopMult;
+                                break;
+                        }
+
+                        // Compute new use weight and apply iy
+                        const float useWeight = loopMult * depth;
+                        loopAccessWeight = std::max(loopAccessWeight, useWeight);
+
+                        // Increment debug counters
+                        loopAccessCount += numUses;
+                        deepestLoopFound = std::max(deepestLoopFound, depth);
+                    }
+
+                    log() << TAB_STR_2;
+                    if (loopAccessCount > 0) {
+                        log() << llvm::format(
+                            "Index: [%02d] - Loop Accesses: [%02d] - Deepest Loop: [%02d] - Loop Weight: [%06.2f]\n",
+                            fieldInfo.getInitialIndex(), loopAccessCount, deepestLoopFound, loopAccessWeight);
+                    } else {
+                        log() << llvm::format("Index: [%02d] - Not used in loops.\n",
+                                              fieldInfo.getInitialIndex());
+                    }
+
+                    fieldInfo.setLoopWeight(loopAccessWeight);
+                }
+
+                if (structInfo.getHasProfile()) {
+                    log() << TAB_STR << "Profile Weights:\n";
+                    for (auto &fieldInfo: fieldInfos) {
+                        const auto count = fieldInfo.getProfileCount();
+                        fieldInfo.setProfileWeight(static_cast<float>(count));
+                        log() << TAB_STR_2 << llvm::format("Index: [%02d] - Profiled Accesses: [%llu]\n",
+                                                           fieldInfo.getInitialIndex(), count);
+                    }
+                }
+
+                structInfo.normalizeWeights();
+
+                auto maxSizeWeight = 1.0F;
+                auto maxLoadWeight = 1.0F;
+                auto maxStoreWeight = 1.0F;
+                auto maxLoopWeight = 1.0F;
+
+                log() << TAB_STR << "Normalized Weights:\n";
+
+                // Find maximum weights
+                for (const auto &fieldInfo: fieldInfos) {
+                    maxSizeWeight = std::max(maxSizeWeight, fieldInfo.getSizeWeight());
+                    maxLoadWeight = std::max(maxLoadWeight, fieldInfo.getLoadWeight());
+                    maxStoreWeight = std::max(maxStoreWeight, fieldInfo.getStoreWeight());
+                    maxLoopWeight = std::max(maxLoopWeight, fieldInfo.getLoopWeight());
+                }
+                // Normalized weights (0, 1)
+                for (auto &fieldInfo: fieldInfos) {
+                    const auto sizeWeight = fieldInfo.getSizeWeight() / maxSizeWeight;
+                    const auto loadWeight = fieldInfo.getLoadWeight() / maxLoadWeight;
+                    const auto storeWeight = fieldInfo.getStoreWeight() / maxStoreWeight;
+                    const auto loopWeight = fieldInfo.getLoopWeight() / maxLoopWeight;
+
+                    fieldInfo.setSizeWeight(sizeWeight);
+                    fieldInfo.setLoadWeight(loadWeight);
+                    fieldInfo.setStoreWeight(storeWeight);
+                    fieldInfo.setLoopWeight(loopWeight);
+
+                    log() << TAB_STR_2 << llvm::format(
+                        "Index: [%02d] - Size Weight: [%06.2f] - Load Weight: [%06.2f] - Store Weight: [%06.2f] - Loop Weight: [%06.2f]\n",
+                        sizeWeight, loadWeight, storeWeight, loopWeight);
+                }
+
+                log() << TAB_STR << "Total Weights:\n";
+                for (auto &fieldInfo: fieldInfos) {
+                    auto totalWeight = 0.0F;
+
+                    if (fieldInfo.getSumLoadStores() != 0) {
+                        // For used fields, prioritize:
+                        // 1. Fields accessed in loops (highest priority), or measured hotness if profiled
+                        // 2. Fields frequently accessed (load/store frequency)
+                        // 3. With a slight bias toward larger fields to reduce padding
+                        const auto hotWeight = structInfo.getHasProfile()
+                                                   ? fieldInfo.getProfileWeight()
+                                                   : fieldInfo.getLoopWeight();
+
+                        totalWeight = hotWeight * 0.6F + // Loop access is most important
+                                      fieldInfo.getLoadWeight() * 0.3F + // Read operations
+                                      fieldInfo.getStoreWeight() * 0.2F + // Write operations
+                                      fieldInfo.getSizeWeight() * 0.1F; // Small bias for larger fields
+                    } else {
+                        // For unused fields, still give a slight preference to larger types
+                        // to help reduce padding when grouped together
+                        totalWeight = 0.1F + fieldInfo.getSizeWeight() * 0.05F;
+                    }
+
+                    fieldInfo.setTotalWeight(totalWeight);
+                    log() << TAB_STR_2 << llvm::format("Index: [%02d] - Total Weight: [%06.2f]\n",
+                                                       fieldInfo.getCurrentIndex(), totalWeight);
+                }
+            }
+            log() << "\n";
+        }
+
+        void computeLayouts() {
+            for (auto &structInfo: structInfos) {
+                log() << "Computing Layout For: " << structInfo.getStructType() << "\n";
+                if (layoutDatabase) {
+                    const auto order = layoutDatabase->lookup(getLayoutKey(structInfo.getStructType()));
+                    if (order && structInfo.applyOrder(*order)) {
+                        log() << TAB_STR << "Reused from the layout database\n";
+                        structInfo.computeTargetLayout(DL);
+                        continue;
+                    }
+                }
+
+                // Ties keep their initial order, so the same weights always give the same layout
+                auto &fieldInfos = structInfo.getFieldInfos();
+                std::stable_sort(fieldInfos.begin(), fieldInfos.end(),
+                                 [](const FieldInfo &a, const FieldInfo &b) {
+                                     return a.getTotalWeight() > b.getTotalWeight();
+                                 });
+                structInfo.clusterFields();
+                structInfo.computeTargetLayout(DL);
+            }
+            log() << "\n";
+        }
+
+    public:
+        explicit Pass(llvm::Module &M, llvm::ModuleAnalysisManager &AM, const bool wholeProgram = false): M(M), AM(AM),
+            DL(M.getDataLayout()),
+            wholeProgram(wholeProgram),
+            accessCache(AccessCacheDir) {}
+
+        /**
+         * Key of a struct in the layout database, taken before the struct is transformed.
+         */
+        static LayoutDatabase::Key getLayoutKey(const StructType structType) {
+            return {structType.ptr->getName().str(), LayoutDatabase::hashSignature(structType.getSignature())};
+        }
+
+        /**
+         * Gives up on every struct left for `reason`, returns false to bail out with.
+         */
+        bool rejectAll(const llvm::StringRef reason) {
+            for (const auto &structInfo: structInfos) {
+                rejectedStructs[structInfo.getStructType().ptr] = reason.str();
+            }
+            structInfos.clear();
+            return false;
+        }
+
+        /**
+         * Collects everything and puts the fields of each struct in their target order, without transforming anything
+         * or recording anything into the layout database.
+         */
+        bool analyze() {
+            if (!collectStructTypes()) return false;
+            loadSummaries();
+            loadLayoutDatabase();
+            if (!checkLegality()) return false;
+            // A layout from the summaries is followed even by modules that never use the fields, eg: to allocate them
+            if (!collectFunctions() && !summaryInfo) return rejectAll("no functions defined in this module");
+            collectFunctionAccesses();
+            collectCallContexts();
+            if (!collectFieldUses() && !summaryInfo) return rejectAll("no fields used in this module");
+            collectGlobalVars();
+            collectAffinity();
+            computeFieldWeights();
+            applySummaries();
+            computeLayouts();
+            return true;
+        }
+
+        /**
+         * Summarizes this module, without transforming anything.
+         *
+         * Every struct is summarized, including unsafe ones, which keep them unsafe for all modules once merged.
+         */
+        SummaryInfo summarizeModule() {
+            SummaryInfo moduleSummary;
+            // Only functions other modules can call resolve their escapes, as long as they keep the pointers intact
+            for (const auto &function: M.functions()) {
+                if (function.isDeclaration() || function.hasLocalLinkage()) continue;
+                moduleSummary.addDefinedFunction(function.getName());
+                for (const auto &argument: function.args()) {
+                    if (!argument.getType()->isPointerTy()) continue;
+                    SummaryInfo::ArgumentSummary argumentSummary;
+                    argumentSummary.unsafeReason = LegalityInfo::checkArgument(&argument, argumentSummary.forwards);
+                    if (argumentSummary.unsafeReason.empty() && argumentSummary.forwards.empty()) continue;
+                    moduleSummary.mergeArgument({function.getName().str(), argument.getArgNo()}, argumentSummary);
+                }
+            }
+            if (!collectStructTypes()) return moduleSummary;
+            const auto legalityInfo = LegalityInfo::compute(M, true, true);
+            collectFunctions();
+            collectFunctionAccesses();
+            collectCallContexts();
+            collectFieldUses();
+            collectAffinity();
+            computeFieldWeights();
+            for (const auto &structInfo: structInfos) {
+                const auto structTy = structInfo.getStructType().ptr;
+                moduleSummary.merge(structTy->getName(),
+                                    structInfo.summarize(legalityInfo.getReason(structTy).str(),
+                                                         legalityInfo.getExternalCallees(structTy)));
+            }
+            return moduleSummary;
+        }
+
+        /**
+         * Writes the summary of this module into the summary directory.
+         */
+        void summarize() {
+            if (SummaryDir.empty()) {
+                llvm::errs() << "No summary directory given, see -zippy-summary-dir\n";
+                return;
+            }
+            const auto moduleSummary = summarizeModule();
+            const auto path = SummaryInfo::getPath(SummaryDir, M.getModuleIdentifier());
+            std::error_code errorCode;
+            llvm::raw_fd_ostream out(path, errorCode);
+            if (errorCode) {
+                llvm::errs() << "Failed to write summary: " << path << " - " << errorCode.message() << "\n";
+                return;
+            }
+            moduleSummary.write(out);
+            log() << llvm::format("Wrote Summary of [%d] Structs: ", structInfos.size()) << path << "\n";
+        }
+
+        /**
+         * Lays out from summaries merged elsewhere rather than the summary directory, eg: by `zippy-tool`.
+         */
+        void setSummaryInfo(SummaryInfo mergedSummary) {
+            summaryInfo = std::move(mergedSummary);
+        }
+
+        const std::vector<StructInfo> &getStructInfos() const {
+            return structInfos;
+        }
+
+        const std::vector<FunctionInfo> &getFunctionInfos() const {
+            return functionInfos;
+        }
+
+        /**
+         * Analyzes the module and hands everything collected over, nothing is kept once there is nothing to lay out.
+         */
+        FieldAccessInfo computeFieldAccessInfo() {
+            if (!analyze()) structInfos.clear();
+            return {std::move(structInfos), std::move(functionInfos), std::move(unsafeStructs),
+                    std::move(rejectedStructs), std::move(layoutDatabase)};
+        }
+    };
+
+    inline FieldAccessInfo ZippyFieldAccessAnalysis::run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) const {
+        return Pass(M, AM, wholeProgram).computeFieldAccessInfo();
+    }
+
+    /**
+     * Reorders the fields of every safe struct into the layout `ZippyFieldAccessAnalysis` computed.
+     */
+    struct ZippyPass : llvm::PassInfoMixin<ZippyPass> {
+        static void writeReport(const llvm::Module &M, const FieldAccessInfo &fieldAccessInfo) {
+            std::error_code errorCode;
+            llvm::raw_fd_ostream out(ReportPath, errorCode);
+            if (errorCode) {
+                llvm::errs() << "Failed to write report: " << ReportPath << " - " << errorCode.message() << "\n";
+                return;
+            }
+            LayoutReport(M, fieldAccessInfo).write(out);
+            log() << "Wrote Report: " << ReportPath << "\n";
+        }
+
+        /**
+         * Records the computed layouts, and takes over any layout another compile decided on in the meantime. Unsafe
+         * structs are kept as is here, so they are recorded as is for everywhere else, even with nothing to lay out.
+         * An unsafe struct another compile already reordered can't agree with it either way, which fails the compile.
+         */
+        static void commitLayouts(llvm::Module &M, FieldAccessInfo &fieldAccessInfo) {
+            auto &layoutDatabase = fieldAccessInfo.getLayoutDatabase();
+            if (!layoutDatabase) return;
+            for (const auto &entry: fieldAccessInfo.getUnsafeStructs()) {
+                std::vector<unsigned> order(entry.first->getNumElements());
+                std::iota(order.begin(), order.end(), 0);
+                layoutDatabase->record(Pass::getLayoutKey({entry.first}), std::move(order));
+            }
+            for (const auto &structInfo: fieldAccessInfo.getStructInfos()) {
+                layoutDatabase->record(Pass::getLayoutKey(structInfo.getStructType()), structInfo.getOrder());
+            }
+            const auto isCommitted = layoutDatabase->commit();
+
+            for (const auto &[structTy, unsafeStruct]: fieldAccessInfo.getUnsafeStructs()) {
+                const auto order = layoutDatabase->lookup(Pass::getLayoutKey({structTy}));
+                if (!order || std::is_sorted(order->begin(), order->end())) continue;
+                M.getContext().emitError("Layout of " + structTy->getName() + " was reordered by another compile, " +
+                                         "but it is unsafe to reorder here: " + unsafeStruct.reason);
+            }
+            if (!isCommitted) return;
+
+            for (auto &structInfo: fieldAccessInfo.getStructInfos()) {
+                const auto order = layoutDatabase->lookup(Pass::getLayoutKey(structInfo.getStructType()));
+                if (!order || *order == structInfo.getOrder() || !structInfo.applyOrder(*order)) continue;
+                log() << "Layout of " << structInfo.getStructType()
+                      << " was decided by another compile first, reused\n";
+            }
+        }
+
+        static llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) {
+            auto &fieldAccessInfo = AM.getResult<ZippyFieldAccessAnalysis>(M);
+            commitLayouts(M, fieldAccessInfo);
+            if (!ReportPath.empty()) writeReport(M, fieldAccessInfo);
+            LayoutRemarks layoutRemarks(M, AM, fieldAccessInfo);
+            layoutRemarks.emitUnsafe(fieldAccessInfo);
+            layoutRemarks.emitRejected(fieldAccessInfo);
+            if (fieldAccessInfo.isEmpty()) {
+                log() << "No work found\n";
+                return llvm::PreservedAnalyses::all();
+            }
+
+            auto didWork = false;
+            auto debugTypeInfo = DebugTypeInfo::collect(M);
+            for (auto &structInfo: fieldAccessInfo.getStructInfos()) {
+                log() << "Transforming: " << structInfo.getStructType() << "\n";
+                if (!structInfo.applyTransform(M.getDataLayout())) {
+                    layoutRemarks.emitUnchanged(structInfo);
+                    continue;
+                }
+                layoutRemarks.emitTransformed(structInfo);
+                ++NumStructsTransformed;
+                const auto initialSize = structInfo.getInitialSize().getKnownMinValue();
+                const auto currentSize = structInfo.getCurrentSize().getKnownMinValue();
+                if (currentSize < initialSize) NumBytesSaved += initialSize - currentSize;
+                didWork = true;
+                if (!debugTypeInfo.isEmpty() && !structInfo.updateDebugInfo(debugTypeInfo))
+                    log() << TAB_STR << "No matching debug info, left as is\n";
+            }
+            if (const auto numUpdated = debugTypeInfo.apply())
+                log() << llvm::format("Updated Debug Info for [%d] Structs\n", numUpdated);
+
+            if (didWork) {
+                log() << "Did work\n";
+                return llvm::PreservedAnalyses::none();
+            }
+            log() << "Did no work\n";
+            // The struct infos were consumed by the transform either way
+            auto preserved = llvm::PreservedAnalyses::all();
+            preserved.abandon<ZippyFieldAccessAnalysis>();
+            return preserved;
+        }
+    };
+
+    /**
+     * Compile step of a ThinLTO build, summarizes the module for the `zippy` runs of every backend to merge.
+     */
+    struct ZippySummarizePass : llvm::PassInfoMixin<ZippySummarizePass> {
+        static llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) {
+            Pass(M, AM).summarize();
+            return llvm::PreservedAnalyses::all();
+        }
+    };
+
+    /**
+     * Prints the cache lines each loop touches per struct element, under the current and the computed layout.
+     */
+    class ZippyLayoutPrinterPass : public llvm::PassInfoMixin<ZippyLayoutPrinterPass> {
+        llvm::raw_ostream &OS;
+
+    public:
+        explicit ZippyLayoutPrinterPass(llvm::raw_ostream &OS): OS(OS) {}
+
+        llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) const {
+            const auto &fieldAccessInfo = AM.getResult<ZippyFieldAccessAnalysis>(M);
+            if (fieldAccessInfo.isEmpty()) return llvm::PreservedAnalyses::all();
+
+            OS << "Zippy Layout Footprints\n";
+            for (const auto &loopLayoutInfo: LoopLayoutInfo::collect(fieldAccessInfo.getStructInfos(),
+                                                                     fieldAccessInfo.getFunctionInfos(),
+                                                                     M.getDataLayout())) {
+                loopLayoutInfo.print(OS);
+            }
+            return llvm::PreservedAnalyses::all();
+        }
+
+        static bool isRequired() {
+            return true;
+        }
+    };
+
+    class ZippyFieldAccessPrinterPass : public llvm::PassInfoMixin<ZippyFieldAccessPrinterPass> {
+        llvm::raw_ostream &OS;
+
+    public:
+        explicit ZippyFieldAccessPrinterPass(llvm::raw_ostream &OS): OS(OS) {}
+
+        llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) const {
+            OS << "Zippy Field Accesses\n";
+            AM.getResult<ZippyFieldAccessAnalysis>(M).print(OS);
+            return llvm::PreservedAnalyses::all();
+        }
+
+        static bool isRequired() {
+            return true;
+        }
+    };
+
+    /**
+     * Writes the layouts `ZippyFieldAccessAnalysis` computed as C struct definitions, without transforming anything or
+     * recording them into the layout database, which is left to `ZippyPass`.
+     */
+    struct ZippyAdvisePass : llvm::PassInfoMixin<ZippyAdvisePass> {
+        static llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) {
+            const auto &fieldAccessInfo = AM.getResult<ZippyFieldAccessAnalysis>(M);
+            std::error_code errorCode;
+            llvm::raw_fd_ostream out(AdvicePath, errorCode);
+            if (errorCode) {
+                llvm::errs() << "Failed to write advice: " << AdvicePath << " - " << errorCode.message() << "\n";
+                return llvm::PreservedAnalyses::all();
+            }
+            LayoutAdvisor(M, fieldAccessInfo).print(out);
+            return llvm::PreservedAnalyses::all();
+        }
+
+        static bool isRequired() {
+            return true;
+        }
+    };
+
+    struct ZippyInstrumentPass : llvm::PassInfoMixin<ZippyInstrumentPass> {
+        static llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM) {
+            return Instrumentation(M, AM).run();
+        }
+    };
+}
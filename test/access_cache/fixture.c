@@ -0,0 +1,25 @@
+/**
+ * fixture.c
+ *
+ * Purpose: 'hot' is only accessed in `bump`, so it is hot because of the loop `bump` is called from, which the
+ * cached accesses of `main` have to carry over
+ */
+
+struct Counter {
+    long cold;          // Accessed once
+    long hot;           // Accessed in `bump`, called in the loop
+};
+
+volatile int iterations = 100;
+
+void bump(struct Counter *counter, const int step) {
+    counter->hot += step;
+}
+
+int main() {
+    struct Counter counter = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        bump(&counter, i);
+    }
+    return counter.cold + counter.hot == 4951 ? 0 : 1;
+}
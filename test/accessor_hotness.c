@@ -0,0 +1,57 @@
+/**
+ * accessor_hotness.c
+ *
+ * Purpose: Verify fields only reached through small accessors called from loops elsewhere are handled correctly
+ * Adapted from: cross_function_structs.c
+ */
+
+struct Account {
+    char name[24];      // Rarely accessed
+    long created;       // Rarely accessed
+    int balance;        // Accessed through `get_balance` in a loop
+    int flags;          // Accessed through a pointer passed to `add_flag` in a loop
+};
+
+// Getter with no loops of its own
+int get_balance(const struct Account *account) {
+    return account->balance;
+}
+
+// The field address is passed in, so its accesses happen in the callee
+void add_flag(int *flags, const int flag) {
+    *flags |= flag;
+}
+
+int sum_balances(struct Account *accounts, const int count) {
+    int sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += get_balance(&accounts[i]);
+        add_flag(&accounts[i].flags, 1 << (i % 4));
+    }
+    return sum;
+}
+
+int main() {
+    struct Account accounts[6];
+    for (int i = 0; i < 6; i++) {
+        accounts[i].name[0] = 'a' + i;
+        accounts[i].created = 1000 + i;
+        accounts[i].balance = i * 5;
+        accounts[i].flags = 0;
+    }
+
+    const int sum = sum_balances(accounts, 6);
+
+    // Verify expected results
+    return (sum == 75 && accounts[5].flags == 2 && accounts[2].created == 1002 && accounts[3].name[0] == 'd') ? 0 : 1;
+}
+
+/* Expected transformation:
+'balance' and 'flags' are hot through the calls made from the loop in `sum_balances`, and should move to the front:
+
+struct Account {
+    int balance;
+    int flags;
+    ...
+};
+*/
@@ -0,0 +1,23 @@
+/**
+ * fixture.c
+ *
+ * Purpose: Built with `-g`, so the advice names and types the fields of `struct Particle` after the debug info, with
+ * 'x' and 'vx' moved to the front
+ */
+
+struct Particle {
+    char tag[16];       // Accessed once
+    double x;           // Accessed in the loop
+    int id;             // Accessed once
+    double vx;          // Accessed in the loop
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Particle particle = {"p", 0.0, 7, 1.0};
+    for (int i = 0; i < iterations; i++) {
+        particle.x += particle.vx;
+    }
+    return particle.x == 100.0 && particle.id == 7 && particle.tag[0] == 'p' ? 0 : 1;
+}
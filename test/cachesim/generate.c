@@ -0,0 +1,61 @@
+/**
+ * generate.c
+ *
+ * Purpose: Writes a deterministic trace for the `zippy-cachesim` test
+ *
+ * Calls into `libzippy_rt` directly instead of being instrumented, with made up object addresses, so the trace and
+ * the simulated misses are the same on every run. Has to run with `ZIPPY_RT_TRACE_PERIOD=1` to record every access.
+ *
+ * A list of `NUM_NODES` nodes is walked `NUM_PASSES` times touching only `key` and `next`, which sit on different
+ * cache lines in the original layout and on the same one once `payload` is moved behind them.
+ *
+ * An array of `NUM_PAIRS` pairs, starting partway into a cache line, is then walked as often. Moving `value` to the
+ * front shrinks each pair from 24 to 16 bytes, so the array spans two thirds of the cache lines it did, from the same
+ * offset within the first one. Scaling its absolute address instead would land it on the nodes, still cached in L2.
+ */
+#include "zippy_rt.h"
+
+#include <stdint.h>
+
+#define NUM_NODES 2048
+#define NUM_PASSES 4
+#define NODE_SIZE 128
+#define NODES_ADDRESS 0x100000
+#define NUM_PAIRS 1024
+#define PAIR_SIZE 24
+#define PAIRS_ADDRESS 0x180020
+
+// struct Node { long key; char payload[112]; struct Node *next; };
+static const zippy_rt_field_layout layout[] = {
+    {0, 8, 8},
+    {8, 112, 8},
+    {120, 8, 8},
+};
+
+// struct Pair { char tag; long value; char flag; };
+static const zippy_rt_field_layout pairLayout[] = {
+    {0, 1, 1},
+    {8, 8, 8},
+    {16, 1, 1},
+};
+
+int main(void) {
+    const uint32_t base = __zippy_rt_register_struct("struct.Node", 3, NODE_SIZE, layout);
+    for (int pass = 0; pass < NUM_PASSES; pass++) {
+        for (uintptr_t i = 0; i < NUM_NODES; i++) {
+            const void *node = (const void *) (NODES_ADDRESS + i * NODE_SIZE);
+            __zippy_rt_trace(base, 0, 3, node);
+            __zippy_rt_trace(base, 2, 3, node);
+        }
+    }
+
+    const uint32_t pairBase = __zippy_rt_register_struct("struct.Pair", 3, PAIR_SIZE, pairLayout);
+    for (int pass = 0; pass < NUM_PASSES; pass++) {
+        for (uintptr_t i = 0; i < NUM_PAIRS; i++) {
+            const void *pair = (const void *) (PAIRS_ADDRESS + i * PAIR_SIZE);
+            __zippy_rt_trace(pairBase, 0, 3, pair);
+            __zippy_rt_trace(pairBase, 1, 3, pair);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+/**
+ * fixture.c
+ *
+ * Purpose: Built with `-g`, so the debug info of `struct Sample` has to follow its fields once 'hot' moves to the front
+ */
+
+struct Sample {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Sample sample = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        sample.hot += i;
+    }
+    return sample.cold + sample.hot == 4951 ? 0 : 1;
+}
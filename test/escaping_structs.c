@@ -0,0 +1,38 @@
+/**
+ * escaping_structs.c
+ *
+ * Purpose: Verify structs whose layout is observed outside the module keep their layout
+ * Adapted from: hot_cold.c
+ */
+
+#include <stdio.h>
+
+// Written out as raw bytes, so its layout is part of a file format
+struct Header {
+    char magic[4];      // Rarely accessed, must stay first in the file
+    short version;      // Rarely accessed
+    int hot;            // Accessed in the loop
+};
+
+int main() {
+    struct Header header = {{'Z', 'P', 'Y', '1'}, 2, 0};
+    for (int i = 0; i < 100; i++) {
+        header.hot += i;
+    }
+
+    FILE *file = tmpfile();
+    if (!file) return 1;
+    fwrite(&header, sizeof(header), 1, file);
+    rewind(file);
+
+    char bytes[sizeof(struct Header)];
+    const size_t read = fread(bytes, sizeof(bytes), 1, file);
+    fclose(file);
+
+    // Verify expected results
+    return (read == 1 && bytes[0] == 'Z' && bytes[3] == '1' && header.hot == 4950) ? 0 : 1;
+}
+
+/* Expected transformation:
+None, `struct Header` escapes to `fwrite` and is skipped as unsafe.
+*/
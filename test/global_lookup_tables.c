@@ -0,0 +1,58 @@
+/**
+ * global_lookup_tables.c
+ *
+ * Purpose: Verify initialized global arrays of structs, nested structs and field pointers are remapped
+ * Adapted from: global_struct_initialization.c
+ */
+
+struct Opcode {
+    char name[8];       // Rarely accessed
+    short flags;        // Rarely accessed
+    int cycles;         // Accessed in the loop
+    long mask;          // Accessed in the loop
+};
+
+struct Table {
+    int version;        // Rarely accessed
+    struct Opcode nop;  // Accessed through `table.nop.cycles`
+};
+
+// Constant lookup table, the initializers must follow the new field order
+const struct Opcode opcodes[4] = {
+    {"add", 1, 2, 0x0F},
+    {"sub", 1, 3, 0xF0},
+    {"mul", 2, 5, 0xFF},
+    {"div", 2, 9, 0x0F0F},
+};
+
+struct Table table = {3, {"nop", 0, 1, 0}};
+
+// Pointers into fields of the table, resolved when the program is loaded
+const int *slowest = &opcodes[3].cycles;
+const short *divFlags = &opcodes[3].flags;
+// Points into the struct nested in `table`, as a byte offset from `table` itself
+const int *nopCycles = &table.nop.cycles;
+
+int main() {
+    long sum = 0;
+    for (int n = 0; n < 100; n++) {
+        const struct Opcode *opcode = &opcodes[n % 4];
+        sum += opcode->cycles + (opcode->mask & 1);
+    }
+    sum += table.nop.cycles;
+
+    // Verify expected results
+    return (sum == 551 && *slowest == 9 && *divFlags == 2 && *nopCycles == 1 && opcodes[2].name[1] == 'u' &&
+            table.version == 3) ? 0 : 1;
+}
+
+/* Expected transformation:
+'cycles' and 'mask' move to the front of `struct Opcode`, with every initializer in `opcodes` and `table`, and the
+field pointers `slowest`, `divFlags` and `nopCycles`, following them:
+
+struct Opcode {
+    long mask;
+    int cycles;
+    ...
+};
+*/
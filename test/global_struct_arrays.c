@@ -0,0 +1,67 @@
+/**
+ * global_struct_arrays.c
+ *
+ * Purpose: Verify fields reached through global arrays and nested member chains are remapped
+ * Adapted from: struct_arrays.c
+ */
+
+struct Point {
+    char label;         // Rarely accessed
+    double weight;      // Rarely accessed
+    int value;          // Accessed in every loop
+};
+
+struct Segment {
+    long id;            // Rarely accessed
+    struct Point start; // Accessed through `segment.start.value`
+    struct Point end;   // Accessed through `segment.end.value`
+};
+
+#define ARRAY_SIZE 8
+
+// Zero initialized, so only the accesses need remapping
+struct Point points[ARRAY_SIZE];
+struct Segment segments[ARRAY_SIZE];
+
+int sum_points(void) {
+    int sum = 0;
+    for (int i = 0; i < ARRAY_SIZE; i++) {
+        sum += points[i].value;
+    }
+    // Constant indices fold into a single `getelementptr` with four indices
+    return sum + points[3].value + (int)points[3].weight;
+}
+
+int sum_segments(void) {
+    int sum = 0;
+    for (int i = 0; i < ARRAY_SIZE; i++) {
+        sum += segments[i].end.value - segments[i].start.value;
+    }
+    return sum + segments[2].end.value + (int)segments[2].id;
+}
+
+int main() {
+    for (int i = 0; i < ARRAY_SIZE; i++) {
+        points[i].value = i;
+        points[i].weight = i * 2.0;
+        points[i].label = 'a' + i;
+        segments[i].id = i;
+        segments[i].start.value = i;
+        segments[i].end.value = i * 3;
+    }
+
+    const int pointSum = sum_points();
+    const int segmentSum = sum_segments();
+
+    // Verify expected results
+    return (pointSum == 37 && segmentSum == 64 && points[7].label == 'h') ? 0 : 1;
+}
+
+/* Expected transformation:
+'value' is accessed in loops through `points[i].value` and `segments[i].end.value`, and should move to the front:
+
+struct Point {
+    int value;
+    ...
+};
+*/
@@ -0,0 +1,68 @@
+/**
+ * heap_struct_arrays.c
+ *
+ * Purpose: Verify heap allocated arrays of structs are sized for the transformed layout
+ * Adapted from: struct_arrays.c
+ */
+
+#include <stdlib.h>
+
+struct Particle {
+    char tag;           // Rarely accessed
+    double mass;        // Rarely accessed
+    char alive;         // Accessed in every loop
+    double position;    // Accessed in every loop
+    char group;         // Rarely accessed
+};
+
+int main() {
+    int count = 8;
+    struct Particle *particles = malloc(count * sizeof(struct Particle));
+    if (!particles) return 1;
+    for (int i = 0; i < count; i++) {
+        particles[i].tag = 'p';
+        particles[i].mass = 1.0;
+        particles[i].alive = 1;
+        particles[i].position = i;
+        particles[i].group = (char) (i % 2);
+    }
+
+    // Grow the array, the new elements must land after the old ones
+    count = 12;
+    particles = realloc(particles, count * sizeof(struct Particle));
+    if (!particles) return 1;
+    for (int i = 8; i < count; i++) {
+        particles[i].alive = 0;
+        particles[i].position = -1.0;
+    }
+
+    // Zeroed elements must be zero in every field
+    struct Particle *spares = calloc(4, sizeof(struct Particle));
+    if (!spares) return 1;
+
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        if (particles[i].alive) sum += particles[i].position;
+    }
+    for (int i = 0; i < 4; i++) {
+        sum += spares[i].position + spares[i].alive;
+    }
+
+    const int result = (sum == 28.0 && particles[7].group == 1 && particles[3].tag == 'p') ? 0 : 1;
+    free(spares);
+    free(particles);
+
+    // Verify expected results
+    return result;
+}
+
+/* Expected transformation:
+'alive' and 'position' move to the front, and the three chars pack together, shrinking the struct from 40 to 24 bytes.
+The sizes passed to `malloc`, `realloc` and `calloc` follow:
+
+struct Particle {
+    double position;
+    char alive;
+    ...
+};
+*/
@@ -0,0 +1,20 @@
+/**
+ * a.c
+ *
+ * Purpose: Compiled first, so its layout of `struct Shared`, 'hot' at the front, is the one recorded in the database
+ */
+
+struct Shared {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Shared shared = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        shared.hot += i;
+    }
+    return shared.cold + shared.hot == 4951 ? 0 : 1;
+}
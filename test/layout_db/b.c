@@ -0,0 +1,28 @@
+/**
+ * b.c
+ *
+ * Purpose: Would keep `struct Shared` as is on its own, but has to reuse the layout `a.c` recorded. `struct Local` is
+ * only seen here, so its layout is appended to the database.
+ */
+
+struct Shared {
+    long cold;          // Accessed in the loop
+    long hot;           // Accessed once
+};
+
+struct Local {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Shared shared = {0, 1};
+    struct Local local = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        shared.cold += i;
+        local.hot += i;
+    }
+    return shared.cold + shared.hot + local.cold + local.hot == 9902 ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+/**
+ * safe.c
+ *
+ * Purpose: Reorders `struct Record`, 'hot' at the front, which `unsafe.c` has to keep as is
+ */
+
+struct Record {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Record record = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        record.hot += i;
+    }
+    return record.cold + record.hot == 4951 ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+/**
+ * unsafe.c
+ *
+ * Purpose: Writes `struct Record` out as raw bytes, so its layout can't change here whatever `safe.c` decided
+ */
+
+#include <stdio.h>
+
+struct Record {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Record record = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        record.hot += i;
+    }
+    fwrite(&record, sizeof(record), 1, stdout);
+    return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * by_value_params.c
+ *
+ * Purpose: Verify structs passed by value are left alone once the caller loads them as wider integers
+ *
+ * At `-O2` the 12 byte `Pair` is passed as an `i64` and an `i32` loaded straight from `pairs`, and `weigh` takes the
+ * fields apart again with shifts and truncations. Moving `count` to the front would shrink the struct to 8 bytes, with
+ * the `i32` then read from the next element.
+ */
+
+typedef struct {
+    char kind;           // Accessed once per call
+    int count;           // Accessed in the loop
+    char flag;           // Accessed once per call
+} Pair;
+
+Pair pairs[2] = {{'a', 3, 'x'}, {'b', 7, 'c'}};
+
+volatile int iterations = 100;
+
+__attribute__((noinline)) int weigh(Pair pair) {
+    int sum = 0;
+    for (int i = 0; i < iterations; i++) {
+        sum += pair.count;
+    }
+    return sum + pair.kind + pair.flag;
+}
+
+__attribute__((noinline)) int weigh_first(const Pair *pair) {
+    int sum = 0;
+    for (int i = 0; i < iterations; i++) {
+        sum += pair->count;
+    }
+    return sum + pair->kind;
+}
+
+int main() {
+    const int weight = weigh(pairs[1]);
+    const int firstWeight = weigh_first(&pairs[0]);
+
+    // Verify expected results
+    return (weight == 897 && firstWeight == 397) ? 0 : 1;
+}
+
+/* Expected transformation:
+None, `Pair` is loaded as an `i64` reaching across `kind` and `count`, and `weigh_first` indexes a pointer parameter.
+*/
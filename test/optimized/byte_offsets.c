@@ -0,0 +1,116 @@
+/**
+ * byte_offsets.c
+ *
+ * Purpose: Verify field accesses survive reordering once InstCombine has turned them into `getelementptr i8` offsets
+ * Adapted from: hot_cold.c
+ */
+
+typedef struct {
+    double coldA;        // Rarely accessed
+    long coldB;          // Rarely accessed
+    int hot;             // Accessed in the loop
+    char tags[6];        // Accessed by element in the loop
+    short warm;          // Accessed once per call
+} Record;
+
+Record record = {1.5, 7, 0, {1, 2, 3, 4, 5, 6}, 3};
+
+// Elements of a global array, addressed by constant byte offsets from the array itself
+typedef struct {
+    char flag;           // Accessed once per call
+    double weight;       // Accessed in the loop
+    int count;           // Accessed in the loop
+} Slot;
+
+Slot slots[4] = {{1, 0.5, 1}, {2, 1.5, 2}, {3, 2.5, 3}, {4, 3.5, 4}};
+
+// A struct nested in another, whose fields are reached by byte offsets from the outer one
+typedef struct {
+    char tag;            // Never accessed
+    int value;           // Accessed once per call
+    char kind;           // Accessed in the loop
+} Inner;
+
+typedef struct {
+    char reserved[24];   // Never accessed
+    Inner inner;         // Accessed in the loop
+    long total;          // Accessed in the loop
+} Outer;
+
+Outer outer = {{0}, {'a', 5, 'b'}, 10};
+
+// Only indexed through a pointer parameter, which isn't known to point at a `Point` where it is indexed
+typedef struct {
+    int x;               // Accessed once per call
+    char label;          // Accessed once per call
+    int y;               // Accessed in the loop
+} Point;
+
+Point point = {3, 'p', 4};
+
+volatile int iterations = 100;
+
+__attribute__((noinline)) int sum_hot(void) {
+    int sum = 0;
+    for (int i = 0; i < iterations; i++) {
+        record.hot += i;
+        sum += record.hot + record.tags[i % 6];
+    }
+    return sum + record.warm;
+}
+
+__attribute__((noinline)) long touch_cold(void) {
+    record.coldB += 1;
+    return (long)record.coldA + record.coldB + record.tags[5];
+}
+
+__attribute__((noinline)) int sum_slots(void) {
+    int sum = 0;
+    for (int i = 0; i < iterations; i++) {
+        sum += slots[2].count + (int)slots[3].weight;
+    }
+    return sum + slots[1].flag;
+}
+
+__attribute__((noinline)) long sum_nested(void) {
+    long sum = 0;
+    for (int i = 0; i < iterations; i++) {
+        sum += outer.inner.kind + outer.total;
+    }
+    return sum + outer.inner.value;
+}
+
+__attribute__((noinline)) int sum_point(const Point *p) {
+    int sum = 0;
+    for (int i = 0; i < iterations; i++) {
+        sum += p->y * p->y;
+    }
+    return sum + p->x + p->label;
+}
+
+int main() {
+    const int sum = sum_hot();
+    const long cold = touch_cold();
+    const int slotSum = sum_slots();
+    const long nestedSum = sum_nested();
+    const int pointSum = sum_point(&point);
+
+    // Verify expected results
+    return (sum == 166999 && cold == 15 && record.hot == 4950 && slotSum == 602 && nestedSum == 10805 &&
+            pointSum == 1715) ? 0 : 1;
+}
+
+/* Expected transformation:
+'hot' and 'tags' are accessed inside the loop through byte offsets from `record`, and should move to the front,
+with every offset rewritten to match:
+
+typedef struct {
+    int hot;
+    char tags[6];
+    ...
+} Record;
+
+The same goes for the offsets into `slots`, which step over whole elements. `Inner` is only reached through offsets
+into `outer`, which are rewritten for the field of `Outer` they point into, so `Outer` is reordered while `Inner` keeps
+its layout. The offsets from `p` in `sum_point` can't be resolved to a field, so `Point` keeps its layout too.
+*/
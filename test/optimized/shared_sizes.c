@@ -0,0 +1,49 @@
+/**
+ * shared_sizes.c
+ *
+ * Purpose: Verify a size shared between an allocation and other uses is only rewritten for the allocation
+ * Adapted from: heap_struct_arrays.c
+ *
+ * At `-O2` the single `mul` computing `bytes` feeds both `malloc` and the store to `reported`, which has to keep
+ * reporting the size of the original layout.
+ */
+
+#include <stdlib.h>
+
+struct Sample {
+    char tag;           // Rarely accessed
+    double value;       // Accessed in every loop
+    char flag;          // Rarely accessed
+};
+
+volatile int count = 8;
+volatile unsigned long reported;
+
+int main() {
+    const long n = count;
+    const unsigned long bytes = n * sizeof(struct Sample);
+    struct Sample *samples = malloc(bytes);
+    if (!samples) return 1;
+    reported = bytes;
+
+    for (long i = 0; i < n; i++) {
+        samples[i].tag = 's';
+        samples[i].value = (double) i;
+        samples[i].flag = (char) (i % 2);
+    }
+
+    double sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += samples[i].value;
+    }
+    const int flags = samples[n - 1].flag + samples[0].tag;
+    free(samples);
+
+    // Verify expected results
+    return (sum == 28.0 && flags == 's' + 1 && reported == 8 * 24) ? 0 : 1;
+}
+
+/* Expected transformation:
+'value' moves to the front, shrinking `struct Sample` from 24 to 16 bytes. `malloc` is passed its own copy of the
+`mul` with the new size, while `reported` is still stored the original one.
+*/
@@ -0,0 +1,83 @@
+/**
+ * partial_resets.c
+ *
+ * Purpose: Verify memset and memcpy over part of a struct still cover the same fields after reordering
+ * Adapted from: hot_cold.c
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+struct Session {
+    char state;         // Reset together with 'retries'
+    long created;       // Rarely accessed
+    int retries;        // Reset together with 'state'
+    char user[12];      // Rarely accessed
+    long bytes;         // Accessed in the loop
+    short flags;        // Accessed in the loop
+};
+
+// Nested in 'Entry', whose copies only cover part of it
+struct Stamp {
+    char zone;          // Copied along with 'seconds'
+    long seconds;       // Copied along with 'zone'
+    int millis;         // Accessed in the loop
+};
+
+struct Entry {
+    struct Stamp stamp; // Partially copied
+    long hits;          // Accessed in the loop
+};
+
+// Clears everything before 'user', which is left untouched
+void reset(struct Session *session) {
+    memset(session, 0, offsetof(struct Session, user));
+}
+
+int main() {
+    struct Session sessions[4];
+    for (int i = 0; i < 4; i++) {
+        sessions[i].state = 'o';
+        sessions[i].created = 100 + i;
+        sessions[i].retries = i;
+        memcpy(sessions[i].user, "someone", 8);
+        sessions[i].bytes = 0;
+        sessions[i].flags = 0;
+    }
+
+    for (int n = 0; n < 100; n++) {
+        sessions[n % 4].bytes += n;
+        sessions[n % 4].flags |= 1 << (n % 3);
+    }
+
+    reset(&sessions[1]);
+
+    // Copy only 'user' and what follows it
+    struct Session copy = sessions[2];
+    memcpy(&copy.user, &sessions[3].user, sizeof(struct Session) - offsetof(struct Session, user));
+
+    struct Entry entries[2] = {{{'u', 10, 0}, 0}, {{'z', 20, 0}, 0}};
+    for (int n = 0; n < 100; n++) {
+        entries[n % 2].stamp.millis += n;
+        entries[n % 2].hits++;
+    }
+
+    // Copy only 'zone' and 'seconds', leaving 'millis' and 'hits' alone
+    memcpy(&entries[0], &entries[1], offsetof(struct Entry, stamp.millis));
+
+    // Verify expected results
+    const int resetOk = sessions[1].state == 0 && sessions[1].created == 0 && sessions[1].retries == 0 &&
+                        sessions[1].user[0] == 's' && sessions[1].bytes == 1225;
+    const int copyOk = copy.state == 'o' && copy.retries == 2 && copy.bytes == 1275 && copy.flags == 7 &&
+                       strcmp(copy.user, "someone") == 0;
+    const int entryOk = entries[0].stamp.zone == 'z' && entries[0].stamp.seconds == 20 &&
+                        entries[0].stamp.millis == 2450 && entries[0].hits == 50;
+    return (resetOk && copyOk && entryOk) ? 0 : 1;
+}
+
+/* Expected transformation:
+'bytes' and 'flags' move to the front. The memset in `reset` is split to clear 'state', 'created' and 'retries' at
+their new positions, and the partial copy covers 'user', 'bytes' and 'flags' wherever they end up.
+
+'Entry' is reordered, but the copy between entries only covers part of 'stamp', so 'Stamp' keeps its layout.
+*/
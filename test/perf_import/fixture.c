@@ -0,0 +1,29 @@
+/**
+ * fixture.c
+ *
+ * Purpose: Debug info and symbols for the `zippy-perf-import` test
+ *
+ * This is linked into a position independent executable, the samples then refer to the fields of `items` and the
+ * instructions of `main` as if it was loaded at some base address.
+ */
+
+struct Item {
+    int key;        // Offset 0
+    double payload; // Offset 8
+    char tag;       // Offset 16
+};
+
+struct Item items[4] = {
+    {1, 1.0, 'a'},
+    {2, 2.0, 'b'},
+    {3, 3.0, 'c'},
+    {4, 4.0, 'd'},
+};
+
+int main(void) {
+    int sum = 0;
+    for (int i = 0; i < 4; i++) {
+        sum += items[i].key;
+    }
+    return sum == 10 ? 0 : 1;
+}
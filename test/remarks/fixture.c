@@ -0,0 +1,44 @@
+/**
+ * fixture.c
+ *
+ * Purpose: One struct per remark, `struct Sample` is reordered, `struct Ordered` is already in its target layout,
+ * `struct Escaped` is skipped as unsafe and `struct Single` is rejected for having a single field
+ */
+
+struct Sample {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+struct Ordered {
+    long hot;           // Accessed in the loop
+    long cold;          // Accessed once
+};
+
+// Defined in another module, never linked in as only the remarks are checked
+struct Escaped {
+    long a;
+    long b;
+};
+
+void consume(struct Escaped *escaped);
+
+struct Single {
+    long value;
+};
+
+struct Single single = {7};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Sample sample = {1, 0};
+    struct Ordered ordered = {0, 1};
+    for (int i = 0; i < iterations; i++) {
+        sample.hot += i;
+        ordered.hot += i;
+    }
+    struct Escaped escaped = {sample.cold + sample.hot, ordered.cold + ordered.hot};
+    consume(&escaped);
+    return single.value == 7 ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+/**
+ * unused.c
+ *
+ * Purpose: `struct Unused` is safe, but none of its fields are ever used, so there is nothing to lay it out from
+ */
+
+struct Unused {
+    long a;
+    long b;
+};
+
+int main() {
+    struct Unused unused;
+    return sizeof(unused) == 16 ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+/**
+ * fixture.c
+ *
+ * Purpose: `struct Sample` is reported with 'hot' moved to the front, and `struct Escaped` with the reason it is kept
+ * as is, padding included
+ */
+
+struct Sample {
+    long cold;          // Accessed once
+    long hot;           // Accessed in the loop
+};
+
+// Defined in another module, never linked in as only the report is checked
+struct Escaped {
+    char a;
+    long b;
+};
+
+void consume(struct Escaped *escaped);
+
+volatile int iterations = 100;
+
+int main() {
+    struct Sample sample = {1, 0};
+    for (int i = 0; i < iterations; i++) {
+        sample.hot += i;
+    }
+    struct Escaped escaped = {sample.cold, sample.hot};
+    consume(&escaped);
+    return 0;
+}
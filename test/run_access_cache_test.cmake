@@ -0,0 +1,102 @@
+# This file defines the test for the cache of function accesses.
+#
+# The fixture is laid out three times against the same cache directory: once to fill it, once reusing every entry, and
+# once after one entry was corrupted, which has to be recomputed and rewritten. Every run has to report the same layout
+# as a run without any cache, with 'hot' moved to the front of `struct Counter`. A fourth run under another data layout
+# has to miss every entry.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+set(CACHE_DIR ${TEST_DIR}/cache)
+file(REMOVE_RECURSE ${CACHE_DIR})
+
+# Emit the fixture IR
+#
+# EG: `clang -S -emit-llvm -O0 fixture.c -o fixture.ll`
+emit_fixture_ir(fixture)
+
+set(IR_PATH ${TEST_DIR}/fixture.ll)
+
+# Runs the pass over `IR_PATH`, reporting its layouts into `<name>.json`, with any further arguments. The fixture is
+# a whole program, which keeps `bump` from making `struct Counter` unsafe.
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -zippy-cache-dir=cache fixture.ll -disable-output`
+function(run_zippy NAME)
+    run_opt("Failed to run optimization pass for ${NAME}"
+            -passes=zippy
+            -zippy-whole-program
+            -zippy-report=${TEST_DIR}/${NAME}.json
+            ${ARGN}
+            ${IR_PATH}
+            -disable-output
+    )
+endfunction()
+
+# Every cached run has to report what a run without the cache reports
+function(expect_uncached_report NAME)
+    file(READ ${TEST_DIR}/uncached.json UNCACHED_REPORT)
+    file(READ ${TEST_DIR}/${NAME}.json REPORT)
+    if(NOT REPORT STREQUAL UNCACHED_REPORT)
+        message(FATAL_ERROR "Report of ${NAME} differs from the uncached one:\n${REPORT}")
+    endif()
+endfunction()
+
+run_zippy(uncached)
+file(READ ${TEST_DIR}/uncached.json UNCACHED_REPORT)
+if(NOT UNCACHED_REPORT MATCHES "\"name\": \"struct.Counter\"")
+    message(FATAL_ERROR "struct Counter not reported:\n${UNCACHED_REPORT}")
+endif()
+if(NOT UNCACHED_REPORT MATCHES "\"target\": \\[\n *1,\n *0\n *\\]")
+    message(FATAL_ERROR "'hot' not moved to the front:\n${UNCACHED_REPORT}")
+endif()
+
+# Fills the cache, one entry per defined function
+run_zippy(filled -zippy-cache-dir=${CACHE_DIR})
+expect_uncached_report(filled)
+file(GLOB ENTRIES ${CACHE_DIR}/*.zippy-access)
+list(LENGTH ENTRIES NUM_ENTRIES)
+if(NOT NUM_ENTRIES EQUAL 2)
+    message(FATAL_ERROR "Expected an entry for both `bump` and `main`, found [${NUM_ENTRIES}]")
+endif()
+
+# The entry of `main` records its call to `bump` from within the loop
+set(CALL_FOUND FALSE)
+foreach(ENTRY ${ENTRIES})
+    file(READ ${ENTRY} ENTRY_TEXT)
+    if(ENTRY_TEXT MATCHES "\ncall 1 1 bump\n")
+        set(CALL_FOUND TRUE)
+    endif()
+endforeach()
+if(NOT CALL_FOUND)
+    message(FATAL_ERROR "Call to `bump` from the loop not cached")
+endif()
+
+# Reuses every entry
+run_zippy(reused -zippy-cache-dir=${CACHE_DIR})
+expect_uncached_report(reused)
+
+# A corrupted entry is recomputed and rewritten
+list(GET ENTRIES 0 CORRUPTED_ENTRY)
+file(WRITE ${CORRUPTED_ENTRY} "not an access\n")
+run_zippy(recomputed -zippy-cache-dir=${CACHE_DIR})
+expect_uncached_report(recomputed)
+file(READ ${CORRUPTED_ENTRY} ENTRY_TEXT)
+if(NOT ENTRY_TEXT MATCHES "^ZIPPY-ACCESS 2\n")
+    message(FATAL_ERROR "Corrupted entry not rewritten:\n${ENTRY_TEXT}")
+endif()
+
+# The same IR under another data layout is keyed apart, so both functions get new entries
+file(READ ${TEST_DIR}/fixture.ll FIXTURE_IR)
+if(NOT FIXTURE_IR MATCHES "target datalayout = \"[^\"]*-S128\"")
+    message(FATAL_ERROR "No stack alignment in the data layout of the fixture")
+endif()
+string(REPLACE "-S128\"" "-S256\"" REALIGNED_IR "${FIXTURE_IR}")
+file(WRITE ${TEST_DIR}/realigned.ll "${REALIGNED_IR}")
+set(IR_PATH ${TEST_DIR}/realigned.ll)
+run_zippy(realigned -zippy-cache-dir=${CACHE_DIR})
+expect_uncached_report(realigned)
+file(GLOB ENTRIES ${CACHE_DIR}/*.zippy-access)
+list(LENGTH ENTRIES NUM_ENTRIES)
+if(NOT NUM_ENTRIES EQUAL 4)
+    message(FATAL_ERROR "Expected new entries under another data layout, found [${NUM_ENTRIES}] in total")
+endif()
@@ -0,0 +1,81 @@
+# This file defines the test for the layout advice.
+#
+# The fixture is emitted with `-g` and run through `zippy-advise`, which has to write `struct Particle` as valid C with
+# 'x' and 'vx' at the front, while leaving both the module and the layout database untouched.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+set(LAYOUT_DB ${TEST_DIR}/zippy.layouts)
+file(REMOVE ${LAYOUT_DB} ${TEST_DIR}/advice.h)
+
+# Emit the fixture IR with debug info
+#
+# EG: `clang -S -emit-llvm -O0 -g fixture.c -o fixture.ll`
+emit_fixture_ir(fixture -g)
+
+# Print the module as is, to compare the advised module against
+#
+# EG: `opt -passes=verify fixture.ll -o expected.ll -S`
+execute_process(
+        COMMAND ${OPT_EXE}
+        -passes=verify
+        ${TEST_DIR}/fixture.ll
+        -o ${TEST_DIR}/expected.ll
+        -S
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to print IR")
+endif()
+
+# Write the advice, against a layout database which must not be created
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy-advise -zippy-advice=advice.h fixture.ll -o output.ll -S`
+run_opt("Failed to run advise pass"
+        -passes=zippy-advise
+        -zippy-advice=${TEST_DIR}/advice.h
+        -zippy-layout-db=${LAYOUT_DB}
+        ${TEST_DIR}/fixture.ll
+        -o ${TEST_DIR}/output.ll
+        -S
+)
+
+# Neither the module nor the database are touched
+file(READ ${TEST_DIR}/expected.ll EXPECTED)
+file(READ ${TEST_DIR}/output.ll OUTPUT)
+if(NOT OUTPUT STREQUAL EXPECTED)
+    message(FATAL_ERROR "Module changed by the advise pass")
+endif()
+if(EXISTS ${LAYOUT_DB})
+    message(FATAL_ERROR "Layout database written by the advise pass")
+endif()
+
+# Fields are declared after their debug info, hot ones first
+#
+# EG: `    double x; /* Index: [01] - Total Weight: [...] */`
+file(READ ${TEST_DIR}/advice.h ADVICE)
+if(NOT ADVICE MATCHES "struct Particle {\n    double v?x;[^\n]*\n    double v?x;[^\n]*\n")
+    message(FATAL_ERROR "Hot fields of struct Particle not advised first:\n${ADVICE}")
+endif()
+foreach(DECLARATION "char tag\\[16\\]; /\\* Index: \\[00\\]" "int id; /\\* Index: \\[02\\]")
+    if(NOT ADVICE MATCHES "${DECLARATION}")
+        message(FATAL_ERROR "Missing declaration '${DECLARATION}':\n${ADVICE}")
+    endif()
+endforeach()
+
+# The advice is valid C
+#
+# EG: `clang -fsyntax-only -x c advice.h`
+execute_process(
+        COMMAND ${CLANG_EXE} -fsyntax-only -x c
+        ${TEST_DIR}/advice.h
+        RESULT_VARIABLE PROC_RESULT
+        ERROR_VARIABLE PROC_ERROR
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Advice is not valid C:\n${PROC_ERROR}")
+endif()
@@ -2,17 +2,21 @@
 #
 # A unique directory is expected for each test file.
 #
-# An input file named `input.c` will be used to emit the initial IR `input.ll`
+# An input file named `input.c` will be used to emit the initial IR `input.ll`, at `OPT_LEVEL` (default `O0`)
 #
 # Which will then be run through the optimisation pass to create the output `output.ll` for inspection.
 #
 # Then, both the `input.ll` and `output.ll` are compiled into the executables `input` and `output`
 
+if(NOT OPT_LEVEL)
+    set(OPT_LEVEL "O0")
+endif()
+
 # Emit initial IR
 #
 # EG: `clang -S -emit-llvm -O0 -x c input.c -o input.ll -fno-discard-value-names -g`
 execute_process(
-        COMMAND ${CLANG_EXE} -S -emit-llvm -O0
+        COMMAND ${CLANG_EXE} -S -emit-llvm -${OPT_LEVEL}
         -x c ${TEST_DIR}/input.c
         -o ${TEST_DIR}/input.ll
         -fno-discard-value-names
@@ -24,12 +28,13 @@ if(NOT PROC_RESULT EQUAL 0)
     message(FATAL_ERROR "Failed to emit IR")
 endif()
 
-# Run the optimization pass
+# Run the optimization pass, every test is a single source program
 #
-# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy input.ll -o output.ll -S`
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -zippy-whole-program input.ll -o output.ll -S`
 execute_process(
         COMMAND ${OPT_EXE} -load-pass-plugin ${PLUGIN_PATH}
         -passes=zippy
+        -zippy-whole-program
         ${TEST_DIR}/input.ll
         -o ${TEST_DIR}/output.ll
         -S
@@ -0,0 +1,83 @@
+# This file defines the test for `zippy-cachesim`.
+#
+# The generator writes a deterministic trace through `libzippy_rt`, which is then replayed against a candidate layout,
+# and the printed misses are compared against the expected ones. A candidate listing a field twice has to be rejected.
+
+# Compile the generator
+#
+# EG: `clang generate.c -o generate -lzippy_rt -lpthread`
+execute_process(
+        COMMAND ${CLANG_EXE}
+        -I${RUNTIME_DIR}
+        ${FIXTURE_DIR}/generate.c
+        ${RUNTIME_LIB}
+        -lpthread
+        -o ${TEST_DIR}/generate
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to compile generator")
+endif()
+
+# Write the trace, sampling every access
+#
+# EG: `ZIPPY_RT_TRACE_PERIOD=1 ./generate`
+execute_process(
+        COMMAND ${CMAKE_COMMAND} -E env
+        ZIPPY_RT_TRACE_PERIOD=1
+        ZIPPY_RT_OUTPUT=${TEST_DIR}/generate.profile
+        ZIPPY_RT_TRACE_OUTPUT=${TEST_DIR}/generate.trace
+        ${TEST_DIR}/generate
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to write trace")
+endif()
+
+# Replay the trace, from the fixture directory so the candidate is printed by its relative path
+#
+# EG: `zippy-cachesim generate.trace -layout=candidate.txt > summary.txt`
+execute_process(
+        COMMAND ${CACHESIM_EXE}
+        ${TEST_DIR}/generate.trace
+        -layout=candidate.txt
+        OUTPUT_FILE ${TEST_DIR}/summary.txt
+        WORKING_DIRECTORY ${FIXTURE_DIR}
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to replay trace")
+endif()
+
+# Compares the summary
+execute_process(
+        COMMAND ${CMAKE_COMMAND} -E compare_files
+        ${TEST_DIR}/summary.txt
+        ${FIXTURE_DIR}/expected.txt
+        RESULT_VARIABLE PROC_RESULT
+)
+
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Summary changed")
+endif()
+
+# A candidate which isn't a permutation of the fields has to fail
+execute_process(
+        COMMAND ${CACHESIM_EXE}
+        ${TEST_DIR}/generate.trace
+        -layout=duplicate.txt
+        OUTPUT_QUIET
+        ERROR_QUIET
+        WORKING_DIRECTORY ${FIXTURE_DIR}
+        RESULT_VARIABLE PROC_RESULT
+)
+
+if(PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Duplicate field index accepted")
+endif()
@@ -0,0 +1,42 @@
+# This file defines the test for the debug info of reordered structs.
+#
+# The fixture is emitted with `-g` and run through the pass, after which every member of `struct Sample` in the output
+# has to sit at the offset of its field under the new layout, 'hot' at the front and 'cold' after it.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+# Emit the fixture IR with debug info
+#
+# EG: `clang -S -emit-llvm -O0 -g fixture.c -o fixture.ll`
+emit_fixture_ir(fixture -g)
+
+# Run the optimization pass
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy fixture.ll -o output.ll -S`
+run_opt("Failed to run optimization pass"
+        -passes=zippy
+        ${TEST_DIR}/fixture.ll
+        -o ${TEST_DIR}/output.ll
+        -S
+)
+
+file(READ ${TEST_DIR}/output.ll OUTPUT)
+
+# Members at offset zero are printed without one, the old members must be gone along with the old composite type
+#
+# EG: `!DIDerivedType(tag: DW_TAG_member, name: "cold", ..., size: 64, offset: 64)`
+string(REGEX MATCHALL "DW_TAG_member, name: \"hot\"[^\n]*" HOT_MEMBERS "${OUTPUT}")
+string(REGEX MATCHALL "DW_TAG_member, name: \"cold\"[^\n]*" COLD_MEMBERS "${OUTPUT}")
+if(NOT HOT_MEMBERS OR NOT COLD_MEMBERS)
+    message(FATAL_ERROR "Missing members of struct Sample")
+endif()
+foreach(MEMBER ${HOT_MEMBERS})
+    if(MEMBER MATCHES "offset:")
+        message(FATAL_ERROR "Member not moved: ${MEMBER}")
+    endif()
+endforeach()
+foreach(MEMBER ${COLD_MEMBERS})
+    if(NOT MEMBER MATCHES "offset: 64[,)]")
+        message(FATAL_ERROR "Member not moved: ${MEMBER}")
+    endif()
+endforeach()
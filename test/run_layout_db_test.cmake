@@ -0,0 +1,181 @@
+# This file defines the test for the layout database shared by separate compiles.
+#
+# `a.c` is laid out first and records its layout of `struct Shared`, which `b.c` has to reuse even though it would
+# keep the struct as is on its own, while the layout of `struct Local` is appended after it. Both modules are then run
+# at once against a fresh database, which must still hold a single layout per struct, and a malformed database must be
+# ignored and left untouched. The analysis and printers on their own never write the database.
+#
+# `struct Record` is safe in `safe.c` but escapes in `unsafe.c`: compiled second, `unsafe.c` has to fail rather than
+# disagree on its layout, and compiled first, it keeps `safe.c` from reordering it.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+set(LAYOUT_DB ${TEST_DIR}/zippy.layouts)
+file(REMOVE ${LAYOUT_DB} ${TEST_DIR}/parallel.layouts ${TEST_DIR}/malformed.layouts ${TEST_DIR}/conflict.layouts)
+
+foreach(MODULE a b safe unsafe)
+    # Emit the module IR
+    #
+    # EG: `clang -S -emit-llvm -O0 a.c -o a.ll`
+    emit_fixture_ir(${MODULE})
+endforeach()
+
+# Runs the pass over a module against a layout database, reporting its layouts into `<module>.json`
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -zippy-layout-db=zippy.layouts a.ll -o a.opt.ll -S`
+function(run_zippy MODULE DATABASE)
+    execute_process(
+            COMMAND ${OPT_EXE} -load-pass-plugin ${PLUGIN_PATH}
+            -passes=zippy
+            -zippy-layout-db=${DATABASE}
+            -zippy-report=${TEST_DIR}/${MODULE}.json
+            ${TEST_DIR}/${MODULE}.ll
+            -o ${TEST_DIR}/${MODULE}.opt.ll
+            -S
+            RESULT_VARIABLE PROC_RESULT
+            ERROR_VARIABLE PROC_ERROR
+    )
+
+    # Check Result
+    if(NOT PROC_RESULT EQUAL 0)
+        message(FATAL_ERROR "Failed to run optimization pass on ${MODULE}.ll:\n${PROC_ERROR}")
+    endif()
+    set(PROC_ERROR ${PROC_ERROR} PARENT_SCOPE)
+endfunction()
+
+# Checks the target order reported for a struct, the report has no other "name" attribute before its order
+#
+# EG: `expect_order(b struct.Shared "1,\n *0")`
+function(expect_order MODULE STRUCT ORDER)
+    file(READ ${TEST_DIR}/${MODULE}.json REPORT)
+    string(FIND "${REPORT}" "\"name\": \"${STRUCT}\"" POSITION)
+    if(POSITION EQUAL -1)
+        message(FATAL_ERROR "${STRUCT} not reported for ${MODULE}.c:\n${REPORT}")
+    endif()
+    string(SUBSTRING "${REPORT}" ${POSITION} -1 STRUCT_REPORT)
+    if(NOT STRUCT_REPORT MATCHES "\"target\": \\[\n *${ORDER}\n *\\]")
+        message(FATAL_ERROR "Unexpected order of ${STRUCT} in ${MODULE}.c:\n${REPORT}")
+    endif()
+endfunction()
+
+# On its own, `b.c` keeps `struct Shared` as is
+run_opt("Failed to run optimization pass on b.ll"
+        -passes=zippy
+        -zippy-report=${TEST_DIR}/b.json
+        ${TEST_DIR}/b.ll
+        -disable-output
+)
+expect_order(b struct.Shared "0,\n *1")
+
+# Only the transform records layouts, analyzing and printing them leaves the database alone
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes='print<zippy-field-access>' -zippy-layout-db=zippy.layouts a.ll`
+run_opt("Failed to run analysis passes on a.ll"
+        "-passes=require<zippy-field-access>,print<zippy-field-access>,print<zippy-layout>"
+        -zippy-layout-db=${LAYOUT_DB}
+        ${TEST_DIR}/a.ll
+        -disable-output
+)
+if(EXISTS ${LAYOUT_DB})
+    message(FATAL_ERROR "Layout database written by the analysis alone")
+endif()
+
+# A missing database is created with the layout `a.c` decided
+run_zippy(a ${LAYOUT_DB})
+file(READ ${LAYOUT_DB} LAYOUTS)
+if(NOT LAYOUTS MATCHES "^ZIPPY-LAYOUTS 1\n[0-9a-f]+ 1,0 struct.Shared\n$")
+    message(FATAL_ERROR "Layout of struct Shared not recorded:\n${LAYOUTS}")
+endif()
+expect_order(a struct.Shared "1,\n *0")
+
+# `b.c` reuses it, and appends the layout of `struct Local` without recording `struct Shared` again
+run_zippy(b ${LAYOUT_DB})
+file(READ ${LAYOUT_DB} LAYOUTS)
+if(NOT LAYOUTS MATCHES "^ZIPPY-LAYOUTS 1\n[0-9a-f]+ 1,0 struct.Shared\n[0-9a-f]+ 1,0 struct.Local\n$")
+    message(FATAL_ERROR "Layout of struct Local not appended:\n${LAYOUTS}")
+endif()
+expect_order(b struct.Shared "1,\n *0")
+
+# Both reordered modules still compute the same results
+foreach(MODULE a b)
+    execute_process(
+            COMMAND ${CLANG_EXE}
+            -Qunused-arguments # Here to silence NixOS Noise
+            ${TEST_DIR}/${MODULE}.opt.ll
+            -o ${TEST_DIR}/${MODULE}
+            RESULT_VARIABLE PROC_RESULT
+    )
+    if(NOT PROC_RESULT EQUAL 0)
+        message(FATAL_ERROR "Failed to compile ${MODULE}.opt.ll")
+    endif()
+    execute_process(
+            COMMAND ${TEST_DIR}/${MODULE}
+            RESULT_VARIABLE PROC_RESULT
+    )
+    if(NOT PROC_RESULT EQUAL 0)
+        message(FATAL_ERROR "${MODULE}.c computes a different result once reordered")
+    endif()
+endforeach()
+
+# Run both modules at once against a fresh database, the lock keeps each struct to a single layout
+#
+# EG: `opt ... -zippy-layout-db=parallel.layouts a.ll & opt ... -zippy-layout-db=parallel.layouts b.ll`
+execute_process(
+        COMMAND ${OPT_EXE} -load-pass-plugin ${PLUGIN_PATH} -passes=zippy
+        -zippy-layout-db=${TEST_DIR}/parallel.layouts ${TEST_DIR}/a.ll -disable-output
+        COMMAND ${OPT_EXE} -load-pass-plugin ${PLUGIN_PATH} -passes=zippy
+        -zippy-layout-db=${TEST_DIR}/parallel.layouts ${TEST_DIR}/b.ll -disable-output
+        RESULTS_VARIABLE PROC_RESULTS
+)
+if(NOT PROC_RESULTS STREQUAL "0;0")
+    message(FATAL_ERROR "Failed to run optimization pass on both modules at once: [${PROC_RESULTS}]")
+endif()
+file(READ ${TEST_DIR}/parallel.layouts LAYOUTS)
+foreach(PATTERN "ZIPPY-LAYOUTS 1\n" " struct.Shared\n" " struct.Local\n")
+    string(REGEX MATCHALL "${PATTERN}" MATCHES "${LAYOUTS}")
+    list(LENGTH MATCHES NUM_MATCHES)
+    if(NOT NUM_MATCHES EQUAL 1)
+        message(FATAL_ERROR "Expected a single '${PATTERN}' in the database, found [${NUM_MATCHES}]:\n${LAYOUTS}")
+    endif()
+endforeach()
+
+# A malformed database is ignored, left as is, and `a.c` lays its structs out as if there was none
+file(WRITE ${TEST_DIR}/malformed.layouts "ZIPPY-LAYOUTS 1\nnot a layout\n")
+run_zippy(a ${TEST_DIR}/malformed.layouts)
+if(NOT PROC_ERROR MATCHES "Malformed or outdated layout database, ignored")
+    message(FATAL_ERROR "Malformed database not reported:\n${PROC_ERROR}")
+endif()
+file(READ ${TEST_DIR}/malformed.layouts LAYOUTS)
+if(NOT LAYOUTS STREQUAL "ZIPPY-LAYOUTS 1\nnot a layout\n")
+    message(FATAL_ERROR "Malformed database was modified:\n${LAYOUTS}")
+endif()
+expect_order(a struct.Shared "1,\n *0")
+
+# A struct unsafe in one module can't follow the layout another module reordered it into, which fails the compile
+run_zippy(safe ${TEST_DIR}/conflict.layouts)
+expect_order(safe struct.Record "1,\n *0")
+execute_process(
+        COMMAND ${OPT_EXE} -load-pass-plugin ${PLUGIN_PATH}
+        -passes=zippy
+        -zippy-layout-db=${TEST_DIR}/conflict.layouts
+        ${TEST_DIR}/unsafe.ll
+        -disable-output
+        RESULT_VARIABLE PROC_RESULT
+        ERROR_VARIABLE PROC_ERROR
+)
+if(PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Reordered layout of unsafe struct Record accepted")
+endif()
+if(NOT PROC_ERROR MATCHES "Layout of struct.Record was reordered by another compile, but it is unsafe to reorder here")
+    message(FATAL_ERROR "Reordered layout of unsafe struct Record not reported:\n${PROC_ERROR}")
+endif()
+
+# The other way around, the unsafe struct is recorded as is and `safe.c` keeps it that way
+file(REMOVE ${TEST_DIR}/conflict.layouts)
+run_zippy(unsafe ${TEST_DIR}/conflict.layouts)
+run_zippy(safe ${TEST_DIR}/conflict.layouts)
+file(READ ${TEST_DIR}/conflict.layouts LAYOUTS)
+if(NOT LAYOUTS MATCHES "^ZIPPY-LAYOUTS 1\n[0-9a-f]+ 0,1 struct.Record\n$")
+    message(FATAL_ERROR "Layout of unsafe struct Record not recorded as is:\n${LAYOUTS}")
+endif()
+expect_order(safe struct.Record "0,\n *1")
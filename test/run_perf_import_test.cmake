@@ -0,0 +1,96 @@
+# This file defines the test for `zippy-perf-import`.
+#
+# The fixture source is linked into a position independent executable with debug info. Samples in `perf script` format
+# are written against it as if it was loaded at `LOAD_BASE`, then imported twice: once finding the load base among the
+# mmap events of the samples, and once passing it with `--load-base`. Both printed summaries are compared against the
+# expected one.
+
+set(LOAD_BASE 0x555555554000)
+
+# Link the fixture
+#
+# EG: `clang -g -O0 -fPIE -pie fixture.c -o fixture`
+execute_process(
+        COMMAND ${CLANG_EXE} -g -O0 -fPIE -pie
+        ${FIXTURE_DIR}/fixture.c
+        -o ${TEST_DIR}/fixture
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to link fixture")
+endif()
+
+# Find the link time addresses of `items` and `main`
+#
+# EG: `nm fixture`
+execute_process(
+        COMMAND ${NM_EXE} ${TEST_DIR}/fixture
+        OUTPUT_VARIABLE SYMBOLS
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to list symbols")
+endif()
+if(NOT SYMBOLS MATCHES "([0-9a-f]+) [dD] items\n")
+    message(FATAL_ERROR "No `items` symbol:\n${SYMBOLS}")
+endif()
+set(ITEMS_ADDRESS 0x${CMAKE_MATCH_1})
+if(NOT SYMBOLS MATCHES "([0-9a-f]+) [tT] main\n")
+    message(FATAL_ERROR "No `main` symbol:\n${SYMBOLS}")
+endif()
+set(MAIN_ADDRESS 0x${CMAKE_MATCH_1})
+
+# Write the samples as `perf script -F addr,ip,dso` prints them, every one in `main` at the given offsets into `items`:
+# three keys, two payloads, one tag and one byte of padding. One more sample lies in another object.
+math(EXPR IP "${LOAD_BASE} + ${MAIN_ADDRESS}" OUTPUT_FORMAT HEXADECIMAL)
+set(SAMPLES "")
+foreach(OFFSET 0x0 0x18 0x20 0x30 0x40 0xc 0x6)
+    math(EXPR ADDRESS "${LOAD_BASE} + ${ITEMS_ADDRESS} + ${OFFSET}" OUTPUT_FORMAT HEXADECIMAL)
+    string(APPEND SAMPLES "    ${ADDRESS}    ${IP} (${TEST_DIR}/fixture)\n")
+endforeach()
+string(APPEND SAMPLES "    0x7f0000001000    0x7f0000400000 (/usr/lib/libc.so.6)\n")
+file(WRITE ${TEST_DIR}/samples.txt "${SAMPLES}")
+file(WRITE ${TEST_DIR}/mmap_samples.txt
+        "fixture 1234 [000] 0.000000: PERF_RECORD_MMAP2 1234/1234: [${LOAD_BASE}(0x1000) @ 0 08:01 4321 0]: "
+        "r--p ${TEST_DIR}/fixture\n"
+        "${SAMPLES}")
+
+# Imports `<name>.txt` with any further arguments, and compares the summary
+#
+# EG: `zippy-perf-import fixture samples.txt -o samples.profile > samples.summary`
+function(import_samples NAME)
+    execute_process(
+            COMMAND ${IMPORT_EXE}
+            ${TEST_DIR}/fixture
+            ${TEST_DIR}/${NAME}.txt
+            -o ${TEST_DIR}/${NAME}.profile
+            ${ARGN}
+            OUTPUT_FILE ${TEST_DIR}/${NAME}.summary
+            RESULT_VARIABLE PROC_RESULT
+    )
+
+    # Check Result
+    if(NOT PROC_RESULT EQUAL 0)
+        message(FATAL_ERROR "Failed to import ${NAME}")
+    endif()
+
+    # Compares the summary
+    execute_process(
+            COMMAND ${CMAKE_COMMAND} -E compare_files
+            ${TEST_DIR}/${NAME}.summary
+            ${FIXTURE_DIR}/expected.txt
+            RESULT_VARIABLE PROC_RESULT
+    )
+
+    if(NOT PROC_RESULT EQUAL 0)
+        file(READ ${TEST_DIR}/${NAME}.summary SUMMARY)
+        message(FATAL_ERROR "Summary of ${NAME} changed:\n${SUMMARY}")
+    endif()
+endfunction()
+
+import_samples(mmap_samples)
+import_samples(samples --load-base=${LOAD_BASE})
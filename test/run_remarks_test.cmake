@@ -0,0 +1,79 @@
+# This file defines the test for the optimization remarks.
+#
+# Each fixture is run through the pass with `-pass-remarks-output`, after which the YAML remarks have to hold one remark
+# per struct. In `fixture.c`: `struct Sample` as reordered, `struct Ordered` as unchanged, and `struct Escaped` and
+# `struct Single` as missed with their reason. In `unused.c`: `struct Unused` as missed, as none of its fields are used.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+# Emits the IR of `<name>.c`, runs the pass over it and reads the remarks it recorded into `REMARKS`
+#
+# EG: `clang -S -emit-llvm -O0 fixture.c -o fixture.ll`
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -pass-remarks-output=fixture.yaml fixture.ll -o output.ll -S`
+function(run_zippy NAME)
+    emit_fixture_ir(${NAME})
+
+    file(REMOVE ${TEST_DIR}/${NAME}.yaml)
+    run_opt("Failed to run optimization pass on ${NAME}.ll"
+            -passes=zippy
+            -pass-remarks-output=${TEST_DIR}/${NAME}.yaml
+            -pass-remarks-filter=zippy
+            ${TEST_DIR}/${NAME}.ll
+            -o ${TEST_DIR}/${NAME}.opt.ll
+            -S
+    )
+    if(NOT EXISTS ${TEST_DIR}/${NAME}.yaml)
+        message(FATAL_ERROR "No remarks written for ${NAME}.ll")
+    endif()
+
+    file(READ ${TEST_DIR}/${NAME}.yaml REMARKS)
+    set(REMARKS "${REMARKS}" PARENT_SCOPE)
+endfunction()
+
+# Checks a single remark of the given kind and name was recorded for a struct, holding every given line
+#
+# EG: `expect_remark(Missed UnsafeStruct struct.Escaped "Reason: +'escapes to external function ''consume'''")`
+function(expect_remark KIND NAME STRUCT)
+    # Each remark runs from its `--- !<kind>` line up to the `...` line closing it
+    string(REGEX MATCHALL "--- !${KIND}\n([ A-Za-z][^\n]*\n)*" CANDIDATES "${REMARKS}")
+    set(FOUND "")
+    foreach(CANDIDATE ${CANDIDATES})
+        if(CANDIDATE MATCHES "\nPass: +zippy\n" AND CANDIDATE MATCHES "\nName: +${NAME}\n" AND
+           CANDIDATE MATCHES "\n  - Struct: +${STRUCT}\n")
+            if(FOUND)
+                message(FATAL_ERROR "More than one ${NAME} remark for ${STRUCT}:\n${REMARKS}")
+            endif()
+            set(FOUND "${CANDIDATE}")
+        endif()
+    endforeach()
+    if(NOT FOUND)
+        message(FATAL_ERROR "No ${NAME} remark for ${STRUCT}:\n${REMARKS}")
+    endif()
+    foreach(LINE ${ARGN})
+        if(NOT FOUND MATCHES "\n  - ${LINE}\n")
+            message(FATAL_ERROR "Missing '${LINE}' in the ${NAME} remark for ${STRUCT}:\n${FOUND}")
+        endif()
+    endforeach()
+endfunction()
+
+run_zippy(fixture)
+
+# Same size, while the loop only touches the cache line 'hot' is on either way
+expect_remark(Passed Reordered struct.Sample
+              "InitialSize: +'?16'?" "TargetSize: +'?16'?" "InitialLines: +'?1'?" "TargetLines: +'?1'?"
+              "NumLoops: +'?1'?")
+expect_remark(Analysis Unchanged struct.Ordered)
+expect_remark(Missed UnsafeStruct struct.Escaped "Reason: +'escapes to external function ''consume'''")
+expect_remark(Missed RejectedStruct struct.Single "Reason: +'?fewer than two fields'?")
+
+# Every remark is located in `main`, the only function defined
+string(REGEX MATCHALL "\nFunction: +[^\n]*\n" FUNCTIONS "${REMARKS}")
+foreach(FUNCTION ${FUNCTIONS})
+    if(NOT FUNCTION MATCHES "Function: +main\n")
+        message(FATAL_ERROR "Remark outside of main:\n${REMARKS}")
+    endif()
+endforeach()
+
+# Nothing is laid out once no field is used, which still has to be reported
+run_zippy(unused)
+expect_remark(Missed RejectedStruct struct.Unused "Reason: +'?no fields used in this module'?")
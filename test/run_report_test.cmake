@@ -0,0 +1,80 @@
+# This file defines the test for the JSON layout report.
+#
+# The fixture is run through the pass with `-zippy-report`, after which the report has to hold `struct Sample` with
+# 'hot' moved in front of 'cold', down to the offsets of its fields and the loop touching it, and `struct Escaped` as
+# unsafe along with its reason, and with its layout as both the initial and the target one.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+# Emit the fixture IR
+#
+# EG: `clang -S -emit-llvm -O0 fixture.c -o fixture.ll`
+emit_fixture_ir(fixture)
+
+# Run the optimization pass, writing the report
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -zippy-report=report.json fixture.ll -o output.ll -S`
+file(REMOVE ${TEST_DIR}/report.json)
+run_opt("Failed to run optimization pass"
+        -passes=zippy
+        -zippy-report=${TEST_DIR}/report.json
+        ${TEST_DIR}/fixture.ll
+        -o ${TEST_DIR}/output.ll
+        -S
+)
+if(NOT EXISTS ${TEST_DIR}/report.json)
+    message(FATAL_ERROR "No report written")
+endif()
+
+file(READ ${TEST_DIR}/report.json REPORT)
+
+# Checks the report holds a JSON fragment, given in parts joined by the whitespace the report is indented with
+#
+# EG: `expect_report("struct Sample not reported as safe" "\"name\": \"struct.Sample\"," "\"safe\": true")`
+function(expect_report MESSAGE)
+    # Joined by hand, as the brackets within the parts would throw off a list
+    set(PATTERN "${ARGV1}")
+    math(EXPR LAST "${ARGC} - 1")
+    foreach(INDEX RANGE 2 ${LAST})
+        string(APPEND PATTERN "[ \n]*${ARGV${INDEX}}")
+    endforeach()
+    if(NOT REPORT MATCHES "${PATTERN}")
+        message(FATAL_ERROR "${MESSAGE}:\n${REPORT}")
+    endif()
+endfunction()
+
+expect_report("Module not reported" "^{" "\"module\": \"[^\"]*fixture.ll\"," "\"structs\": \\[")
+
+# The safe struct comes first, with 'hot' in front of 'cold'
+expect_report("struct Sample not reported as safe"
+              "{" "\"name\": \"struct.Sample\"," "\"safe\": true," "\"profiled\": false,"
+              "\"size\": {" "\"initial\": 16," "\"target\": 16" "}")
+expect_report("Unexpected order of struct Sample"
+              "\"order\": {" "\"initial\": \\[" "0," "1" "\\]," "\"target\": \\[" "1," "0" "\\]" "}")
+
+# Fields are reported by their initial index, along with their offset under both layouts
+#
+# EG: `{"index": 0, "position": 1, "type": "i64", "size": 8, "align": 8, "offset": {"initial": 0, "target": 8}, ...}`
+expect_report("Unexpected field 'cold' of struct Sample"
+              "{" "\"index\": 0," "\"position\": 1," "\"type\": \"i64\"," "\"size\": 8," "\"align\": 8,"
+              "\"offset\": {" "\"initial\": 0," "\"target\": 8" "}")
+expect_report("Unexpected field 'hot' of struct Sample"
+              "{" "\"index\": 1," "\"position\": 0," "\"type\": \"i64\"," "\"size\": 8," "\"align\": 8,"
+              "\"offset\": {" "\"initial\": 8," "\"target\": 0" "}")
+
+# The loop in `main` only touches 'hot', which fits a single cache line either way
+expect_report("Loop of struct Sample not reported"
+              "\"loops\": \\[" "{" "\"function\": \"main\",[^}]*\"depth\": 1,"
+              "\"fields\": \\[" "1" "\\]," "\"lines\": {" "\"initial\": 1," "\"target\": 1" "}")
+
+# Unsafe structs come with their reason, and keep their layout
+expect_report("struct Escaped not reported as unsafe"
+              "{" "\"name\": \"struct.Escaped\"," "\"safe\": false,"
+              "\"reason\": \"escapes to external function 'consume'\","
+              "\"size\": {" "\"initial\": 16," "\"target\": 16" "},"
+              "\"padding\": {" "\"initial\": 7," "\"target\": 7" "},"
+              "\"order\": {" "\"initial\": \\[" "0," "1" "\\]," "\"target\": \\[" "0," "1" "\\]" "},"
+              "\"fields\": \\[")
+expect_report("Unexpected field 'b' of struct Escaped"
+              "{" "\"index\": 1," "\"position\": 1," "\"type\": \"i64\"," "\"size\": 8," "\"align\": 8,"
+              "\"offset\": {" "\"initial\": 8," "\"target\": 8" "}" "}" "\\]" "}")
@@ -0,0 +1,116 @@
+# This file defines the test for `libzippy_rt`.
+#
+# The fixture is instrumented in trace mode, linked against the runtime and run with a `%p` output pattern. The profile
+# it writes is then read back by the checker, which compares the totals merged from every thread against the expected
+# ones, and the trace is read back by `zippy-cachesim`, which has to find every sampled access.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+# Emit the fixture IR
+#
+# EG: `clang -S -emit-llvm -O0 fixture.c -o fixture.ll`
+emit_fixture_ir(fixture)
+
+# Instrument the fixture
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy-instrument -zippy-instrument-mode=trace fixture.ll ...`
+run_opt("Failed to instrument fixture"
+        -passes=zippy-instrument
+        -zippy-instrument-mode=trace
+        ${TEST_DIR}/fixture.ll
+        -o ${TEST_DIR}/instrumented.ll
+        -S
+)
+
+# Link against the runtime
+#
+# EG: `clang instrumented.ll -o instrumented -lzippy_rt -lpthread`
+execute_process(
+        COMMAND ${CLANG_EXE}
+        -Qunused-arguments # Here to silence NixOS Noise
+        ${TEST_DIR}/instrumented.ll
+        ${RUNTIME_LIB}
+        -lpthread
+        -o ${TEST_DIR}/instrumented
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to link instrumented fixture")
+endif()
+
+# Compile the checker
+execute_process(
+        COMMAND ${CLANG_EXE}
+        -I${RUNTIME_DIR}
+        ${FIXTURE_DIR}/check_profile.c
+        -o ${TEST_DIR}/check_profile
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to compile checker")
+endif()
+
+# Run with the pid in the output path, after clearing the profiles of earlier runs, sampling every 10th access
+#
+# EG: `ZIPPY_RT_OUTPUT=zippy.%p.profile ZIPPY_RT_TRACE_PERIOD=10 ./instrumented`
+file(GLOB OLD_PROFILES ${TEST_DIR}/zippy.*.profile)
+if(OLD_PROFILES)
+    file(REMOVE ${OLD_PROFILES})
+endif()
+execute_process(
+        COMMAND ${CMAKE_COMMAND} -E env
+        ZIPPY_RT_OUTPUT=${TEST_DIR}/zippy.%p.profile
+        ZIPPY_RT_TRACE_OUTPUT=${TEST_DIR}/zippy.trace
+        ZIPPY_RT_TRACE_PERIOD=10
+        ${TEST_DIR}/instrumented
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Instrumented fixture failed")
+endif()
+
+# Exactly one profile is expected, with the `%p` replaced by a pid
+file(GLOB PROFILES ${TEST_DIR}/zippy.*.profile)
+list(LENGTH PROFILES NUM_PROFILES)
+if(NOT NUM_PROFILES EQUAL 1)
+    message(FATAL_ERROR "Expected one profile, found [${NUM_PROFILES}]")
+endif()
+get_filename_component(PROFILE_NAME ${PROFILES} NAME)
+if(NOT PROFILE_NAME MATCHES "^zippy\\.[0-9]+\\.profile$")
+    message(FATAL_ERROR "Output path not expanded: ${PROFILE_NAME}")
+endif()
+
+# Check the merged totals
+execute_process(
+        COMMAND ${TEST_DIR}/check_profile ${PROFILES}
+        RESULT_VARIABLE PROC_RESULT
+)
+
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Profile changed")
+endif()
+
+# Replay the trace, every 10th of the 4 * 1000 worker and 200 main thread accesses has to be in it
+#
+# EG: `zippy-cachesim zippy.trace > summary.txt`
+execute_process(
+        COMMAND ${CACHESIM_EXE}
+        ${TEST_DIR}/zippy.trace
+        OUTPUT_VARIABLE SUMMARY
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to replay trace")
+endif()
+
+if(NOT SUMMARY MATCHES "^Replaying \\[420\\] events over \\[1\\] structs\n")
+    message(FATAL_ERROR "Trace changed: ${SUMMARY}")
+endif()
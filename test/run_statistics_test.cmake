@@ -0,0 +1,51 @@
+# This file defines the test for the statistics of the pass.
+#
+# The fixture is run through the pass with `-stats`, after which the counters written as JSON have to count both
+# structs, the unsafe one, the reordered one and the padding it dropped. Statistics are only counted by LLVM builds
+# with assertions or `LLVM_FORCE_ENABLE_STATS`, the test is skipped without them.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+# Emit the fixture IR, without `optnone` so other passes count their statistics over it too
+#
+# EG: `clang -S -emit-llvm -O0 -Xclang -disable-O0-optnone fixture.c -o fixture.ll`
+emit_fixture_ir(fixture -Xclang -disable-O0-optnone)
+
+# Runs a pipeline over the fixture, writing its statistics as JSON into `STATISTICS`
+#
+# EG: `opt -passes=sroa -stats -stats-json -info-output-file=stats.json fixture.ll -disable-output`
+function(collect_statistics PASSES)
+    file(REMOVE ${TEST_DIR}/stats.json)
+    run_opt("Failed to run ${PASSES}"
+            -passes=${PASSES}
+            -stats
+            -stats-json
+            -info-output-file=${TEST_DIR}/stats.json
+            ${TEST_DIR}/fixture.ll
+            -disable-output
+    )
+    set(STATISTICS "")
+    if(EXISTS ${TEST_DIR}/stats.json)
+        file(READ ${TEST_DIR}/stats.json STATISTICS)
+    endif()
+    set(STATISTICS "${STATISTICS}" PARENT_SCOPE)
+endfunction()
+
+# SROA counts the allocas of any unoptimized module, so counts nothing only when statistics are disabled
+collect_statistics(sroa)
+if(NOT STATISTICS MATCHES "\"sroa\\.")
+    message(STATUS "Statistics not enabled in this LLVM build, skipped")
+    return()
+endif()
+
+# Run the optimization pass
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -stats -stats-json -info-output-file=stats.json fixture.ll`
+collect_statistics(zippy)
+foreach(STATISTIC
+        "NumStructsConsidered\": 2" "NumStructsUnsafe\": 1" "NumStructsTransformed\": 1" "NumBytesSaved\": 8"
+        "NumGEPInsts\": [1-9]")
+    if(NOT STATISTICS MATCHES "\"zippy\\.${STATISTIC}")
+        message(FATAL_ERROR "Missing statistic '${STATISTIC}':\n${STATISTICS}")
+    endif()
+endforeach()
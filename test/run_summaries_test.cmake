@@ -0,0 +1,102 @@
+# This file defines the test for the summaries of a ThinLTO style build.
+#
+# Both modules are summarized into one directory and laid out separately from the merged summaries. `b.c` lets the
+# pointer it is passed in `leak` escape, which its summary has to record so `struct Leaked` is unsafe in both modules,
+# and the two modules linked back together have to agree on the layout of `struct Shared`. `c.c` is never summarized, so
+# `struct Local` has no summary and has to keep its layout.
+
+include(${CMAKE_CURRENT_LIST_DIR}/test_utils.cmake)
+
+file(REMOVE_RECURSE ${TEST_DIR}/summaries)
+file(MAKE_DIRECTORY ${TEST_DIR}/summaries)
+
+foreach(MODULE a b c)
+    # Emit the module IR
+    #
+    # EG: `clang -S -emit-llvm -O0 a.c -o a.ll`
+    emit_fixture_ir(${MODULE})
+    if(MODULE STREQUAL "c")
+        continue()
+    endif()
+
+    # Summarize the module
+    #
+    # EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy-summarize -zippy-summary-dir=summaries a.ll ...`
+    run_opt("Failed to summarize ${MODULE}.ll"
+            -passes=zippy-summarize
+            -zippy-summary-dir=${TEST_DIR}/summaries
+            ${TEST_DIR}/${MODULE}.ll
+            -disable-output
+    )
+endforeach()
+
+# One summary per module, named after it
+file(GLOB SUMMARIES ${TEST_DIR}/summaries/*.zippy-summary)
+list(LENGTH SUMMARIES NUM_SUMMARIES)
+if(NOT NUM_SUMMARIES EQUAL 2)
+    message(FATAL_ERROR "Expected two summaries, found [${NUM_SUMMARIES}]")
+endif()
+
+# The escape in `leak` is recorded against its argument
+file(GLOB B_SUMMARY ${TEST_DIR}/summaries/b.ll.*.zippy-summary)
+file(READ ${B_SUMMARY} B_SUMMARY_TEXT)
+if(NOT B_SUMMARY_TEXT MATCHES "\nargument 0 leak\nunsafe passed through varargs\nend\n")
+    message(FATAL_ERROR "Escape not summarized:\n${B_SUMMARY_TEXT}")
+endif()
+
+foreach(MODULE a b c)
+    # Lay the module out from the merged summaries
+    #
+    # EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy -zippy-summary-dir=summaries a.ll -o a.opt.ll -S`
+    run_opt("Failed to run optimization pass on ${MODULE}.ll"
+            -passes=zippy
+            -zippy-summary-dir=${TEST_DIR}/summaries
+            -zippy-report=${TEST_DIR}/${MODULE}.json
+            ${TEST_DIR}/${MODULE}.ll
+            -o ${TEST_DIR}/${MODULE}.opt.ll
+            -S
+    )
+
+    if(MODULE STREQUAL "c")
+        continue()
+    endif()
+
+    # Both modules keep `struct Leaked` as is, for the same reason
+    file(READ ${TEST_DIR}/${MODULE}.json REPORT)
+    if(NOT REPORT MATCHES "\"name\": \"struct.Leaked\",\n *\"safe\": false,\n *\"reason\": \"passed through varargs in 'leak'\"")
+        message(FATAL_ERROR "struct Leaked not unsafe in ${MODULE}.c:\n${REPORT}")
+    endif()
+endforeach()
+
+# Without a summary, `struct Local` is left as is rather than laid out locally
+file(READ ${TEST_DIR}/c.opt.ll C_IR)
+if(NOT C_IR MATCHES "%struct.Local = type { i8, i64, i8 }")
+    message(FATAL_ERROR "struct Local laid out without a summary:\n${C_IR}")
+endif()
+
+# Link the modules back together
+#
+# EG: `clang a.opt.ll b.opt.ll -o program`
+execute_process(
+        COMMAND ${CLANG_EXE}
+        -Qunused-arguments # Here to silence NixOS Noise
+        ${TEST_DIR}/a.opt.ll
+        ${TEST_DIR}/b.opt.ll
+        -o ${TEST_DIR}/program
+        RESULT_VARIABLE PROC_RESULT
+)
+
+# Check Result
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Failed to link modules")
+endif()
+
+# Runs the program, which only succeeds if both modules agree on every layout
+execute_process(
+        COMMAND ${TEST_DIR}/program
+        RESULT_VARIABLE PROC_RESULT
+)
+
+if(NOT PROC_RESULT EQUAL 0)
+    message(FATAL_ERROR "Modules disagree on a layout")
+endif()
@@ -0,0 +1,105 @@
+/**
+ * check_profile.c
+ *
+ * Purpose: Reads back the profile written by the instrumented `fixture.c`, and checks the merged totals.
+ *
+ * Only the main thread alternates between `hits` and `misses` of one object. Its `j`-th access pairs up with every
+ * access to the other field among the previous `ZIPPY_RT_COACCESS_WINDOW`, which is `(j + 1) / 2` of them for the
+ * first 8 accesses and 4 from then on, so the two fields are co-accessed `16 + (200 - 8) * 4` times.
+ *
+ * EG: `check_profile zippy.1234.profile`
+ */
+#include "zippy_rt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPECTED_STRUCT "struct.Counter"
+#define EXPECTED_FIELDS 4
+
+static const uint64_t expectedCounts[EXPECTED_FIELDS] = {4 * 1000 + 100, 100, 0, 0};
+static const uint64_t expectedCoAccesses = 16 + (200 - 8) * 4;
+
+static int failed = 0;
+
+static void expect(const char *what, const uint64_t actual, const uint64_t expected) {
+    if (actual == expected) return;
+    fprintf(stderr, "%s: expected [%llu], found [%llu]\n", what, (unsigned long long) expected,
+            (unsigned long long) actual);
+    failed = 1;
+}
+
+static int readValue(FILE *file, void *value, const size_t size) {
+    return fread(value, size, 1, file) == 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fputs("Usage: check_profile <profile>\n", stderr);
+        return 1;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open '%s'\n", argv[1]);
+        return 1;
+    }
+
+    zippy_rt_profile_header header;
+    if (!readValue(file, &header, sizeof(header)) ||
+        memcmp(header.magic, ZIPPY_RT_PROFILE_MAGIC, ZIPPY_RT_PROFILE_MAGIC_SIZE) != 0 ||
+        header.version != ZIPPY_RT_PROFILE_VERSION) {
+        fputs("Malformed profile header\n", stderr);
+        return 1;
+    }
+
+    int found = 0;
+    for (uint32_t i = 0; i < header.numStructs; i++) {
+        zippy_rt_profile_struct_header structHeader;
+        if (!readValue(file, &structHeader, sizeof(structHeader))) {
+            fputs("Truncated profile\n", stderr);
+            return 1;
+        }
+        const size_t paddedLength = (structHeader.nameLength + 7) & ~(size_t) 7;
+        char *name = calloc(1, paddedLength + 1);
+        const size_t numCounters = structHeader.numFields + structHeader.numFields * structHeader.numFields;
+        uint64_t *counters = calloc(numCounters, sizeof(uint64_t));
+        if (!name || !counters ||
+            (paddedLength && !readValue(file, name, paddedLength)) ||
+            (numCounters && !readValue(file, counters, numCounters * sizeof(uint64_t)))) {
+            fputs("Truncated profile\n", stderr);
+            return 1;
+        }
+
+        if (strcmp(name, EXPECTED_STRUCT) == 0) {
+            found = 1;
+            expect("Number of fields", structHeader.numFields, EXPECTED_FIELDS);
+            if (structHeader.numFields == EXPECTED_FIELDS) {
+                char what[64];
+                for (uint32_t field = 0; field < EXPECTED_FIELDS; field++) {
+                    snprintf(what, sizeof(what), "Count of field [%u]", field);
+                    expect(what, counters[field], expectedCounts[field]);
+                }
+
+                // Symmetric, and only `hits` and `misses` are ever paired
+                const uint64_t *matrix = &counters[EXPECTED_FIELDS];
+                for (uint32_t first = 0; first < EXPECTED_FIELDS; first++) {
+                    for (uint32_t second = 0; second < EXPECTED_FIELDS; second++) {
+                        const int paired = (first == 0 && second == 1) || (first == 1 && second == 0);
+                        snprintf(what, sizeof(what), "Co-access of fields [%u] and [%u]", first, second);
+                        expect(what, matrix[first * EXPECTED_FIELDS + second], paired ? expectedCoAccesses : 0);
+                    }
+                }
+            }
+        }
+        free(name);
+        free(counters);
+    }
+    fclose(file);
+
+    if (!found) {
+        fputs("Missing " EXPECTED_STRUCT "\n", stderr);
+        return 1;
+    }
+    return failed;
+}
@@ -0,0 +1,52 @@
+/**
+ * fixture.c
+ *
+ * Purpose: Instrumented program for the `libzippy_rt` test
+ *
+ * Each worker thread counts into its own block, which is merged when the thread exits. The main thread is still alive
+ * when the process exits, so its block is only merged by the `atexit` handler.
+ *
+ * At `-O0` every field access below is a GEP of its own, so the expected totals are exact:
+ * `hits` is accessed `NUM_WORKERS * WORKER_ACCESSES + MAIN_ACCESSES` times, `misses` `MAIN_ACCESSES` times, and
+ * `padding` and `cold` never.
+ */
+#include <pthread.h>
+
+#define NUM_WORKERS 4
+#define WORKER_ACCESSES 1000
+#define MAIN_ACCESSES 100
+
+struct Counter {
+    long hits;
+    long misses;
+    long padding[6];
+    long cold;
+};
+
+struct Counter counters[NUM_WORKERS];
+
+void *worker(void *arg) {
+    struct Counter *counter = arg;
+    for (int i = 0; i < WORKER_ACCESSES; i++) {
+        counter->hits++;
+    }
+    return 0;
+}
+
+int main(void) {
+    pthread_t threads[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        if (pthread_create(&threads[i], 0, worker, &counters[i]) != 0) return 1;
+    }
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_join(threads[i], 0);
+    }
+
+    // Alternates between two fields of the same object
+    struct Counter local = {0};
+    for (int i = 0; i < MAIN_ACCESSES; i++) {
+        local.hits++;
+        local.misses++;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+/**
+ * fixture.c
+ *
+ * Purpose: `struct Padded` is reordered, dropping the padding around 'hot', and `struct Escaped` is skipped as unsafe
+ */
+
+struct Padded {
+    char first;         // Accessed once
+    long hot;           // Accessed in the loop
+    char last;          // Accessed once
+};
+
+// Defined in another module, never linked in as only the statistics are checked
+struct Escaped {
+    long a;
+    long b;
+};
+
+void consume(struct Escaped *escaped);
+
+volatile int iterations = 100;
+
+int main() {
+    struct Padded padded = {1, 0, 2};
+    for (int i = 0; i < iterations; i++) {
+        padded.hot += i;
+    }
+    struct Escaped escaped = {padded.first + padded.last, padded.hot};
+    consume(&escaped);
+    return 0;
+}
@@ -0,0 +1,19 @@
+/**
+ * a.c
+ *
+ * Purpose: Passes both structs to functions `b.c` defines. Only `sum_shared` keeps the pointer intact, so `Shared` may
+ * be reordered as long as both modules agree, while `Leaked` has to keep its layout in both.
+ */
+#include "shared.h"
+
+volatile int iterations = 100;
+
+int main() {
+    struct Shared shared = {1, 0, 2};
+    struct Leaked leaked = {3, 0};
+    for (int i = 0; i < iterations; i++) {
+        shared.hot += i;
+        leaked.hot += i;
+    }
+    return (sum_shared(&shared) == 25050 && leak(&leaked) == 4953) ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+/**
+ * b.c
+ *
+ * Purpose: Defines the functions `a.c` passes its structs to, where `leak` lets its pointer escape through varargs.
+ */
+#include "shared.h"
+
+// Weighs each field differently, so the result changes if the modules disagree on the layout
+long sum_shared(struct Shared *shared) {
+    return shared->coldA * 100 + shared->hot + shared->coldB * 10000;
+}
+
+static long count(int n, ...) {
+    return n;
+}
+
+long leak(struct Leaked *leaked) {
+    return count(1, leaked) - 1 + leaked->cold + leaked->hot;
+}
@@ -0,0 +1,22 @@
+/**
+ * c.c
+ *
+ * Purpose: Laid out from the merged summaries without having been summarized itself, eg: a module added since the
+ * summaries were written. `Local` has no summary, so it has to keep its layout, as other modules may not reorder it.
+ */
+
+struct Local {
+    char flag;          // Read once
+    long hot;           // Accessed in the loop
+    char tag;           // Read once
+};
+
+volatile int iterations = 100;
+
+int main() {
+    struct Local local = {1, 0, 2};
+    for (int i = 0; i < iterations; i++) {
+        local.hot += i;
+    }
+    return local.flag + local.hot + local.tag == 4953 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+/**
+ * shared.h
+ *
+ * Structs shared by `a.c` and `b.c`, which are summarized and laid out separately.
+ */
+
+struct Shared {
+    long coldA;         // Read once in `b.c`
+    long hot;           // Accessed in the loop in `a.c`
+    long coldB;         // Read once in `b.c`
+};
+
+struct Leaked {
+    long cold;          // Read once in `b.c`
+    long hot;           // Accessed in the loop in `a.c`
+};
+
+long sum_shared(struct Shared *shared);
+long leak(struct Leaked *leaked);
@@ -0,0 +1,38 @@
+# This file holds the steps shared by the `run_*_test.cmake` scripts, which include it.
+#
+# Every script is run with `TEST_DIR` as its work directory and `FIXTURE_DIR` holding its fixtures, along with the tools
+# passed by `add_fixture_test` in `CMakeLists.txt`.
+
+# Emits the IR of the fixture `<name>.c` into `<name>.ll`, at `-O0` unless further clang arguments say otherwise
+#
+# EG: `clang -S -emit-llvm -O0 fixture.c -o fixture.ll`
+function(emit_fixture_ir NAME)
+    execute_process(
+            COMMAND ${CLANG_EXE} -S -emit-llvm -O0
+            ${ARGN}
+            ${FIXTURE_DIR}/${NAME}.c
+            -o ${TEST_DIR}/${NAME}.ll
+            RESULT_VARIABLE PROC_RESULT
+    )
+
+    # Check Result
+    if(NOT PROC_RESULT EQUAL 0)
+        message(FATAL_ERROR "Failed to emit IR for ${NAME}.c")
+    endif()
+endfunction()
+
+# Runs `opt` with the pass plugin loaded and the given arguments, failing the test with `MESSAGE` if it fails
+#
+# EG: `opt -load-pass-plugin ZippyPass.so -passes=zippy fixture.ll -o output.ll -S`
+function(run_opt MESSAGE)
+    execute_process(
+            COMMAND ${OPT_EXE} -load-pass-plugin ${PLUGIN_PATH}
+            ${ARGN}
+            RESULT_VARIABLE PROC_RESULT
+    )
+
+    # Check Result
+    if(NOT PROC_RESULT EQUAL 0)
+        message(FATAL_ERROR "${MESSAGE}")
+    endif()
+endfunction()
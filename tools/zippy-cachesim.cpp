@@ -0,0 +1,311 @@
+/**
+ * zippy-cachesim
+ *
+ * Replays a sampled address trace written by `libzippy_rt` through a simulated L1/L2 cache hierarchy, once with the
+ * original layout and once per candidate layout, and reports the predicted misses of each.
+ *
+ * Candidate layouts are text files with one struct per line, listing the original field indices in their new order:
+ *
+ *     struct.Foo 2 0 1 3
+ *
+ * Structs missing from a candidate keep their original layout.
+ *
+ * EG: `zippy-cachesim zippy.trace -layout=candidate.txt`
+ */
+#include "zippy_rt.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Alignment.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstring>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> TracePath(cl::Positional, cl::desc("<trace file>"), cl::Required);
+
+static cl::list<std::string> LayoutPaths("layout", cl::desc("Candidate layout file, may be repeated"));
+
+static cl::opt<unsigned> LineSize("line-size", cl::desc("Cache line size in bytes"), cl::init(64));
+static cl::opt<unsigned> L1Size("l1-size", cl::desc("L1 size in bytes"), cl::init(32 * 1024));
+static cl::opt<unsigned> L1Assoc("l1-assoc", cl::desc("L1 associativity"), cl::init(8));
+static cl::opt<unsigned> L2Size("l2-size", cl::desc("L2 size in bytes"), cl::init(1024 * 1024));
+static cl::opt<unsigned> L2Assoc("l2-assoc", cl::desc("L2 associativity"), cl::init(16));
+
+namespace {
+    struct FieldLayout {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t align;
+    };
+
+    struct TraceStruct {
+        std::string name;
+        uint64_t allocSize = 0;
+        std::vector<FieldLayout> fields;
+    };
+
+    struct Trace {
+        std::vector<TraceStruct> structs;
+        // Maps a counter index to its struct and field index
+        DenseMap<uint32_t, std::pair<unsigned, unsigned>> counterIndices;
+        std::vector<zippy_rt_trace_event> events;
+        // Lowest object traced per struct, taken as the start of the array its objects are in
+        std::vector<uint64_t> bases;
+    };
+
+    /**
+     * Set-associative cache with LRU replacement, each set is kept in most to least recently used order.
+     */
+    class CacheLevel {
+        uint64_t numSets;
+        unsigned numWays;
+        std::vector<SmallVector<uint64_t, 16>> sets;
+
+    public:
+        uint64_t accesses = 0;
+        uint64_t misses = 0;
+
+        CacheLevel(const uint64_t size, const unsigned ways): numSets(std::max<uint64_t>(1, size / LineSize / ways)),
+                                                              numWays(ways), sets(numSets) {}
+
+        bool access(const uint64_t line) {
+            accesses++;
+            auto &set = sets[line % numSets];
+            for (auto it = set.begin(); it != set.end(); ++it) {
+                if (*it != line) continue;
+                set.erase(it);
+                set.insert(set.begin(), line);
+                return true;
+            }
+            misses++;
+            if (set.size() == numWays) set.pop_back();
+            set.insert(set.begin(), line);
+            return false;
+        }
+    };
+
+    /**
+     * Private L1 and L2 of one thread, L2 is only consulted on an L1 miss.
+     */
+    struct CacheHierarchy {
+        CacheLevel l1{L1Size, L1Assoc};
+        CacheLevel l2{L2Size, L2Assoc};
+
+        void access(const uint64_t line) {
+            if (!l1.access(line)) l2.access(line);
+        }
+    };
+
+    struct SimResult {
+        uint64_t l1Accesses = 0;
+        uint64_t l1Misses = 0;
+        uint64_t l2Misses = 0;
+    };
+
+    template<typename T>
+    bool readValue(const char *&cursor, const char *end, T &value) {
+        if (end - cursor < static_cast<ptrdiff_t>(sizeof(T))) return false;
+        std::memcpy(&value, cursor, sizeof(T));
+        cursor += sizeof(T);
+        return true;
+    }
+
+    size_t padTo8(const size_t size) {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    bool readTrace(const MemoryBuffer &buffer, Trace &trace) {
+        const char *start = buffer.getBufferStart();
+        const char *cursor = start;
+        const char *end = buffer.getBufferEnd();
+
+        zippy_rt_trace_header header;
+        if (!readValue(cursor, end, header)) return false;
+        if (std::memcmp(header.magic, ZIPPY_RT_TRACE_MAGIC, ZIPPY_RT_PROFILE_MAGIC_SIZE) != 0) return false;
+        if (header.version != ZIPPY_RT_TRACE_VERSION) return false;
+
+        for (uint32_t i = 0; i < header.numStructs; i++) {
+            zippy_rt_trace_struct_header structHeader;
+            if (!readValue(cursor, end, structHeader)) return false;
+            if (end - cursor < static_cast<ptrdiff_t>(padTo8(structHeader.nameLength))) return false;
+
+            TraceStruct layout;
+            layout.name.assign(cursor, structHeader.nameLength);
+            layout.allocSize = structHeader.allocSize;
+            cursor += padTo8(structHeader.nameLength);
+
+            for (uint32_t field = 0; field < structHeader.numFields; field++) {
+                zippy_rt_field_layout fieldLayout;
+                if (!readValue(cursor, end, fieldLayout)) return false;
+                layout.fields.push_back({fieldLayout.offset, fieldLayout.size, fieldLayout.align});
+                trace.counterIndices[structHeader.base + field] = {trace.structs.size(), field};
+            }
+            trace.structs.push_back(std::move(layout));
+        }
+        cursor = start + padTo8(cursor - start);
+
+        trace.events.reserve(header.numEvents);
+        for (uint64_t i = 0; i < header.numEvents; i++) {
+            zippy_rt_trace_event event;
+            if (!readValue(cursor, end, event)) return false;
+            trace.events.push_back(event);
+        }
+
+        trace.bases.assign(trace.structs.size(), UINT64_MAX);
+        for (const auto &event: trace.events) {
+            const auto found = trace.counterIndices.find(event.index);
+            if (found == trace.counterIndices.end()) continue;
+            auto &base = trace.bases[found->second.first];
+            base = std::min<uint64_t>(base, event.object);
+        }
+        return true;
+    }
+
+    /**
+     * Lays the fields out in the given order with their natural alignment, like the struct body would be.
+     */
+    TraceStruct applyOrder(const TraceStruct &original, ArrayRef<unsigned> order) {
+        TraceStruct layout = original;
+        uint64_t offset = 0;
+        uint64_t maxAlign = 1;
+        for (const auto index: order) {
+            auto &field = layout.fields[index];
+            offset = alignTo(offset, field.align);
+            field.offset = offset;
+            offset += field.size;
+            maxAlign = std::max(maxAlign, field.align);
+        }
+        layout.allocSize = alignTo(offset, maxAlign);
+        return layout;
+    }
+
+    bool readCandidate(StringRef path, const Trace &trace, std::vector<TraceStruct> &layouts) {
+        auto bufferOrErr = MemoryBuffer::getFile(path);
+        if (!bufferOrErr) {
+            errs() << "Failed to read layout: " << path << "\n";
+            return false;
+        }
+        StringMap<unsigned> structIndices;
+        for (unsigned i = 0; i < trace.structs.size(); i++) {
+            structIndices[trace.structs[i].name] = i;
+        }
+
+        layouts = trace.structs;
+        SmallVector<StringRef, 8> lines;
+        (*bufferOrErr)->getBuffer().split(lines, '\n', -1, false);
+        for (const auto line: lines) {
+            SmallVector<StringRef, 16> tokens;
+            line.trim().split(tokens, ' ', -1, false);
+            if (tokens.empty() || tokens.front().starts_with("#")) continue;
+
+            const auto found = structIndices.find(tokens.front());
+            if (found == structIndices.end()) continue;
+            const auto &original = trace.structs[found->second];
+
+            SmallVector<unsigned, 16> order;
+            SmallVector<bool, 16> listed(original.fields.size(), false);
+            for (const auto token: ArrayRef<StringRef>(tokens).drop_front()) {
+                unsigned index;
+                if (token.getAsInteger(10, index) || index >= original.fields.size()) {
+                    errs() << "Invalid field index '" << token << "' for " << original.name << "\n";
+                    return false;
+                }
+                // A layout has to be a permutation, a field listed twice would leave another one without an offset
+                if (listed[index]) {
+                    errs() << "Field index '" << token << "' listed twice for " << original.name << "\n";
+                    return false;
+                }
+                listed[index] = true;
+                order.push_back(index);
+            }
+            if (order.size() != original.fields.size()) {
+                errs() << "Layout for " << original.name << " does not list every field\n";
+                return false;
+            }
+            layouts[found->second] = applyOrder(original, order);
+        }
+        return true;
+    }
+
+    SimResult simulate(const Trace &trace, const std::vector<TraceStruct> &layouts) {
+        DenseMap<uint32_t, CacheHierarchy> caches;
+        for (const auto &event: trace.events) {
+            const auto found = trace.counterIndices.find(event.index);
+            if (found == trace.counterIndices.end()) continue;
+            const auto [structIndex, fieldIndex] = found->second;
+            const auto &original = trace.structs[structIndex];
+            const auto &layout = layouts[structIndex];
+
+            // Objects are assumed to be laid out in one array from the lowest one, so a size change moves each one by its
+            // index into that array, while the array itself stays at the same offset within its cache line
+            uint64_t object = event.object;
+            if (layout.allocSize != original.allocSize && original.allocSize != 0) {
+                const auto base = trace.bases[structIndex];
+                const auto offset = object - base;
+                object = base + offset / original.allocSize * layout.allocSize + offset % original.allocSize;
+            }
+
+            const auto &field = layout.fields[fieldIndex];
+            const auto first = (object + field.offset) / LineSize;
+            const auto last = (object + field.offset + std::max<uint64_t>(field.size, 1) - 1) / LineSize;
+            auto &cache = caches[event.thread];
+            for (auto line = first; line <= last; line++) {
+                cache.access(line);
+            }
+        }
+
+        SimResult result;
+        for (const auto &[thread, cache]: caches) {
+            result.l1Accesses += cache.l1.accesses;
+            result.l1Misses += cache.l1.misses;
+            result.l2Misses += cache.l2.misses;
+        }
+        return result;
+    }
+
+    void printResult(const StringRef name, const SimResult &result, const SimResult *baseline) {
+        outs() << format("%-32s L1 Accesses: [%10llu] L1 Misses: [%10llu] L2 Misses: [%10llu]",
+                         name.str().c_str(), result.l1Accesses, result.l1Misses, result.l2Misses);
+        if (baseline) {
+            outs() << format(" - L1 Delta: [%+lld] L2 Delta: [%+lld]",
+                             static_cast<long long>(result.l1Misses - baseline->l1Misses),
+                             static_cast<long long>(result.l2Misses - baseline->l2Misses));
+        }
+        outs() << "\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "Zippy trace driven cache simulator\n");
+
+    auto bufferOrErr = MemoryBuffer::getFile(TracePath);
+    if (!bufferOrErr) {
+        errs() << "Failed to read trace: " << TracePath << "\n";
+        return 1;
+    }
+    Trace trace;
+    if (!readTrace(**bufferOrErr, trace)) {
+        errs() << "Malformed trace: " << TracePath << "\n";
+        return 1;
+    }
+    outs() << format("Replaying [%zu] events over [%zu] structs\n", trace.events.size(), trace.structs.size());
+
+    const auto baseline = simulate(trace, trace.structs);
+    printResult("original", baseline, nullptr);
+
+    for (const auto &layoutPath: LayoutPaths) {
+        std::vector<TraceStruct> layouts;
+        if (!readCandidate(layoutPath, trace, layouts)) return 1;
+        printResult(layoutPath, simulate(trace, layouts), &baseline);
+    }
+    return 0;
+}
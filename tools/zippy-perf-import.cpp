@@ -0,0 +1,437 @@
+/**
+ * zippy-perf-import
+ *
+ * Turns `perf mem record` / `perf record -d` samples into a field access profile, the same format `libzippy_rt`
+ * writes and `-zippy-profile` consumes.
+ *
+ * The input is the text output of `perf script -F addr,ip,dso`, where the first two hexadecimal tokens of each line
+ * are taken as the data address and the instruction address, and the parenthesized token as the object the instruction
+ * lies in. Samples whose instruction lies outside the binary are skipped. Data addresses are resolved to a data symbol
+ * of the binary, and then through the DWARF type of that variable down to the `DW_TAG_member` containing it, descending
+ * into nested structs and arrays of structs.
+ *
+ * Position independent binaries are loaded at a different address on every run, which is subtracted from both
+ * addresses first. It is taken from `--load-base`, or else from the mapping of the binary at file offset 0 among the
+ * `PERF_RECORD_MMAP` events that `--show-mmap-events` adds to the output.
+ *
+ * Only variables with a symbol can be resolved this way, heap objects are reported as unmapped.
+ *
+ * EG: `perf script --show-mmap-events -F addr,ip,dso > samples.txt && zippy-perf-import ./server samples.txt`
+ */
+#include "ProfileInfo.hpp"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/DebugInfo/DWARF/DWARFContext.h>
+#include <llvm/Object/ELFObjectFile.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <vector>
+
+using namespace llvm;
+using Zippy::ProfileInfo;
+
+static cl::opt<std::string> BinaryPath(cl::Positional, cl::desc("<binary with debug info>"), cl::Required);
+static cl::opt<std::string> ScriptPath(cl::Positional, cl::desc("<perf script output>"), cl::Required);
+static cl::opt<std::string> OutputPath("o", cl::desc("Profile to write"), cl::value_desc("file"),
+                                       cl::init("zippy.profile"));
+static cl::opt<uint64_t> LoadBase("load-base",
+                                  cl::desc("Address the binary was mapped at, from file offset 0, eg: from "
+                                           "/proc/<pid>/maps. Defaults to its mapping among the perf mmap events"),
+                                  cl::value_desc("address"));
+
+namespace {
+    struct DataSymbol {
+        std::string name;
+        uint64_t address;
+        uint64_t size;
+    };
+
+    struct Member {
+        uint64_t offset;
+        uint64_t size;
+        DWARFDie type;
+    };
+
+    struct DwarfStruct {
+        // IR style name, eg: `struct.Foo`
+        std::string name;
+        std::vector<Member> members;
+    };
+
+    struct WindowEntry {
+        uint64_t object = 0;
+        const std::string *name = nullptr;
+        unsigned field = 0;
+    };
+
+    /**
+     * Address the start of the file is linked at, eg: 0 for a position independent binary, found from its first
+     * loadable segment.
+     */
+    template <typename ELFT>
+    uint64_t getFileBase(const object::ELFObjectFile<ELFT> &elfObj) {
+        auto programHeaders = elfObj.getELFFile().program_headers();
+        if (!programHeaders) {
+            consumeError(programHeaders.takeError());
+            return 0;
+        }
+        for (const auto &programHeader: *programHeaders) {
+            if (programHeader.p_type == ELF::PT_LOAD) return programHeader.p_vaddr - programHeader.p_offset;
+        }
+        return 0;
+    }
+
+    class Importer {
+        std::vector<DataSymbol> symbols;
+        std::vector<std::pair<uint64_t, uint64_t>> textRanges;
+        StringMap<DWARFDie> variableTypes;
+        std::map<uint64_t, std::optional<DwarfStruct>> structLayouts;
+
+        std::map<std::string, ProfileInfo::StructProfile> structProfiles;
+        WindowEntry window[ZIPPY_RT_COACCESS_WINDOW];
+        unsigned windowHead = 0;
+
+        // Runtime minus link time addresses, only set for position independent binaries
+        uint64_t fileBase = 0;
+        uint64_t loadBias = 0;
+        bool isPositionIndependent = false;
+        bool hasLoadBase = false;
+
+    public:
+        unsigned numSamples = 0;
+        unsigned numForeign = 0;
+        unsigned numMapped = 0;
+
+        bool loadSymbols(const object::ObjectFile &obj) {
+            const auto elfObj = dyn_cast<object::ELFObjectFileBase>(&obj);
+            if (!elfObj) {
+                errs() << "Not an ELF binary: " << BinaryPath << "\n";
+                return false;
+            }
+            isPositionIndependent = elfObj->getEType() == ELF::ET_DYN;
+            if (const auto elf32LE = dyn_cast<object::ELF32LEObjectFile>(elfObj)) fileBase = getFileBase(*elf32LE);
+            else if (const auto elf32BE = dyn_cast<object::ELF32BEObjectFile>(elfObj)) fileBase = getFileBase(*elf32BE);
+            else if (const auto elf64LE = dyn_cast<object::ELF64LEObjectFile>(elfObj)) fileBase = getFileBase(*elf64LE);
+            else if (const auto elf64BE = dyn_cast<object::ELF64BEObjectFile>(elfObj)) fileBase = getFileBase(*elf64BE);
+            for (const auto &section: obj.sections()) {
+                if (section.isText()) textRanges.emplace_back(section.getAddress(), section.getSize());
+            }
+            for (const auto &symbol: elfObj->symbols()) {
+                auto type = symbol.getType();
+                auto name = symbol.getName();
+                auto address = symbol.getAddress();
+                if (!type || !name || !address) {
+                    consumeError(type.takeError());
+                    consumeError(name.takeError());
+                    consumeError(address.takeError());
+                    continue;
+                }
+                if (*type != object::SymbolRef::ST_Data || symbol.getSize() == 0) continue;
+                symbols.push_back({name->str(), *address, symbol.getSize()});
+            }
+            std::sort(symbols.begin(), symbols.end(), [](const DataSymbol &a, const DataSymbol &b) {
+                return a.address < b.address;
+            });
+            return true;
+        }
+
+        /**
+         * Takes `loadBase`, where file offset 0 of the binary was mapped, as the address it was loaded at. Only
+         * position independent binaries are moved, the rest run at their link time addresses.
+         */
+        void setLoadBase(const uint64_t loadBase) {
+            if (!isPositionIndependent || hasLoadBase) return;
+            loadBias = loadBase - fileBase;
+            hasLoadBase = true;
+        }
+
+        bool isMissingLoadBase() const {
+            return isPositionIndependent && !hasLoadBase;
+        }
+
+        void loadVariables(DWARFContext &ctx) {
+            for (const auto &unit: ctx.compile_units()) {
+                loadVariables(unit->getUnitDIE(false));
+            }
+        }
+
+        bool isForeign(const uint64_t ip) const {
+            for (const auto &[start, size]: textRanges) {
+                if (ip >= start && ip < start + size) return false;
+            }
+            return true;
+        }
+
+        /**
+         * Attributes a sample, `dso` is the object perf found the instruction in if it was printed.
+         */
+        void addSample(uint64_t address, uint64_t ip, const StringRef dso) {
+            numSamples++;
+            const auto isOtherObject = !dso.empty() && sys::path::filename(dso) != sys::path::filename(BinaryPath);
+            if (isOtherObject || ip < loadBias || isForeign(ip - loadBias)) {
+                numForeign++;
+                return;
+            }
+            ip -= loadBias;
+            if (address < loadBias) return;
+            address -= loadBias;
+            const auto symbol = findSymbol(address);
+            if (!symbol) return;
+            const auto type = variableTypes.find(symbol->name);
+            if (type == variableTypes.end()) return;
+            if (attribute(type->second, symbol->address, address - symbol->address, "")) numMapped++;
+        }
+
+        ProfileInfo buildProfile() const {
+            ProfileInfo profileInfo;
+            for (const auto &[name, structProfile]: structProfiles) {
+                profileInfo.merge(name, structProfile);
+            }
+            return profileInfo;
+        }
+
+        void printSummary(raw_ostream &out) const {
+            out << format("Mapped [%d] of [%d] samples, [%d] outside the binary\n", numMapped, numSamples,
+                          numForeign);
+            for (const auto &[name, structProfile]: structProfiles) {
+                out << name << format(" [%d] fields -", structProfile.numFields);
+                for (unsigned i = 0; i < structProfile.numFields; i++) {
+                    out << format(" [%02d]=%llu", i, structProfile.counts[i]);
+                }
+                out << "\n";
+            }
+        }
+
+    private:
+        void loadVariables(const DWARFDie &die) {
+            for (const auto child: die.children()) {
+                if (child.getTag() == dwarf::DW_TAG_variable) {
+                    const auto name = child.getName(DINameKind::ShortName);
+                    const auto type = child.getAttributeValueAsReferencedDie(dwarf::DW_AT_type);
+                    if (name && type) variableTypes.try_emplace(name, type);
+                    continue;
+                }
+                // Function local statics are nested inside their subprogram
+                if (child.hasChildren()) loadVariables(child);
+            }
+        }
+
+        const DataSymbol *findSymbol(const uint64_t address) const {
+            auto it = std::upper_bound(symbols.begin(), symbols.end(), address,
+                                       [](const uint64_t value, const DataSymbol &symbol) {
+                                           return value < symbol.address;
+                                       });
+            if (it == symbols.begin()) return nullptr;
+            --it;
+            return address < it->address + it->size ? &*it : nullptr;
+        }
+
+        /**
+         * Strips typedefs and qualifiers, keeping the outermost typedef name to name anonymous structs like clang does.
+         */
+        static DWARFDie stripType(DWARFDie die, std::string &typedefName) {
+            while (die) {
+                switch (die.getTag()) {
+                    case dwarf::DW_TAG_typedef:
+                        if (typedefName.empty()) {
+                            if (const auto name = die.getName(DINameKind::ShortName)) typedefName = name;
+                        }
+                        [[fallthrough]];
+                    case dwarf::DW_TAG_const_type:
+                    case dwarf::DW_TAG_volatile_type:
+                    case dwarf::DW_TAG_atomic_type:
+                        die = die.getAttributeValueAsReferencedDie(dwarf::DW_AT_type);
+                        continue;
+                    default:
+                        return die;
+                }
+            }
+            return die;
+        }
+
+        static uint64_t getByteSize(const DWARFDie &die) {
+            if (const auto size = dwarf::toUnsigned(die.find(dwarf::DW_AT_byte_size))) return *size;
+            if (die.getTag() == dwarf::DW_TAG_pointer_type) return die.getDwarfUnit()->getAddressByteSize();
+            std::string ignored;
+            if (const auto type = stripType(die.getAttributeValueAsReferencedDie(dwarf::DW_AT_type), ignored);
+                type && type != die)
+                return getByteSize(type);
+            return 0;
+        }
+
+        const std::optional<DwarfStruct> &getDwarfStruct(const DWARFDie &die, const std::string &typedefName) {
+            const auto found = structLayouts.find(die.getOffset());
+            if (found != structLayouts.end()) return found->second;
+            auto &entry = structLayouts[die.getOffset()];
+
+            const auto name = die.getName(DINameKind::ShortName);
+            if (!name && typedefName.empty()) return entry;
+
+            DwarfStruct layout;
+            layout.name = "struct." + (name ? std::string(name) : typedefName);
+            for (const auto child: die.children()) {
+                if (child.getTag() != dwarf::DW_TAG_member) continue;
+                // Bit-fields share IR elements, so member ordinals no longer match field indices
+                if (child.find(dwarf::DW_AT_bit_size)) return entry;
+                const auto offset = dwarf::toUnsigned(child.find(dwarf::DW_AT_data_member_location));
+                const auto type = child.getAttributeValueAsReferencedDie(dwarf::DW_AT_type);
+                if (!offset || !type) return entry;
+                layout.members.push_back({*offset, getByteSize(type), type});
+            }
+            if (layout.members.empty()) return entry;
+            entry = std::move(layout);
+            return entry;
+        }
+
+        /**
+         * Attributes the byte at `offset` into an object of type `type` at `object`, returns if any field was found.
+         */
+        bool attribute(const DWARFDie &rawType, const uint64_t object, const uint64_t offset,
+                       std::string typedefName) {
+            const auto type = stripType(rawType, typedefName);
+            if (!type) return false;
+
+            if (type.getTag() == dwarf::DW_TAG_array_type) {
+                const auto elementType = type.getAttributeValueAsReferencedDie(dwarf::DW_AT_type);
+                const auto elementSize = getByteSize(elementType);
+                if (elementSize == 0) return false;
+                const auto index = offset / elementSize;
+                return attribute(elementType, object + index * elementSize, offset % elementSize, "");
+            }
+
+            if (type.getTag() != dwarf::DW_TAG_structure_type) return false;
+            const auto &layout = getDwarfStruct(type, typedefName);
+            if (!layout) return false;
+
+            for (unsigned i = 0; i < layout->members.size(); i++) {
+                const auto &member = layout->members[i];
+                if (offset < member.offset || offset >= member.offset + std::max<uint64_t>(member.size, 1))
+                    continue;
+                record(layout->name, layout->members.size(), i, object);
+                attribute(member.type, object + member.offset, offset - member.offset, "");
+                return true;
+            }
+            return false;
+        }
+
+        /**
+         * Counts the access, and pairs it up with recent samples of the same object like the runtime does.
+         */
+        void record(const std::string &name, const unsigned numFields, const unsigned field, const uint64_t object) {
+            auto [found, inserted] = structProfiles.try_emplace(name, numFields);
+            auto &structProfile = found->second;
+            structProfile.counts[field]++;
+
+            for (const auto &entry: window) {
+                if (entry.object != object || entry.name != &found->first || entry.field == field) continue;
+                structProfile.addCoAccess(entry.field, field, 1);
+            }
+            window[windowHead++ % ZIPPY_RT_COACCESS_WINDOW] = {object, &found->first, field};
+        }
+    };
+
+    /**
+     * Takes the first two bare hexadecimal tokens of a line, as `perf script -F addr,ip` prints them, and the object
+     * in parentheses after them, if `dso` was printed too.
+     */
+    bool parseLine(StringRef line, uint64_t &address, uint64_t &ip, StringRef &dso) {
+        dso = StringRef();
+        const auto dsoStart = line.find('(');
+        if (dsoStart != StringRef::npos) {
+            dso = line.substr(dsoStart + 1).rsplit(')').first;
+            line = line.take_front(dsoStart);
+        }
+        SmallVector<StringRef, 8> tokens;
+        line.split(tokens, ' ', -1, false);
+        unsigned numFound = 0;
+        for (auto token: tokens) {
+            token = token.trim();
+            if (token.starts_with("0x")) token = token.drop_front(2);
+            uint64_t value;
+            if (token.empty() || token.getAsInteger(16, value)) continue;
+            if (numFound == 0) address = value;
+            else ip = value;
+            if (++numFound == 2) return true;
+        }
+        return false;
+    }
+
+    /**
+     * Takes the start, file offset and path of a mapping from an mmap event, eg:
+     * `PERF_RECORD_MMAP2 1234/1234: [0x55d0c0000000(0x2000) @ 0 fd:01 4321 0]: r--p /usr/bin/server`
+     */
+    bool parseMapping(const StringRef line, uint64_t &start, uint64_t &fileOffset, StringRef &path) {
+        const auto event = line.find("PERF_RECORD_MMAP");
+        if (event == StringRef::npos) return false;
+        auto [range, rest] = line.substr(event).split('[').second.split(']');
+        auto [startText, offsetText] = range.split('(');
+        offsetText = offsetText.split('@').second.trim().split(' ').first;
+        // Both are printed in hexadecimal, the offset without a prefix when 0
+        startText.consume_front("0x");
+        offsetText.consume_front("0x");
+        if (startText.getAsInteger(16, start) || offsetText.getAsInteger(16, fileOffset)) return false;
+        path = rest.trim().rsplit(' ').second;
+        return !path.empty();
+    }
+}
+
+int main(int argc, char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "Zippy perf sample importer\n");
+
+    auto binaryOrErr = object::ObjectFile::createObjectFile(BinaryPath);
+    if (!binaryOrErr) {
+        errs() << "Failed to read binary: " << BinaryPath << ": " << toString(binaryOrErr.takeError()) << "\n";
+        return 1;
+    }
+    const auto &obj = *binaryOrErr->getBinary();
+
+    Importer importer;
+    if (!importer.loadSymbols(obj)) return 1;
+    const auto dwarfCtx = DWARFContext::create(obj);
+    importer.loadVariables(*dwarfCtx);
+
+    auto scriptOrErr = MemoryBuffer::getFile(ScriptPath);
+    if (!scriptOrErr) {
+        errs() << "Failed to read perf script output: " << ScriptPath << "\n";
+        return 1;
+    }
+    SmallVector<StringRef, 0> lines;
+    (*scriptOrErr)->getBuffer().split(lines, '\n', -1, false);
+    if (LoadBase.getNumOccurrences()) importer.setLoadBase(LoadBase);
+    for (const auto line: lines) {
+        uint64_t start, fileOffset;
+        StringRef path;
+        if (!parseMapping(line, start, fileOffset, path)) continue;
+        if (fileOffset != 0 || sys::path::filename(path) != sys::path::filename(BinaryPath)) continue;
+        importer.setLoadBase(start);
+    }
+    if (importer.isMissingLoadBase()) {
+        errs() << "No load base for position independent binary: " << BinaryPath
+               << ", pass --load-base or record with --show-mmap-events\n";
+    }
+    for (const auto line: lines) {
+        uint64_t address, ip;
+        StringRef dso;
+        if (line.contains("PERF_RECORD_")) continue;
+        if (parseLine(line, address, ip, dso)) importer.addSample(address, ip, dso);
+    }
+
+    std::error_code ec;
+    raw_fd_ostream out(OutputPath, ec, sys::fs::OF_None);
+    if (ec) {
+        errs() << "Failed to open output: " << OutputPath << ": " << ec.message() << "\n";
+        return 1;
+    }
+    importer.buildProfile().write(out);
+    importer.printSummary(outs());
+    return 0;
+}
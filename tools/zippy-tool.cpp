@@ -0,0 +1,207 @@
+/**
+ * zippy-tool
+ *
+ * Lays out the structs of a whole project from its bitcode files, without linking them into one module.
+ *
+ * Every module is parsed once and summarized the same way `-passes=zippy-summarize` does, in parallel. The summaries
+ * are merged in input order, and every module is analyzed again against the merged summary for the layout of the
+ * structs it defines, reusing the module and its cached analyses, so every module stays loaded until then. The first layout
+ * of each struct, in input order, is written into a layout database for `-zippy-layout-db`, along with a report.
+ * Layouts already in the database are kept, like any later compile would.
+ *
+ * EG: `zippy-tool $(find build -name '*.bc') -o zippy.layouts -report=zippy-report.txt -j 16`
+ */
+#include "ZippyPass.hpp"
+
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/Parallel.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+using Zippy::LayoutDatabase;
+using Zippy::SummaryInfo;
+
+static cl::list<std::string> InputPaths(cl::Positional, cl::desc("<bitcode or IR files>"), cl::OneOrMore);
+static cl::opt<std::string> OutputPath("o", cl::desc("Layout database to write"), cl::value_desc("file"),
+                                       cl::init("zippy.layouts"));
+static cl::opt<std::string> ReportPath("report", cl::desc("Report to write, '-' for stdout"), cl::value_desc("file"),
+                                       cl::init("-"));
+static cl::opt<unsigned> Jobs("j", cl::desc("Modules analyzed in parallel, 0 for every core"), cl::init(0));
+
+namespace {
+    struct Decision {
+        LayoutDatabase::Key key;
+        std::vector<unsigned> order;
+        uint64_t initialSize;
+        uint64_t targetSize;
+    };
+
+    /**
+     * A module along with its own analysis managers, kept from its summary through the layout of its structs so it is
+     * only parsed once, and the loops of its functions are only computed once.
+     */
+    class LoadedModule {
+        LLVMContext context;
+        std::unique_ptr<Module> M;
+        // Declared after the module, so they are destroyed before it
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+
+    public:
+        /**
+         * Parses the module at `path`, or returns nullptr after printing why it couldn't be.
+         */
+        static std::unique_ptr<LoadedModule> load(const std::string &path) {
+            auto loadedModule = std::make_unique<LoadedModule>();
+            SMDiagnostic diagnostic;
+            loadedModule->M = parseIRFile(path, diagnostic, loadedModule->context);
+            if (!loadedModule->M) {
+                diagnostic.print("zippy-tool", errs());
+                return nullptr;
+            }
+
+            PassBuilder PB;
+            PB.registerModuleAnalyses(loadedModule->MAM);
+            PB.registerCGSCCAnalyses(loadedModule->CGAM);
+            PB.registerFunctionAnalyses(loadedModule->FAM);
+            PB.registerLoopAnalyses(loadedModule->LAM);
+            PB.crossRegisterProxies(loadedModule->LAM, loadedModule->FAM, loadedModule->CGAM, loadedModule->MAM);
+            return loadedModule;
+        }
+
+        /**
+         * Runs `analyze` over the module with a fresh pass, the analyses cached by an earlier one are kept.
+         */
+        template<typename AnalyzeFn>
+        void analyze(AnalyzeFn analyzeFn) {
+            Zippy::Pass pass(*M, MAM);
+            analyzeFn(pass, *M);
+        }
+    };
+
+    std::vector<unsigned> getIdentityOrder(const unsigned numFields) {
+        std::vector<unsigned> order(numFields);
+        for (unsigned i = 0; i < numFields; i++) {
+            order[i] = i;
+        }
+        return order;
+    }
+}
+
+int main(int argc, char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "Zippy whole project layout driver\n");
+    parallel::strategy = hardware_concurrency(Jobs);
+    const auto numModules = InputPaths.size();
+
+    // Summarize every module on its own
+    std::vector<std::unique_ptr<LoadedModule>> loadedModules(numModules);
+    std::vector<std::optional<SummaryInfo>> moduleSummaries(numModules);
+    parallelFor(0, numModules, [&](const size_t i) {
+        loadedModules[i] = LoadedModule::load(InputPaths[i]);
+        if (!loadedModules[i]) return;
+        loadedModules[i]->analyze([&](Zippy::Pass &pass, Module &) {
+            moduleSummaries[i] = pass.summarizeModule();
+        });
+    });
+    SummaryInfo mergedSummary;
+    unsigned numLoaded = 0;
+    for (const auto &moduleSummary: moduleSummaries) {
+        if (!moduleSummary) continue;
+        mergedSummary.mergeAll(*moduleSummary);
+        numLoaded++;
+    }
+    mergedSummary.resolveExternalCallees();
+    if (numLoaded == 0) {
+        errs() << "No modules could be loaded\n";
+        return 1;
+    }
+
+    // Lay out every struct against the merged summary, in the modules that define it
+    std::vector<std::vector<Decision>> moduleDecisions(numModules);
+    parallelFor(0, numModules, [&](const size_t i) {
+        if (!loadedModules[i]) return;
+        loadedModules[i]->analyze([&](Zippy::Pass &pass, Module &) {
+            pass.setSummaryInfo(mergedSummary);
+            if (!pass.analyze()) return;
+            for (const auto &structInfo: pass.getStructInfos()) {
+                moduleDecisions[i].push_back({
+                    {structInfo.getStructType().ptr->getName().str(),
+                     LayoutDatabase::hashSignature(structInfo.getSignature())},
+                    structInfo.getOrder(),
+                    structInfo.getInitialSize().getKnownMinValue(),
+                    structInfo.getTargetLayout()->getSizeInBytes().getKnownMinValue()
+                });
+            }
+        });
+    });
+    loadedModules.clear();
+
+    // Every module lays out from the same summary, input order only picks which one reports it
+    auto layoutDatabase = LayoutDatabase::load(OutputPath);
+    if (!layoutDatabase) return 1;
+    std::map<LayoutDatabase::Key, Decision> decisions;
+    for (auto &decisionsOfModule: moduleDecisions) {
+        for (auto &decision: decisionsOfModule) {
+            decisions.try_emplace(decision.key, std::move(decision));
+        }
+    }
+    // Unsafe structs keep their layout everywhere
+    for (const auto &entry: mergedSummary.getStructSummaries()) {
+        const auto &structSummary = entry.getValue();
+        if (structSummary.isSafe()) continue;
+        layoutDatabase->record({entry.getKey().str(), LayoutDatabase::hashSignature(structSummary.signature)},
+                               getIdentityOrder(structSummary.getNumFields()));
+    }
+    for (const auto &[key, decision]: decisions) {
+        layoutDatabase->record(key, decision.order);
+    }
+    std::error_code errorCode;
+    raw_fd_ostream databaseOut(OutputPath, errorCode);
+    if (errorCode) {
+        errs() << "Failed to write layout database: " << OutputPath << ": " << errorCode.message() << "\n";
+        return 1;
+    }
+    layoutDatabase->write(databaseOut);
+
+    raw_fd_ostream reportOut(ReportPath, errorCode);
+    if (errorCode) {
+        errs() << "Failed to write report: " << ReportPath << ": " << errorCode.message() << "\n";
+        return 1;
+    }
+    reportOut << format("Zippy Layout Report: [%d] Modules - [%d] Structs\n", numLoaded,
+                        mergedSummary.getStructSummaries().size());
+    std::map<std::string, const SummaryInfo::StructSummary*> sortedSummaries;
+    for (const auto &entry: mergedSummary.getStructSummaries()) {
+        sortedSummaries.emplace(entry.getKey().str(), &entry.getValue());
+    }
+    for (const auto &[name, structSummary]: sortedSummaries) {
+        reportOut << Zippy::TAB_STR << name;
+        if (!structSummary->isSafe()) {
+            reportOut << " - Unsafe: " << structSummary->unsafeReason << "\n";
+            continue;
+        }
+        const auto found = decisions.find({name, LayoutDatabase::hashSignature(structSummary->signature)});
+        if (found == decisions.end()) {
+            reportOut << " - Not laid out, unsafe or unused where defined\n";
+            continue;
+        }
+        const auto &decision = found->second;
+        reportOut << format(" - Size: [%llu] -> [%llu] - Order:", decision.initialSize, decision.targetSize);
+        for (const auto index: decision.order) {
+            reportOut << format(" [%02d]", index);
+        }
+        reportOut << "\n";
+    }
+    return 0;
+}